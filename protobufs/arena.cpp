@@ -0,0 +1,308 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+namespace {
+
+// arena blocks are 2MB-aligned multiples of 2MB, so any pointer can be mapped
+// to the block that would own it with a shift, and looked up in a registry.
+const int kBlockShift = 21;
+const size_t kBlockBytes = size_t(1) << kBlockShift;
+const size_t kAlign = 16;
+
+// requests above this get a dedicated block instead of wasting the tail of
+// the current one.
+const size_t kLargeBytes = kBlockBytes / 4;
+
+// open-addressing set of block numbers owned by live arenas, stored as
+// number + 2 so that 0 can mean empty and 1 a deleted slot. lookups are
+// lock-free; inserts and erases are serialized by g_registry_mutex.
+// 2^18 slots cover 512GB of live arena memory.
+//
+// inserts reuse deleted slots, and once live and deleted slots together
+// pass three quarters of the table it is rebuilt in place without the
+// deleted ones, so a lookup always reaches an empty slot. the rebuild moves
+// keys under a seqlock: g_registry_version is odd while it runs, and a
+// lookup that overlapped it starts over.
+const int kRegistryBits = 18;
+const size_t kRegistrySize = size_t(1) << kRegistryBits;
+const size_t kRegistryMaxUsed = kRegistrySize / 4 * 3;
+const uint64_t kEmptySlot = 0;
+const uint64_t kDeletedSlot = 1;
+
+std::atomic<uint64_t> g_registry[kRegistrySize];
+std::atomic<uint64_t> g_registry_version(0);
+std::atomic<size_t> g_live_blocks(0);
+// slots holding a key or a deletion mark; g_registry_mutex.
+size_t g_used_slots = 0;
+std::mutex g_registry_mutex;
+
+thread_local tutorial::Arena *t_arena = nullptr;
+thread_local tutorial::AllocationCounters t_counters = {0, 0};
+
+size_t registry_slot(uint64_t key) {
+  return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >>
+                             (64 - kRegistryBits));
+}
+
+uint64_t registry_key(const void *p) {
+  return (reinterpret_cast<uintptr_t>(p) >> kBlockShift) + 2;
+}
+
+bool registry_contains(uint64_t key) {
+  for (;;) {
+    uint64_t version = g_registry_version.load(std::memory_order_acquire);
+    if (version & 1) {
+      continue;
+    }
+    bool found = false;
+    size_t i = registry_slot(key);
+    for (size_t probes = 0; probes < kRegistrySize;
+         ++probes, i = (i + 1) & (kRegistrySize - 1)) {
+      uint64_t slot = g_registry[i].load(std::memory_order_acquire);
+      if (slot == key) {
+        found = true;
+        break;
+      }
+      if (slot == kEmptySlot) {
+        break;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (g_registry_version.load(std::memory_order_relaxed) == version) {
+      return found;
+    }
+  }
+}
+
+// the slot `key` goes in: the first deleted one on its probe path, or else
+// the empty one that ends it. the key must not be present.
+size_t registry_insert_slot(uint64_t key) {
+  size_t i = registry_slot(key);
+  for (;; i = (i + 1) & (kRegistrySize - 1)) {
+    uint64_t slot = g_registry[i].load(std::memory_order_relaxed);
+    if (slot == kEmptySlot || slot == kDeletedSlot) {
+      return i;
+    }
+  }
+}
+
+// drops the deletion marks; the caller holds g_registry_mutex. keys are
+// gathered with malloc, not new, which may be serving an arena right now.
+void compact_registry() {
+  size_t live = g_live_blocks.load(std::memory_order_relaxed);
+  uint64_t *keys =
+      static_cast<uint64_t *>(std::malloc(sizeof(uint64_t) * (live + 1)));
+  if (keys == nullptr) {
+    throw std::bad_alloc();
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < kRegistrySize; ++i) {
+    uint64_t slot = g_registry[i].load(std::memory_order_relaxed);
+    if (slot != kEmptySlot && slot != kDeletedSlot) {
+      keys[count++] = slot;
+    }
+  }
+
+  uint64_t version = g_registry_version.load(std::memory_order_relaxed);
+  g_registry_version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < kRegistrySize; ++i) {
+    g_registry[i].store(kEmptySlot, std::memory_order_relaxed);
+  }
+  for (size_t k = 0; k < count; ++k) {
+    g_registry[registry_insert_slot(keys[k])].store(keys[k],
+                                                    std::memory_order_relaxed);
+  }
+  g_registry_version.store(version + 2, std::memory_order_release);
+  g_used_slots = count;
+  std::free(keys);
+}
+
+void register_block(const uint8_t *base, size_t bytes) {
+  std::lock_guard<std::mutex> lk(g_registry_mutex);
+  size_t blocks = bytes / kBlockBytes;
+  if (g_used_slots + blocks > kRegistryMaxUsed) {
+    compact_registry();
+    if (g_used_slots + blocks > kRegistryMaxUsed) {
+      throw std::bad_alloc();
+    }
+  }
+  for (size_t offset = 0; offset < bytes; offset += kBlockBytes) {
+    uint64_t key = registry_key(base + offset);
+    size_t i = registry_insert_slot(key);
+    if (g_registry[i].load(std::memory_order_relaxed) == kEmptySlot) {
+      ++g_used_slots;
+    }
+    g_registry[i].store(key, std::memory_order_release);
+  }
+  g_live_blocks.fetch_add(blocks, std::memory_order_relaxed);
+}
+
+void unregister_block(const uint8_t *base, size_t bytes) {
+  std::lock_guard<std::mutex> lk(g_registry_mutex);
+  for (size_t offset = 0; offset < bytes; offset += kBlockBytes) {
+    uint64_t key = registry_key(base + offset);
+    size_t i = registry_slot(key);
+    for (size_t probes = 0; probes < kRegistrySize;
+         ++probes, i = (i + 1) & (kRegistrySize - 1)) {
+      uint64_t slot = g_registry[i].load(std::memory_order_relaxed);
+      if (slot == key) {
+        g_registry[i].store(kDeletedSlot, std::memory_order_release);
+        break;
+      }
+      if (slot == kEmptySlot) {
+        break;
+      }
+    }
+  }
+  g_live_blocks.fetch_sub(bytes / kBlockBytes, std::memory_order_relaxed);
+}
+
+void *heap_allocate(size_t size) {
+  ++t_counters.heap;
+  void *p = std::malloc(size != 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void heap_free(void *p) {
+  if (p != nullptr && !tutorial::Arena::owns(p)) {
+    std::free(p);
+  }
+}
+
+} // namespace
+
+namespace tutorial {
+
+// header at the start of every block; keeps the block list out of the heap,
+// which matters because the arena may be allocating on behalf of itself.
+struct Arena::Block {
+  Block *next;
+  size_t bytes;
+};
+
+Arena::Arena()
+    : m_head(nullptr), m_ptr(nullptr), m_end(nullptr), m_used(0),
+      m_reserved(0), m_blocks(0) {}
+
+Arena::~Arena() {
+  while (m_head != nullptr) {
+    Block *next = m_head->next;
+    unregister_block(reinterpret_cast<uint8_t *>(m_head), m_head->bytes);
+    std::free(m_head);
+    m_head = next;
+  }
+}
+
+void *Arena::allocate(size_t bytes) {
+  bytes = bytes == 0 ? kAlign : (bytes + kAlign - 1) & ~(kAlign - 1);
+  m_used += bytes;
+
+  if (bytes > static_cast<size_t>(m_end - m_ptr)) {
+    if (bytes > kLargeBytes) {
+      return allocate_block(bytes);
+    }
+    m_ptr = static_cast<uint8_t *>(
+        allocate_block(kBlockBytes - sizeof(Block)));
+    m_end = m_ptr + kBlockBytes - sizeof(Block);
+  }
+
+  void *p = m_ptr;
+  m_ptr += bytes;
+  return p;
+}
+
+void *Arena::allocate_block(size_t bytes) {
+  size_t size = (bytes + sizeof(Block) + kBlockBytes - 1) & ~(kBlockBytes - 1);
+
+  void *base;
+  if (posix_memalign(&base, kBlockBytes, size) != 0) {
+    throw std::bad_alloc();
+  }
+  try {
+    register_block(static_cast<uint8_t *>(base), size);
+  } catch (const std::bad_alloc &) {
+    std::free(base);
+    throw;
+  }
+
+  Block *block = static_cast<Block *>(base);
+  block->next = m_head;
+  block->bytes = size;
+  m_head = block;
+  m_reserved += size;
+  ++m_blocks;
+
+  return static_cast<uint8_t *>(base) + sizeof(Block);
+}
+
+bool Arena::owns(const void *p) {
+  return g_live_blocks.load(std::memory_order_relaxed) != 0 &&
+         registry_contains(registry_key(p));
+}
+
+ArenaScope::ArenaScope(Arena *arena) : m_previous(t_arena) { t_arena = arena; }
+
+ArenaScope::~ArenaScope() { t_arena = m_previous; }
+
+ArenaAddressBook::ArenaAddressBook() {
+  // descriptors are built lazily on first use; make sure that happens on the
+  // heap and not in an arena that is about to be freed.
+  AddressBook::descriptor();
+  Person::descriptor();
+  Person_PhoneNumber::descriptor();
+
+  m_book = new (m_arena.allocate(sizeof(AddressBook))) AddressBook;
+}
+
+AllocationCounters thread_allocations() { return t_counters; }
+
+} // namespace tutorial
+
+void *operator new(size_t size) {
+  if (tutorial::Arena *arena = t_arena) {
+    ++t_counters.arena;
+    return arena->allocate(size);
+  }
+  return heap_allocate(size);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept { heap_free(p); }
+
+void operator delete[](void *p) noexcept { heap_free(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  heap_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  heap_free(p);
+}
+
+// the sized forms, which code built as C++14 or later (libprotobuf, for
+// one) calls; left out, a library's replacement of them would be handed
+// blocks from heap_allocate.
+void operator delete(void *p, size_t) noexcept { heap_free(p); }
+
+void operator delete[](void *p, size_t) noexcept { heap_free(p); }
@@ -0,0 +1,101 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "person.pb.h"
+
+// protobuf 2.5 generated code has no arena support: Person::mutable_name(),
+// add_phone() and friends call plain `new`. arena.cpp therefore replaces the
+// global operator new/delete. while an ArenaScope is active on a thread,
+// every allocation that thread makes is bumped out of the scope's Arena, and
+// operator delete on arena memory is a no-op, so a whole message graph can be
+// thrown away by releasing the arena's blocks without running a destructor.
+//
+// linking arena.cpp also gives the binary per-thread allocation counters.
+// it is linked only into binaries that use either (see the Makefile): once
+// an arena is alive, every operator delete in the process checks whether
+// its pointer is arena memory.
+namespace tutorial {
+
+class Arena {
+public:
+  Arena();
+  // releases every block; objects in the arena are not destroyed.
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // 16-byte aligned; never returns null (throws std::bad_alloc instead).
+  void *allocate(size_t bytes);
+
+  // bytes handed out and bytes reserved from the system, respectively.
+  size_t bytes_used() const { return m_used; }
+  size_t bytes_reserved() const { return m_reserved; }
+  size_t blocks() const { return m_blocks; }
+
+  // true if `p` points into a block owned by any live arena.
+  static bool owns(const void *p);
+
+private:
+  struct Block;
+
+  void *allocate_block(size_t bytes);
+
+  Block *m_head;
+  uint8_t *m_ptr;
+  uint8_t *m_end;
+  size_t m_used;
+  size_t m_reserved;
+  size_t m_blocks;
+};
+
+// routes this thread's allocations into `arena` until destroyed; scopes nest,
+// and a null arena routes back to the heap.
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena *arena);
+  ~ArenaScope();
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  Arena *m_previous;
+};
+
+// an AddressBook that lives, with everything it points to, in its own arena.
+// parse into book() and otherwise mutate it only inside
+// ArenaScope(arena()); heap memory attached outside a scope is leaked at
+// teardown. strings copied out of the book must not share its buffers, which
+// holds for the C++11 std::string ABI but not for old copy-on-write strings.
+class ArenaAddressBook {
+public:
+  ArenaAddressBook();
+  // one free per arena block; ~AddressBook never runs.
+  ~ArenaAddressBook() {}
+
+  ArenaAddressBook(const ArenaAddressBook &) = delete;
+  ArenaAddressBook &operator=(const ArenaAddressBook &) = delete;
+
+  AddressBook *book() { return m_book; }
+  Arena *arena() { return &m_arena; }
+
+private:
+  Arena m_arena;
+  AddressBook *m_book;
+};
+
+// allocations made by the calling thread since it started, split by where
+// they were served from.
+struct AllocationCounters {
+  uint64_t heap;
+  uint64_t arena;
+};
+AllocationCounters thread_allocations();
+
+} // namespace tutorial
+
+#endif // ARENA_H_
@@ -0,0 +1,547 @@
+// micro-benchmarks for the person.proto messages. every operation runs in
+// batches over a set of distinct sample messages until it has been timed for
+// --min-time seconds; results go to stdout as one JSON document so runs can
+// be diffed between releases.
+//
+//   ./person_bench [--min-time SECONDS] [--filter SUBSTRING]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "packed_book.h"
+#include "person.pb.h"
+#include "person_store.h"
+#include "projection.h"
+#include "static_decoder.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace {
+
+double g_min_time = 0.2;
+const char *g_filter = "";
+
+// record shapes: a bare contact, a typical one, and one with long strings
+// and many phones.
+struct Distribution {
+  const char *name;
+  int name_length;
+  int email_percent;
+  int email_length;
+  int max_phones;
+  int number_length;
+};
+
+const Distribution kDistributions[] = {
+    {"small", 8, 0, 0, 1, 8},
+    {"medium", 16, 75, 24, 3, 12},
+    {"large", 64, 100, 64, 8, 20},
+};
+
+// distinct samples per person-sized benchmark, and people per book.
+const int kSamples = 256;
+const int kBookPeople = 1000;
+const int kBooks = 4;
+
+string random_text(mt19937 *random, int length) {
+  static const char kChars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  uniform_int_distribution<int> pick(0, sizeof(kChars) - 2);
+  string text(length, ' ');
+  for (char &c : text) {
+    c = kChars[pick(*random)];
+  }
+  return text;
+}
+
+void make_person(const Distribution &shape, mt19937 *random,
+                 tutorial::Person *person) {
+  person->set_name(random_text(random, shape.name_length));
+  person->set_id(static_cast<int32_t>((*random)() >> 1));
+  if (static_cast<int>((*random)() % 100) < shape.email_percent) {
+    person->set_email(random_text(random, shape.email_length) +
+                      "@example.com");
+  }
+  int phones = (*random)() % (shape.max_phones + 1);
+  for (int i = 0; i < phones; ++i) {
+    tutorial::Person::PhoneNumber *phone = person->add_phone();
+    phone->set_number(random_text(random, shape.number_length));
+    if (i % 2 == 1) {
+      phone->set_type(tutorial::Person::Work);
+    }
+  }
+}
+
+struct Result {
+  Result() : iterations(0), seconds(0), allocations(0) {}
+
+  uint64_t iterations;
+  double seconds;
+  uint64_t allocations;
+};
+
+// calls prepare() untimed, then op(i) for i in [0, batch), until the ops
+// have run for g_min_time in total.
+template <typename Prepare, typename Op>
+Result measure(size_t batch, Prepare prepare, Op op) {
+  Result result;
+  while (result.seconds < g_min_time) {
+    prepare();
+    tutorial::AllocationCounters before = tutorial::thread_allocations();
+    tutorial::Stopwatch watch;
+    for (size_t i = 0; i < batch; ++i) {
+      op(i);
+    }
+    result.seconds += watch.seconds();
+    result.allocations += tutorial::thread_allocations().heap - before.heap;
+    result.iterations += batch;
+  }
+  return result;
+}
+
+class Report {
+public:
+  Report() : m_first(true) {}
+
+  void add(const string &message, const string &distribution,
+           const string &operation, const Result &result,
+           double bytes_per_op, double records_per_op) {
+    double ops = result.iterations;
+    m_out << (m_first ? "" : ",") << "\n    {\"name\": \"" << message << "/"
+          << distribution << "/" << operation << "\", \"message\": \""
+          << message << "\", \"distribution\": \"" << distribution
+          << "\", \"operation\": \"" << operation
+          << "\", \"iterations\": " << result.iterations
+          << ", \"ns_per_op\": " << result.seconds * 1e9 / ops
+          << ", \"records_per_second\": "
+          << records_per_op * ops / result.seconds
+          << ", \"mb_per_second\": "
+          << bytes_per_op * ops / result.seconds / 1e6
+          << ", \"bytes_per_op\": " << bytes_per_op
+          << ", \"allocations_per_op\": " << result.allocations / ops << "}";
+    m_first = false;
+  }
+
+  void print() const {
+    cout << "{\n  \"context\": {\"protobuf_version\": "
+         << GOOGLE_PROTOBUF_VERSION << ", \"compiler\": \"" << __VERSION__
+         << "\", \"min_time\": " << g_min_time << "},\n  \"benchmarks\": ["
+         << m_out.str() << "\n  ]\n}" << endl;
+  }
+
+private:
+  ostringstream m_out;
+  bool m_first;
+};
+
+bool selected(const string &name) {
+  return name.find(g_filter) != string::npos;
+}
+
+// every operation over `samples`, which must all be initialized.
+template <typename Message>
+void bench_message(const string &type, const string &distribution,
+                   const vector<Message> &samples, double records_per_op,
+                   Report *report) {
+  size_t n = samples.size();
+  vector<string> bytes(n);
+  double bytes_per_op = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bytes[i] = samples[i].SerializeAsString();
+    bytes_per_op += bytes[i].size();
+  }
+  bytes_per_op /= n;
+
+  vector<Message> targets(n);
+  auto none = [] {};
+  auto refill = [&] {
+    for (size_t i = 0; i < n; ++i) {
+      targets[i].CopyFrom(samples[i]);
+    }
+  };
+  auto clear = [&] {
+    for (size_t i = 0; i < n; ++i) {
+      targets[i].Clear();
+    }
+  };
+  string prefix = type + "/" + distribution + "/";
+  bool ok = true;
+
+  if (selected(prefix + "parse")) {
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= targets[i].ParseFromArray(bytes[i].data(),
+                                      static_cast<int>(bytes[i].size()));
+    });
+    report->add(type, distribution, "parse", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "parse_static")) {
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= tutorial::static_parse(
+          reinterpret_cast<const uint8_t *>(bytes[i].data()), bytes[i].size(),
+          &targets[i]);
+    });
+    report->add(type, distribution, "parse_static", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "serialize")) {
+    size_t largest = 0;
+    for (const string &b : bytes) {
+      largest = max(largest, b.size());
+    }
+    string buffer(largest, '\0');
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= samples[i].SerializeToArray(&buffer[0],
+                                        static_cast<int>(buffer.size()));
+    });
+    report->add(type, distribution, "serialize", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "byte_size")) {
+    int sink = 0;
+    Result result = measure(n, none,
+                            [&](size_t i) { sink += samples[i].ByteSize(); });
+    ok &= sink > 0;
+    report->add(type, distribution, "byte_size", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "copy_from")) {
+    Result result = measure(n, none,
+                            [&](size_t i) { targets[i].CopyFrom(samples[i]); });
+    report->add(type, distribution, "copy_from", result, bytes_per_op,
+                records_per_op);
+  }
+
+  // merging into a cleared message, so repeated fields don't pile up.
+  if (selected(prefix + "merge_from")) {
+    Result result = measure(n, clear,
+                            [&](size_t i) { targets[i].MergeFrom(samples[i]); });
+    report->add(type, distribution, "merge_from", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "swap")) {
+    vector<Message> others(samples);
+    refill();
+    Result result =
+        measure(n, none, [&](size_t i) { targets[i].Swap(&others[i]); });
+    report->add(type, distribution, "swap", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (selected(prefix + "clear")) {
+    Result result = measure(n, refill, [&](size_t i) { targets[i].Clear(); });
+    report->add(type, distribution, "clear", result, bytes_per_op,
+                records_per_op);
+  }
+
+  if (!ok) {
+    cerr << "benchmark operation failed: " << prefix << endl;
+    exit(1);
+  }
+}
+
+bool parse_projected(const string &bytes, tutorial::FieldMask mask,
+                     tutorial::Person *person) {
+  return tutorial::parse_person_projected(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), mask,
+      person);
+}
+
+bool parse_projected(const string &bytes, tutorial::FieldMask mask,
+                     tutorial::AddressBook *book) {
+  book->Clear();
+  return tutorial::parse_address_book_projected(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), mask,
+      book);
+}
+
+// projected parses, to set against the full "parse" case of the same
+// samples.
+template <typename Message>
+void bench_projections(const string &type, const string &distribution,
+                       const vector<Message> &samples, double records_per_op,
+                       Report *report) {
+  struct Projection {
+    const char *name;
+    tutorial::FieldMask mask;
+  };
+  const Projection kProjections[] = {
+      {"parse_projected_id", tutorial::kPersonId},
+      {"parse_projected_phone_type", tutorial::kPhoneType},
+      {"parse_projected_all", tutorial::kAllPersonFields},
+  };
+
+  size_t n = samples.size();
+  vector<string> bytes(n);
+  double bytes_per_op = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bytes[i] = samples[i].SerializeAsString();
+    bytes_per_op += bytes[i].size();
+  }
+  bytes_per_op /= n;
+  vector<Message> targets(n);
+
+  for (const Projection &projection : kProjections) {
+    if (!selected(type + "/" + distribution + "/" + projection.name)) {
+      continue;
+    }
+    bool ok = true;
+    Result result = measure(n, [] {}, [&](size_t i) {
+      ok &= parse_projected(bytes[i], projection.mask, &targets[i]);
+    });
+    if (!ok) {
+      cerr << "projected parse failed: " << type << endl;
+      exit(1);
+    }
+    report->add(type, distribution, projection.name, result, bytes_per_op,
+                records_per_op);
+  }
+}
+
+// the packed format (packed_book.h) against protobuf on the same books
+// sorted by id, which is what it is built for. bytes_per_op is each
+// format's own size, so the two can be compared directly.
+void bench_packed(const string &distribution,
+                  const vector<tutorial::AddressBook> &books,
+                  Report *report) {
+  size_t n = books.size();
+  vector<string> bytes(n);
+  vector<string> packed(n);
+  double bytes_per_op = 0;
+  double packed_per_op = 0;
+  bool ok = true;
+  for (size_t i = 0; i < n; ++i) {
+    tutorial::AddressBook sorted(books[i]);
+    sort(sorted.mutable_person()->begin(), sorted.mutable_person()->end(),
+         [](const tutorial::Person &a, const tutorial::Person &b) {
+           return a.id() < b.id();
+         });
+    bytes[i] = sorted.SerializeAsString();
+    ok &= tutorial::pack_address_book(sorted, &packed[i]);
+    bytes_per_op += bytes[i].size();
+    packed_per_op += packed[i].size();
+  }
+  bytes_per_op /= n;
+  packed_per_op /= n;
+
+  vector<tutorial::AddressBook> targets(n);
+  vector<vector<int32_t>> ids(n);
+  auto none = [] {};
+  string prefix = "AddressBook/" + distribution + "/";
+  if (selected(prefix + "parse_sorted")) {
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= targets[i].ParseFromArray(bytes[i].data(),
+                                      static_cast<int>(bytes[i].size()));
+    });
+    report->add("AddressBook", distribution, "parse_sorted", result,
+                bytes_per_op, kBookPeople);
+  }
+  if (selected(prefix + "unpack_packed")) {
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= tutorial::unpack_address_book(
+          reinterpret_cast<const uint8_t *>(packed[i].data()),
+          packed[i].size(), &targets[i]);
+    });
+    report->add("AddressBook", distribution, "unpack_packed", result,
+                packed_per_op, kBookPeople);
+  }
+  if (selected(prefix + "unpack_packed_ids")) {
+    Result result = measure(n, none, [&](size_t i) {
+      ok &= tutorial::unpack_ids(
+          reinterpret_cast<const uint8_t *>(packed[i].data()),
+          packed[i].size(), &ids[i]);
+    });
+    report->add("AddressBook", distribution, "unpack_packed_ids", result,
+                packed_per_op, kBookPeople);
+  }
+  if (!ok) {
+    cerr << "packed book benchmark failed: " << distribution << endl;
+    exit(1);
+  }
+}
+
+// people shared the way they are without PersonStore: every access under
+// one mutex.
+class LockedStore {
+public:
+  bool put(const tutorial::Person &person) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_people[person.id()].CopyFrom(person);
+    return true;
+  }
+
+  bool get(int32_t id, tutorial::Person *person) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unordered_map<int32_t, tutorial::Person>::const_iterator found =
+        m_people.find(id);
+    if (found == m_people.end()) {
+      return false;
+    }
+    person->CopyFrom(found->second);
+    return true;
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  unordered_map<int32_t, tutorial::Person> m_people;
+};
+
+// gets and puts of random `people` on `threads` threads at once for
+// g_min_time, `read_percent` of them gets. every get finds its person.
+template <typename Store>
+Result run_mixed(Store *store, const vector<tutorial::Person> &people,
+                 int threads, int read_percent) {
+  for (const tutorial::Person &person : people) {
+    store->put(person);
+  }
+  std::atomic<bool> stop(false);
+  std::atomic<bool> ok(true);
+  vector<Result> results(threads);
+  vector<std::thread> workers;
+  tutorial::Stopwatch watch;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      mt19937 random(t);
+      tutorial::Person person;
+      tutorial::AllocationCounters before = tutorial::thread_allocations();
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 64; ++i) {
+          uint32_t r = random();
+          const tutorial::Person &sample = people[r % people.size()];
+          if (static_cast<int>((r >> 20) % 100) < read_percent) {
+            if (!store->get(sample.id(), &person)) {
+              ok.store(false);
+            }
+          } else {
+            store->put(sample);
+          }
+        }
+        results[t].iterations += 64;
+      }
+      results[t].allocations =
+          tutorial::thread_allocations().heap - before.heap;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(g_min_time));
+  stop.store(true);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (!ok.load()) {
+    cerr << "store lost a person" << endl;
+    exit(1);
+  }
+  Result total;
+  total.seconds = watch.seconds();
+  for (const Result &result : results) {
+    total.iterations += result.iterations;
+    total.allocations += result.allocations;
+  }
+  return total;
+}
+
+// PersonStore against one mutex, from 1 to 64 threads at three read/write
+// mixes. ns_per_op is wall time over every thread's operations, so it
+// falls as threads are added only if they run in parallel.
+void bench_store(const string &distribution,
+                 const vector<tutorial::Person> &people, Report *report) {
+  double bytes_per_op = 0;
+  for (const tutorial::Person &person : people) {
+    bytes_per_op += person.ByteSize();
+  }
+  bytes_per_op /= people.size();
+
+  for (int read_percent : {100, 90, 50}) {
+    for (int threads = 1; threads <= 64; threads *= 2) {
+      string mix = "_r" + to_string(read_percent) + "_t" + to_string(threads);
+      string prefix = "PersonStore/" + distribution + "/";
+      if (selected(prefix + "sharded" + mix)) {
+        tutorial::PersonStore store;
+        report->add("PersonStore", distribution, "sharded" + mix,
+                    run_mixed(&store, people, threads, read_percent),
+                    bytes_per_op, 1);
+      }
+      if (selected(prefix + "locked" + mix)) {
+        LockedStore store;
+        report->add("PersonStore", distribution, "locked" + mix,
+                    run_mixed(&store, people, threads, read_percent),
+                    bytes_per_op, 1);
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  for (int arg = 1; arg < argc; ++arg) {
+    if (strcmp(argv[arg], "--min-time") == 0 && arg + 1 < argc) {
+      g_min_time = atof(argv[++arg]);
+    } else if (strcmp(argv[arg], "--filter") == 0 && arg + 1 < argc) {
+      g_filter = argv[++arg];
+    } else {
+      cerr << "Usage: " << argv[0]
+           << " [--min-time SECONDS] [--filter SUBSTRING]" << endl;
+      return -1;
+    }
+  }
+
+  Report report;
+  mt19937 random(42);
+  for (const Distribution &shape : kDistributions) {
+    vector<tutorial::Person> people(kSamples);
+    vector<tutorial::Person::PhoneNumber> phones;
+    for (tutorial::Person &person : people) {
+      make_person(shape, &random, &person);
+      for (int i = 0; i < person.phone_size(); ++i) {
+        phones.push_back(person.phone(i));
+      }
+    }
+    vector<tutorial::AddressBook> books(kBooks);
+    for (tutorial::AddressBook &book : books) {
+      for (int i = 0; i < kBookPeople; ++i) {
+        make_person(shape, &random, book.add_person());
+      }
+    }
+
+    bench_message("Person", shape.name, people, 1, &report);
+    bench_projections("Person", shape.name, people, 1, &report);
+    if (!phones.empty()) {
+      bench_message("PhoneNumber", shape.name, phones, 1, &report);
+    }
+    bench_message("AddressBook", shape.name, books, kBookPeople, &report);
+    bench_projections("AddressBook", shape.name, books, kBookPeople, &report);
+    bench_packed(shape.name, books, &report);
+    // the store's cases take g_min_time each, so they run on one shape.
+    if (strcmp(shape.name, "medium") == 0) {
+      vector<tutorial::Person> stored(16 * kSamples);
+      for (tutorial::Person &person : stored) {
+        make_person(shape, &random, &person);
+      }
+      bench_store(shape.name, stored, &report);
+    }
+  }
+
+  report.print();
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
+}
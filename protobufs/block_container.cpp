@@ -0,0 +1,329 @@
+#include "block_container.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include "fast_decoder.h"
+#include "file_io.h"
+#include "lz.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const char kMagic[8] = {'X', 'P', 'B', 'L', 'K', '0', '0', '1'};
+
+struct Trailer {
+  uint64_t index_offset;
+  uint64_t blocks;
+  char magic[8];
+};
+
+// guards allocations driven by a damaged index.
+const uint32_t kMaxRawBlock = 1u << 30;
+
+bool inflate_block(const uint8_t *data, const BlockInfo &info,
+                   std::string *raw) {
+  raw->resize(info.raw_size);
+  uint8_t *out = reinterpret_cast<uint8_t *>(&(*raw)[0]);
+  const uint8_t *in = data + info.offset;
+  bool ok;
+  switch (info.codec) {
+  case kBlockStored:
+    ok = info.stored_size == info.raw_size;
+    if (ok) {
+      memcpy(out, in, info.raw_size);
+    }
+    break;
+  case kBlockZlib: {
+    uLongf length = info.raw_size;
+    ok = uncompress(out, &length, in, info.stored_size) == Z_OK &&
+         length == info.raw_size;
+    break;
+  }
+  case kBlockLz:
+    ok = lz_decompress(in, info.stored_size, out, info.raw_size);
+    break;
+  default:
+    ok = false;
+  }
+  return ok && crc32(0, out, info.raw_size) == info.crc;
+}
+
+// parses the length-prefixed records of a raw block into `book`.
+bool parse_block(const std::string &raw, uint32_t records, AddressBook *book) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(raw.data());
+  const uint8_t *end = p + raw.size();
+  uint32_t parsed = 0;
+  while (p < end) {
+    uint64_t size;
+    if (!wire::read_varint64(&p, end, &size) ||
+        size > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    Person *person = book->add_person();
+    if (!decode_person(p, size, person, end) || !person->IsInitialized()) {
+      return false;
+    }
+    p += size;
+    ++parsed;
+  }
+  return parsed == records;
+}
+
+void move_people(AddressBook *from, AddressBook *to) {
+  google::protobuf::RepeatedPtrField<Person> *people = from->mutable_person();
+  std::vector<Person *> released(people->size());
+  people->ExtractSubrange(0, people->size(), released.data());
+  for (Person *person : released) {
+    to->mutable_person()->AddAllocated(person);
+  }
+}
+
+} // namespace
+
+PersonBlockWriter::PersonBlockWriter()
+    : m_fd(-1), m_codec(kBlockLz), m_offset(0), m_records(0),
+      m_failed(false) {}
+
+PersonBlockWriter::~PersonBlockWriter() { close(); }
+
+bool PersonBlockWriter::open(const std::string &path, BlockCodec codec) {
+  close();
+
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    return false;
+  }
+  m_codec = codec;
+  m_block.clear();
+  m_index.clear();
+  m_offset = sizeof(kMagic);
+  m_records = 0;
+  m_failed = !write_all(m_fd, kMagic, sizeof(kMagic));
+  return !m_failed;
+}
+
+bool PersonBlockWriter::write(const Person &person) {
+  if (m_fd < 0 || m_failed || !person.IsInitialized()) {
+    return false;
+  }
+
+  if (m_block.empty()) {
+    memset(&m_current, 0, sizeof(m_current));
+    m_current.min_id = INT32_MAX;
+    m_current.max_id = INT32_MIN;
+  }
+
+  int size = person.ByteSize();
+  size_t offset = m_block.size();
+  m_block.resize(offset + wire::varint_size(size) + size);
+  uint8_t *target = reinterpret_cast<uint8_t *>(&m_block[offset]);
+  target = wire::write_varint64(size, target);
+  person.SerializeWithCachedSizesToArray(target);
+
+  ++m_current.records;
+  m_current.min_id = std::min(m_current.min_id, person.id());
+  m_current.max_id = std::max(m_current.max_id, person.id());
+  ++m_records;
+
+  if (m_block.size() >= kBlockBytes) {
+    return flush_block();
+  }
+  return true;
+}
+
+bool PersonBlockWriter::close() {
+  if (m_fd < 0) {
+    return true;
+  }
+
+  bool ok = !m_failed && (m_block.empty() || flush_block());
+  Trailer trailer;
+  trailer.index_offset = m_offset;
+  trailer.blocks = m_index.size();
+  memcpy(trailer.magic, kMagic, sizeof(kMagic));
+  ok = ok &&
+       write_all(m_fd, m_index.data(), m_index.size() * sizeof(BlockInfo)) &&
+       write_all(m_fd, &trailer, sizeof(trailer));
+  ok = ::close(m_fd) == 0 && ok;
+  m_fd = -1;
+  return ok;
+}
+
+bool PersonBlockWriter::flush_block() {
+  const uint8_t *raw = reinterpret_cast<const uint8_t *>(m_block.data());
+  size_t raw_size = m_block.size();
+  if (raw_size > kMaxRawBlock) {
+    m_failed = true;
+    return false;
+  }
+
+  size_t stored_size = raw_size;
+  uint32_t codec = kBlockStored;
+  if (m_codec == kBlockZlib) {
+    uLongf length = compressBound(raw_size);
+    m_compressed.resize(length);
+    if (compress2(reinterpret_cast<Bytef *>(&m_compressed[0]), &length, raw,
+                  raw_size, Z_DEFAULT_COMPRESSION) == Z_OK) {
+      stored_size = length;
+      codec = kBlockZlib;
+    }
+  } else if (m_codec == kBlockLz) {
+    m_compressed.resize(lz_compress_bound(raw_size));
+    stored_size = lz_compress(
+        raw, raw_size, reinterpret_cast<uint8_t *>(&m_compressed[0]));
+    codec = kBlockLz;
+  }
+  if (stored_size >= raw_size) {
+    stored_size = raw_size;
+    codec = kBlockStored;
+  }
+  const char *stored = codec == kBlockStored ? m_block.data()
+                                             : m_compressed.data();
+
+  m_current.offset = m_offset;
+  m_current.stored_size = static_cast<uint32_t>(stored_size);
+  m_current.raw_size = static_cast<uint32_t>(raw_size);
+  m_current.crc = crc32(0, raw, raw_size);
+  m_current.codec = codec;
+  if (!write_all(m_fd, stored, stored_size)) {
+    m_failed = true;
+    return false;
+  }
+  m_index.push_back(m_current);
+  m_offset += stored_size;
+  m_block.clear();
+  return true;
+}
+
+bool PersonBlockReader::open(const std::string &path) {
+  close();
+  if (!m_file.open(path)) {
+    return false;
+  }
+
+  const uint8_t *data = m_file.data();
+  size_t size = m_file.size();
+  Trailer trailer;
+  if (size < sizeof(kMagic) + sizeof(trailer) ||
+      memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    close();
+    return false;
+  }
+  memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+  uint64_t index_end = size - sizeof(trailer);
+  if (memcmp(trailer.magic, kMagic, sizeof(kMagic)) != 0 ||
+      trailer.index_offset < sizeof(kMagic) ||
+      trailer.index_offset > index_end ||
+      trailer.blocks != (index_end - trailer.index_offset) / sizeof(BlockInfo) ||
+      (index_end - trailer.index_offset) % sizeof(BlockInfo) != 0) {
+    close();
+    return false;
+  }
+
+  m_index.resize(trailer.blocks);
+  if (!m_index.empty()) {
+    memcpy(m_index.data(), data + trailer.index_offset,
+           m_index.size() * sizeof(BlockInfo));
+  }
+  for (const BlockInfo &info : m_index) {
+    if (info.offset < sizeof(kMagic) || info.offset > trailer.index_offset ||
+        info.stored_size > trailer.index_offset - info.offset ||
+        info.raw_size > kMaxRawBlock) {
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void PersonBlockReader::close() {
+  m_file.close();
+  m_index.clear();
+}
+
+int64_t PersonBlockReader::records() const {
+  int64_t records = 0;
+  for (const BlockInfo &info : m_index) {
+    records += info.records;
+  }
+  return records;
+}
+
+bool PersonBlockReader::read_block(size_t i, AddressBook *book) const {
+  std::string raw;
+  return i < m_index.size() && inflate_block(m_file.data(), m_index[i], &raw) &&
+         parse_block(raw, m_index[i].records, book);
+}
+
+bool PersonBlockReader::read_ids(int32_t min_id, int32_t max_id,
+                                 AddressBook *book) const {
+  AddressBook block;
+  for (size_t i = 0; i < m_index.size(); ++i) {
+    const BlockInfo &info = m_index[i];
+    if (info.max_id < min_id || info.min_id > max_id) {
+      continue;
+    }
+    block.Clear();
+    if (!read_block(i, &block)) {
+      return false;
+    }
+    for (int j = 0; j < block.person_size(); ++j) {
+      int32_t id = block.person(j).id();
+      if (id >= min_id && id <= max_id) {
+        book->add_person()->Swap(block.mutable_person(j));
+      }
+    }
+  }
+  return true;
+}
+
+bool PersonBlockReader::read_all(int threads, AddressBook *book) const {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<int>(1, std::min<size_t>(threads, m_index.size()));
+
+  // workers claim blocks in order and inflate each into its own shard; the
+  // shards are spliced into `book` by pointer once everyone is done.
+  std::vector<AddressBook> shards(m_index.size());
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  auto work = [&]() {
+    for (size_t i = next++; i < shards.size() && !failed.load(); i = next++) {
+      if (!read_block(i, &shards[i])) {
+        failed.store(true);
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (failed.load()) {
+    return false;
+  }
+
+  book->mutable_person()->Reserve(book->person_size() +
+                                  static_cast<int>(records()));
+  for (AddressBook &shard : shards) {
+    move_people(&shard, book);
+  }
+  return true;
+}
+
+} // namespace tutorial
@@ -0,0 +1,111 @@
+#ifndef BLOCK_CONTAINER_H_
+#define BLOCK_CONTAINER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "person.pb.h"
+
+// a compressed archive of Person records. records are framed as in a person
+// stream (varint length, then the record) and grouped into blocks of about
+// kBlockBytes, each compressed on its own with zlib or the built-in LZ codec
+// (lz.h). an index at the end of the file lists every block's offset, sizes,
+// checksum and the smallest and largest id inside it, so a reader can pick
+// out the blocks covering an id range and inflate only those, or inflate all
+// of them on several cores at once.
+//
+// layout: magic, blocks, one BlockInfo per block, then a trailer with the
+// index offset, the block count and the magic again. integers are in host
+// byte order.
+namespace tutorial {
+
+enum BlockCodec {
+  kBlockStored = 0,
+  kBlockZlib = 1,
+  kBlockLz = 2,
+};
+
+struct BlockInfo {
+  uint64_t offset;
+  uint32_t stored_size;
+  uint32_t raw_size;
+  uint32_t records;
+  // crc32 of the raw (uncompressed) bytes.
+  uint32_t crc;
+  int32_t min_id;
+  int32_t max_id;
+  // a BlockCodec; blocks that do not shrink are stored raw.
+  uint32_t codec;
+  uint32_t reserved;
+};
+
+class PersonBlockWriter {
+public:
+  // raw bytes per block before it is compressed and written.
+  static const size_t kBlockBytes = 64 << 10;
+
+  PersonBlockWriter();
+  ~PersonBlockWriter();
+
+  PersonBlockWriter(const PersonBlockWriter &) = delete;
+  PersonBlockWriter &operator=(const PersonBlockWriter &) = delete;
+
+  // creates or truncates `path`.
+  bool open(const std::string &path, BlockCodec codec = kBlockLz);
+  // false if `person` is missing required fields or a write failed.
+  bool write(const Person &person);
+  // writes the last block and the index; returns false if any write failed.
+  bool close();
+
+  int64_t records() const { return m_records; }
+
+private:
+  bool flush_block();
+
+  int m_fd;
+  BlockCodec m_codec;
+  std::string m_block;
+  std::string m_compressed;
+  BlockInfo m_current;
+  std::vector<BlockInfo> m_index;
+  uint64_t m_offset;
+  int64_t m_records;
+  bool m_failed;
+};
+
+class PersonBlockReader {
+public:
+  PersonBlockReader() {}
+
+  PersonBlockReader(const PersonBlockReader &) = delete;
+  PersonBlockReader &operator=(const PersonBlockReader &) = delete;
+
+  // maps `path` and checks its index; blocks are only inflated on demand.
+  bool open(const std::string &path);
+  void close();
+
+  size_t blocks() const { return m_index.size(); }
+  const BlockInfo &block(size_t i) const { return m_index[i]; }
+  int64_t records() const;
+
+  // inflates block `i` and appends its people to `book`. false if the block
+  // is corrupt (bad checksum, malformed record, missing required field).
+  bool read_block(size_t i, AddressBook *book) const;
+  // appends every person with min_id <= id <= max_id, inflating only the
+  // blocks whose id range overlaps.
+  bool read_ids(int32_t min_id, int32_t max_id, AddressBook *book) const;
+  // appends every person, in file order, inflating blocks on `threads`
+  // cores; threads <= 0 uses every hardware thread.
+  bool read_all(int threads, AddressBook *book) const;
+
+private:
+  MappedFile m_file;
+  std::vector<BlockInfo> m_index;
+};
+
+} // namespace tutorial
+
+#endif // BLOCK_CONTAINER_H_
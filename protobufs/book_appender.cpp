@@ -0,0 +1,244 @@
+#include "book_appender.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "file_io.h"
+#include "mapped_file.h"
+#include "person_view.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// compaction writes in chunks of this size.
+const size_t kCompactBuffer = 1 << 20;
+
+// the length of the book without a record torn off its end: one whose tag,
+// length or bytes run past the end of the file, as a crash mid-append
+// leaves. false if it is malformed anywhere else, which no crash explains.
+bool complete_prefix(const uint8_t *data, size_t size, size_t *complete) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  while (p < end) {
+    wire::ScanResult result = wire::scan_field(&p, end);
+    if (result == wire::kScanMalformed) {
+      return false;
+    }
+    if (result == wire::kScanCutOff) {
+      break;
+    }
+  }
+  *complete = p - data;
+  return true;
+}
+
+} // namespace
+
+BookAppender::BookAppender()
+    : m_fd(-1), m_appended(0), m_durable(0), m_commits(0), m_autocommit(0),
+      m_syncing(false), m_failed(false) {}
+
+BookAppender::~BookAppender() { close(); }
+
+bool BookAppender::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  MappedFile file;
+  if (!file.open(path)) {
+    ::close(fd);
+    return false;
+  }
+  size_t complete;
+  if (!complete_prefix(file.data(), file.size(), &complete) ||
+      (complete != file.size() &&
+       (ftruncate(fd, complete) != 0 || fdatasync(fd) != 0))) {
+    ::close(fd);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_fd = fd;
+  m_pending.clear();
+  m_appended = 0;
+  m_durable = 0;
+  m_commits = 0;
+  m_failed = false;
+  return true;
+}
+
+bool BookAppender::close() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_fd < 0) {
+    return true;
+  }
+  bool ok = commit_locked(&lock);
+  ok = ::close(m_fd) == 0 && ok;
+  m_fd = -1;
+  return ok;
+}
+
+bool BookAppender::append(const Person &person) {
+  if (!person.IsInitialized()) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_fd < 0 || m_failed) {
+    return false;
+  }
+
+  // serialized straight into the queue: tag, length, then the record.
+  int size = person.ByteSize();
+  size_t offset = m_pending.size();
+  m_pending.resize(offset + 1 + wire::varint_size(size) + size);
+  uint8_t *target = reinterpret_cast<uint8_t *>(&m_pending[offset]);
+  *target++ = static_cast<uint8_t>(wire::kPersonTag);
+  target = wire::write_varint64(size, target);
+  person.SerializeWithCachedSizesToArray(target);
+  ++m_appended;
+
+  if (m_autocommit > 0 && m_appended - m_durable >= m_autocommit &&
+      !m_syncing) {
+    return commit_locked(&lock);
+  }
+  return true;
+}
+
+void BookAppender::set_autocommit(int records) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_autocommit = records;
+}
+
+bool BookAppender::commit() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return commit_locked(&lock);
+}
+
+// group commit. whoever finds no flush in progress becomes the leader: it
+// takes everything queued so far, writes and syncs it without holding the
+// lock, and wakes the others. a follower whose records the leader carried is
+// done when it wakes; one whose records arrived after the leader took its
+// batch leads the next round.
+bool BookAppender::commit_locked(std::unique_lock<std::mutex> *lock) {
+  int64_t target = m_appended;
+  while (m_durable < target && !m_failed) {
+    if (m_syncing) {
+      m_synced.wait(*lock);
+      continue;
+    }
+
+    m_syncing = true;
+    std::string batch;
+    batch.swap(m_pending);
+    int64_t batch_end = m_appended;
+    int fd = m_fd;
+    lock->unlock();
+    bool ok = write_all(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+    lock->lock();
+
+    m_syncing = false;
+    if (ok) {
+      m_durable = batch_end;
+      ++m_commits;
+    } else {
+      m_failed = true;
+    }
+    m_synced.notify_all();
+  }
+  return !m_failed;
+}
+
+int64_t BookAppender::records() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_appended;
+}
+
+int64_t BookAppender::commits() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_commits;
+}
+
+bool BookAppender::compact(const std::string &path) {
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  file.advise_sequential();
+
+  // every top-level field in file order, people and anything else alike;
+  // only people are ever dropped.
+  struct Field {
+    const uint8_t *data;
+    size_t size;
+    bool person;
+    int32_t id;
+  };
+  std::vector<Field> fields;
+  std::unordered_map<int32_t, size_t> last;
+  const uint8_t *field_begin = file.data();
+  bool ok = wire::for_each_field(
+      file.data(), file.data() + file.size(),
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        Field field = {field_begin, size_t(value_end - field_begin), false, 0};
+        if (tag == wire::kPersonTag) {
+          const uint8_t *payload = wire::payload(value, value_end);
+          PersonView person(payload, value_end - payload);
+          // with no id there is nothing to tell an update from a new
+          // person, and keying it as id 0 would drop the ones before it.
+          if (!person.has_id()) {
+            return false;
+          }
+          field.person = true;
+          field.id = person.id();
+          last[field.id] = fields.size();
+        }
+        fields.push_back(field);
+        field_begin = value_end;
+        return true;
+      });
+  // for_each_field stops without failing when the visitor refuses a field.
+  if (!ok || field_begin != file.data() + file.size()) {
+    return false;
+  }
+
+  std::string temp_path = path + ".compact";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  std::string buffer;
+  for (size_t i = 0; i < fields.size() && ok; ++i) {
+    const Field &field = fields[i];
+    if (field.person && last[field.id] != i) {
+      continue;
+    }
+    buffer.append(reinterpret_cast<const char *>(field.data), field.size);
+    if (buffer.size() >= kCompactBuffer) {
+      ok = write_all(fd, buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  ok = ok && write_all(fd, buffer.data(), buffer.size()) && fdatasync(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return sync_directory(path);
+}
+
+} // namespace tutorial
@@ -0,0 +1,76 @@
+#ifndef BOOK_APPENDER_H_
+#define BOOK_APPENDER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "person.pb.h"
+
+// adds people to a serialized AddressBook file in place. a book is just a
+// run of `person` fields (tag 0x0a, length, Person bytes), and the parser
+// merges repeated fields across the whole input, so writing one more such
+// field at the end of the file appends a Person without reading, parsing or
+// rewriting what is already there.
+//
+// appends queue in memory; commit() makes them durable with a single write
+// and fdatasync. concurrent committers share that work: one thread becomes
+// the leader and flushes everything queued so far, the rest wait for it and
+// find their records already on disk.
+namespace tutorial {
+
+class BookAppender {
+public:
+  BookAppender();
+  ~BookAppender();
+
+  BookAppender(const BookAppender &) = delete;
+  BookAppender &operator=(const BookAppender &) = delete;
+
+  // opens or creates `path`. a record torn by a crash mid-append is cut
+  // off, which costs one pass over the book's tags and lengths (not its
+  // contents) on open. false if the book is malformed anywhere before that
+  // last record, which is left as it is.
+  bool open(const std::string &path);
+  // commits, then closes the file.
+  bool close();
+
+  // queues `person`; false if it is missing required fields or the appender
+  // has failed. safe to call from several threads.
+  bool append(const Person &person);
+  // once set, append() commits by itself whenever `records` have queued up;
+  // 0 (the default) commits only when asked.
+  void set_autocommit(int records);
+  // blocks until every record appended before the call is on disk.
+  bool commit();
+
+  int64_t records() const;
+  int64_t commits() const;
+
+  // rewrites `path` keeping only the last record for each id, in the order
+  // those records appear, so appending a Person with an existing id acts as
+  // an update once the book is compacted. top-level fields other than
+  // people are kept byte for byte. false if the book is malformed or a
+  // Person has no id. the new file replaces the old one atomically. must
+  // not run while an appender has the file open.
+  static bool compact(const std::string &path);
+
+private:
+  bool commit_locked(std::unique_lock<std::mutex> *lock);
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_synced;
+  int m_fd;
+  std::string m_pending;
+  int64_t m_appended;
+  int64_t m_durable;
+  int64_t m_commits;
+  int m_autocommit;
+  bool m_syncing;
+  bool m_failed;
+};
+
+} // namespace tutorial
+
+#endif // BOOK_APPENDER_H_
@@ -0,0 +1,278 @@
+#include "book_diff.h"
+
+#include <unistd.h>
+
+#include <cstring>
+
+#include "field_file.h"
+#include "person_view.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// Entry's fields; see book_diff.h.
+const uint32_t kEntryIdTag = (1 << 3) | wire::kVarint;
+const uint32_t kEntryChangedTag = (2 << 3) | wire::kVarint;
+const uint32_t kEntryPersonTag = (3 << 3) | wire::kLengthDelimited;
+
+// a book being walked in id order, positioned on its current Person.
+class BookCursor {
+public:
+  BookCursor() : m_id(0), m_people(0), m_done(false) {}
+
+  bool open(const std::string &path) { return m_reader.open(path); }
+
+  // moves to the next Person, skipping other top-level fields; false on
+  // error, including an id not above the one before. sets done() at the end
+  // of the book.
+  bool next() {
+    for (;;) {
+      if (!m_reader.next()) {
+        m_done = true;
+        return !m_reader.failed();
+      }
+      if (m_reader.tag() != wire::kPersonTag) {
+        continue;
+      }
+      PersonView person(m_reader.payload(), m_reader.payload_size());
+      if (!person.has_id() || (m_people > 0 && person.id() <= m_id)) {
+        return false;
+      }
+      m_id = person.id();
+      ++m_people;
+      return true;
+    }
+  }
+
+  bool done() const { return m_done; }
+  int32_t id() const { return m_id; }
+  int64_t people() const { return m_people; }
+  // the current Person, as a whole `person` field and as its bytes alone.
+  const uint8_t *field() const { return m_reader.field(); }
+  size_t field_size() const { return m_reader.field_size(); }
+  const uint8_t *person() const { return m_reader.payload(); }
+  size_t size() const { return m_reader.payload_size(); }
+
+private:
+  FieldFileReader m_reader;
+  int32_t m_id;
+  int64_t m_people;
+  bool m_done;
+};
+
+// parses the diff entry `reader` is on; false if it is not one.
+bool read_entry(const FieldFileReader &reader, DiffEntry *entry) {
+  int kind = wire::tag_field(reader.tag());
+  if (wire::tag_type(reader.tag()) != wire::kLengthDelimited ||
+      kind < kDiffInsert || kind > kDiffUpdate) {
+    return false;
+  }
+  entry->kind = static_cast<DiffKind>(kind);
+  entry->changed = 0;
+  entry->person = nullptr;
+  entry->size = 0;
+  bool has_id = false;
+  const uint8_t *data = reader.payload();
+  bool ok = wire::for_each_field(
+      data, data + reader.payload_size(),
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        // the tags carry their wire type, so both varints below have
+        // already been stepped over by for_each_field.
+        uint64_t v = 0;
+        if (tag == kEntryIdTag) {
+          wire::read_varint64(&value, value_end, &v);
+          entry->id = static_cast<int32_t>(v);
+          has_id = true;
+        } else if (tag == kEntryChangedTag) {
+          wire::read_varint64(&value, value_end, &v);
+          entry->changed = static_cast<FieldMask>(v);
+        } else if (tag == kEntryPersonTag) {
+          entry->person = wire::payload(value, value_end);
+          entry->size = value_end - entry->person;
+        }
+        return true;
+      });
+  return ok && has_id && (entry->kind == kDiffRemove || entry->person);
+}
+
+void write_entry(const DiffEntry &entry, FieldFileWriter *writer) {
+  uint8_t header[32];
+  uint8_t *p = wire::write_varint64(kEntryIdTag, header);
+  // negative int32s are sign-extended on the wire.
+  p = wire::write_varint64(
+      static_cast<uint64_t>(static_cast<int64_t>(entry.id)), p);
+  if (entry.kind == kDiffUpdate) {
+    p = wire::write_varint64(kEntryChangedTag, p);
+    p = wire::write_varint64(entry.changed, p);
+  }
+  if (entry.person) {
+    p = wire::write_varint64(kEntryPersonTag, p);
+    p = wire::write_varint64(entry.size, p);
+  }
+  uint8_t prefix[15];
+  uint8_t *q = wire::write_varint64(
+      wire::make_tag(entry.kind, wire::kLengthDelimited), prefix);
+  q = wire::write_varint64((p - header) + entry.size, q);
+  writer->append(prefix, q - prefix);
+  writer->append(header, p - header);
+  if (entry.person) {
+    writer->append(entry.person, entry.size);
+  }
+}
+
+} // namespace
+
+// a phone list of a different length counts as a change to both phone
+// fields.
+FieldMask changed_fields(const uint8_t *old_person, size_t old_size,
+                         const uint8_t *new_person, size_t new_size) {
+  PersonView a(old_person, old_size);
+  PersonView b(new_person, new_size);
+  FieldMask changed = 0;
+  if (a.has_name() != b.has_name() || a.name() != b.name()) {
+    changed |= kPersonName;
+  }
+  if (a.has_email() != b.has_email() || a.email() != b.email()) {
+    changed |= kPersonEmail;
+  }
+  int phones = a.phone_size();
+  if (phones != b.phone_size()) {
+    return changed | kPhoneNumber | kPhoneType;
+  }
+  for (int i = 0; i < phones; ++i) {
+    PhoneNumberView x = a.phone(i);
+    PhoneNumberView y = b.phone(i);
+    if (x.has_number() != y.has_number() || x.number() != y.number()) {
+      changed |= kPhoneNumber;
+    }
+    if (x.has_type() != y.has_type() || x.type() != y.type()) {
+      changed |= kPhoneType;
+    }
+  }
+  return changed;
+}
+
+bool diff_books(const std::string &old_path, const std::string &new_path,
+                const DiffConsumer &consume, DiffStats *stats) {
+  BookCursor a;
+  BookCursor b;
+  if (!a.open(old_path) || !b.open(new_path) || !a.next() || !b.next()) {
+    return false;
+  }
+  DiffStats totals;
+  bool ok = true;
+  while (ok && (!a.done() || !b.done())) {
+    DiffEntry entry;
+    entry.changed = 0;
+    entry.person = nullptr;
+    entry.size = 0;
+    bool advance_a = false;
+    bool advance_b = false;
+    if (b.done() || (!a.done() && a.id() < b.id())) {
+      entry.kind = kDiffRemove;
+      entry.id = a.id();
+      advance_a = true;
+      ++totals.removed;
+    } else if (a.done() || b.id() < a.id()) {
+      entry.kind = kDiffInsert;
+      entry.id = b.id();
+      entry.person = b.person();
+      entry.size = b.size();
+      advance_b = true;
+      ++totals.inserted;
+    } else {
+      if (a.size() == b.size() &&
+          memcmp(a.person(), b.person(), a.size()) == 0) {
+        ++totals.unchanged;
+        ok = a.next() && b.next();
+        continue;
+      }
+      entry.kind = kDiffUpdate;
+      entry.id = b.id();
+      entry.changed =
+          changed_fields(a.person(), a.size(), b.person(), b.size());
+      entry.person = b.person();
+      entry.size = b.size();
+      advance_a = advance_b = true;
+      ++totals.updated;
+    }
+    if (!consume(entry)) {
+      break;
+    }
+    ok = (!advance_a || a.next()) && (!advance_b || b.next());
+  }
+  totals.old_people = a.people();
+  totals.new_people = b.people();
+  if (stats) {
+    *stats = totals;
+  }
+  return ok;
+}
+
+bool write_diff(const std::string &old_path, const std::string &new_path,
+                const std::string &diff_path, DiffStats *stats) {
+  FieldFileWriter writer;
+  if (!writer.open(diff_path)) {
+    return false;
+  }
+  bool ok = diff_books(old_path, new_path,
+                       [&](const DiffEntry &entry) {
+                         write_entry(entry, &writer);
+                         return true;
+                       },
+                       stats);
+  return writer.close() && ok;
+}
+
+bool apply_diff(const std::string &old_path, const std::string &diff_path,
+                const std::string &new_path) {
+  BookCursor book;
+  FieldFileReader diff;
+  FieldFileWriter writer;
+  if (!book.open(old_path) || !diff.open(diff_path) || !book.next() ||
+      !writer.open(new_path)) {
+    return false;
+  }
+
+  bool ok = true;
+  bool first = true;
+  int32_t last_id = 0;
+  DiffEntry entry;
+  while (ok && diff.next()) {
+    if (!read_entry(diff, &entry) || (!first && entry.id <= last_id)) {
+      ok = false;
+      break;
+    }
+    first = false;
+    last_id = entry.id;
+    while (ok && !book.done() && book.id() < entry.id) {
+      writer.append(book.field(), book.field_size());
+      ok = book.next();
+    }
+    bool present = !book.done() && book.id() == entry.id;
+    if (!ok || present != (entry.kind != kDiffInsert)) {
+      ok = false;
+      break;
+    }
+    if (entry.kind != kDiffRemove) {
+      writer.append_field(wire::kPersonTag, entry.person, entry.size);
+    }
+    if (present) {
+      ok = book.next();
+    }
+  }
+  ok = ok && !diff.failed();
+  while (ok && !book.done()) {
+    writer.append(book.field(), book.field_size());
+    ok = book.next();
+  }
+  ok = writer.close() && ok;
+  if (!ok) {
+    unlink(new_path.c_str());
+  }
+  return ok;
+}
+
+} // namespace tutorial
@@ -0,0 +1,86 @@
+#ifndef BOOK_DIFF_H_
+#define BOOK_DIFF_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "projection.h"
+
+// a streaming diff between two address books sorted by id, such as
+// sort_book writes. both books are walked in step as a merge join, one
+// Person at a time through FieldFileReaders (field_file.h), so memory stays
+// constant whatever their size. people found in both are compared as
+// serialized bytes first and only decoded, as PersonViews, when the bytes
+// differ, to work out which fields changed.
+//
+// a diff file is itself protobuf wire format, one length-delimited field per
+// entry in id order, as if written from
+//
+//   message Entry { optional int32 id = 1; optional uint32 changed = 2;
+//                   optional Person person = 3; }
+//   message Diff { repeated Entry insert = 1; repeated Entry remove = 2;
+//                  repeated Entry update = 3; }
+//
+// so apply_diff can stream it against the old book in the same way.
+namespace tutorial {
+
+enum DiffKind {
+  kDiffInsert = 1,
+  kDiffRemove = 2,
+  kDiffUpdate = 3,
+};
+
+struct DiffEntry {
+  DiffKind kind;
+  int32_t id;
+  // updates only: the PersonFields whose values differ. an update may have
+  // none set when only unknown fields or the field order changed.
+  FieldMask changed;
+  // the new serialized Person for inserts and updates; null for removals.
+  // only valid during the callback.
+  const uint8_t *person;
+  size_t size;
+};
+
+struct DiffStats {
+  DiffStats()
+      : old_people(0), new_people(0), inserted(0), removed(0), updated(0),
+        unchanged(0) {}
+
+  int64_t old_people;
+  int64_t new_people;
+  int64_t inserted;
+  int64_t removed;
+  int64_t updated;
+  int64_t unchanged;
+};
+
+// called once per entry, in id order; return false to stop early.
+typedef std::function<bool(const DiffEntry &entry)> DiffConsumer;
+
+// the fields that differ between two serialized people.
+FieldMask changed_fields(const uint8_t *old_person, size_t old_size,
+                         const uint8_t *new_person, size_t new_size);
+
+// false if a book cannot be read or is malformed, a Person lacks an id, or
+// ids are not strictly increasing in either book; an early stop by the
+// consumer is not a failure. `stats` may be null.
+bool diff_books(const std::string &old_path, const std::string &new_path,
+                const DiffConsumer &consume, DiffStats *stats = nullptr);
+
+// diff_books into a diff file at `diff_path`.
+bool write_diff(const std::string &old_path, const std::string &new_path,
+                const std::string &diff_path, DiffStats *stats = nullptr);
+
+// writes the book at `old_path` with the diff applied to `new_path`. false
+// if the diff does not fit the book: an insert of an id already there, or a
+// removal or update of one that is not. applying write_diff(old, new) to
+// old reproduces new's Person records byte for byte.
+bool apply_diff(const std::string &old_path, const std::string &diff_path,
+                const std::string &new_path);
+
+} // namespace tutorial
+
+#endif // BOOK_DIFF_H_
@@ -0,0 +1,349 @@
+#include "book_index.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "file_io.h"
+
+namespace tutorial {
+
+// key is the id, or the high half of the name hash; size 0 marks an empty
+// slot, which no Person can be since id and name are required.
+struct BookIndex::Slot {
+  uint32_t key;
+  uint32_t size;
+  uint64_t offset;
+};
+
+namespace {
+
+const char kMagic[8] = {'X', 'P', 'I', 'D', 'X', '0', '0', '2'};
+
+// padded to a cache line so the tables behind it start on one.
+struct IndexHeader {
+  char magic[8];
+  uint64_t book_size;
+  uint64_t book_crc;
+  uint64_t records;
+  uint64_t id_capacity;
+  uint64_t name_capacity;
+  uint64_t reserved[2];
+};
+
+// crc32 of the whole book, in pieces zlib's 32-bit lengths can take.
+uint64_t book_checksum(const uint8_t *data, size_t size) {
+  const size_t kPiece = size_t(1) << 30;
+  uLong crc = crc32(0, Z_NULL, 0);
+  while (size > 0) {
+    size_t n = std::min(size, kPiece);
+    crc = crc32(crc, data, static_cast<uInt>(n));
+    data += n;
+    size -= n;
+  }
+  return crc;
+}
+
+// how many probes ahead the batch lookups prefetch; a name probe spends
+// kPrefetchDistance steps waiting on its slot and as many on its record.
+const size_t kPrefetchDistance = 8;
+const size_t kPendingRing = 32;
+
+uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+uint64_t hash_name(StringView name) {
+  const char *p = name.data();
+  size_t n = name.size();
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+  while (n >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    h = mix64(h ^ word);
+    p += 8;
+    n -= 8;
+  }
+  uint64_t word = 0;
+  if (n > 0) {
+    memcpy(&word, p, n);
+  }
+  return mix64(h ^ word);
+}
+
+uint32_t name_tag(uint64_t hash) { return static_cast<uint32_t>(hash >> 32); }
+
+// load factor at most 1/2 keeps linear probe runs short.
+uint64_t table_capacity(uint64_t records) {
+  uint64_t capacity = 16;
+  while (capacity < 2 * records) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+bool is_power_of_two(uint64_t x) { return x != 0 && (x & (x - 1)) == 0; }
+
+} // namespace
+
+BookIndex::BookIndex()
+    : m_book(nullptr), m_book_size(0), m_records(0), m_id_slots(nullptr),
+      m_id_mask(0), m_name_slots(nullptr), m_name_mask(0) {}
+
+bool BookIndex::build(const uint8_t *data, size_t size,
+                      const std::string &index_path) {
+  struct Entry {
+    int32_t id;
+    uint64_t hash;
+    Slot slot;
+  };
+  std::vector<Entry> entries;
+
+  AddressBookView book(data, size);
+  PersonView person;
+  while (book.next(&person)) {
+    if (!person.valid() || !person.has_id() || !person.has_name() ||
+        person.size() > UINT32_MAX) {
+      return false;
+    }
+    Entry entry;
+    entry.id = person.id();
+    entry.hash = hash_name(person.name());
+    entry.slot.size = static_cast<uint32_t>(person.size());
+    entry.slot.offset = person.data() - data;
+    entries.push_back(entry);
+  }
+  if (book.failed()) {
+    return false;
+  }
+
+  // inserting in book order leaves the earliest of several equal keys first
+  // along its probe sequence.
+  IndexHeader header = {};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.book_size = size;
+  header.book_crc = book_checksum(data, size);
+  header.records = entries.size();
+  header.id_capacity = table_capacity(entries.size());
+  header.name_capacity = table_capacity(entries.size());
+
+  Slot empty = {0, 0, 0};
+  std::vector<Slot> ids(header.id_capacity, empty);
+  std::vector<Slot> names(header.name_capacity, empty);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    Entry &entry = entries[i];
+    uint64_t mask = header.id_capacity - 1;
+    size_t slot = mix64(static_cast<uint32_t>(entry.id)) & mask;
+    while (ids[slot].size != 0) {
+      slot = (slot + 1) & mask;
+    }
+    ids[slot] = entry.slot;
+    ids[slot].key = static_cast<uint32_t>(entry.id);
+
+    mask = header.name_capacity - 1;
+    slot = entry.hash & mask;
+    while (names[slot].size != 0) {
+      slot = (slot + 1) & mask;
+    }
+    names[slot] = entry.slot;
+    names[slot].key = name_tag(entry.hash);
+  }
+
+  int fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, ids.data(), ids.size() * sizeof(Slot)) &&
+            write_all(fd, names.data(), names.size() * sizeof(Slot));
+  return ::close(fd) == 0 && ok;
+}
+
+bool BookIndex::open(const std::string &index_path, const uint8_t *book,
+                     size_t book_size) {
+  close();
+  if (!m_file.open(index_path)) {
+    return false;
+  }
+
+  IndexHeader header;
+  if (m_file.size() < sizeof(header)) {
+    close();
+    return false;
+  }
+  memcpy(&header, m_file.data(), sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.book_size != book_size ||
+      header.book_crc != book_checksum(book, book_size) ||
+      !is_power_of_two(header.id_capacity) ||
+      !is_power_of_two(header.name_capacity) ||
+      header.id_capacity > m_file.size() ||
+      header.name_capacity > m_file.size() ||
+      m_file.size() != sizeof(header) + (header.id_capacity +
+                                         header.name_capacity) *
+                                            sizeof(Slot)) {
+    close();
+    return false;
+  }
+
+  m_book = book;
+  m_book_size = book_size;
+  m_records = header.records;
+  m_id_slots = reinterpret_cast<const Slot *>(m_file.data() + sizeof(header));
+  m_id_mask = header.id_capacity - 1;
+  m_name_slots = m_id_slots + header.id_capacity;
+  m_name_mask = header.name_capacity - 1;
+  return true;
+}
+
+void BookIndex::close() {
+  m_file.close();
+  m_book = nullptr;
+  m_book_size = 0;
+  m_records = 0;
+  m_id_slots = nullptr;
+  m_id_mask = 0;
+  m_name_slots = nullptr;
+  m_name_mask = 0;
+}
+
+bool BookIndex::find_id(int32_t id, PersonView *person) const {
+  return is_open() && probe_id(id, id_home(id), person);
+}
+
+bool BookIndex::find_name(StringView name, PersonView *person) const {
+  if (!is_open()) {
+    return false;
+  }
+  uint64_t hash = hash_name(name);
+  return probe_name(name, name_tag(hash), name_home(hash), person);
+}
+
+void BookIndex::find_ids(const int32_t *ids, size_t count, PersonView *people,
+                         bool *found) const {
+  if (!is_open()) {
+    memset(found, 0, count * sizeof(bool));
+    return;
+  }
+  for (size_t i = 0; i < count && i < kPrefetchDistance; ++i) {
+    __builtin_prefetch(&m_id_slots[id_home(ids[i])]);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (i + kPrefetchDistance < count) {
+      __builtin_prefetch(&m_id_slots[id_home(ids[i + kPrefetchDistance])]);
+    }
+    found[i] = probe_id(ids[i], id_home(ids[i]), &people[i]);
+  }
+}
+
+// a three-stage pipeline: hash a name and prefetch its home slot, then
+// kPrefetchDistance probes later walk to the first slot with a matching tag
+// and prefetch that record, then as many probes later again confirm the name.
+void BookIndex::find_names(const StringView *names, size_t count,
+                           PersonView *people, bool *found) const {
+  if (!is_open()) {
+    memset(found, 0, count * sizeof(bool));
+    return;
+  }
+
+  struct Pending {
+    uint32_t tag;
+    size_t slot;
+  };
+  Pending pending[kPendingRing];
+
+  for (size_t i = 0; i < count + 2 * kPrefetchDistance; ++i) {
+    if (i < count) {
+      uint64_t hash = hash_name(names[i]);
+      Pending &next = pending[i % kPendingRing];
+      next.tag = name_tag(hash);
+      next.slot = name_home(hash);
+      __builtin_prefetch(&m_name_slots[next.slot]);
+    }
+
+    if (i >= kPrefetchDistance && i - kPrefetchDistance < count) {
+      Pending &next = pending[(i - kPrefetchDistance) % kPendingRing];
+      for (uint64_t n = 0; n < m_name_mask &&
+                           m_name_slots[next.slot].size != 0 &&
+                           m_name_slots[next.slot].key != next.tag;
+           ++n) {
+        next.slot = (next.slot + 1) & m_name_mask;
+      }
+      const Slot &slot = m_name_slots[next.slot];
+      if (slot.size != 0 && slot.offset < m_book_size) {
+        __builtin_prefetch(m_book + slot.offset);
+      }
+    }
+
+    if (i >= 2 * kPrefetchDistance) {
+      size_t j = i - 2 * kPrefetchDistance;
+      const Pending &next = pending[j % kPendingRing];
+      found[j] = probe_name(names[j], next.tag, next.slot, &people[j]);
+    }
+  }
+}
+
+size_t BookIndex::id_home(int32_t id) const {
+  return mix64(static_cast<uint32_t>(id)) & m_id_mask;
+}
+
+size_t BookIndex::name_home(uint64_t hash) const { return hash & m_name_mask; }
+
+// slots come from a file; one pointing outside the book resolves to nothing
+// rather than to a view of someone else's memory.
+bool BookIndex::resolve(const Slot &slot, PersonView *person) const {
+  if (slot.offset > m_book_size || slot.size > m_book_size - slot.offset) {
+    return false;
+  }
+  *person = PersonView(m_book + slot.offset, slot.size);
+  return true;
+}
+
+// both probes give up after a full lap, which only a damaged file with no
+// empty slot left could make them take.
+bool BookIndex::probe_id(int32_t id, size_t slot, PersonView *person) const {
+  for (uint64_t n = 0; n <= m_id_mask; ++n, slot = (slot + 1) & m_id_mask) {
+    const Slot &entry = m_id_slots[slot];
+    if (entry.size == 0) {
+      return false;
+    }
+    PersonView candidate;
+    if (entry.key == static_cast<uint32_t>(id) &&
+        resolve(entry, &candidate) && candidate.has_id() &&
+        candidate.id() == id) {
+      *person = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BookIndex::probe_name(StringView name, uint32_t tag, size_t slot,
+                           PersonView *person) const {
+  for (uint64_t n = 0; n <= m_name_mask;
+       ++n, slot = (slot + 1) & m_name_mask) {
+    const Slot &entry = m_name_slots[slot];
+    if (entry.size == 0) {
+      return false;
+    }
+    PersonView candidate;
+    if (entry.key == tag && resolve(entry, &candidate) &&
+        candidate.name() == name) {
+      *person = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace tutorial
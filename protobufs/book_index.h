@@ -0,0 +1,79 @@
+#ifndef BOOK_INDEX_H_
+#define BOOK_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.h"
+#include "person_view.h"
+#include "string_view.h"
+
+// persistent lookup index over a serialized AddressBook, kept in a file next
+// to it. the file is two open-addressing tables with linear probing, one
+// keyed by id and one by a hash of the name, both of 16-byte slots holding
+// the key and where the Person record sits in the book. it is used straight
+// off an mmap: a lookup probes for the key, usually within a single cache
+// line, then reads the candidate record to confirm its id or name. either
+// way the result is a PersonView into the mapped book.
+//
+// the index stores the size and crc32 of the book it was built from and
+// refuses to open against any other, so a book rewritten in place, even to
+// the same size, needs a new index; checking costs open() one pass over the
+// book. ids and names need not be unique; lookups return the first matching
+// record in book order.
+namespace tutorial {
+
+class BookIndex {
+public:
+  BookIndex();
+
+  // indexes the book in [data, data + size) and writes the index to
+  // `index_path`. false if the book is malformed, a Person lacks its id or
+  // name, or the file cannot be written.
+  static bool build(const uint8_t *data, size_t size,
+                    const std::string &index_path);
+
+  // maps `index_path` for lookups into `book`, which must outlive this
+  // object. false if the index was built from a different book.
+  bool open(const std::string &index_path, const uint8_t *book,
+            size_t book_size);
+  void close();
+  bool is_open() const { return m_file.is_open(); }
+
+  uint64_t records() const { return m_records; }
+
+  bool find_id(int32_t id, PersonView *person) const;
+  bool find_name(StringView name, PersonView *person) const;
+
+  // batch lookups; found[i] says whether people[i] was set. slots (and, for
+  // names, candidate records) are prefetched several probes ahead, so the
+  // memory latency of consecutive probes overlaps instead of adding up.
+  void find_ids(const int32_t *ids, size_t count, PersonView *people,
+                bool *found) const;
+  void find_names(const StringView *names, size_t count, PersonView *people,
+                  bool *found) const;
+
+private:
+  struct Slot;
+
+  size_t id_home(int32_t id) const;
+  size_t name_home(uint64_t hash) const;
+  bool resolve(const Slot &slot, PersonView *person) const;
+  bool probe_id(int32_t id, size_t slot, PersonView *person) const;
+  bool probe_name(StringView name, uint32_t tag, size_t slot,
+                  PersonView *person) const;
+
+  MappedFile m_file;
+  const uint8_t *m_book;
+  size_t m_book_size;
+  uint64_t m_records;
+  const Slot *m_id_slots;
+  uint64_t m_id_mask;
+  const Slot *m_name_slots;
+  uint64_t m_name_mask;
+};
+
+} // namespace tutorial
+
+#endif // BOOK_INDEX_H_
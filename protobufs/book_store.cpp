@@ -0,0 +1,788 @@
+#include "book_store.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "file_io.h"
+#include "mapped_file.h"
+#include "parallel_loader.h"
+#include "stats.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// Mutation's fields, and the Log field that holds each one; see
+// book_store.h.
+const uint32_t kRecordTag = (1 << 3) | wire::kLengthDelimited;
+const uint32_t kIdTag = (1 << 3) | wire::kVarint;
+const uint32_t kPutTag = (2 << 3) | wire::kLengthDelimited;
+const uint32_t kRemoveTag = (3 << 3) | wire::kVarint;
+const uint32_t kEmailTag = (4 << 3) | wire::kLengthDelimited;
+const uint32_t kAddPhoneTag = (5 << 3) | wire::kLengthDelimited;
+const uint32_t kChecksumTag = (15 << 3) | wire::kFixed32;
+// the checksum's tag and value, at the end of every record.
+const size_t kChecksumBytes = 5;
+
+// 256 shards, picked by a multiplicative hash of the id.
+const int kShardBits = 8;
+const size_t kShards = size_t(1) << kShardBits;
+
+// snapshots are written in chunks of this size.
+const size_t kSnapshotBuffer = 1 << 20;
+
+// how long the background thread waits to retry a failed checkpoint.
+const std::chrono::seconds kCheckpointRetry(1);
+
+size_t shard_of(int32_t id) {
+  return (static_cast<uint32_t>(id) * 2654435761u) >> (32 - kShardBits);
+}
+
+void append_varint(uint64_t value, std::string *out) {
+  uint8_t buffer[10];
+  out->append(reinterpret_cast<const char *>(buffer),
+              wire::write_varint64(value, buffer) - buffer);
+}
+
+void append_field(uint32_t tag, const std::string &value, std::string *out) {
+  append_varint(tag, out);
+  append_varint(value.size(), out);
+  *out += value;
+}
+
+// a Mutation for `id` with `body` as its other fields, checksummed and
+// framed as a Log field.
+std::string make_record(int32_t id, const std::string &body) {
+  std::string mutation;
+  append_varint(kIdTag, &mutation);
+  // negative int32s are sign-extended on the wire.
+  append_varint(static_cast<uint64_t>(static_cast<int64_t>(id)), &mutation);
+  mutation += body;
+  uint32_t crc = crc32(0, reinterpret_cast<const Bytef *>(mutation.data()),
+                       mutation.size());
+  mutation += static_cast<char>(kChecksumTag);
+  for (int i = 0; i < 4; ++i) {
+    mutation += static_cast<char>(crc >> (8 * i));
+  }
+  std::string record;
+  append_field(kRecordTag, mutation, &record);
+  return record;
+}
+
+// the Mutation at `p`, if a whole record with a good checksum starts there;
+// `p` moves past it. a record whose length runs past `end` is cut off, as
+// the last one in a segment is by a torn write; any other damage is
+// malformed.
+wire::ScanResult next_record(const uint8_t **p, const uint8_t *end,
+                             const uint8_t **mutation, size_t *size,
+                             int32_t *id) {
+  const uint8_t *q = *p;
+  uint64_t tag;
+  uint64_t length;
+  wire::ScanResult result = wire::scan_varint64(&q, end, &tag);
+  if (result != wire::kScanWhole) {
+    return result;
+  }
+  if (tag != kRecordTag) {
+    return wire::kScanMalformed;
+  }
+  result = wire::scan_varint64(&q, end, &length);
+  if (result != wire::kScanWhole) {
+    return result;
+  }
+  if (length < kChecksumBytes) {
+    return wire::kScanMalformed;
+  }
+  if (length > static_cast<uint64_t>(end - q)) {
+    return wire::kScanCutOff;
+  }
+  const uint8_t *checksum = q + length - kChecksumBytes;
+  uint32_t crc = 0;
+  for (int i = 0; i < 4; ++i) {
+    crc |= static_cast<uint32_t>(checksum[1 + i]) << (8 * i);
+  }
+  const uint8_t *value = q;
+  uint32_t id_tag = 0;
+  uint64_t v = 0;
+  if (checksum[0] != kChecksumTag ||
+      crc32(0, q, checksum - q) != crc ||
+      !wire::read_varint32(&value, checksum, &id_tag) || id_tag != kIdTag ||
+      !wire::read_varint64(&value, checksum, &v)) {
+    return wire::kScanMalformed;
+  }
+  *mutation = q;
+  *size = checksum - q;
+  *id = static_cast<int32_t>(v);
+  *p = q + length;
+  return wire::kScanWhole;
+}
+
+// BookStore's shards.
+typedef std::unordered_map<int32_t, std::shared_ptr<const Person>> PersonMap;
+
+// applies a logged Mutation to the shard holding its person; false if it
+// is damaged or names a person who is not there.
+bool apply_mutation(const uint8_t *mutation, size_t size, int32_t id,
+                    PersonMap *shard) {
+  uint32_t op = 0;
+  const uint8_t *data = nullptr;
+  const uint8_t *data_end = nullptr;
+  bool ok = wire::for_each_field(
+      mutation, mutation + size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == kPutTag || tag == kEmailTag || tag == kAddPhoneTag) {
+          op = tag;
+          data = wire::payload(value, value_end);
+          data_end = value_end;
+        } else if (tag == kRemoveTag) {
+          op = tag;
+        }
+        return true;
+      });
+  if (!ok || op == 0) {
+    return false;
+  }
+  if (op == kRemoveTag) {
+    shard->erase(id);
+    return true;
+  }
+  int length = static_cast<int>(data_end - data);
+  std::shared_ptr<Person> person = std::make_shared<Person>();
+  if (op == kPutTag) {
+    if (!person->ParseFromArray(data, length)) {
+      return false;
+    }
+  } else {
+    PersonMap::const_iterator found = shard->find(id);
+    if (found == shard->end()) {
+      return false;
+    }
+    person->CopyFrom(*found->second);
+    if (op == kEmailTag) {
+      person->set_email(reinterpret_cast<const char *>(data), length);
+    } else if (!person->add_phone()->ParseFromArray(data, length)) {
+      return false;
+    }
+  }
+  (*shard)[id] = person;
+  return true;
+}
+
+// "NAME.N" -> N.
+bool parse_name(const char *file, const char *name, uint64_t *number) {
+  size_t length = strlen(name);
+  if (strncmp(file, name, length) != 0 || file[length] != '.' ||
+      !isdigit(static_cast<unsigned char>(file[length + 1]))) {
+    return false;
+  }
+  char *end;
+  *number = strtoull(file + length + 1, &end, 10);
+  return *end == '\0';
+}
+
+std::string file_name(const std::string &dir, const char *name,
+                      uint64_t number) {
+  return dir + "/" + name + "." + std::to_string(number);
+}
+
+int thread_count(int threads) {
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return threads > 0 ? threads : std::max(1, cores);
+}
+
+// runs work(t) for t in [0, threads) on that many threads.
+template <typename Work> void run_threads(int threads, Work work) {
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; ++t) {
+    workers.emplace_back(work, t);
+  }
+  work(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+} // namespace
+
+// a log segment being replayed, and where its records are.
+struct BookStore::Segment {
+  struct Record {
+    const uint8_t *mutation;
+    size_t size;
+    int32_t id;
+  };
+
+  uint64_t start;
+  MappedFile file;
+  std::vector<Record> records;
+};
+
+StoreOptions::StoreOptions() : checkpoint_bytes(64 << 20), threads(0) {}
+
+BookStore::BookStore()
+    : m_people(0), m_fd(-1), m_sealed_fd(-1), m_sequence(0), m_durable(0),
+      m_logged_bytes(0), m_syncing(false), m_failed(false),
+      m_stopping(false) {}
+
+BookStore::~BookStore() { close(); }
+
+bool BookStore::open(const std::string &dir, const StoreOptions &options) {
+  close();
+  Stopwatch watch;
+  m_dir = dir;
+  m_options = options;
+  m_shards.clear();
+  for (size_t i = 0; i < kShards; ++i) {
+    m_shards.push_back(std::make_shared<Shard>());
+  }
+  m_people = 0;
+  m_sequence = 0;
+  m_logged_bytes = 0;
+  m_failed = false;
+  m_stopping = false;
+  m_stats = StoreStats();
+  if ((mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) || !recover()) {
+    return false;
+  }
+  m_durable = m_sequence;
+  m_fd = ::open(file_name(dir, "wal", m_sequence).c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (m_fd < 0 || !sync_directory(file_name(dir, "wal", m_sequence))) {
+    return false;
+  }
+  m_stats.recovery_seconds = watch.seconds();
+  if (m_options.checkpoint_bytes > 0) {
+    m_checkpointer = std::thread(&BookStore::checkpoint_loop, this);
+  }
+  return true;
+}
+
+bool BookStore::close() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_checkpoint_wanted.notify_all();
+  if (m_checkpointer.joinable()) {
+    m_checkpointer.join();
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_fd < 0) {
+    return true;
+  }
+  while (m_syncing) {
+    m_synced.wait(lock);
+  }
+  bool ok = commit(&lock);
+  // a commit that failed can leave the segment a checkpoint sealed open.
+  if (m_sealed_fd >= 0) {
+    ::close(m_sealed_fd);
+    m_sealed_fd = -1;
+    m_sealed.clear();
+  }
+  ok = ::close(m_fd) == 0 && ok;
+  m_fd = -1;
+  return ok;
+}
+
+// the newest snapshot, then every log segment from it on, oldest first.
+// leftovers of an interrupted checkpoint are removed: a snapshot that was
+// never finished, and segments the last snapshot already covers.
+bool BookStore::recover() {
+  DIR *listing = opendir(m_dir.c_str());
+  if (!listing) {
+    return false;
+  }
+  std::vector<uint64_t> snapshots;
+  std::vector<uint64_t> starts;
+  std::vector<std::string> stale;
+  while (dirent *entry = readdir(listing)) {
+    uint64_t number;
+    const char *name = entry->d_name;
+    size_t length = strlen(name);
+    if (length > 4 && strcmp(name + length - 4, ".tmp") == 0) {
+      stale.push_back(m_dir + "/" + name);
+    } else if (parse_name(name, "snapshot", &number)) {
+      snapshots.push_back(number);
+    } else if (parse_name(name, "wal", &number)) {
+      starts.push_back(number);
+    }
+  }
+  closedir(listing);
+  std::sort(snapshots.begin(), snapshots.end());
+  std::sort(starts.begin(), starts.end());
+
+  uint64_t base = snapshots.empty() ? 0 : snapshots.back();
+  if (!snapshots.empty()) {
+    AddressBook book;
+    if (!load_address_book_parallel(file_name(m_dir, "snapshot", base),
+                                    m_options.threads, &book)) {
+      return false;
+    }
+    std::vector<Person *> people(book.person_size());
+    book.mutable_person()->ExtractSubrange(0, book.person_size(),
+                                           people.data());
+    int threads = thread_count(m_options.threads);
+    run_threads(threads, [&](int t) {
+      for (Person *person : people) {
+        size_t shard = shard_of(person->id());
+        if (shard % threads == static_cast<size_t>(t)) {
+          (*m_shards[shard])[person->id()].reset(person);
+        }
+      }
+    });
+    snapshots.pop_back();
+  }
+  for (uint64_t snapshot : snapshots) {
+    stale.push_back(file_name(m_dir, "snapshot", snapshot));
+  }
+
+  std::vector<Segment> segments;
+  m_sequence = base;
+  bool torn = false;
+  for (uint64_t start : starts) {
+    if (start < base) {
+      stale.push_back(file_name(m_dir, "wal", start));
+      continue;
+    }
+    std::string path = file_name(m_dir, "wal", start);
+    segments.emplace_back();
+    Segment &segment = segments.back();
+    segment.start = start;
+    if (!segment.file.open(path)) {
+      return false;
+    }
+    // segments have to pick up where the one before left off, except for
+    // empty ones a crash left behind a segment whose last records were
+    // never written, or were torn.
+    if (start != m_sequence || torn) {
+      if (segment.file.size() != 0) {
+        return false;
+      }
+      segments.pop_back();
+      stale.push_back(path);
+      continue;
+    }
+    const uint8_t *p = segment.file.data();
+    const uint8_t *end = p + segment.file.size();
+    Segment::Record record;
+    wire::ScanResult result = wire::kScanWhole;
+    while (p < end && result == wire::kScanWhole) {
+      result = next_record(&p, end, &record.mutation, &record.size,
+                           &record.id);
+      if (result == wire::kScanWhole) {
+        segment.records.push_back(record);
+      }
+    }
+    // only the last record can have been torn; damage before it is not
+    // something a crash leaves behind, and cutting there would lose every
+    // record after it.
+    if (result == wire::kScanMalformed) {
+      return false;
+    }
+    m_sequence += segment.records.size();
+    m_logged_bytes += p - segment.file.data();
+    // a torn record is cut off, so the next segment starts right after the
+    // last good one.
+    if (p != end) {
+      torn = true;
+      int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+      bool ok = fd >= 0 && ftruncate(fd, p - segment.file.data()) == 0 &&
+                fdatasync(fd) == 0;
+      if (fd >= 0) {
+        ok = ::close(fd) == 0 && ok;
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+  }
+  if (!replay(segments)) {
+    return false;
+  }
+  for (const std::shared_ptr<Shard> &shard : m_shards) {
+    m_people += shard->size();
+  }
+  for (const std::string &path : stale) {
+    unlink(path.c_str());
+  }
+  return true;
+}
+
+// records for different ids commute, so each thread applies, in log order,
+// the records of the shards it owns.
+bool BookStore::replay(const std::vector<Segment> &segments) {
+  int threads = thread_count(m_options.threads);
+  std::atomic<bool> failed(false);
+  std::atomic<int64_t> replayed(0);
+  run_threads(threads, [&](int t) {
+    int64_t applied = 0;
+    for (const Segment &segment : segments) {
+      for (const Segment::Record &record : segment.records) {
+        size_t index = shard_of(record.id);
+        if (index % threads != static_cast<size_t>(t)) {
+          continue;
+        }
+        if (!apply_mutation(record.mutation, record.size, record.id,
+                            m_shards[index].get())) {
+          failed.store(true);
+          return;
+        }
+        ++applied;
+      }
+    }
+    replayed += applied;
+  });
+  m_stats.replayed = replayed.load();
+  return !failed.load();
+}
+
+bool BookStore::put(const Person &person) {
+  if (!person.IsInitialized()) {
+    return false;
+  }
+  std::shared_ptr<const Person> copy = std::make_shared<Person>(person);
+  std::string body;
+  append_field(kPutTag, person.SerializeAsString(), &body);
+  std::string record = make_record(person.id(), body);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_fd < 0 || m_failed) {
+    return false;
+  }
+  log_locked(record);
+  std::shared_ptr<const Person> &slot =
+      (*writable_shard_locked(person.id()))[person.id()];
+  m_people += slot ? 0 : 1;
+  slot = copy;
+  return commit(&lock);
+}
+
+bool BookStore::remove(int32_t id) {
+  std::string body;
+  append_varint(kRemoveTag, &body);
+  append_varint(1, &body);
+  std::string record = make_record(id, body);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_fd < 0 || m_failed || m_shards[shard_of(id)]->count(id) == 0) {
+    return false;
+  }
+  log_locked(record);
+  writable_shard_locked(id)->erase(id);
+  --m_people;
+  return commit(&lock);
+}
+
+bool BookStore::set_email(int32_t id, const std::string &email) {
+  std::string body;
+  append_field(kEmailTag, email, &body);
+  std::string record = make_record(id, body);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const Shard &shard = *m_shards[shard_of(id)];
+  Shard::const_iterator found = shard.find(id);
+  if (m_fd < 0 || m_failed || found == shard.end()) {
+    return false;
+  }
+  std::shared_ptr<Person> person = std::make_shared<Person>(*found->second);
+  person->set_email(email);
+  log_locked(record);
+  (*writable_shard_locked(id))[id] = person;
+  return commit(&lock);
+}
+
+bool BookStore::add_phone(int32_t id, const Person::PhoneNumber &phone) {
+  if (!phone.IsInitialized()) {
+    return false;
+  }
+  std::string body;
+  append_field(kAddPhoneTag, phone.SerializeAsString(), &body);
+  std::string record = make_record(id, body);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const Shard &shard = *m_shards[shard_of(id)];
+  Shard::const_iterator found = shard.find(id);
+  if (m_fd < 0 || m_failed || found == shard.end()) {
+    return false;
+  }
+  std::shared_ptr<Person> person = std::make_shared<Person>(*found->second);
+  person->add_phone()->CopyFrom(phone);
+  log_locked(record);
+  (*writable_shard_locked(id))[id] = person;
+  return commit(&lock);
+}
+
+bool BookStore::get(int32_t id, Person *person) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_shards.empty()) {
+    return false;
+  }
+  const Shard &shard = *m_shards[shard_of(id)];
+  Shard::const_iterator found = shard.find(id);
+  if (found == shard.end()) {
+    return false;
+  }
+  person->CopyFrom(*found->second);
+  return true;
+}
+
+int64_t BookStore::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_people;
+}
+
+// copies outside the lock, from shards that writers leave alone until the
+// copy lets go of them.
+void BookStore::copy_to(AddressBook *book) const {
+  std::vector<std::shared_ptr<Shard>> shards;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    shards = m_shards;
+    book->Clear();
+    book->mutable_person()->Reserve(static_cast<int>(m_people));
+  }
+  for (const std::shared_ptr<Shard> &shard : shards) {
+    for (const Shard::value_type &entry : *shard) {
+      book->add_person()->CopyFrom(*entry.second);
+    }
+  }
+  release_shards(&shards);
+}
+
+// under the lock, so that a writer who then finds a shard unshared also
+// sees the reader done with it. shards writers have since replaced are the
+// reader's alone by now, and are freed after the lock is let go.
+void BookStore::release_shards(
+    std::vector<std::shared_ptr<Shard>> *shards) const {
+  std::vector<std::shared_ptr<Shard>> replaced;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < shards->size(); ++i) {
+    if ((*shards)[i] != m_shards[i]) {
+      replaced.push_back(std::move((*shards)[i]));
+    }
+  }
+  shards->clear();
+}
+
+void BookStore::log_locked(const std::string &record) {
+  m_pending += record;
+  ++m_sequence;
+  ++m_stats.mutations;
+  m_logged_bytes += record.size();
+  if (m_options.checkpoint_bytes > 0 &&
+      m_logged_bytes >= m_options.checkpoint_bytes) {
+    m_checkpoint_wanted.notify_one();
+  }
+}
+
+// a shard some checkpoint or copy still holds is copied, pointers only,
+// before it changes.
+BookStore::Shard *BookStore::writable_shard_locked(int32_t id) {
+  std::shared_ptr<Shard> &shard = m_shards[shard_of(id)];
+  if (shard.use_count() > 1) {
+    shard = std::make_shared<Shard>(*shard);
+  }
+  return shard.get();
+}
+
+// group commit, as BookAppender::commit_locked. a leader that finds a
+// segment sealed by a checkpoint finishes and closes it before writing to
+// the new one, so a record in the new segment is never durable before one
+// ahead of it in the old.
+bool BookStore::commit(std::unique_lock<std::mutex> *lock) {
+  uint64_t target = m_sequence;
+  while (m_durable < target && !m_failed) {
+    if (m_syncing) {
+      m_synced.wait(*lock);
+      continue;
+    }
+
+    m_syncing = true;
+    std::string sealed;
+    std::string batch;
+    sealed.swap(m_sealed);
+    batch.swap(m_pending);
+    int sealed_fd = m_sealed_fd;
+    int fd = m_fd;
+    uint64_t batch_end = m_sequence;
+    m_sealed_fd = -1;
+    lock->unlock();
+    bool ok = true;
+    if (sealed_fd >= 0) {
+      ok = write_all(sealed_fd, sealed.data(), sealed.size()) &&
+           fdatasync(sealed_fd) == 0;
+      ok = ::close(sealed_fd) == 0 && ok;
+    }
+    ok = ok && write_all(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+    lock->lock();
+
+    m_syncing = false;
+    if (ok) {
+      m_durable = batch_end;
+      ++m_stats.commits;
+    } else {
+      m_failed = true;
+    }
+    m_synced.notify_all();
+  }
+  return !m_failed;
+}
+
+bool BookStore::checkpoint() {
+  std::lock_guard<std::mutex> checkpointing(m_checkpoint_mutex);
+  std::vector<std::shared_ptr<Shard>> shards;
+  uint64_t sequence;
+  size_t covered;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0 || m_failed) {
+      return false;
+    }
+    if (m_logged_bytes == 0) {
+      return true;
+    }
+    // the segment sealed last time has to be closed before another is.
+    while (m_syncing || m_sealed_fd >= 0) {
+      if (m_syncing) {
+        m_synced.wait(lock);
+      } else if (!commit(&lock)) {
+        return false;
+      }
+    }
+    sequence = m_sequence;
+    std::string path = file_name(m_dir, "wal", sequence);
+    int fd = ::open(path.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    // with nothing queued the old segment is already durable.
+    if (m_pending.empty()) {
+      ::close(m_fd);
+    } else {
+      m_sealed_fd = m_fd;
+      m_sealed.swap(m_pending);
+    }
+    m_fd = fd;
+    // taken off only once the snapshot is down, so a failed checkpoint
+    // leaves the bytes it did not cover to the next.
+    covered = m_logged_bytes;
+    shards = m_shards;
+  }
+  // the new segment's name has to be durable before the snapshot replaces
+  // the log that led up to it.
+  bool ok = sync_directory(file_name(m_dir, "wal", sequence)) &&
+            write_snapshot(sequence, shards);
+  release_shards(&shards);
+  if (!ok) {
+    return false;
+  }
+
+  DIR *listing = opendir(m_dir.c_str());
+  if (!listing) {
+    return false;
+  }
+  while (dirent *entry = readdir(listing)) {
+    uint64_t number;
+    if ((parse_name(entry->d_name, "snapshot", &number) ||
+         parse_name(entry->d_name, "wal", &number)) &&
+        number < sequence) {
+      unlink((m_dir + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(listing);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_logged_bytes -= covered;
+  ++m_stats.checkpoints;
+  return true;
+}
+
+bool BookStore::write_snapshot(
+    uint64_t sequence, const std::vector<std::shared_ptr<Shard>> &shards) {
+  std::string path = file_name(m_dir, "snapshot", sequence);
+  std::string temp_path = path + ".tmp";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool ok = true;
+  std::string buffer;
+  for (const std::shared_ptr<Shard> &shard : shards) {
+    for (const Shard::value_type &entry : *shard) {
+      // serialized straight into the buffer: tag, length, then the record.
+      const Person &person = *entry.second;
+      int size = person.ByteSize();
+      size_t offset = buffer.size();
+      buffer.resize(offset + 1 + wire::varint_size(size) + size);
+      uint8_t *target = reinterpret_cast<uint8_t *>(&buffer[offset]);
+      *target++ = static_cast<uint8_t>(wire::kPersonTag);
+      target = wire::write_varint64(size, target);
+      person.SerializeWithCachedSizesToArray(target);
+      if (buffer.size() >= kSnapshotBuffer) {
+        ok = ok && write_all(fd, buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+  }
+  ok = ok && write_all(fd, buffer.data(), buffer.size()) && fdatasync(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return sync_directory(path);
+}
+
+void BookStore::checkpoint_loop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_checkpoint_wanted.wait(lock, [this] {
+      return m_stopping || m_logged_bytes >= m_options.checkpoint_bytes;
+    });
+    if (m_stopping) {
+      return;
+    }
+    lock.unlock();
+    bool ok = checkpoint();
+    lock.lock();
+    if (!ok) {
+      ++m_stats.failed_checkpoints;
+      // a failed commit fails the store, which failed() reports; anything
+      // else, a full disk say, may clear, so try again in a while.
+      if (m_failed) {
+        return;
+      }
+      m_checkpoint_wanted.wait_for(lock, kCheckpointRetry,
+                                   [this] { return m_stopping; });
+    }
+  }
+}
+
+bool BookStore::failed() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_failed;
+}
+
+StoreStats BookStore::stats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+} // namespace tutorial
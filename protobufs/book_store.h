@@ -0,0 +1,167 @@
+#ifndef BOOK_STORE_H_
+#define BOOK_STORE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "person.pb.h"
+
+// a durable, mutable address book kept in a directory of its own:
+//
+//   snapshot.N   a serialized AddressBook holding the first N mutations,
+//                readable by every other tool here;
+//   wal.N        the mutations from the Nth on, one record each.
+//
+// a mutation is logged and applied under one lock, so the log order is the
+// order they took effect in, then made durable by group commit as in
+// BookAppender: one write and fdatasync carries every record queued since
+// the last, and the writers that queued them all return when it lands.
+//
+// a checkpoint starts a new log segment at the current mutation, writes the
+// book as it stood there to a new snapshot and then deletes the older
+// snapshot and segments. writers carry on meanwhile: the book is held in
+// shards of shared Person pointers, a checkpoint takes a reference to every
+// shard, and a writer that finds its shard still referenced copies the
+// shard's pointers before changing it, never the people themselves. a
+// background thread checkpoints each time `checkpoint_bytes` have been
+// logged, which bounds how much log a restart has to replay, and retries
+// one that failed until it succeeds or the store fails.
+//
+// open() loads the newest snapshot with load_address_book_parallel and
+// replays the log after it on `threads` threads, each applying the records
+// for its own shards in log order. a record torn by a crash, the last in
+// its segment with a length running past the end, is cut off; damage
+// anywhere else fails the open.
+//
+// a log segment is protobuf wire format, as if written from
+//
+//   message Mutation { optional int32 id = 1; optional Person put = 2;
+//                      optional bool remove = 3; optional string email = 4;
+//                      optional Person.PhoneNumber add_phone = 5;
+//                      optional fixed32 checksum = 15; }
+//   message Log { repeated Mutation mutation = 1; }
+//
+// where the checksum, always last, is the crc32 of the mutation's other
+// bytes.
+namespace tutorial {
+
+struct StoreOptions {
+  StoreOptions();
+
+  // log bytes between background checkpoints; 0 checkpoints only when
+  // asked.
+  size_t checkpoint_bytes;
+  // threads for loading and replay on open; <= 0 uses every hardware
+  // thread.
+  int threads;
+};
+
+struct StoreStats {
+  StoreStats()
+      : mutations(0), commits(0), checkpoints(0), failed_checkpoints(0),
+        replayed(0), recovery_seconds(0) {}
+
+  // since open.
+  int64_t mutations;
+  int64_t commits;
+  int64_t checkpoints;
+  // background checkpoints that failed; each is retried a second later
+  // unless the store itself has failed.
+  int64_t failed_checkpoints;
+  // log records applied on open, and the time open took.
+  int64_t replayed;
+  double recovery_seconds;
+};
+
+class BookStore {
+public:
+  BookStore();
+  ~BookStore();
+
+  BookStore(const BookStore &) = delete;
+  BookStore &operator=(const BookStore &) = delete;
+
+  // opens the store in `dir`, creating the directory if need be, and
+  // recovers its book. false if it cannot be read or its log is damaged
+  // anywhere but at the end.
+  bool open(const std::string &dir, const StoreOptions &options);
+  // stops the checkpoint thread and closes the log; every mutation that
+  // returned true is already durable.
+  bool close();
+
+  // each mutation returns once it is durable. false if the person is
+  // missing required fields or, for the rest, there is no person with that
+  // id; and once any write to the log has failed, after which the store
+  // only reads. see failed().
+  bool put(const Person &person);
+  bool remove(int32_t id);
+  bool set_email(int32_t id, const std::string &email);
+  bool add_phone(int32_t id, const Person::PhoneNumber &phone);
+
+  bool get(int32_t id, Person *person) const;
+  int64_t size() const;
+  // replaces the contents of `book` with every person, in no set order.
+  void copy_to(AddressBook *book) const;
+
+  // writes a snapshot of the book as it is now, and returns when it is
+  // durable and the log before it is gone.
+  bool checkpoint();
+
+  bool failed() const;
+  StoreStats stats() const;
+
+private:
+  // by id; see book_store.cpp's PersonMap.
+  typedef std::unordered_map<int32_t, std::shared_ptr<const Person>> Shard;
+  struct Segment;
+
+  bool recover();
+  bool replay(const std::vector<Segment> &segments);
+  // queues `record` for the next commit; the caller holds m_mutex and
+  // applies the mutation itself.
+  void log_locked(const std::string &record);
+  Shard *writable_shard_locked(int32_t id);
+  // drops references taken to read the shards outside the lock.
+  void release_shards(std::vector<std::shared_ptr<Shard>> *shards) const;
+  bool commit(std::unique_lock<std::mutex> *lock);
+  bool write_snapshot(uint64_t sequence,
+                      const std::vector<std::shared_ptr<Shard>> &shards);
+  void checkpoint_loop();
+
+  std::string m_dir;
+  StoreOptions m_options;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_synced;
+  std::vector<std::shared_ptr<Shard>> m_shards;
+  int64_t m_people;
+  // the log segment being written, and the one a checkpoint just closed
+  // off, whose last records the next commit still has to write.
+  int m_fd;
+  int m_sealed_fd;
+  std::string m_sealed;
+  std::string m_pending;
+  uint64_t m_sequence;
+  uint64_t m_durable;
+  size_t m_logged_bytes;
+  bool m_syncing;
+  bool m_failed;
+  StoreStats m_stats;
+
+  // one checkpoint at a time, and the background thread that starts them.
+  std::mutex m_checkpoint_mutex;
+  std::condition_variable m_checkpoint_wanted;
+  std::thread m_checkpointer;
+  bool m_stopping;
+};
+
+} // namespace tutorial
+
+#endif // BOOK_STORE_H_
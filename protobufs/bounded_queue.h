@@ -0,0 +1,65 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace tutorial {
+
+// a blocking FIFO of at most `capacity` items, for handing work between
+// pipeline stages: a full queue stalls its producers, which is how a slow
+// stage pushes back on the ones feeding it. closing wakes everyone; pushes
+// fail from then on and pops drain what is left.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity)
+      : m_capacity(capacity), m_closed(false) {}
+
+  // blocks while the queue is full; false once it is closed.
+  bool push(T value) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock,
+                    [this] { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed) {
+      return false;
+    }
+    m_items.push_back(std::move(value));
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  // blocks while the queue is empty; false once it is closed and drained.
+  bool pop(T *value) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty()) {
+      return false;
+    }
+    *value = std::move(m_items.front());
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_not_full;
+  std::condition_variable m_not_empty;
+  std::deque<T> m_items;
+  size_t m_capacity;
+  bool m_closed;
+};
+
+} // namespace tutorial
+
+#endif // BOUNDED_QUEUE_H_
@@ -0,0 +1,333 @@
+#include "columnar.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "file_io.h"
+#include "mapped_file.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const uint32_t kNameTag = (1 << 3) | wire::kLengthDelimited;
+const uint32_t kIdTag = (2 << 3) | wire::kVarint;
+const uint32_t kEmailTag = (3 << 3) | wire::kLengthDelimited;
+const uint32_t kPhoneTag = (4 << 3) | wire::kLengthDelimited;
+const uint32_t kNumberTag = (1 << 3) | wire::kLengthDelimited;
+const uint32_t kTypeTag = (2 << 3) | wire::kVarint;
+
+// file layout: magic, person and phone counts, then every column as a byte
+// length followed by its bytes, each padded to 8 bytes.
+const char kMagic[8] = {'X', 'P', 'C', 'O', 'L', 'S', '0', '1'};
+
+StringView string_value(const uint8_t *value, const uint8_t *value_end) {
+  const uint8_t *payload = wire::payload(value, value_end);
+  return StringView(reinterpret_cast<const char *>(payload),
+                    value_end - payload);
+}
+
+bool write_column(int fd, const void *data, size_t size) {
+  static const char kPadding[8] = {};
+  uint64_t length = size;
+  return write_all(fd, &length, sizeof(length)) &&
+         write_all(fd, data, size) &&
+         write_all(fd, kPadding, (8 - size % 8) % 8);
+}
+
+// bounds-checked cursor over a mapped column file.
+class ColumnReader {
+public:
+  ColumnReader(const uint8_t *data, size_t size)
+      : m_ptr(data), m_end(data + size) {}
+
+  bool read(void *out, size_t size) {
+    if (static_cast<size_t>(m_end - m_ptr) < size) {
+      return false;
+    }
+    memcpy(out, m_ptr, size);
+    m_ptr += size;
+    return true;
+  }
+
+  // a column must hold exactly `count` elements.
+  template <typename Column> bool column(size_t count, Column *out) {
+    uint64_t length;
+    return read(&length, sizeof(length)) &&
+           length == count * sizeof(typename Column::value_type) &&
+           copy(length, out);
+  }
+
+  // a blob is sized by its offsets column, so any length goes here.
+  bool blob(std::string *out) {
+    uint64_t length;
+    return read(&length, sizeof(length)) && copy(length, out);
+  }
+
+  bool done() const { return m_ptr == m_end; }
+
+private:
+  template <typename Column> bool copy(uint64_t length, Column *out) {
+    uint64_t padded = (length + 7) & ~uint64_t(7);
+    if (padded < length || padded > static_cast<uint64_t>(m_end - m_ptr)) {
+      return false;
+    }
+    out->resize(length / sizeof(typename Column::value_type));
+    if (length > 0) {
+      memcpy(&(*out)[0], m_ptr, length);
+    }
+    m_ptr += padded;
+    return true;
+  }
+
+  const uint8_t *m_ptr;
+  const uint8_t *m_end;
+};
+
+bool offsets_valid(const std::vector<uint64_t> &offsets, size_t count,
+                   size_t blob_size) {
+  if (offsets.size() != count + 1 || offsets[0] != 0 ||
+      offsets[count] != blob_size) {
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+void ColumnarBook::assign(const AddressBook &book) {
+  clear();
+  for (int i = 0; i < book.person_size(); ++i) {
+    append(book.person(i));
+  }
+}
+
+bool ColumnarBook::assign(const uint8_t *data, size_t size) {
+  clear();
+  bool ok = true;
+  bool framed = wire::for_each_field(
+      data, data + size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == wire::kPersonTag) {
+          const uint8_t *payload = wire::payload(value, value_end);
+          ok = add_serialized(payload, value_end);
+        }
+        return ok;
+      });
+  if (!framed || !ok) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+void ColumnarBook::append(const Person &person) {
+  for (int i = 0; i < person.phone_size(); ++i) {
+    const Person::PhoneNumber &phone = person.phone(i);
+    add_phone(phone.number(), phone.type());
+  }
+  StringView email(person.email());
+  add_person(person.id(), person.name(),
+             person.has_email() ? &email : nullptr);
+}
+
+void ColumnarBook::clear() {
+  m_ids.clear();
+  m_names.clear();
+  m_name_offsets.assign(1, 0);
+  m_emails.clear();
+  m_email_offsets.assign(1, 0);
+  m_has_email.clear();
+  m_phone_offsets.assign(1, 0);
+  m_numbers.clear();
+  m_number_offsets.assign(1, 0);
+  m_phone_types.clear();
+}
+
+void ColumnarBook::materialize(size_t person, Person *out) const {
+  out->Clear();
+  StringView str = name(person);
+  out->mutable_name()->assign(str.data(), str.size());
+  out->set_id(m_ids[person]);
+  if (has_email(person)) {
+    str = email(person);
+    out->mutable_email()->assign(str.data(), str.size());
+  }
+  for (size_t i = phone_begin(person); i < phone_end(person); ++i) {
+    Person::PhoneNumber *phone = out->add_phone();
+    str = phone_number(i);
+    phone->mutable_number()->assign(str.data(), str.size());
+    phone->set_type(phone_type(i));
+  }
+}
+
+bool ColumnarBook::save(const std::string &path) const {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  uint64_t counts[2] = {people(), phones()};
+  bool ok =
+      write_all(fd, kMagic, sizeof(kMagic)) &&
+      write_all(fd, counts, sizeof(counts)) &&
+      write_column(fd, m_ids.data(), m_ids.size() * sizeof(int32_t)) &&
+      write_column(fd, m_name_offsets.data(),
+                   m_name_offsets.size() * sizeof(uint64_t)) &&
+      write_column(fd, m_names.data(), m_names.size()) &&
+      write_column(fd, m_email_offsets.data(),
+                   m_email_offsets.size() * sizeof(uint64_t)) &&
+      write_column(fd, m_emails.data(), m_emails.size()) &&
+      write_column(fd, m_has_email.data(),
+                   m_has_email.size() * sizeof(uint64_t)) &&
+      write_column(fd, m_phone_offsets.data(),
+                   m_phone_offsets.size() * sizeof(uint64_t)) &&
+      write_column(fd, m_number_offsets.data(),
+                   m_number_offsets.size() * sizeof(uint64_t)) &&
+      write_column(fd, m_numbers.data(), m_numbers.size()) &&
+      write_column(fd, m_phone_types.data(), m_phone_types.size());
+  return ::close(fd) == 0 && ok;
+}
+
+bool ColumnarBook::load(const std::string &path) {
+  clear();
+
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  file.advise_sequential();
+
+  ColumnReader reader(file.data(), file.size());
+  char magic[sizeof(kMagic)];
+  uint64_t counts[2];
+  if (!reader.read(magic, sizeof(magic)) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !reader.read(counts, sizeof(counts)) || counts[0] > file.size() ||
+      counts[1] > file.size()) {
+    return false;
+  }
+  size_t people = counts[0];
+  size_t phones = counts[1];
+
+  bool ok = reader.column(people, &m_ids) &&
+            reader.column(people + 1, &m_name_offsets) &&
+            reader.blob(&m_names) &&
+            reader.column(people + 1, &m_email_offsets) &&
+            reader.blob(&m_emails) &&
+            reader.column((people + 63) / 64, &m_has_email) &&
+            reader.column(people + 1, &m_phone_offsets) &&
+            reader.column(phones + 1, &m_number_offsets) &&
+            reader.blob(&m_numbers) && reader.column(phones, &m_phone_types) &&
+            reader.done() &&
+            offsets_valid(m_name_offsets, people, m_names.size()) &&
+            offsets_valid(m_email_offsets, people, m_emails.size()) &&
+            offsets_valid(m_phone_offsets, people, phones) &&
+            offsets_valid(m_number_offsets, phones, m_numbers.size());
+  for (size_t i = 0; ok && i < phones; ++i) {
+    ok = Person_PhoneType_IsValid(m_phone_types[i]);
+  }
+  if (!ok) {
+    clear();
+  }
+  return ok;
+}
+
+void ColumnarBook::add_phone(StringView number, int type) {
+  m_numbers.append(number.data(), number.size());
+  m_number_offsets.push_back(m_numbers.size());
+  m_phone_types.push_back(static_cast<uint8_t>(type));
+}
+
+void ColumnarBook::add_person(int32_t id, StringView name,
+                              const StringView *email) {
+  size_t person = m_ids.size();
+  m_ids.push_back(id);
+  m_names.append(name.data(), name.size());
+  m_name_offsets.push_back(m_names.size());
+  if (person % 64 == 0) {
+    m_has_email.push_back(0);
+  }
+  if (email != nullptr) {
+    m_emails.append(email->data(), email->size());
+    m_has_email.back() |= uint64_t(1) << (person % 64);
+  }
+  m_email_offsets.push_back(m_emails.size());
+  m_phone_offsets.push_back(m_phone_types.size());
+}
+
+// one pass over the record with last-value-wins semantics, as in the
+// generated parser. phones go in as they are met; if the record then turns
+// out to be incomplete, the caller throws the whole book away anyway.
+bool ColumnarBook::add_serialized(const uint8_t *data, const uint8_t *end) {
+  StringView name;
+  StringView email;
+  uint64_t id = 0;
+  bool has_name = false;
+  bool has_id = false;
+  bool has_email = false;
+  bool ok = true;
+
+  bool framed = wire::for_each_field(
+      data, end,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == kNameTag) {
+          name = string_value(value, value_end);
+          has_name = true;
+        } else if (tag == kIdTag) {
+          has_id = wire::read_varint64(&value, value_end, &id);
+        } else if (tag == kEmailTag) {
+          email = string_value(value, value_end);
+          has_email = true;
+        } else if (tag == kPhoneTag) {
+          ok = add_serialized_phone(wire::payload(value, value_end),
+                                    value_end);
+        }
+        return ok;
+      });
+  if (!framed || !ok || !has_name || !has_id) {
+    return false;
+  }
+
+  add_person(static_cast<int32_t>(id), name, has_email ? &email : nullptr);
+  return true;
+}
+
+bool ColumnarBook::add_serialized_phone(const uint8_t *data,
+                                        const uint8_t *end) {
+  StringView number;
+  bool has_number = false;
+  int type = Person::Home;
+
+  bool framed = wire::for_each_field(
+      data, end,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        uint64_t v;
+        if (tag == kNumberTag) {
+          number = string_value(value, value_end);
+          has_number = true;
+        } else if (tag == kTypeTag &&
+                   wire::read_varint64(&value, value_end, &v) &&
+                   Person_PhoneType_IsValid(static_cast<int>(v))) {
+          // out-of-range types become unknown fields in the generated code.
+          type = static_cast<int>(v);
+        }
+        return true;
+      });
+  if (!framed || !has_number) {
+    return false;
+  }
+
+  add_phone(number, type);
+  return true;
+}
+
+} // namespace tutorial
@@ -0,0 +1,102 @@
+#ifndef COLUMNAR_H_
+#define COLUMNAR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "person.pb.h"
+#include "string_view.h"
+
+// struct-of-arrays copy of an AddressBook for analytic scans. each field is
+// its own contiguous column: ids and phone types are plain arrays, strings
+// are one blob per field with offsets into it, and phones are flattened
+// across people with per-person offsets. a scan over one field touches only
+// that field's bytes, in order, with no pointers to chase.
+//
+// the copy is read-only once built. phone types are stored as their
+// effective value, so an unset type reads back as Home, same as
+// PhoneNumber::type(); unknown fields are dropped.
+namespace tutorial {
+
+class ColumnarBook {
+public:
+  ColumnarBook() { clear(); }
+
+  // replace the contents with `book`.
+  void assign(const AddressBook &book);
+  // same for a serialized AddressBook, in one pass over the bytes and without
+  // building any message. false, leaving the columns empty, if the bytes are
+  // malformed or a required field is missing.
+  bool assign(const uint8_t *data, size_t size);
+  void append(const Person &person);
+  void clear();
+
+  size_t people() const { return m_ids.size(); }
+  size_t phones() const { return m_phone_types.size(); }
+
+  // raw columns, for loops the compiler can vectorize. ids() and the email
+  // bitmap have one entry per person, phone_types() (Person::PhoneType
+  // values) one per phone. person i owns phones
+  // [phone_offsets()[i], phone_offsets()[i + 1]).
+  const int32_t *ids() const { return m_ids.data(); }
+  const uint64_t *email_bitmap() const { return m_has_email.data(); }
+  const uint8_t *phone_types() const { return m_phone_types.data(); }
+  const uint64_t *phone_offsets() const { return m_phone_offsets.data(); }
+
+  int32_t id(size_t person) const { return m_ids[person]; }
+  StringView name(size_t person) const {
+    return slice(m_names, m_name_offsets, person);
+  }
+  bool has_email(size_t person) const {
+    return (m_has_email[person / 64] >> (person % 64)) & 1;
+  }
+  StringView email(size_t person) const {
+    return slice(m_emails, m_email_offsets, person);
+  }
+  size_t phone_begin(size_t person) const { return m_phone_offsets[person]; }
+  size_t phone_end(size_t person) const { return m_phone_offsets[person + 1]; }
+  StringView phone_number(size_t phone) const {
+    return slice(m_numbers, m_number_offsets, phone);
+  }
+  Person::PhoneType phone_type(size_t phone) const {
+    return static_cast<Person::PhoneType>(m_phone_types[phone]);
+  }
+
+  // rebuilds person `person` as a message, replacing the contents of `out`.
+  void materialize(size_t person, Person *out) const;
+
+  // the on-disk form is the columns themselves, 8-byte aligned, in host byte
+  // order. load() checks every offset, so a damaged file fails rather than
+  // producing views out of bounds.
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+
+private:
+  static StringView slice(const std::string &blob,
+                          const std::vector<uint64_t> &offsets, size_t i) {
+    return StringView(blob.data() + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+
+  // a person's phones are added first; add_person() then closes the record.
+  void add_phone(StringView number, int type);
+  void add_person(int32_t id, StringView name, const StringView *email);
+  bool add_serialized(const uint8_t *data, const uint8_t *end);
+  bool add_serialized_phone(const uint8_t *data, const uint8_t *end);
+
+  std::vector<int32_t> m_ids;
+  std::string m_names;
+  std::vector<uint64_t> m_name_offsets;
+  std::string m_emails;
+  std::vector<uint64_t> m_email_offsets;
+  std::vector<uint64_t> m_has_email;
+  std::vector<uint64_t> m_phone_offsets;
+  std::string m_numbers;
+  std::vector<uint64_t> m_number_offsets;
+  std::vector<uint8_t> m_phone_types;
+};
+
+} // namespace tutorial
+
+#endif // COLUMNAR_H_
@@ -0,0 +1,40 @@
+#include <cstring>
+#include <iostream>
+
+#include "book_diff.h"
+#include "stats.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  bool apply = argc == 5 && strcmp(argv[1], "--apply") == 0;
+  if (argc != 4 && !apply) {
+    cerr << "Usage: " << argv[0] << " OLD_BOOK NEW_BOOK DIFF_FILE\n"
+         << "       " << argv[0] << " --apply OLD_BOOK DIFF_FILE NEW_BOOK"
+         << endl;
+    return -1;
+  }
+
+  tutorial::Stopwatch watch;
+  if (apply) {
+    if (!tutorial::apply_diff(argv[2], argv[3], argv[4])) {
+      cerr << "Failed to apply " << argv[3] << " to " << argv[2] << endl;
+      return -1;
+    }
+    cout << "applied " << argv[3] << " in " << watch.seconds() * 1e3 << " ms"
+         << endl;
+    return 0;
+  }
+
+  tutorial::DiffStats stats;
+  if (!tutorial::write_diff(argv[1], argv[2], argv[3], &stats)) {
+    cerr << "Failed to diff " << argv[1] << " against " << argv[2]
+         << "; both must be sorted by id" << endl;
+    return -1;
+  }
+  cout << "diffed " << stats.old_people << " against " << stats.new_people
+       << " people in " << watch.seconds() * 1e3 << " ms: " << stats.inserted
+       << " inserted, " << stats.removed << " removed, " << stats.updated
+       << " updated, " << stats.unchanged << " unchanged" << endl;
+  return 0;
+}
@@ -0,0 +1,447 @@
+#include "external_sort.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "field_file.h"
+#include "file_io.h"
+#include "stats.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// Person.id = 2, varint.
+const uint32_t kIdTag = (2 << 3) | wire::kVarint;
+
+// floors for the options; below them runs and blocks get too small to pay
+// for their system calls.
+const size_t kMinMemory = 1 << 20;
+const size_t kMinIo = 64 << 10;
+// keys per sorting thread worth starting a thread for.
+const size_t kMinSlice = 1 << 14;
+
+// where a record sits in the run buffer, and its id.
+struct Key {
+  int32_t id;
+  uint32_t size;
+  uint64_t offset;
+};
+
+// by id, then by input position, which keeps the sort stable.
+bool key_less(const Key &a, const Key &b) {
+  return a.id < b.id || (a.id == b.id && a.offset < b.offset);
+}
+
+// a record's id, the last one if repeated; false if the person has none or
+// its fields are malformed.
+bool read_id(const uint8_t *data, size_t size, int32_t *id) {
+  bool found = false;
+  bool ok = wire::for_each_field(
+      data, data + size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == kIdTag) {
+          // for_each_field has already stepped over this varint.
+          uint64_t v = 0;
+          wire::read_varint64(&value, value_end, &v);
+          *id = static_cast<int32_t>(v);
+          found = true;
+        }
+        return true;
+      });
+  return ok && found;
+}
+
+// steps over the top-level field at *p, if it ends by `end`, and reads its
+// tag and where its value starts: the tag need not be a single byte, as
+// the parser accepts an overlong one.
+wire::ScanResult next_field(const uint8_t **p, const uint8_t *end,
+                            uint32_t *tag, const uint8_t **value) {
+  const uint8_t *q = *p;
+  wire::ScanResult result = wire::scan_field(p, end);
+  if (result == wire::kScanWhole) {
+    wire::read_varint32(&q, *p, tag);
+    *value = q;
+  }
+  return result;
+}
+
+// a tournament over k sorted sources. each internal node keeps the loser of
+// the match played there, so once the winner's source moves on, only the
+// log2(k) matches on its path to the root are replayed, one comparison each.
+// less(a, b) compares the current heads of sources a and b; it must be a
+// strict total order that puts exhausted sources last.
+template <typename Less> class LoserTree {
+public:
+  LoserTree(size_t sources, Less less)
+      : m_nodes(std::max<size_t>(sources, 1)), m_sources(sources),
+        m_less(less) {
+    m_nodes[0] = sources > 0 ? build(1) : 0;
+  }
+
+  size_t winner() const { return m_nodes[0]; }
+
+  // call after the winner's source has advanced.
+  void replay() {
+    size_t winner = m_nodes[0];
+    for (size_t node = (winner + m_sources) / 2; node > 0; node /= 2) {
+      if (m_less(m_nodes[node], winner)) {
+        std::swap(m_nodes[node], winner);
+      }
+    }
+    m_nodes[0] = winner;
+  }
+
+private:
+  // plays the subtree at `node` and returns its winner. nodes 1..k-1 are
+  // internal; node k + i is source i.
+  size_t build(size_t node) {
+    if (node >= m_sources) {
+      return node - m_sources;
+    }
+    size_t a = build(2 * node);
+    size_t b = build(2 * node + 1);
+    if (m_less(b, a)) {
+      std::swap(a, b);
+    }
+    m_nodes[node] = b;
+    return a;
+  }
+
+  std::vector<size_t> m_nodes;
+  size_t m_sources;
+  Less m_less;
+};
+
+// names the run files and removes whichever are left when it goes away, so
+// a failed sort leaves nothing behind.
+class RunFiles {
+public:
+  RunFiles(const std::string &output, const std::string &temp_dir)
+      : m_count(0) {
+    if (temp_dir.empty()) {
+      m_prefix = output;
+    } else {
+      size_t slash = output.rfind('/');
+      m_prefix = temp_dir + "/" +
+                 (slash == std::string::npos ? output
+                                             : output.substr(slash + 1));
+    }
+  }
+  ~RunFiles() {
+    for (const std::string &path : m_live) {
+      unlink(path.c_str());
+    }
+  }
+
+  RunFiles(const RunFiles &) = delete;
+  RunFiles &operator=(const RunFiles &) = delete;
+
+  std::string create() {
+    m_live.push_back(m_prefix + ".run" + std::to_string(m_count++));
+    return m_live.back();
+  }
+
+  void remove(const std::string &path) {
+    unlink(path.c_str());
+    m_live.erase(std::find(m_live.begin(), m_live.end(), path));
+  }
+
+private:
+  std::string m_prefix;
+  int m_count;
+  std::vector<std::string> m_live;
+};
+
+class Sorter {
+public:
+  Sorter(const std::string &output, const SortOptions &options)
+      : m_output(output), m_memory(std::max(options.memory_bytes, kMinMemory)),
+        m_io(std::max(kMinIo, std::min(options.io_bytes, m_memory / 4))),
+        m_threads(options.threads), m_files(output, options.temp_dir) {
+    if (m_threads <= 0) {
+      m_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+  }
+
+  bool form_runs(int fd);
+  bool merge_runs();
+  const SortStats &stats() const { return m_stats; }
+
+private:
+  bool write_run(const uint8_t *data, std::vector<Key> *keys,
+                 const std::string &path);
+  bool merge(const std::vector<std::string> &runs, const std::string &path);
+
+  std::string m_output;
+  size_t m_memory;
+  size_t m_io;
+  int m_threads;
+  RunFiles m_files;
+  // in input order, which the merge's tie-breaking relies on.
+  std::vector<std::string> m_runs;
+  SortStats m_stats;
+};
+
+// fills the buffer a block at a time, keying records as they arrive, until
+// the next block would take records plus keys over the budget. the records
+// cut off at the end of a run start the next one.
+bool Sorter::form_runs(int fd) {
+  size_t capacity = m_memory;
+  std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+  std::vector<Key> keys;
+  size_t filled = 0;
+  size_t cut = 0;
+  bool eof = false;
+
+  for (;;) {
+    Stopwatch watch;
+    while (!eof) {
+      if (!keys.empty() &&
+          filled + m_io + keys.size() * sizeof(Key) > m_memory) {
+        break;
+      }
+      // only a record larger than what is left of the budget gets here
+      // with the buffer full.
+      if (filled + m_io > capacity) {
+        std::unique_ptr<uint8_t[]> grown(new uint8_t[capacity * 2]);
+        memcpy(grown.get(), data.get(), filled);
+        data.swap(grown);
+        capacity *= 2;
+      }
+      ssize_t n = read_full(fd, data.get() + filled, m_io);
+      if (n < 0) {
+        return false;
+      }
+      filled += n;
+      m_stats.bytes += n;
+      eof = static_cast<size_t>(n) < m_io;
+
+      const uint8_t *end = data.get() + filled;
+      const uint8_t *p = data.get() + cut;
+      uint32_t tag = 0;
+      const uint8_t *value = nullptr;
+      for (const uint8_t *record = p;; record = p) {
+        // only a record cut off by the end of the buffer waits for more
+        // input; bad bytes fail the sort before they can grow the buffer.
+        wire::ScanResult result = next_field(&p, end, &tag, &value);
+        if (result == wire::kScanMalformed) {
+          return false;
+        }
+        if (result == wire::kScanCutOff) {
+          break;
+        }
+        if (tag != wire::kPersonTag) {
+          continue;
+        }
+        Key key;
+        const uint8_t *payload = wire::payload(value, p);
+        if (!read_id(payload, p - payload, &key.id)) {
+          return false;
+        }
+        key.size = static_cast<uint32_t>(p - record);
+        key.offset = record - data.get();
+        keys.push_back(key);
+      }
+      cut = p - data.get();
+    }
+    m_stats.read_seconds += watch.seconds();
+
+    // a record still incomplete at the end of the file never will be.
+    if (eof && cut != filled) {
+      return false;
+    }
+    if (eof && m_runs.empty()) {
+      m_stats.people += keys.size();
+      m_stats.runs = 1;
+      return write_run(data.get(), &keys, m_output);
+    }
+    if (!keys.empty()) {
+      m_stats.people += keys.size();
+      m_runs.push_back(m_files.create());
+      if (!write_run(data.get(), &keys, m_runs.back())) {
+        return false;
+      }
+      keys.clear();
+    }
+    if (eof) {
+      m_stats.runs = static_cast<int>(m_runs.size());
+      return true;
+    }
+    memmove(data.get(), data.get() + cut, filled - cut);
+    filled -= cut;
+    cut = 0;
+  }
+}
+
+// sorts the keys in one slice per thread, then merges the slices while
+// copying their records out.
+bool Sorter::write_run(const uint8_t *data, std::vector<Key> *keys,
+                       const std::string &path) {
+  Stopwatch watch;
+  size_t count = keys->size();
+  size_t slices = std::max<size_t>(
+      1, std::min<size_t>(m_threads, count / kMinSlice));
+  std::vector<size_t> heads(slices);
+  std::vector<size_t> ends(slices);
+  for (size_t i = 0; i < slices; ++i) {
+    heads[i] = count * i / slices;
+    ends[i] = count * (i + 1) / slices;
+  }
+  Key *base = keys->data();
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < slices; ++i) {
+    workers.emplace_back([=, &heads, &ends] {
+      std::sort(base + heads[i], base + ends[i], key_less);
+    });
+  }
+  std::sort(base + heads[0], base + ends[0], key_less);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  m_stats.sort_seconds += watch.seconds();
+
+  watch.reset();
+  FieldFileWriter writer(m_io);
+  if (!writer.open(path)) {
+    return false;
+  }
+  auto less = [&](size_t a, size_t b) {
+    bool a_done = heads[a] == ends[a];
+    bool b_done = heads[b] == ends[b];
+    if (a_done || b_done) {
+      return a_done == b_done ? a < b : b_done;
+    }
+    return key_less(base[heads[a]], base[heads[b]]);
+  };
+  LoserTree<decltype(less)> tree(slices, less);
+  for (size_t i = 0; i < count; ++i) {
+    size_t slice = tree.winner();
+    const Key &key = base[heads[slice]++];
+    writer.append(data + key.offset, key.size);
+    tree.replay();
+  }
+  bool ok = writer.close();
+  m_stats.write_seconds += watch.seconds();
+  return ok;
+}
+
+// each pass merges consecutive groups of as many runs as the budget has
+// buffers for, until one pass can write the output.
+bool Sorter::merge_runs() {
+  Stopwatch watch;
+  size_t fan_in = std::max<size_t>(2, m_memory / m_io - 1);
+  while (!m_runs.empty()) {
+    ++m_stats.merge_passes;
+    bool last = m_runs.size() <= fan_in;
+    std::vector<std::string> merged;
+    for (size_t first = 0; first < m_runs.size(); first += fan_in) {
+      std::vector<std::string> group(
+          m_runs.begin() + first,
+          m_runs.begin() + std::min(first + fan_in, m_runs.size()));
+      std::string path = last ? m_output : m_files.create();
+      if (!merge(group, path)) {
+        return false;
+      }
+      for (const std::string &run : group) {
+        m_files.remove(run);
+      }
+      if (!last) {
+        merged.push_back(path);
+      }
+    }
+    m_runs.swap(merged);
+  }
+  m_stats.merge_seconds = watch.seconds();
+  return true;
+}
+
+// a run being merged: its reader, positioned on the run's current record,
+// and that record's id.
+struct RunHead {
+  explicit RunHead(size_t block_bytes)
+      : reader(block_bytes), id(0), done(false) {}
+
+  // moves to the next record; false on error. sets `done` at the end of the
+  // run.
+  bool next() {
+    if (!reader.next()) {
+      done = true;
+      return !reader.failed();
+    }
+    // runs hold nothing but Person records, which all have an id.
+    return reader.tag() == wire::kPersonTag &&
+           read_id(reader.payload(), reader.payload_size(), &id);
+  }
+
+  FieldFileReader reader;
+  int32_t id;
+  bool done;
+};
+
+// ties go to the earlier run, which holds the earlier input.
+bool Sorter::merge(const std::vector<std::string> &runs,
+                   const std::string &path) {
+  std::vector<std::unique_ptr<RunHead>> heads;
+  for (const std::string &run : runs) {
+    heads.emplace_back(new RunHead(m_io));
+    if (!heads.back()->reader.open(run) || !heads.back()->next()) {
+      return false;
+    }
+  }
+  FieldFileWriter writer(m_io);
+  if (!writer.open(path)) {
+    return false;
+  }
+
+  auto less = [&](size_t a, size_t b) {
+    const RunHead &x = *heads[a];
+    const RunHead &y = *heads[b];
+    if (x.done || y.done) {
+      return x.done == y.done ? a < b : y.done;
+    }
+    return x.id < y.id || (x.id == y.id && a < b);
+  };
+  LoserTree<decltype(less)> tree(heads.size(), less);
+  for (size_t run = tree.winner(); !heads[run]->done; run = tree.winner()) {
+    RunHead *head = heads[run].get();
+    writer.append(head->reader.field(), head->reader.field_size());
+    if (!head->next()) {
+      return false;
+    }
+    tree.replay();
+  }
+  return writer.close();
+}
+
+} // namespace
+
+SortOptions::SortOptions()
+    : memory_bytes(256 << 20), io_bytes(4 << 20), threads(0) {}
+
+bool sort_address_book(const std::string &input, const std::string &output,
+                       const SortOptions &options, SortStats *stats) {
+  Stopwatch watch;
+  int fd = ::open(input.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  Sorter sorter(output, options);
+  bool ok = sorter.form_runs(fd);
+  ::close(fd);
+  ok = ok && sorter.merge_runs();
+  if (stats) {
+    *stats = sorter.stats();
+    stats->seconds = watch.seconds();
+  }
+  return ok;
+}
+
+} // namespace tutorial
@@ -0,0 +1,66 @@
+#ifndef EXTERNAL_SORT_H_
+#define EXTERNAL_SORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// sorts the Person records of a serialized AddressBook by id, for books that
+// do not fit in memory. records are never parsed: the sort cuts the book
+// into records, reads each one's id off the wire and moves the bytes.
+//
+//   runs    the input is read in pieces that fit the memory budget; each
+//           piece's keys are sorted in slices on `threads` threads, and the
+//           slices are merged straight into a run file;
+//   merge   the runs are k-way merged with a loser tree, reading every run
+//           and writing the output in io_bytes blocks. more runs than the
+//           budget has room for buffers take several passes.
+//
+// a book that fits in one run skips the merge and is written out directly.
+// the sort is stable, so people sharing an id keep their input order, and
+// its output is again a serialized AddressBook; top-level fields other than
+// `person` are dropped.
+namespace tutorial {
+
+struct SortOptions {
+  SortOptions();
+
+  // bytes of input plus sort keys held at once while forming runs, and the
+  // total of the read and write buffers while merging.
+  size_t memory_bytes;
+  // size of every read and write while merging.
+  size_t io_bytes;
+  // threads <= 0 uses every hardware thread.
+  int threads;
+  // where run files go; empty puts them next to the output, as
+  // OUTPUT.runN. they are removed once merged, or on failure.
+  std::string temp_dir;
+};
+
+// seconds per phase; read, sort and write are the run phase's.
+struct SortStats {
+  SortStats()
+      : bytes(0), people(0), runs(0), merge_passes(0), read_seconds(0),
+        sort_seconds(0), write_seconds(0), merge_seconds(0), seconds(0) {}
+
+  int64_t bytes;
+  int64_t people;
+  int runs;
+  int merge_passes;
+  double read_seconds;
+  double sort_seconds;
+  double write_seconds;
+  double merge_seconds;
+  double seconds;
+};
+
+// writes the people of the book at `input` to `output` sorted by id. false
+// if either file cannot be opened, the input is malformed or truncated, a
+// Person has no id, or a write fails. `stats` may be null.
+bool sort_address_book(const std::string &input, const std::string &output,
+                       const SortOptions &options,
+                       SortStats *stats = nullptr);
+
+} // namespace tutorial
+
+#endif // EXTERNAL_SORT_H_
@@ -0,0 +1,158 @@
+#include "fast_decoder.h"
+
+#include <climits>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "varint.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const uint64_t kNameTag = (1 << 3) | wire::kLengthDelimited;
+const uint64_t kIdTag = (2 << 3) | wire::kVarint;
+const uint64_t kEmailTag = (3 << 3) | wire::kLengthDelimited;
+const uint64_t kPhoneTag = (4 << 3) | wire::kLengthDelimited;
+const uint64_t kNumberTag = (1 << 3) | wire::kLengthDelimited;
+const uint64_t kTypeTag = (2 << 3) | wire::kVarint;
+
+bool decode_phone(const uint8_t *p, const uint8_t *end,
+                  const uint8_t *readable_end, Person_PhoneNumber *phone) {
+  uint64_t v[2];
+  if (wire::next_varints(&p, end, readable_end, v, 2) != 2 ||
+      v[0] != kNumberTag || v[1] > static_cast<uint64_t>(end - p)) {
+    return false;
+  }
+  phone->mutable_number()->assign(reinterpret_cast<const char *>(p), v[1]);
+  p += v[1];
+  if (p == end) {
+    return true;
+  }
+
+  // enums go through ReadVarint32 in the generated code, which truncates.
+  if (wire::next_varints(&p, end, readable_end, v, 2) != 2 ||
+      v[0] != kTypeTag || p != end) {
+    return false;
+  }
+  int type = static_cast<int32_t>(static_cast<uint32_t>(v[1]));
+  if (!Person_PhoneType_IsValid(type)) {
+    return false;
+  }
+  phone->set_type(static_cast<Person_PhoneType>(type));
+  return true;
+}
+
+// the fast path proper; false means "not in canonical shape", after which
+// `person` holds partial results and must be cleared.
+bool decode_canonical(const uint8_t *p, const uint8_t *end,
+                      const uint8_t *readable_end, Person *person) {
+  uint64_t v[4];
+  if (wire::next_varints(&p, end, readable_end, v, 2) != 2 ||
+      v[0] != kNameTag || v[1] > static_cast<uint64_t>(end - p)) {
+    return false;
+  }
+  person->mutable_name()->assign(reinterpret_cast<const char *>(p), v[1]);
+  p += v[1];
+
+  // id tag, id, and the tag and length of whatever follows, in one step.
+  int decoded = wire::next_varints(&p, end, readable_end, v, 4);
+  if (decoded < 2 || v[0] != kIdTag) {
+    return false;
+  }
+  person->set_id(static_cast<int32_t>(v[1]));
+  if (decoded == 2) {
+    return p == end;
+  }
+  if (decoded != 4) {
+    return false;
+  }
+
+  uint64_t tag = v[2];
+  uint64_t length = v[3];
+  if (tag == kEmailTag) {
+    if (length > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    person->mutable_email()->assign(reinterpret_cast<const char *>(p),
+                                    length);
+    p += length;
+    if (p == end) {
+      return true;
+    }
+    if (wire::next_varints(&p, end, readable_end, v, 2) != 2) {
+      return false;
+    }
+    tag = v[0];
+    length = v[1];
+  }
+
+  for (;;) {
+    if (tag != kPhoneTag || length > static_cast<uint64_t>(end - p) ||
+        !decode_phone(p, p + length, readable_end, person->add_phone())) {
+      return false;
+    }
+    p += length;
+    if (p == end) {
+      return true;
+    }
+    if (wire::next_varints(&p, end, readable_end, v, 2) != 2) {
+      return false;
+    }
+    tag = v[0];
+    length = v[1];
+  }
+}
+
+} // namespace
+
+bool decode_person(const uint8_t *data, size_t size, Person *person,
+                   const uint8_t *readable_end) {
+  const uint8_t *end = data + size;
+  if (readable_end == nullptr || readable_end < end) {
+    readable_end = end;
+  }
+
+  person->Clear();
+  if (decode_canonical(data, end, readable_end, person)) {
+    return true;
+  }
+  return size <= INT_MAX &&
+         person->ParsePartialFromArray(data, static_cast<int>(size));
+}
+
+bool decode_address_book(const uint8_t *data, size_t size, AddressBook *book) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  while (p < end) {
+    const uint8_t *field = p;
+    uint32_t tag;
+    if (!wire::read_varint32(&p, end, &tag) || tag == 0) {
+      return false;
+    }
+    const uint8_t *value = p;
+    if (!wire::skip_field(tag, &p, end)) {
+      return false;
+    }
+
+    if (tag == wire::kPersonTag) {
+      const uint8_t *payload = wire::payload(value, p);
+      Person *person = book->add_person();
+      if (!decode_person(payload, p - payload, person, end) ||
+          !person->IsInitialized()) {
+        return false;
+      }
+    } else {
+      // anything else is an unknown field of the book; let protobuf keep it.
+      google::protobuf::io::CodedInputStream input(
+          field, static_cast<int>(p - field));
+      if (!book->MergePartialFromCodedStream(&input)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace tutorial
@@ -0,0 +1,31 @@
+#ifndef FAST_DECODER_H_
+#define FAST_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "person.pb.h"
+
+// a Person decoder specialized for the field order protoc emits (name, id,
+// email, phone*; number then type inside a phone). tags are compared as
+// decoded values rather than switched on, and the id, the tag after it and
+// that field's length come out of one block varint decode (varint.h).
+// records in any other shape (reordered or repeated fields, unknown fields,
+// out-of-range phone types) are handed to the generated parser, so results
+// always match Person::ParsePartialFromArray.
+namespace tutorial {
+
+// parses [data, data + size) into `person`, replacing its contents.
+// `readable_end`, if given, lets the decoder load past the record up to that
+// point; pass the end of the enclosing buffer when decoding in place.
+bool decode_person(const uint8_t *data, size_t size, Person *person,
+                   const uint8_t *readable_end = nullptr);
+
+// merges a serialized AddressBook into `book`, like
+// book->MergePartialFromCodedStream; false if the book is malformed or a
+// Person is missing required fields.
+bool decode_address_book(const uint8_t *data, size_t size, AddressBook *book);
+
+} // namespace tutorial
+
+#endif // FAST_DECODER_H_
@@ -0,0 +1,135 @@
+#include "field_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "file_io.h"
+#include "wire.h"
+
+namespace tutorial {
+
+FieldFileReader::FieldFileReader(size_t block_bytes)
+    : m_data(new uint8_t[block_bytes]), m_capacity(block_bytes), m_begin(0),
+      m_end(0), m_tag(0), m_field(nullptr), m_field_size(0),
+      m_payload(nullptr), m_fd(-1), m_eof(false), m_failed(false) {}
+
+FieldFileReader::~FieldFileReader() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+bool FieldFileReader::open(const std::string &path) {
+  m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  return m_fd >= 0;
+}
+
+bool FieldFileReader::next() {
+  for (;;) {
+    const uint8_t *field = m_data.get() + m_begin;
+    const uint8_t *end = m_data.get() + m_end;
+    const uint8_t *p = field;
+    wire::ScanResult result = wire::scan_field(&p, end);
+    if (result == wire::kScanWhole) {
+      const uint8_t *value = field;
+      wire::read_varint32(&value, p, &m_tag);
+      m_field = field;
+      m_field_size = p - field;
+      m_payload = wire::tag_type(m_tag) == wire::kLengthDelimited
+                      ? wire::payload(value, p)
+                      : p;
+      m_begin = p - m_data.get();
+      return true;
+    }
+    // only a field cut off by the end of the buffer waits for more input;
+    // bad bytes fail the read before they can grow the buffer.
+    if (result == wire::kScanMalformed) {
+      m_failed = true;
+      return false;
+    }
+    // a field still incomplete at the end of the file never will be.
+    if (m_eof) {
+      m_failed = m_begin != m_end;
+      return false;
+    }
+    if (!refill()) {
+      m_failed = true;
+      return false;
+    }
+  }
+}
+
+// keeps the incomplete field at the front and reads behind it, growing the
+// buffer when that field fills all of it.
+bool FieldFileReader::refill() {
+  size_t carried = m_end - m_begin;
+  if (carried == m_capacity) {
+    std::unique_ptr<uint8_t[]> grown(new uint8_t[m_capacity * 2]);
+    memcpy(grown.get(), m_data.get() + m_begin, carried);
+    m_data.swap(grown);
+    m_capacity *= 2;
+  } else {
+    memmove(m_data.get(), m_data.get() + m_begin, carried);
+  }
+  m_begin = 0;
+  m_end = carried;
+  ssize_t n = read_full(m_fd, m_data.get() + m_end, m_capacity - m_end);
+  if (n < 0) {
+    return false;
+  }
+  m_end += n;
+  m_eof = static_cast<size_t>(n) < m_capacity - carried;
+  return true;
+}
+
+FieldFileWriter::FieldFileWriter(size_t block_bytes)
+    : m_data(new uint8_t[block_bytes]), m_capacity(block_bytes), m_size(0),
+      m_fd(-1), m_ok(false) {}
+
+FieldFileWriter::~FieldFileWriter() { close(); }
+
+bool FieldFileWriter::open(const std::string &path) {
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  m_ok = m_fd >= 0;
+  return m_ok;
+}
+
+void FieldFileWriter::append(const uint8_t *data, size_t size) {
+  if (m_size + size > m_capacity) {
+    flush();
+    if (size > m_capacity) {
+      m_ok = m_ok && write_all(m_fd, data, size);
+      return;
+    }
+  }
+  memcpy(m_data.get() + m_size, data, size);
+  m_size += size;
+}
+
+void FieldFileWriter::append_field(uint32_t tag, const uint8_t *payload,
+                                   size_t size) {
+  uint8_t prefix[15];
+  uint8_t *end = wire::write_varint64(tag, prefix);
+  end = wire::write_varint64(size, end);
+  append(prefix, end - prefix);
+  append(payload, size);
+}
+
+bool FieldFileWriter::close() {
+  if (m_fd < 0) {
+    return m_ok;
+  }
+  flush();
+  m_ok = ::close(m_fd) == 0 && m_ok;
+  m_fd = -1;
+  return m_ok;
+}
+
+void FieldFileWriter::flush() {
+  m_ok = m_ok && write_all(m_fd, m_data.get(), m_size);
+  m_size = 0;
+}
+
+} // namespace tutorial
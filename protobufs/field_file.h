@@ -0,0 +1,87 @@
+#ifndef FIELD_FILE_H_
+#define FIELD_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// sequential access to files of back-to-back top-level protobuf fields, such
+// as a serialized AddressBook, through one fixed-size block buffer. the
+// reader hands out each field's bytes in place without decoding them, and
+// only ever holds a block (or one field larger than a block), so a book of
+// any size is streamed in constant memory.
+namespace tutorial {
+
+class FieldFileReader {
+public:
+  explicit FieldFileReader(size_t block_bytes = 1 << 20);
+  ~FieldFileReader();
+
+  FieldFileReader(const FieldFileReader &) = delete;
+  FieldFileReader &operator=(const FieldFileReader &) = delete;
+
+  bool open(const std::string &path);
+
+  // moves to the next field; false at the end of the file or on error, see
+  // failed(). the previous field's bytes are gone after the call.
+  bool next();
+  bool failed() const { return m_failed; }
+
+  uint32_t tag() const { return m_tag; }
+  // the whole field, tag included.
+  const uint8_t *field() const { return m_field; }
+  size_t field_size() const { return m_field_size; }
+  // the value of a length-delimited field, past its length prefix.
+  const uint8_t *payload() const { return m_payload; }
+  size_t payload_size() const { return m_field + m_field_size - m_payload; }
+
+private:
+  bool refill();
+
+  std::unique_ptr<uint8_t[]> m_data;
+  size_t m_capacity;
+  size_t m_begin;
+  size_t m_end;
+  uint32_t m_tag;
+  const uint8_t *m_field;
+  size_t m_field_size;
+  const uint8_t *m_payload;
+  int m_fd;
+  bool m_eof;
+  bool m_failed;
+};
+
+// collects bytes into blocks and writes them out a block at a time.
+class FieldFileWriter {
+public:
+  explicit FieldFileWriter(size_t block_bytes = 1 << 20);
+  ~FieldFileWriter();
+
+  FieldFileWriter(const FieldFileWriter &) = delete;
+  FieldFileWriter &operator=(const FieldFileWriter &) = delete;
+
+  // creates or truncates `path`.
+  bool open(const std::string &path);
+
+  // raw bytes, e.g. a whole field from a FieldFileReader.
+  void append(const uint8_t *data, size_t size);
+  // a length-delimited field: the tag, the length, then `payload`.
+  void append_field(uint32_t tag, const uint8_t *payload, size_t size);
+
+  // returns false if any write failed.
+  bool close();
+
+private:
+  void flush();
+
+  std::unique_ptr<uint8_t[]> m_data;
+  size_t m_capacity;
+  size_t m_size;
+  int m_fd;
+  bool m_ok;
+};
+
+} // namespace tutorial
+
+#endif // FIELD_FILE_H_
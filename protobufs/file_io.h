@@ -0,0 +1,65 @@
+#ifndef FILE_IO_H_
+#define FILE_IO_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+
+namespace tutorial {
+
+// write(2) until everything is out, retrying short writes and EINTR.
+inline bool write_all(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, p, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
+// read(2) until `size` bytes or end of file; -1 on error.
+inline ssize_t read_full(int fd, void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::read(fd, p + done, size - done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return static_cast<ssize_t>(done);
+}
+
+// makes a file created or renamed in `path`'s directory durable.
+inline bool sync_directory(const std::string &path) {
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+  int fd = ::open(dir.empty() ? "/" : dir.c_str(),
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = fsync(fd) == 0;
+  return ::close(fd) == 0 && ok;
+}
+
+} // namespace tutorial
+
+#endif // FILE_IO_H_
@@ -0,0 +1,102 @@
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "generator.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace {
+
+// "MIN:MAX", or a single value for both.
+bool parse_range(const char *text, tutorial::GeneratorRange *range) {
+  char end;
+  if (sscanf(text, "%d:%d%c", &range->min, &range->max, &end) == 2) {
+    return true;
+  }
+  if (sscanf(text, "%d%c", &range->min, &end) == 1) {
+    range->max = range->min;
+    return true;
+  }
+  return false;
+}
+
+bool parse_weights(const char *text, int *weights) {
+  char end;
+  return sscanf(text, "%d:%d:%d%c", &weights[0], &weights[1], &weights[2],
+                &end) == 3;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  tutorial::GeneratorOptions options;
+  tutorial::GeneratorFormat format = tutorial::kGenerateBook;
+  int threads = -1;
+  bool ok = true;
+  int arg = 1;
+  for (; arg < argc - 1 && ok; ++arg) {
+    const char *value = argv[arg + 1];
+    if (strcmp(argv[arg], "--stream") == 0) {
+      format = tutorial::kGenerateStream;
+      continue;
+    }
+    if (arg + 1 >= argc - 1) {
+      ok = false;
+    } else if (strcmp(argv[arg], "--people") == 0) {
+      options.people = atoll(value);
+    } else if (strcmp(argv[arg], "--seed") == 0) {
+      options.seed = strtoull(value, nullptr, 10);
+    } else if (strcmp(argv[arg], "--threads") == 0) {
+      threads = atoi(value);
+    } else if (strcmp(argv[arg], "--name-length") == 0) {
+      ok = parse_range(value, &options.name_length);
+    } else if (strcmp(argv[arg], "--emails") == 0) {
+      options.email_percent = atoi(value);
+    } else if (strcmp(argv[arg], "--email-length") == 0) {
+      ok = parse_range(value, &options.email_length);
+    } else if (strcmp(argv[arg], "--phones") == 0) {
+      ok = parse_range(value, &options.phones);
+    } else if (strcmp(argv[arg], "--types") == 0) {
+      ok = parse_weights(value, options.type_weights);
+    } else if (strcmp(argv[arg], "--unknown") == 0) {
+      options.unknown_percent = atoi(value);
+    } else if (strcmp(argv[arg], "--unknown-length") == 0) {
+      ok = parse_range(value, &options.unknown_length);
+    } else {
+      ok = false;
+    }
+    ++arg;
+  }
+
+  tutorial::BookGenerator generator(options);
+  if (!ok || arg != argc - 1 || !generator.valid()) {
+    cerr << "Usage: " << argv[0]
+         << " [--people N] [--seed S] [--threads N] [--stream]"
+         << " [--name-length MIN:MAX] [--emails PERCENT]"
+         << " [--email-length MIN:MAX] [--phones MIN:MAX]"
+         << " [--types MOBILE:HOME:WORK] [--unknown PERCENT]"
+         << " [--unknown-length MIN:MAX] OUTPUT_FILE" << endl;
+    return -1;
+  }
+  const char *path = argv[arg];
+
+  tutorial::Stopwatch watch;
+  if (!generator.write(path, format, threads)) {
+    cerr << "Failed to write: " << path << endl;
+    return -1;
+  }
+  double seconds = watch.seconds();
+
+  struct stat st;
+  int64_t bytes = stat(path, &st) == 0 ? st.st_size : 0;
+  cout << "generated " << options.people << " people (" << bytes
+       << " bytes) in " << seconds * 1e3 << " ms, " << bytes / 1e6 / seconds
+       << " MB/s" << endl;
+  return 0;
+}
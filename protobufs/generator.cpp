@@ -0,0 +1,331 @@
+#include "generator.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "file_io.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// people per chunk handed to a generator thread; a few MB of output.
+const int64_t kChunkPeople = 1 << 16;
+
+// text is cut from this many random characters, small enough to stay in L2.
+const size_t kTextPool = 1 << 16;
+// longest string field, and most phones per person, the options may ask for.
+const int kMaxLength = 4096;
+const int kMaxPhones = 256;
+
+// padded so write_bytes() may read a whole block from any of them.
+const char kDomains[][32] = {
+    "gmail.com",   "yahoo.com",   "hotmail.com", "outlook.com",
+    "icloud.com",  "aol.com",     "proton.me",   "gmx.de",
+    "web.de",      "yandex.ru",   "qq.com",      "163.com",
+    "orange.fr",   "live.com",    "example.com", "mail.example.org",
+};
+const int kDomainCount = sizeof(kDomains) / sizeof(kDomains[0]);
+const int kMaxDomain = 16;
+
+// numbers are "AAA-DDD-DDDD", the area code from this set.
+const char kAreaCodes[][32] = {
+    "212-", "213-", "312-", "415-", "503-", "512-", "617-", "646-",
+    "650-", "702-", "713-", "718-", "805-", "818-", "917-", "949-",
+};
+const int kAreaCodeCount = sizeof(kAreaCodes) / sizeof(kAreaCodes[0]);
+const int kNumberLength = 12;
+
+uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+bool valid_range(GeneratorRange range, int max) {
+  return range.min >= 0 && range.min <= range.max && range.max <= max;
+}
+
+bool valid_percent(int percent) { return percent >= 0 && percent <= 100; }
+
+uint8_t *write_tag(int field, wire::WireType type, uint8_t *target) {
+  *target++ = static_cast<uint8_t>(wire::make_tag(field, type));
+  return target;
+}
+
+// short strings are copied as one fixed-size block, which compiles to a
+// couple of vector moves instead of a call; the overrun lands in space the
+// caller has reserved and is overwritten by what follows.
+const size_t kCopyBlock = 32;
+
+uint8_t *write_bytes(const char *data, size_t size, uint8_t *target) {
+  if (size <= kCopyBlock) {
+    memcpy(target, data, kCopyBlock);
+  } else {
+    memcpy(target, data, size);
+  }
+  return target + size;
+}
+
+size_t string_field_size(size_t size) {
+  return 1 + wire::varint_size(size) + size;
+}
+
+} // namespace
+
+// wyrand: one multiply per draw, which matters at a dozen draws a person.
+class BookGenerator::Random {
+public:
+  Random(uint64_t seed, int64_t index)
+      : m_state(mix64(seed ^ mix64(static_cast<uint64_t>(index)))) {}
+
+  uint64_t next() {
+    m_state += 0xa0761d6478bd642full;
+    __uint128_t product =
+        static_cast<__uint128_t>(m_state) * (m_state ^ 0xe7037ed1a0b428dbull);
+    return static_cast<uint64_t>(product >> 64) ^
+           static_cast<uint64_t>(product);
+  }
+
+  // uniform in [0, n), for n < 2^32.
+  uint32_t below(uint32_t n) {
+    return static_cast<uint32_t>(((next() >> 32) * n) >> 32);
+  }
+
+  // ranges are validated to be non-negative.
+  uint32_t in(GeneratorRange range) {
+    return range.min + below(range.max - range.min + 1);
+  }
+
+  bool percent(int percent) { return below(100) < static_cast<uint32_t>(percent); }
+
+  size_t offset() { return below(kTextPool); }
+
+private:
+  uint64_t m_state;
+};
+
+GeneratorOptions::GeneratorOptions()
+    : seed(1), people(1000000), name_length{8, 24}, email_percent(80),
+      email_length{4, 16}, phones{0, 3}, type_weights{50, 30, 20},
+      unknown_percent(0), unknown_length{8, 32} {}
+
+BookGenerator::BookGenerator(const GeneratorOptions &options)
+    : m_options(options) {
+  m_valid = options.people >= 0 &&
+            valid_range(options.name_length, kMaxLength) &&
+            valid_percent(options.email_percent) &&
+            valid_range(options.email_length, kMaxLength) &&
+            valid_range(options.phones, kMaxPhones) &&
+            valid_percent(options.unknown_percent) &&
+            valid_range(options.unknown_length, kMaxLength);
+  int total_weight = 0;
+  for (int weight : options.type_weights) {
+    m_valid = m_valid && weight >= 0;
+    total_weight += weight;
+  }
+  m_valid = m_valid && total_weight > 0;
+
+  // the pools are padded so a slice starting anywhere in the first kTextPool
+  // characters never runs off the end.
+  Random random(options.seed, -1);
+  m_letters.resize(kTextPool + kMaxLength);
+  for (char &c : m_letters) {
+    c = static_cast<char>('a' + random.below(26));
+  }
+  m_digits.resize(kTextPool + kMaxLength);
+  for (char &c : m_digits) {
+    c = static_cast<char>('0' + random.below(10));
+  }
+}
+
+size_t BookGenerator::max_record_size() const {
+  const GeneratorOptions &o = m_options;
+  size_t person = string_field_size(o.name_length.max) + 1 + 10 +
+                  string_field_size(o.email_length.max + 1 + kMaxDomain) +
+                  o.phones.max * string_field_size(kNumberLength + 1 + 2 + 2) +
+                  string_field_size(o.unknown_length.max);
+  return 1 + wire::varint_size(person) + person;
+}
+
+void BookGenerator::generate(int64_t first, int64_t count,
+                             GeneratorFormat format, std::string *out) const {
+  out->resize(fill(first, count, format, out, out->size()));
+}
+
+// std::string zero-fills whatever it grows by, which would cost as much as
+// generating the bytes if done per call; buffers grow geometrically and are
+// only cut to size by the caller.
+size_t BookGenerator::fill(int64_t first, int64_t count,
+                           GeneratorFormat format, std::string *buffer,
+                           size_t used) const {
+  if (!m_valid) {
+    return used;
+  }
+  size_t bound = max_record_size();
+  for (int64_t i = first; i < first + count; ++i) {
+    if (buffer->size() - used < bound + kCopyBlock) {
+      buffer->resize(std::max(2 * buffer->size(), used + 256 * bound));
+    }
+    uint8_t *data = reinterpret_cast<uint8_t *>(&(*buffer)[0]);
+    used = generate_person(i, format, data + used) - data;
+  }
+  return used;
+}
+
+// every length is drawn first, so the record's size is known before any of
+// it is written; the contents are drawn as they are written.
+uint8_t *BookGenerator::generate_person(int64_t index, GeneratorFormat format,
+                                        uint8_t *target) const {
+  const GeneratorOptions &o = m_options;
+  Random random(o.seed, index);
+
+  uint32_t name_length = random.in(o.name_length);
+  uint32_t local_length = 0;
+  const char *domain = nullptr;
+  size_t domain_length = 0;
+  if (random.percent(o.email_percent)) {
+    local_length = random.in(o.email_length);
+    domain = kDomains[random.below(kDomainCount)];
+    domain_length = strlen(domain);
+  }
+  uint32_t phones = random.in(o.phones);
+  bool unknown = random.percent(o.unknown_percent);
+  uint32_t unknown_length = unknown ? random.in(o.unknown_length) : 0;
+
+  int32_t id = static_cast<int32_t>(index);
+  // negative int32 values are sign-extended to ten bytes on the wire.
+  uint64_t id_value = static_cast<uint64_t>(static_cast<int64_t>(id));
+  size_t email_length = domain ? local_length + 1 + domain_length : 0;
+  size_t phone_size = 2 + kNumberLength + 2;
+  size_t size = string_field_size(name_length) + 1 +
+                wire::varint_size(id_value) +
+                (domain ? string_field_size(email_length) : 0) +
+                phones * string_field_size(phone_size) +
+                (unknown ? string_field_size(unknown_length) : 0);
+
+  if (format == kGenerateBook) {
+    *target++ = static_cast<uint8_t>(wire::kPersonTag);
+  }
+  target = wire::write_varint64(size, target);
+
+  // two words, unless the name is too short for a space to fit.
+  target = write_tag(1, wire::kLengthDelimited, target);
+  target = wire::write_varint64(name_length, target);
+  if (name_length >= 3) {
+    uint32_t first = name_length / 2;
+    target = write_bytes(&m_letters[random.offset()], first, target);
+    *target++ = ' ';
+    target = write_bytes(&m_letters[random.offset()], name_length - first - 1,
+                         target);
+  } else {
+    target = write_bytes(&m_letters[random.offset()], name_length, target);
+  }
+
+  target = write_tag(2, wire::kVarint, target);
+  target = wire::write_varint64(id_value, target);
+
+  if (domain) {
+    target = write_tag(3, wire::kLengthDelimited, target);
+    target = wire::write_varint64(email_length, target);
+    target = write_bytes(&m_letters[random.offset()], local_length, target);
+    *target++ = '@';
+    target = write_bytes(domain, domain_length, target);
+  }
+
+  int total_weight = o.type_weights[0] + o.type_weights[1] + o.type_weights[2];
+  for (uint32_t i = 0; i < phones; ++i) {
+    target = write_tag(4, wire::kLengthDelimited, target);
+    target = wire::write_varint64(phone_size, target);
+    target = write_tag(1, wire::kLengthDelimited, target);
+    target = wire::write_varint64(kNumberLength, target);
+    target = write_bytes(kAreaCodes[random.below(kAreaCodeCount)], 4, target);
+    const char *digits = &m_digits[random.offset()];
+    target = write_bytes(digits, 3, target);
+    *target++ = '-';
+    target = write_bytes(digits + 3, 4, target);
+
+    uint32_t pick = random.below(total_weight);
+    int type = pick < static_cast<uint32_t>(o.type_weights[0])
+                   ? 0
+                   : pick < static_cast<uint32_t>(o.type_weights[0] +
+                                                  o.type_weights[1])
+                         ? 1
+                         : 2;
+    target = write_tag(2, wire::kVarint, target);
+    *target++ = static_cast<uint8_t>(type);
+  }
+
+  if (unknown) {
+    target = write_tag(kUnknownField, wire::kLengthDelimited, target);
+    target = wire::write_varint64(unknown_length, target);
+    target = write_bytes(&m_letters[random.offset()], unknown_length, target);
+  }
+  return target;
+}
+
+// rounds of one chunk per thread, double buffered: while the workers fill
+// one set of buffers, the calling thread writes out the round before.
+bool BookGenerator::write(const std::string &path, GeneratorFormat format,
+                          int threads) const {
+  if (!m_valid) {
+    return false;
+  }
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  int64_t chunks = (m_options.people + kChunkPeople - 1) / kChunkPeople;
+  threads = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(threads, chunks)));
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  // each buffer's bytes and how many of them the last chunk used.
+  std::vector<std::string> buffers[2];
+  std::vector<size_t> used[2];
+  for (int i = 0; i < 2; ++i) {
+    buffers[i].resize(threads);
+    used[i].resize(threads);
+  }
+  bool ok = true;
+  int64_t rounds = (chunks + threads - 1) / threads;
+  for (int64_t round = 0; round <= rounds && ok; ++round) {
+    std::vector<std::thread> workers;
+    if (round < rounds) {
+      std::vector<std::string> &fill_buffers = buffers[round % 2];
+      std::vector<size_t> &fill_used = used[round % 2];
+      for (int t = 0; t < threads; ++t) {
+        int64_t first = (round * threads + t) * kChunkPeople;
+        int64_t count = std::max<int64_t>(
+            0, std::min(kChunkPeople, m_options.people - first));
+        workers.emplace_back([=, &fill_buffers, &fill_used] {
+          fill_used[t] = fill(first, count, format, &fill_buffers[t], 0);
+        });
+      }
+    }
+    if (round > 0) {
+      int last = (round - 1) % 2;
+      for (int t = 0; t < threads; ++t) {
+        ok = ok && write_all(fd, buffers[last][t].data(), used[last][t]);
+      }
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+  return ::close(fd) == 0 && ok;
+}
+
+} // namespace tutorial
@@ -0,0 +1,94 @@
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// synthetic address books for benchmarks and capacity planning. the
+// generator writes wire bytes directly rather than building messages, and
+// every person is a pure function of the seed and its position: person i
+// draws from a random stream seeded by (seed, i). the same options therefore
+// give the same bytes whatever the thread count or chunking, and any slice
+// of a book can be regenerated on its own.
+//
+// ids are the positions, so they are unique below 2^31 people. names and
+// email local parts are cut from a pool of random letters, email domains and
+// phone prefixes come from small fixed sets, as they cluster in real books.
+namespace tutorial {
+
+// an inclusive range values are drawn from uniformly.
+struct GeneratorRange {
+  int min;
+  int max;
+};
+
+struct GeneratorOptions {
+  GeneratorOptions();
+
+  uint64_t seed;
+  int64_t people;
+  GeneratorRange name_length;
+  // share of people, in percent, with an email; its local part length.
+  int email_percent;
+  GeneratorRange email_length;
+  GeneratorRange phones;
+  // relative weights of Mobile, Home and Work. the type is always written,
+  // even when it is the default.
+  int type_weights[3];
+  // share of people, in percent, carrying an unknown length-delimited field
+  // (number kUnknownField) of unknown_length bytes.
+  int unknown_percent;
+  GeneratorRange unknown_length;
+};
+
+enum GeneratorFormat {
+  // a serialized AddressBook: `person` fields back to back.
+  kGenerateBook = 0,
+  // a person stream (record_stream.h): varint length, then the record.
+  kGenerateStream = 1,
+};
+
+// the field number unknown fields are written with; not in person.proto.
+const int kUnknownField = 15;
+
+class BookGenerator {
+public:
+  explicit BookGenerator(const GeneratorOptions &options);
+
+  BookGenerator(const BookGenerator &) = delete;
+  BookGenerator &operator=(const BookGenerator &) = delete;
+
+  // false if a range is empty or out of bounds, or no type has weight.
+  bool valid() const { return m_valid; }
+  const GeneratorOptions &options() const { return m_options; }
+
+  // appends people [first, first + count) to `out`.
+  void generate(int64_t first, int64_t count, GeneratorFormat format,
+                std::string *out) const;
+
+  // writes all options().people to `path`. chunks are generated on
+  // `threads` threads (<= 0 means every hardware thread) while the calling
+  // thread writes the chunks before them out in order.
+  bool write(const std::string &path, GeneratorFormat format,
+             int threads) const;
+
+private:
+  class Random;
+
+  size_t max_record_size() const;
+  size_t fill(int64_t first, int64_t count, GeneratorFormat format,
+              std::string *buffer, size_t used) const;
+  uint8_t *generate_person(int64_t index, GeneratorFormat format,
+                           uint8_t *target) const;
+
+  GeneratorOptions m_options;
+  bool m_valid;
+  // random letters and digits the text fields are cut from.
+  std::string m_letters;
+  std::string m_digits;
+};
+
+} // namespace tutorial
+
+#endif // GENERATOR_H_
@@ -0,0 +1,613 @@
+#include "ingest.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#include "bounded_queue.h"
+#include "stats.h"
+#include "utf8.h"
+
+namespace tutorial {
+
+namespace {
+
+// a file read into memory, waiting to be parsed.
+struct LoadedFile {
+  LoadedFile() : index(0), size(0), ok(false) {}
+
+  size_t index;
+  std::unique_ptr<uint8_t[]> data;
+  size_t size;
+  bool ok;
+  // running since the file's open was issued.
+  Stopwatch started;
+};
+
+// parses loaded files, hands them to the callback and keeps the totals.
+// safe to call from several threads.
+class Collector {
+public:
+  Collector(const IngestCallback &callback, bool validate_utf8)
+      : m_callback(callback), m_validate_utf8(validate_utf8), m_failed(0),
+        m_bytes(0), m_people(0) {}
+
+  // `book` is scratch space owned by the calling thread.
+  void finish(LoadedFile *file, AddressBook *book) {
+    bool ok = file->ok && file->size <= INT_MAX &&
+              book->ParseFromArray(file->data.get(),
+                                   static_cast<int>(file->size)) &&
+              (!m_validate_utf8 || utf8_valid(*book));
+    file->data.reset();
+    int people = ok ? book->person_size() : 0;
+    m_callback(file->index, ok ? book : nullptr);
+    double latency = file->started.seconds();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_latencies.push_back(latency);
+    m_failed += !ok;
+    m_bytes += file->size;
+    m_people += people;
+  }
+
+  void fill(IngestStats *stats) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats->files = m_latencies.size();
+    stats->failed = m_failed;
+    stats->bytes = m_bytes;
+    stats->people = m_people;
+    std::sort(m_latencies.begin(), m_latencies.end());
+    stats->p50_latency = percentile(0.50);
+    stats->p99_latency = percentile(0.99);
+  }
+
+  int64_t failed() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+  }
+
+private:
+  double percentile(double p) const {
+    if (m_latencies.empty()) {
+      return 0;
+    }
+    size_t i = static_cast<size_t>(p * m_latencies.size());
+    return m_latencies[std::min(i, m_latencies.size() - 1)];
+  }
+
+  const IngestCallback &m_callback;
+  bool m_validate_utf8;
+  std::mutex m_mutex;
+  std::vector<double> m_latencies;
+  int64_t m_failed;
+  int64_t m_bytes;
+  int64_t m_people;
+};
+
+int hardware_threads(int threads) {
+  if (threads > 0) {
+    return threads;
+  }
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// blocking open, fstat, pread until the size fstat gave, close.
+bool read_file(const std::string &path, LoadedFile *file) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  size_t size = ok ? static_cast<size_t>(st.st_size) : 0;
+  file->data.reset(new uint8_t[std::max<size_t>(size, 1)]);
+  size_t done = 0;
+  while (ok && done < size) {
+    ssize_t n = pread(fd, file->data.get() + done, size - done, done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    ok = n >= 0;
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  file->size = done;
+  return ::close(fd) == 0 && ok;
+}
+
+// loads paths[i] for every i in `indices`.
+void ingest_with_threads(const std::vector<std::string> &paths,
+                         const std::vector<size_t> &indices, int threads,
+                         Collector *collector) {
+  std::atomic<size_t> next(0);
+  auto work = [&] {
+    AddressBook book;
+    for (size_t i = next++; i < indices.size(); i = next++) {
+      LoadedFile file;
+      file.index = indices[i];
+      file.ok = read_file(paths[file.index], &file);
+      collector->finish(&file, &book);
+    }
+  };
+  threads = static_cast<int>(std::min<size_t>(
+      std::max(1, threads), std::max<size_t>(1, indices.size())));
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+#ifdef HAVE_IO_URING
+
+// a minimal io_uring: the two rings and the submission array mapped from the
+// kernel, driven with raw system calls so there is no liburing dependency.
+class Ring {
+public:
+  Ring()
+      : m_fd(-1), m_sq_ring(MAP_FAILED), m_sq_ring_size(0),
+        m_cq_ring(MAP_FAILED), m_cq_ring_size(0), m_sqes(nullptr),
+        m_sqes_size(0), m_entries(0), m_tail(0), m_unsubmitted(0) {}
+
+  ~Ring() {
+    if (m_sqes) {
+      munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+      munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring != MAP_FAILED) {
+      munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+  }
+
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  bool init(unsigned entries);
+  // whether the kernel knows every opcode in [ops, ops + count).
+  bool supports(const int *ops, int count);
+
+  unsigned entries() const { return m_entries; }
+
+  // a zeroed submission entry, queued for the next submit; null if the
+  // submission ring is full.
+  io_uring_sqe *next_sqe();
+  // submits what is queued and waits for at least one completion.
+  bool submit_and_wait();
+  bool pop(io_uring_cqe *cqe);
+
+private:
+  int m_fd;
+  void *m_sq_ring;
+  size_t m_sq_ring_size;
+  void *m_cq_ring;
+  size_t m_cq_ring_size;
+  io_uring_sqe *m_sqes;
+  size_t m_sqes_size;
+  unsigned m_entries;
+
+  unsigned *m_sq_head;
+  unsigned *m_sq_tail;
+  unsigned *m_sq_mask;
+  unsigned *m_sq_array;
+  unsigned *m_cq_head;
+  unsigned *m_cq_tail;
+  unsigned *m_cq_mask;
+  io_uring_cqe *m_cqes;
+
+  // our copy of the submission tail, published on submit.
+  unsigned m_tail;
+  unsigned m_unsubmitted;
+};
+
+bool Ring::init(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (m_fd < 0) {
+    return false;
+  }
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    m_sq_ring_size = m_cq_ring_size =
+        std::max(m_sq_ring_size, m_cq_ring_size);
+  }
+  m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (m_sq_ring == MAP_FAILED) {
+    return false;
+  }
+  m_cq_ring = single_mmap
+                  ? m_sq_ring
+                  : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+  if (m_cq_ring == MAP_FAILED) {
+    return false;
+  }
+  m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(m_sq_ring);
+  m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  m_sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(m_cq_ring);
+  m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  m_cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  m_entries = params.sq_entries;
+  m_tail = *m_sq_tail;
+  return true;
+}
+
+bool Ring::supports(const int *ops, int count) {
+  const unsigned kOps = 256;
+  std::vector<uint8_t> buffer(sizeof(io_uring_probe) +
+                              kOps * sizeof(io_uring_probe_op));
+  io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+  if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe,
+              kOps) < 0) {
+    return false;
+  }
+  for (int i = 0; i < count; ++i) {
+    if (ops[i] > probe->last_op ||
+        !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+io_uring_sqe *Ring::next_sqe() {
+  unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+  if (m_tail - head >= m_entries) {
+    return nullptr;
+  }
+  unsigned index = m_tail & *m_sq_mask;
+  io_uring_sqe *sqe = &m_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  m_sq_array[index] = index;
+  ++m_tail;
+  ++m_unsubmitted;
+  return sqe;
+}
+
+bool Ring::submit_and_wait() {
+  __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+  for (;;) {
+    long submitted = syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (submitted < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    m_unsubmitted -= static_cast<unsigned>(submitted);
+    return true;
+  }
+}
+
+bool Ring::pop(io_uring_cqe *cqe) {
+  unsigned head = *m_cq_head;
+  if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *cqe = m_cqes[head & *m_cq_mask];
+  __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+const int kRingOps[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                        IORING_OP_CLOSE};
+
+// user_data is the slot index shifted past the operation.
+enum RingOp { kOpOpen = 0, kOpStat = 1, kOpRead = 2, kOpClose = 3 };
+
+// a file between its open and its close.
+struct Slot {
+  Slot() : fd(-1), waiting(0), failed(false), stat(), done(0) {}
+
+  LoadedFile file;
+  int fd;
+  // open and statx completions still outstanding.
+  int waiting;
+  bool failed;
+  struct statx stat;
+  size_t done;
+};
+
+// the largest single read; a longer file takes several.
+const size_t kMaxRead = 1 << 30;
+
+class RingIngest {
+public:
+  RingIngest(Ring *ring, const std::vector<std::string> &paths,
+             int queue_depth, BoundedQueue<LoadedFile> *parse_queue)
+      : m_ring(ring), m_paths(paths), m_slots(queue_depth),
+        m_parse_queue(parse_queue), m_in_flight(0) {
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      m_free.push_back(i);
+    }
+  }
+
+  // false if the ring itself failed, with the indices of the files not yet
+  // handed on in `unfinished`.
+  bool run(std::vector<size_t> *unfinished);
+
+private:
+  void start(size_t index);
+  void complete(const io_uring_cqe &cqe);
+  void opened(size_t slot);
+  void read_more(size_t slot);
+  void finish(size_t slot, bool ok);
+  io_uring_sqe *sqe(size_t slot, RingOp op);
+
+  Ring *m_ring;
+  const std::vector<std::string> &m_paths;
+  std::vector<Slot> m_slots;
+  std::vector<size_t> m_free;
+  BoundedQueue<LoadedFile> *m_parse_queue;
+  unsigned m_in_flight;
+};
+
+// only start() adds to the operations in flight: every other submission
+// answers a completion (the second of open and statx, or a read), so
+// admitting a file only while two entries are spare keeps the ring from ever
+// filling.
+io_uring_sqe *RingIngest::sqe(size_t slot, RingOp op) {
+  io_uring_sqe *entry = m_ring->next_sqe();
+  entry->user_data = (static_cast<uint64_t>(slot) << 2) | op;
+  ++m_in_flight;
+  return entry;
+}
+
+void RingIngest::start(size_t index) {
+  size_t slot = m_free.back();
+  m_free.pop_back();
+  Slot &s = m_slots[slot];
+  s = Slot();
+  s.file.index = index;
+  s.waiting = 2;
+  const char *path = m_paths[index].c_str();
+
+  io_uring_sqe *open = sqe(slot, kOpOpen);
+  open->opcode = IORING_OP_OPENAT;
+  open->fd = AT_FDCWD;
+  open->addr = reinterpret_cast<uint64_t>(path);
+  open->open_flags = O_RDONLY | O_CLOEXEC;
+
+  io_uring_sqe *stat = sqe(slot, kOpStat);
+  stat->opcode = IORING_OP_STATX;
+  stat->fd = AT_FDCWD;
+  stat->addr = reinterpret_cast<uint64_t>(path);
+  stat->len = STATX_SIZE;
+  stat->off = reinterpret_cast<uint64_t>(&s.stat);
+}
+
+void RingIngest::opened(size_t slot) {
+  Slot &s = m_slots[slot];
+  if (s.failed) {
+    finish(slot, false);
+    return;
+  }
+  s.file.size = s.stat.stx_size;
+  s.file.data.reset(new uint8_t[std::max<size_t>(s.file.size, 1)]);
+  if (s.file.size == 0) {
+    finish(slot, true);
+    return;
+  }
+  read_more(slot);
+}
+
+void RingIngest::read_more(size_t slot) {
+  Slot &s = m_slots[slot];
+  io_uring_sqe *read = sqe(slot, kOpRead);
+  read->opcode = IORING_OP_READ;
+  read->fd = s.fd;
+  read->addr = reinterpret_cast<uint64_t>(s.file.data.get() + s.done);
+  read->len = static_cast<uint32_t>(std::min(s.file.size - s.done, kMaxRead));
+  read->off = s.done;
+}
+
+// closes the file (without waiting for the close) and passes it on.
+void RingIngest::finish(size_t slot, bool ok) {
+  Slot &s = m_slots[slot];
+  if (s.fd >= 0) {
+    io_uring_sqe *close = sqe(slot, kOpClose);
+    close->opcode = IORING_OP_CLOSE;
+    close->fd = s.fd;
+    s.fd = -1;
+  }
+  s.file.ok = ok;
+  m_parse_queue->push(std::move(s.file));
+  m_free.push_back(slot);
+}
+
+void RingIngest::complete(const io_uring_cqe &cqe) {
+  --m_in_flight;
+  size_t slot = static_cast<size_t>(cqe.user_data >> 2);
+  RingOp op = static_cast<RingOp>(cqe.user_data & 3);
+  Slot &s = m_slots[slot];
+  switch (op) {
+  case kOpOpen:
+  case kOpStat:
+    if (cqe.res < 0) {
+      s.failed = true;
+    } else if (op == kOpOpen) {
+      s.fd = cqe.res;
+    }
+    if (--s.waiting == 0) {
+      opened(slot);
+    }
+    break;
+  case kOpRead:
+    if (cqe.res < 0) {
+      finish(slot, false);
+    } else if (cqe.res == 0) {
+      // the file shrank since statx; keep what was there.
+      s.file.size = s.done;
+      finish(slot, true);
+    } else {
+      s.done += cqe.res;
+      if (s.done < s.file.size) {
+        read_more(slot);
+      } else {
+        finish(slot, true);
+      }
+    }
+    break;
+  case kOpClose:
+    break;
+  }
+}
+
+bool RingIngest::run(std::vector<size_t> *unfinished) {
+  size_t next = 0;
+  while (next < m_paths.size() || m_free.size() < m_slots.size() ||
+         m_in_flight > 0) {
+    while (next < m_paths.size() && !m_free.empty() &&
+           m_in_flight + 2 <= m_ring->entries()) {
+      start(next++);
+    }
+    if (!m_ring->submit_and_wait()) {
+      // the kernel may still write into the buffers of files in flight, so
+      // they are leaked rather than freed under it.
+      for (size_t slot = 0; slot < m_slots.size(); ++slot) {
+        if (std::find(m_free.begin(), m_free.end(), slot) == m_free.end()) {
+          m_slots[slot].file.data.release();
+          unfinished->push_back(m_slots[slot].file.index);
+        }
+      }
+      for (; next < m_paths.size(); ++next) {
+        unfinished->push_back(next);
+      }
+      return false;
+    }
+    io_uring_cqe cqe;
+    while (m_ring->pop(&cqe)) {
+      complete(cqe);
+    }
+  }
+  return true;
+}
+
+// the calling thread drives the ring; parser threads take files from it as
+// they complete. false if there is no usable ring. if the ring fails part
+// way, the files it had not handed on are left in `unfinished`.
+bool ingest_with_ring(const std::vector<std::string> &paths,
+                      const IngestOptions &options, Collector *collector,
+                      std::vector<size_t> *unfinished) {
+  unsigned depth = static_cast<unsigned>(std::max(1, options.queue_depth));
+  Ring ring;
+  if (!ring.init(2 * depth) ||
+      !ring.supports(kRingOps, sizeof(kRingOps) / sizeof(kRingOps[0]))) {
+    return false;
+  }
+
+  BoundedQueue<LoadedFile> parse_queue(depth);
+  std::vector<std::thread> parsers;
+  for (int i = 0; i < hardware_threads(options.parsers); ++i) {
+    parsers.emplace_back([&] {
+      AddressBook book;
+      LoadedFile file;
+      while (parse_queue.pop(&file)) {
+        collector->finish(&file, &book);
+      }
+    });
+  }
+
+  RingIngest ingest(&ring, paths, static_cast<int>(depth), &parse_queue);
+  ingest.run(unfinished);
+  parse_queue.close();
+  for (std::thread &parser : parsers) {
+    parser.join();
+  }
+  return true;
+}
+
+#endif // HAVE_IO_URING
+
+} // namespace
+
+IngestOptions::IngestOptions()
+    : queue_depth(64), parsers(0), use_uring(true), validate_utf8(false) {}
+
+bool uring_available() {
+#ifdef HAVE_IO_URING
+  Ring ring;
+  return ring.init(4) &&
+         ring.supports(kRingOps, sizeof(kRingOps) / sizeof(kRingOps[0]));
+#else
+  return false;
+#endif
+}
+
+bool ingest_address_books(const std::vector<std::string> &paths,
+                          const IngestOptions &options,
+                          const IngestCallback &callback, IngestStats *stats) {
+  Stopwatch watch;
+  Collector collector(callback, options.validate_utf8);
+  bool used_uring = false;
+  std::vector<size_t> unfinished;
+#ifdef HAVE_IO_URING
+  used_uring = options.use_uring &&
+               ingest_with_ring(paths, options, &collector, &unfinished);
+#endif
+  if (!used_uring) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      unfinished.push_back(i);
+    }
+  }
+  // everything, or whatever a ring that failed part way left over.
+  if (!unfinished.empty()) {
+    ingest_with_threads(paths, unfinished, options.queue_depth, &collector);
+  }
+
+  if (stats) {
+    collector.fill(stats);
+    stats->seconds = watch.seconds();
+    stats->used_uring = used_uring;
+  }
+  return collector.failed() == 0;
+}
+
+} // namespace tutorial
@@ -0,0 +1,73 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "person.pb.h"
+
+// loads many small AddressBook files at once. rather than opening and
+// reading one file at a time, which leaves the device idle between requests,
+// the calling thread keeps up to queue_depth files in flight through
+// io_uring: it submits the open and statx of each file together, a read
+// once both complete, and a close once the read does. completed buffers go
+// to a pool of parser threads, so each book is parsed while later files are
+// still being read.
+//
+// where io_uring is missing (older kernels, seccomp sandboxes, no
+// <linux/io_uring.h>) or disabled, a pool of threads does the same with
+// blocking open/fstat/pread/close and parses in place. if the ring fails
+// part way, the pool loads whatever files it had not finished.
+namespace tutorial {
+
+struct IngestOptions {
+  IngestOptions();
+
+  // files in flight at once; also the fallback's thread count.
+  int queue_depth;
+  // parser threads behind the ring; <= 0 uses every hardware thread.
+  int parsers;
+  // false forces the thread-pool fallback.
+  bool use_uring;
+  // fails a file with a string field that is not UTF-8, checked by the
+  // parser that parsed it; see utf8.h. off by default.
+  bool validate_utf8;
+};
+
+struct IngestStats {
+  IngestStats()
+      : files(0), failed(0), bytes(0), people(0), seconds(0),
+        p50_latency(0), p99_latency(0), used_uring(false) {}
+
+  int64_t files;
+  int64_t failed;
+  int64_t bytes;
+  int64_t people;
+  double seconds;
+  // per file, from submitting its open to finishing its parse.
+  double p50_latency;
+  double p99_latency;
+  bool used_uring;
+};
+
+// called once per file, from a parser thread and so possibly concurrently,
+// as soon as it is parsed. `book` is null if the file could not be read or
+// parsed; otherwise it is only valid for the call and may be swapped from.
+typedef std::function<void(size_t index, AddressBook *book)> IngestCallback;
+
+// false if any file failed; every file is still attempted. `stats` may be
+// null.
+bool ingest_address_books(const std::vector<std::string> &paths,
+                          const IngestOptions &options,
+                          const IngestCallback &callback,
+                          IngestStats *stats = nullptr);
+
+// whether this kernel accepts the io_uring operations ingestion uses.
+bool uring_available();
+
+} // namespace tutorial
+
+#endif // INGEST_H_
@@ -0,0 +1,417 @@
+#include "interned_book.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const uint8_t kNameTag = (1 << 3) | wire::kLengthDelimited;
+const uint8_t kIdTag = (2 << 3) | wire::kVarint;
+const uint8_t kEmailTag = (3 << 3) | wire::kLengthDelimited;
+const uint8_t kPhoneTag = (4 << 3) | wire::kLengthDelimited;
+const uint8_t kNumberTag = (1 << 3) | wire::kLengthDelimited;
+const uint8_t kTypeTag = (2 << 3) | wire::kVarint;
+
+// a phone prefix runs through the first separator found within this many
+// bytes; numbers without one are stored whole.
+const size_t kMaxPrefix = 8;
+
+size_t phone_prefix_size(StringView number) {
+  for (size_t i = 1; i < number.size() && i < kMaxPrefix; ++i) {
+    char c = number[i];
+    if (c == '-' || c == ' ' || c == '.' || c == ')' || c == '/') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// position of the last '@', or npos.
+size_t domain_separator(StringView email) {
+  for (size_t i = email.size(); i > 0; --i) {
+    if (email[i - 1] == '@') {
+      return i - 1;
+    }
+  }
+  return std::string::npos;
+}
+
+uint64_t hash_text(StringView str) {
+  // FNV-1a; dictionary keys are short.
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (char c : str) {
+    h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// int32 and enum fields are written sign-extended to 64 bits.
+uint64_t int32_varint(int32_t value) {
+  return static_cast<uint64_t>(static_cast<int64_t>(value));
+}
+
+size_t string_field_size(size_t size) {
+  return 1 + wire::varint_size(size) + size;
+}
+
+// an empty view may have no data at all, which memcpy must not be given.
+uint8_t *put_bytes(StringView str, uint8_t *target) {
+  if (!str.empty()) {
+    memcpy(target, str.data(), str.size());
+  }
+  return target + str.size();
+}
+
+// a message's unknown fields as wire bytes, written the way packed_book.cpp
+// writes them so protobuf 2.5 and 3.x both can.
+template <typename Message>
+std::string unknown_fields_bytes(const Message &message) {
+  if (message.unknown_fields().empty()) {
+    return std::string();
+  }
+  Message unknown;
+  unknown.mutable_unknown_fields()->MergeFrom(message.unknown_fields());
+  return unknown.SerializePartialAsString();
+}
+
+} // namespace
+
+StringDictionary::StringDictionary() : m_table(16, 0) {}
+
+uint32_t StringDictionary::intern(StringView str) {
+  size_t mask = m_table.size() - 1;
+  for (size_t slot = hash_text(str) & mask;; slot = (slot + 1) & mask) {
+    uint32_t entry = m_table[slot];
+    if (entry == 0) {
+      uint32_t id = static_cast<uint32_t>(m_entries.size());
+      TextRef ref = {static_cast<uint32_t>(m_text.size()),
+                     static_cast<uint32_t>(str.size())};
+      m_text.append(str.data(), str.size());
+      m_entries.push_back(ref);
+      m_table[slot] = id + 1;
+      if (m_entries.size() * 2 > m_table.size()) {
+        grow();
+      }
+      return id;
+    }
+    if (lookup(entry - 1) == str) {
+      return entry - 1;
+    }
+  }
+}
+
+void StringDictionary::clear() {
+  m_text.clear();
+  m_entries.clear();
+  m_table.assign(16, 0);
+}
+
+size_t StringDictionary::bytes_used() const {
+  return m_text.capacity() + m_entries.capacity() * sizeof(TextRef) +
+         m_table.capacity() * sizeof(uint32_t);
+}
+
+void StringDictionary::grow() {
+  m_table.assign(m_table.size() * 2, 0);
+  size_t mask = m_table.size() - 1;
+  for (uint32_t id = 0; id < m_entries.size(); ++id) {
+    size_t slot = hash_text(lookup(id)) & mask;
+    while (m_table[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    m_table[slot] = id + 1;
+  }
+}
+
+bool InternedBook::assign(const AddressBook &book) {
+  clear();
+  for (int i = 0; i < book.person_size(); ++i) {
+    if (!append(book.person(i))) {
+      clear();
+      return false;
+    }
+  }
+  m_book_extras = unknown_fields_bytes(book);
+  return true;
+}
+
+bool InternedBook::append(const Person &person) {
+  // checked up front so a Person is either added whole or not at all.
+  std::string unknown = unknown_fields_bytes(person);
+  size_t text = person.name().size() + person.email().size() + unknown.size();
+  for (int i = 0; i < person.phone_size(); ++i) {
+    const Person::PhoneNumber &phone = person.phone(i);
+    if (!phone.unknown_fields().empty()) {
+      return false;
+    }
+    text += phone.number().size();
+  }
+  if (text > UINT32_MAX - m_text.size() ||
+      static_cast<uint32_t>(person.phone_size()) > kMaxPhones ||
+      m_phones.size() + person.phone_size() > UINT32_MAX) {
+    return false;
+  }
+
+  if (!unknown.empty()) {
+    Extra extra;
+    extra.person = static_cast<uint32_t>(m_people.size());
+    extra.bytes = add_text(unknown.data(), unknown.size());
+    m_extras.push_back(extra);
+  }
+  PersonEntry entry;
+  entry.has_id = person.has_id();
+  entry.id = person.id();
+  entry.has_name = person.has_name();
+  entry.name = add_text(person.name().data(), person.name().size());
+  entry.domain = kNoEmail;
+  entry.email_local = TextRef();
+  if (person.has_email()) {
+    StringView email(person.email());
+    size_t at = domain_separator(email);
+    if (at == std::string::npos) {
+      entry.domain = kNoDomain;
+      entry.email_local = add_text(email.data(), email.size());
+    } else {
+      entry.domain = m_domains.intern(
+          StringView(email.data() + at + 1, email.size() - at - 1));
+      entry.email_local = add_text(email.data(), at);
+    }
+  }
+
+  entry.phone_begin = static_cast<uint32_t>(m_phones.size());
+  entry.phones = static_cast<uint32_t>(person.phone_size());
+  for (int i = 0; i < person.phone_size(); ++i) {
+    const Person::PhoneNumber &phone = person.phone(i);
+    StringView number(phone.number());
+    size_t prefix = phone_prefix_size(number);
+    PhoneEntry phone_entry;
+    phone_entry.prefix =
+        prefix == 0 ? kNoPrefix
+                    : m_prefixes.intern(StringView(number.data(), prefix));
+    phone_entry.rest =
+        add_text(number.data() + prefix, number.size() - prefix);
+    phone_entry.type =
+        phone.has_type() ? static_cast<uint8_t>(phone.type()) : kTypeUnset;
+    phone_entry.has_number = phone.has_number();
+    m_phones.push_back(phone_entry);
+  }
+
+  m_people.push_back(entry);
+  return true;
+}
+
+void InternedBook::clear() {
+  m_people.clear();
+  m_phones.clear();
+  m_extras.clear();
+  m_text.clear();
+  m_book_extras.clear();
+  m_domains.clear();
+  m_prefixes.clear();
+}
+
+StringView InternedBook::email_domain(size_t person) const {
+  uint32_t domain = m_people[person].domain;
+  return domain < kNoDomain ? m_domains.lookup(domain) : StringView();
+}
+
+std::string InternedBook::email(size_t person) const {
+  std::string email = email_local(person).to_string();
+  if (m_people[person].domain < kNoDomain) {
+    email += '@';
+    StringView domain = email_domain(person);
+    email.append(domain.data(), domain.size());
+  }
+  return email;
+}
+
+std::string InternedBook::phone_number(size_t phone) const {
+  const PhoneEntry &entry = m_phones[phone];
+  std::string number;
+  if (entry.prefix != kNoPrefix) {
+    number = m_prefixes.lookup(entry.prefix).to_string();
+  }
+  StringView rest = text(entry.rest);
+  number.append(rest.data(), rest.size());
+  return number;
+}
+
+void InternedBook::materialize(size_t person, Person *out) const {
+  out->Clear();
+  if (has_name(person)) {
+    StringView str = name(person);
+    out->mutable_name()->assign(str.data(), str.size());
+  }
+  if (has_id(person)) {
+    out->set_id(id(person));
+  }
+  if (has_email(person)) {
+    *out->mutable_email() = email(person);
+  }
+  for (size_t i = phone_begin(person); i < phone_end(person); ++i) {
+    Person::PhoneNumber *phone = out->add_phone();
+    if (m_phones[i].has_number) {
+      *phone->mutable_number() = phone_number(i);
+    }
+    if (m_phones[i].type != kTypeUnset) {
+      phone->set_type(static_cast<Person::PhoneType>(m_phones[i].type));
+    }
+  }
+  // the bytes hold only fields Person does not know, so parsing them adds
+  // them as unknown fields and touches nothing else. they were written by
+  // append(), so they parse.
+  StringView unknown = extra(person);
+  if (!unknown.empty()) {
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const uint8_t *>(unknown.data()),
+        static_cast<int>(unknown.size()));
+    out->MergePartialFromCodedStream(&input);
+  }
+}
+
+// straight from the dictionaries to wire format in protoc's field order,
+// without building a message; a Person is sized first so its length prefix
+// can be written ahead of it.
+void InternedBook::serialize(std::string *out) const {
+  std::vector<uint32_t> phone_sizes;
+  size_t next_extra = 0;
+  for (size_t i = 0; i < m_people.size(); ++i) {
+    const PersonEntry &person = m_people[i];
+    StringView extra;
+    if (next_extra < m_extras.size() && m_extras[next_extra].person == i) {
+      extra = text(m_extras[next_extra++].bytes);
+    }
+    size_t size = serialized_size(person, extra, &phone_sizes);
+    size_t offset = out->size();
+    out->resize(offset + 1 + wire::varint_size(size) + size);
+    uint8_t *target = reinterpret_cast<uint8_t *>(&(*out)[offset]);
+
+    *target++ = static_cast<uint8_t>(wire::kPersonTag);
+    target = wire::write_varint64(size, target);
+    if (person.has_name) {
+      *target++ = kNameTag;
+      target = wire::write_varint64(person.name.size, target);
+      target = put_bytes(text(person.name), target);
+    }
+    if (person.has_id) {
+      *target++ = kIdTag;
+      target = wire::write_varint64(int32_varint(person.id), target);
+    }
+
+    if (person.domain != kNoEmail) {
+      StringView domain;
+      size_t email_size = person.email_local.size;
+      if (person.domain != kNoDomain) {
+        domain = m_domains.lookup(person.domain);
+        email_size += 1 + domain.size();
+      }
+      *target++ = kEmailTag;
+      target = wire::write_varint64(email_size, target);
+      target = put_bytes(text(person.email_local), target);
+      if (person.domain != kNoDomain) {
+        *target++ = '@';
+        target = put_bytes(domain, target);
+      }
+    }
+
+    for (uint32_t j = 0; j < person.phones; ++j) {
+      const PhoneEntry &phone = m_phones[person.phone_begin + j];
+      StringView prefix;
+      if (phone.prefix != kNoPrefix) {
+        prefix = m_prefixes.lookup(phone.prefix);
+      }
+      *target++ = kPhoneTag;
+      target = wire::write_varint64(phone_sizes[j], target);
+      if (phone.has_number) {
+        *target++ = kNumberTag;
+        target =
+            wire::write_varint64(prefix.size() + phone.rest.size, target);
+        target = put_bytes(prefix, target);
+        target = put_bytes(text(phone.rest), target);
+      }
+      if (phone.type != kTypeUnset) {
+        *target++ = kTypeTag;
+        target = wire::write_varint64(phone.type, target);
+      }
+    }
+    // the generated serializer writes unknown fields last.
+    put_bytes(extra, target);
+  }
+  out->append(m_book_extras);
+}
+
+size_t InternedBook::bytes_used() const {
+  return m_people.capacity() * sizeof(PersonEntry) +
+         m_phones.capacity() * sizeof(PhoneEntry) +
+         m_extras.capacity() * sizeof(Extra) + m_text.capacity() +
+         m_book_extras.capacity() + m_domains.bytes_used() +
+         m_prefixes.bytes_used();
+}
+
+TextRef InternedBook::add_text(const char *data, size_t size) {
+  TextRef ref = {static_cast<uint32_t>(m_text.size()),
+                 static_cast<uint32_t>(size)};
+  m_text.append(data, size);
+  return ref;
+}
+
+StringView InternedBook::extra(size_t person) const {
+  std::vector<Extra>::const_iterator found = std::lower_bound(
+      m_extras.begin(), m_extras.end(), person,
+      [](const Extra &extra, size_t p) { return extra.person < p; });
+  if (found == m_extras.end() || found->person != person) {
+    return StringView();
+  }
+  return text(found->bytes);
+}
+
+size_t InternedBook::serialized_size(const PersonEntry &person,
+                                     StringView extra,
+                                     std::vector<uint32_t> *phone_sizes) const {
+  size_t size = extra.size();
+  if (person.has_name) {
+    size += string_field_size(person.name.size);
+  }
+  if (person.has_id) {
+    size += 1 + wire::varint_size(int32_varint(person.id));
+  }
+  if (person.domain != kNoEmail) {
+    size_t email_size = person.email_local.size;
+    if (person.domain != kNoDomain) {
+      email_size += 1 + m_domains.lookup(person.domain).size();
+    }
+    size += string_field_size(email_size);
+  }
+
+  phone_sizes->clear();
+  for (uint32_t i = 0; i < person.phones; ++i) {
+    const PhoneEntry &phone = m_phones[person.phone_begin + i];
+    size_t number_size = phone.rest.size;
+    if (phone.prefix != kNoPrefix) {
+      number_size += m_prefixes.lookup(phone.prefix).size();
+    }
+    size_t phone_size = phone.has_number ? string_field_size(number_size) : 0;
+    if (phone.type != kTypeUnset) {
+      phone_size += 1 + wire::varint_size(phone.type);
+    }
+    phone_sizes->push_back(static_cast<uint32_t>(phone_size));
+    size += string_field_size(phone_size);
+  }
+  return size;
+}
+
+size_t space_used(const AddressBook &book) {
+#if GOOGLE_PROTOBUF_VERSION >= 3004000
+  return book.SpaceUsedLong();
+#else
+  return book.SpaceUsed();
+#endif
+}
+
+} // namespace tutorial
@@ -0,0 +1,164 @@
+#ifndef INTERNED_BOOK_H_
+#define INTERNED_BOOK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "person.pb.h"
+#include "string_view.h"
+
+// a dictionary-encoded, in-memory copy of an AddressBook. every email is
+// split at its last '@' into a local part and an interned domain, and every
+// phone number into an interned prefix (through the first separator, e.g.
+// "555-" or "(415)") and the rest, so a domain or area code shared by a
+// million people is stored once. the remaining strings live in one shared
+// text buffer and are referenced by offset and size, not by std::string.
+//
+// the copy round-trips losslessly to the wire format: serialize() writes the
+// bytes the generated serializer would for the same people, explicitly set
+// phone types, missing required fields and unknown fields on the book and on
+// each Person included. a phone's unknown fields are not kept, so a phone
+// with any, an out-of-range type among them, cannot be added.
+namespace tutorial {
+
+// a reference into a text buffer; 8 bytes instead of a 32-byte std::string.
+struct TextRef {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// interns strings as dense ids. ids are handed out from 0 in first-seen
+// order and stay valid as more strings are interned.
+class StringDictionary {
+public:
+  StringDictionary();
+
+  uint32_t intern(StringView str);
+  StringView lookup(uint32_t id) const {
+    return StringView(m_text.data() + m_entries[id].offset,
+                      m_entries[id].size);
+  }
+  size_t size() const { return m_entries.size(); }
+  void clear();
+
+  // heap bytes held, for memory reports.
+  size_t bytes_used() const;
+
+private:
+  void grow();
+
+  std::string m_text;
+  std::vector<TextRef> m_entries;
+  // open addressing over entry ids + 1; 0 is empty.
+  std::vector<uint32_t> m_table;
+};
+
+class InternedBook {
+public:
+  // sentinels in place of a dictionary id.
+  static const uint32_t kNoEmail = UINT32_MAX;
+  static const uint32_t kNoDomain = UINT32_MAX - 1;
+  static const uint32_t kNoPrefix = UINT32_MAX;
+
+  InternedBook() {}
+
+  // false, leaving the copy empty, once the people's remaining text and
+  // unknown fields would pass 4 GB, or for a phone with unknown fields.
+  bool assign(const AddressBook &book);
+  // as assign(), for one Person; on false the copy is unchanged.
+  bool append(const Person &person);
+  void clear();
+
+  size_t people() const { return m_people.size(); }
+  size_t phones() const { return m_phones.size(); }
+  const StringDictionary &domains() const { return m_domains; }
+  const StringDictionary &prefixes() const { return m_prefixes; }
+
+  bool has_id(size_t person) const { return m_people[person].has_id; }
+  int32_t id(size_t person) const { return m_people[person].id; }
+  bool has_name(size_t person) const { return m_people[person].has_name; }
+  StringView name(size_t person) const { return text(m_people[person].name); }
+  bool has_email(size_t person) const {
+    return m_people[person].domain != kNoEmail;
+  }
+  // both return views into the dictionaries and the text buffer.
+  StringView email_local(size_t person) const {
+    return text(m_people[person].email_local);
+  }
+  StringView email_domain(size_t person) const;
+
+  // rebuilt strings, for when a caller needs the whole value.
+  std::string email(size_t person) const;
+  std::string phone_number(size_t phone) const;
+  size_t phone_begin(size_t person) const {
+    return m_people[person].phone_begin;
+  }
+  size_t phone_end(size_t person) const {
+    return m_people[person].phone_begin + m_people[person].phones;
+  }
+
+  void materialize(size_t person, Person *out) const;
+  // appends the people, and the book's unknown fields after them, as a
+  // serialized AddressBook to `out`.
+  void serialize(std::string *out) const;
+
+  // heap bytes held by the copy, dictionaries included.
+  size_t bytes_used() const;
+
+private:
+  struct PersonEntry {
+    int32_t id;
+    // a domains() id, kNoDomain for an email without '@', or kNoEmail.
+    uint32_t domain;
+    TextRef name;
+    TextRef email_local;
+    uint32_t phone_begin;
+    // the flags take bits the count does not need, keeping an entry at 32
+    // bytes.
+    uint32_t phones : 30;
+    uint32_t has_name : 1;
+    uint32_t has_id : 1;
+  };
+  struct PhoneEntry {
+    uint32_t prefix;
+    TextRef rest;
+    // a Person::PhoneType, or kTypeUnset.
+    uint8_t type;
+    bool has_number;
+  };
+  // a Person's unknown fields as wire bytes in the text buffer. few people
+  // have any, so only they are listed, in person order.
+  struct Extra {
+    uint32_t person;
+    TextRef bytes;
+  };
+  static const uint8_t kTypeUnset = 0xff;
+  static const uint32_t kMaxPhones = (1u << 30) - 1;
+
+  StringView text(TextRef ref) const {
+    return StringView(m_text.data() + ref.offset, ref.size);
+  }
+  TextRef add_text(const char *data, size_t size);
+  // the person's unknown fields; empty if it has none.
+  StringView extra(size_t person) const;
+  size_t serialized_size(const PersonEntry &person, StringView extra,
+                         std::vector<uint32_t> *phone_sizes) const;
+
+  std::vector<PersonEntry> m_people;
+  std::vector<PhoneEntry> m_phones;
+  std::vector<Extra> m_extras;
+  std::string m_text;
+  // the book's own unknown fields, as wire bytes.
+  std::string m_book_extras;
+  StringDictionary m_domains;
+  StringDictionary m_prefixes;
+};
+
+// what the same people cost as generated messages, by SpaceUsed().
+size_t space_used(const AddressBook &book);
+
+} // namespace tutorial
+
+#endif // INTERNED_BOOK_H_
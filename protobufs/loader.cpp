@@ -0,0 +1,96 @@
+#include "loader.h"
+
+#include <climits>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "mapped_file.h"
+#include "stats.h"
+#include "utf8.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// CodedInputStream indexes its buffer with an int and, by default, refuses to
+// read past 64MB, so the mapping is fed to the parser in windows cut on
+// top-level field boundaries. a window this size stays warm in cache between
+// the boundary scan and the parse.
+const size_t kWindowBytes = 4 << 20;
+
+} // namespace
+
+bool load_address_book(const std::string &path, AddressBook *book,
+                       LoadStats *stats, bool validate_utf8) {
+  Stopwatch watch;
+  int people = book->person_size();
+
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  file.advise_sequential();
+  size_t bytes = file.size();
+
+  if (!load_address_book(&file, book, validate_utf8)) {
+    return false;
+  }
+
+  if (stats != nullptr) {
+    stats->bytes = bytes;
+    stats->people = book->person_size() - people;
+    stats->seconds = watch.seconds();
+    stats->peak_rss = peak_rss_bytes();
+  }
+  return true;
+}
+
+bool load_address_book(MappedFile *file, AddressBook *book,
+                       bool validate_utf8) {
+  const uint8_t *data = file->data();
+  const uint8_t *end = data + file->size();
+  Utf8Batch utf8;
+  int checked = book->person_size();
+
+  const uint8_t *begin = data;
+  while (begin < end) {
+    // extend the window over whole top-level fields; repeated fields merge by
+    // appending, so parsing window by window is the same as one big parse.
+    const uint8_t *window_end = wire::skip_fields(begin, end, kWindowBytes);
+    if (window_end == nullptr) {
+      return false;
+    }
+
+    size_t length = window_end - begin;
+    if (length > INT_MAX) {
+      return false;
+    }
+    file->advise_willneed(window_end - data, kWindowBytes);
+
+    google::protobuf::io::CodedInputStream input(begin,
+                                                 static_cast<int>(length));
+    wire::set_total_bytes_limit(&input, static_cast<int>(length));
+    if (!book->MergePartialFromCodedStream(&input) ||
+        !input.ConsumedEntireMessage()) {
+      return false;
+    }
+    // each window's people while they are still in cache.
+    if (validate_utf8) {
+      for (; checked < book->person_size(); ++checked) {
+        utf8.add(book->person(checked));
+      }
+      if (!utf8.valid()) {
+        return false;
+      }
+      utf8.clear();
+    }
+
+    file->advise_dontneed(begin - data, length);
+    begin = window_end;
+  }
+
+  return book->IsInitialized();
+}
+
+} // namespace tutorial
@@ -0,0 +1,37 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <cstddef>
+#include <string>
+
+#include "person.pb.h"
+
+namespace tutorial {
+
+class MappedFile;
+
+struct LoadStats {
+  LoadStats() : bytes(0), people(0), seconds(0), peak_rss(0) {}
+
+  size_t bytes;
+  int people;
+  double seconds;
+  size_t peak_rss;
+};
+
+// mmaps `path` and merges its contents into `book`, feeding
+// AddressBook::MergePartialFromCodedStream straight from the mapping.
+// returns false if the file cannot be mapped, is malformed, or leaves required
+// fields unset, and with `validate_utf8` if a string field is not UTF-8 (see
+// utf8.h). `stats` may be null.
+bool load_address_book(const std::string &path, AddressBook *book,
+                       LoadStats *stats = nullptr, bool validate_utf8 = false);
+
+// same, over an already mapped file; consumed pages are released with
+// MADV_DONTNEED as parsing advances, so the mapping does not add to peak RSS.
+bool load_address_book(MappedFile *file, AddressBook *book,
+                       bool validate_utf8 = false);
+
+} // namespace tutorial
+
+#endif // LOADER_H_
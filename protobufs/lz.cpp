@@ -0,0 +1,163 @@
+#include "lz.h"
+
+#include <cstring>
+
+namespace tutorial {
+
+namespace {
+
+const int kHashBits = 14;
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = 65535;
+
+// the low nibble of a token is the match length less kMinMatch; 15 in either
+// nibble means more length bytes follow.
+const size_t kNibbleMax = 15;
+
+uint32_t load32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+uint32_t hash32(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+uint8_t *put_length(size_t length, uint8_t *op) {
+  for (; length >= 255; length -= 255) {
+    *op++ = 255;
+  }
+  *op++ = static_cast<uint8_t>(length);
+  return op;
+}
+
+bool get_length(const uint8_t **ip, const uint8_t *end, size_t *length) {
+  for (;;) {
+    if (*ip >= end) {
+      return false;
+    }
+    uint8_t byte = *(*ip)++;
+    *length += byte;
+    if (byte != 255) {
+      return true;
+    }
+  }
+}
+
+// one sequence: literals, then (unless this is the last one) a match.
+uint8_t *put_sequence(const uint8_t *literals, size_t literal_length,
+                      size_t match_length, size_t offset, uint8_t *op) {
+  uint8_t *token = op++;
+  size_t literal_nibble =
+      literal_length < kNibbleMax ? literal_length : kNibbleMax;
+  if (literal_length >= kNibbleMax) {
+    op = put_length(literal_length - kNibbleMax, op);
+  }
+  memcpy(op, literals, literal_length);
+  op += literal_length;
+
+  size_t match_nibble = 0;
+  if (match_length > 0) {
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    size_t extra = match_length - kMinMatch;
+    match_nibble = extra < kNibbleMax ? extra : kNibbleMax;
+    if (extra >= kNibbleMax) {
+      op = put_length(extra - kNibbleMax, op);
+    }
+  }
+  *token = static_cast<uint8_t>(literal_nibble << 4 | match_nibble);
+  return op;
+}
+
+} // namespace
+
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst) {
+  // positions of the last sequence seen per hash; stale or colliding
+  // entries are caught by comparing the bytes.
+  uint32_t table[1 << kHashBits];
+  memset(table, 0, sizeof(table));
+
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *end = src + size;
+  uint8_t *op = dst;
+  while (end - ip >= static_cast<ptrdiff_t>(kMinMatch)) {
+    uint32_t sequence = load32(ip);
+    uint32_t *entry = &table[hash32(sequence)];
+    const uint8_t *ref = src + *entry;
+    *entry = static_cast<uint32_t>(ip - src);
+    if (ref >= ip || static_cast<size_t>(ip - ref) > kMaxOffset ||
+        load32(ref) != sequence) {
+      ++ip;
+      continue;
+    }
+
+    size_t offset = ip - ref;
+    const uint8_t *match_end = ip + kMinMatch;
+    while (match_end < end && *match_end == *(match_end - offset)) {
+      ++match_end;
+    }
+    op = put_sequence(anchor, ip - anchor, match_end - ip, offset, op);
+    ip = match_end;
+    anchor = ip;
+  }
+
+  return put_sequence(anchor, end - anchor, 0, 0, op) - dst;
+}
+
+bool lz_decompress(const uint8_t *src, size_t size, uint8_t *dst,
+                   size_t raw_size) {
+  const uint8_t *ip = src;
+  const uint8_t *end = src + size;
+  uint8_t *op = dst;
+  uint8_t *out_end = dst + raw_size;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == kNibbleMax &&
+        !get_length(&ip, end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(end - ip) ||
+        literal_length > static_cast<size_t>(out_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+    if (ip == end) {
+      break;
+    }
+
+    if (end - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | static_cast<size_t>(ip[1]) << 8;
+    ip += 2;
+    size_t match_length = token & kNibbleMax;
+    if (match_length == kNibbleMax && !get_length(&ip, end, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+        match_length > static_cast<size_t>(out_end - op)) {
+      return false;
+    }
+
+    // the match may overlap its own output (a run), so copy forward.
+    const uint8_t *ref = op - offset;
+    if (offset >= match_length) {
+      memcpy(op, ref, match_length);
+      op += match_length;
+    } else {
+      for (size_t i = 0; i < match_length; ++i) {
+        *op++ = *ref++;
+      }
+    }
+  }
+  return op == out_end;
+}
+
+} // namespace tutorial
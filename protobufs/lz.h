@@ -0,0 +1,29 @@
+#ifndef LZ_H_
+#define LZ_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// a small byte-oriented LZ77 codec in the style of LZ4: greedy matching
+// through a hash of 4-byte sequences, 16-bit offsets, and a token byte per
+// sequence holding the literal and match lengths. it trades ratio for speed
+// against zlib; address book blocks are full of repeated domains and phone
+// prefixes, which even a greedy matcher finds.
+namespace tutorial {
+
+// worst-case compressed size of `size` input bytes.
+inline size_t lz_compress_bound(size_t size) { return size + size / 255 + 16; }
+
+// compresses [src, src + size) into `dst`, which must hold
+// lz_compress_bound(size) bytes; returns the compressed size.
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst);
+
+// decompresses exactly `raw_size` bytes into `dst`. false if the input is
+// malformed or does not decode to exactly `raw_size` bytes; never reads or
+// writes out of bounds either way.
+bool lz_decompress(const uint8_t *src, size_t size, uint8_t *dst,
+                   size_t raw_size);
+
+} // namespace tutorial
+
+#endif // LZ_H_
@@ -1,24 +1,440 @@
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <fstream>
+#include <memory>
 #include <string>
+#include <thread>
 
+#include "arena.h"
+#include "book_index.h"
+#include "columnar.h"
+#include "fast_decoder.h"
+#include "ingest.h"
+#include "interned_book.h"
+#include "loader.h"
+#include "mapped_file.h"
+#include "parallel_loader.h"
 #include "person.pb.h"
+#include "person_view.h"
+#include "pipelined_reader.h"
+#include "stats.h"
 
 using namespace std;
 
+namespace {
+
+// the serial loader with the specialized decoder in place of the generated
+// parser.
+bool load_fast(const char *path, tutorial::AddressBook *book,
+               tutorial::LoadStats *stats) {
+  tutorial::Stopwatch watch;
+  int people = book->person_size();
+
+  tutorial::MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  file.advise_sequential();
+  if (!tutorial::decode_address_book(file.data(), file.size(), book)) {
+    return false;
+  }
+
+  stats->bytes = file.size();
+  stats->people = book->person_size() - people;
+  stats->seconds = watch.seconds();
+  stats->peak_rss = tutorial::peak_rss_bytes();
+  return true;
+}
+
+// converts the book to columns straight from the mapping, then runs a few
+// single-column scans over the result.
+int scan_columns(const char *path) {
+  tutorial::Stopwatch watch;
+  tutorial::MappedFile file;
+  if (!file.open(path)) {
+    cerr << "Failed to open address book: " << path << endl;
+    return -1;
+  }
+  file.advise_sequential();
+
+  tutorial::ColumnarBook columns;
+  if (!columns.assign(file.data(), file.size())) {
+    cerr << "Failed to load address book: " << path << endl;
+    return -1;
+  }
+  cout << "converted " << columns.people() << " people to columns in "
+       << watch.seconds() * 1e3 << " ms" << endl;
+
+  watch.reset();
+  size_t people = columns.people();
+  const int32_t *ids = columns.ids();
+  int64_t id_sum = 0;
+  for (size_t i = 0; i < people; ++i) {
+    id_sum += ids[i];
+  }
+  int64_t emails = 0;
+  const uint64_t *has_email = columns.email_bitmap();
+  for (size_t i = 0; i < (people + 63) / 64; ++i) {
+    emails += __builtin_popcountll(has_email[i]);
+  }
+  int64_t types[3] = {};
+  const uint8_t *phone_types = columns.phone_types();
+  for (size_t i = 0; i < columns.phones(); ++i) {
+    ++types[phone_types[i]];
+  }
+
+  double seconds = watch.seconds();
+  size_t bytes = people * sizeof(int32_t) + (people + 63) / 64 * 8 +
+                 columns.phones();
+  cout << "scanned ids (sum " << id_sum << "), " << emails << " emails, "
+       << "phone types " << types[0] << "/" << types[1] << "/" << types[2]
+       << " in " << seconds * 1e3 << " ms, " << bytes / 1e6 / seconds
+       << " MB/s, peak RSS " << tutorial::peak_rss_bytes() / (1 << 20)
+       << " MB" << endl;
+  return 0;
+}
+
+// opens (building it first if missing or stale) the index at
+// ADDRESS_BOOK_FILE.idx, then times random lookups by id and by name, one at
+// a time and batched.
+int lookup_index(const char *path) {
+  tutorial::MappedFile file;
+  if (!file.open(path)) {
+    cerr << "Failed to open address book: " << path << endl;
+    return -1;
+  }
+
+  string index_path = string(path) + ".idx";
+  tutorial::BookIndex index;
+  if (!index.open(index_path, file.data(), file.size())) {
+    tutorial::Stopwatch watch;
+    if (!tutorial::BookIndex::build(file.data(), file.size(), index_path) ||
+        !index.open(index_path, file.data(), file.size())) {
+      cerr << "Failed to index address book: " << path << endl;
+      return -1;
+    }
+    cout << "built " << index_path << " in " << watch.seconds() * 1e3 << " ms"
+         << endl;
+  }
+
+  vector<int32_t> ids;
+  vector<tutorial::StringView> names;
+  tutorial::AddressBookView book(file.data(), file.size());
+  tutorial::PersonView person;
+  while (book.next(&person)) {
+    ids.push_back(person.id());
+    names.push_back(person.name());
+  }
+  mt19937 random(42);
+  shuffle(ids.begin(), ids.end(), random);
+  shuffle(names.begin(), names.end(), random);
+
+  size_t count = ids.size();
+  unique_ptr<tutorial::PersonView[]> people(new tutorial::PersonView[count]);
+  unique_ptr<bool[]> found(new bool[count]);
+  int64_t hits[4] = {};
+  double seconds[4];
+
+  tutorial::Stopwatch watch;
+  for (size_t i = 0; i < count; ++i) {
+    hits[0] += index.find_id(ids[i], &people[i]);
+  }
+  seconds[0] = watch.seconds();
+  watch.reset();
+  index.find_ids(ids.data(), count, people.get(), found.get());
+  hits[1] = count_if(found.get(), found.get() + count, [](bool b) { return b; });
+  seconds[1] = watch.seconds();
+  watch.reset();
+  for (size_t i = 0; i < count; ++i) {
+    hits[2] += index.find_name(names[i], &people[i]);
+  }
+  seconds[2] = watch.seconds();
+  watch.reset();
+  index.find_names(names.data(), count, people.get(), found.get());
+  hits[3] = count_if(found.get(), found.get() + count, [](bool b) { return b; });
+  seconds[3] = watch.seconds();
+
+  const char *labels[4] = {"id", "id, batched", "name", "name, batched"};
+  for (int i = 0; i < 4; ++i) {
+    cout << "lookup by " << labels[i] << ": " << hits[i] << "/" << count
+         << " found, " << seconds[i] * 1e9 / max<size_t>(count, 1)
+         << " ns each" << endl;
+  }
+  return 0;
+}
+
+// loads the book, then compares what it takes as generated messages with
+// its dictionary-encoded copy.
+int intern_book(const char *path) {
+  tutorial::AddressBook book;
+  if (!tutorial::load_address_book(path, &book)) {
+    cerr << "Failed to load address book: " << path << endl;
+    return -1;
+  }
+
+  tutorial::Stopwatch watch;
+  tutorial::InternedBook interned;
+  if (!interned.assign(book)) {
+    cerr << "Failed to intern address book (too large, or a phone has "
+            "unknown fields): "
+         << path << endl;
+    return -1;
+  }
+  double seconds = watch.seconds();
+
+  size_t messages = tutorial::space_used(book);
+  size_t bytes = interned.bytes_used();
+  cout << "interned " << interned.people() << " people in " << seconds * 1e3
+       << " ms: " << interned.domains().size() << " email domains, "
+       << interned.prefixes().size() << " phone prefixes" << endl;
+  cout << "messages " << messages / (1 << 20) << " MB, interned "
+       << bytes / (1 << 20) << " MB, saved "
+       << (messages - min(messages, bytes)) / (1 << 20) << " MB" << endl;
+  return 0;
+}
+
+void print_stage(const char *name, const tutorial::StageStats &stage,
+                 double seconds, int threads) {
+  double wall = seconds * threads;
+  cout << "  " << name << ": busy " << 100 * stage.busy / wall
+       << "%, starved " << 100 * stage.starved / wall << "%, blocked "
+       << 100 * stage.blocked / wall << "%" << endl;
+}
+
+// streams the book through the io/decode/consume pipeline, summing ids in
+// the consumer, and reports where each stage spent its time.
+int read_pipeline(const char *path, int decoders) {
+  tutorial::PipelineOptions options;
+  options.decoders = decoders;
+  int64_t id_sum = 0;
+  tutorial::PipelineStats stats;
+  bool ok = tutorial::read_pipelined(
+      path, options,
+      [&](const tutorial::AddressBook &batch) {
+        for (const tutorial::Person &person : batch.person()) {
+          id_sum += person.id();
+        }
+        return true;
+      },
+      &stats);
+  if (!ok) {
+    cerr << "Failed to load address book: " << path << endl;
+    return -1;
+  }
+
+  if (decoders <= 0) {
+    decoders = max(1, static_cast<int>(thread::hardware_concurrency()) - 1);
+  }
+  cout << "read " << stats.people << " people (id sum " << id_sum << ", "
+       << stats.bytes << " bytes) in " << stats.batches << " batches, "
+       << stats.seconds * 1e3 << " ms, "
+       << stats.bytes / 1e6 / stats.seconds << " MB/s, peak RSS "
+       << tutorial::peak_rss_bytes() / (1 << 20) << " MB" << endl;
+  print_stage("io", stats.io, stats.seconds, 1);
+  print_stage("decode", stats.decode, stats.seconds, decoders);
+  print_stage("consume", stats.consume, stats.seconds, 1);
+  return 0;
+}
+
+// loads every regular file in `dir` as an AddressBook, many at a time.
+int ingest_directory(const char *dir, bool use_uring) {
+  vector<string> paths;
+  DIR *listing = opendir(dir);
+  if (!listing) {
+    cerr << "Failed to open directory: " << dir << endl;
+    return -1;
+  }
+  while (struct dirent *entry = readdir(listing)) {
+    string path = string(dir) + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      paths.push_back(path);
+    }
+  }
+  closedir(listing);
+  sort(paths.begin(), paths.end());
+
+  tutorial::IngestOptions options;
+  options.use_uring = use_uring;
+  tutorial::IngestStats stats;
+  tutorial::ingest_address_books(
+      paths, options, [](size_t, tutorial::AddressBook *) {}, &stats);
+  cout << "ingested " << stats.files << " files (" << stats.failed
+       << " failed, " << stats.people << " people, " << stats.bytes
+       << " bytes) via " << (stats.used_uring ? "io_uring" : "threads")
+       << " in " << stats.seconds * 1e3 << " ms, "
+       << stats.files / stats.seconds << " files/s, latency p50 "
+       << stats.p50_latency * 1e6 << " us, p99 " << stats.p99_latency * 1e6
+       << " us" << endl;
+  return stats.failed == 0 ? 0 : -1;
+}
+
+} // namespace
+
 int main(int argc, char **argv) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-  if (argc != 2) {
-    cerr << "Usage: " << argv[0] << " ADDRESS_BOOK_FILE" << endl;
+  // --threads 0 (the default) loads on the calling thread; anything else goes
+  // through the parallel loader, with a negative count meaning every hardware
+  // thread. --arena parses serially into an arena-backed book. --view scans
+  // ids straight off the mapping without materializing any Person. --fast
+  // parses serially with the specialized decoder, alone or with --arena.
+  // --columns converts to the columnar layout and scans that. --index looks
+  // people up through the book's persistent index. --intern reports the
+  // memory saved by the dictionary-encoded copy. --pipeline N reads through
+  // the three-stage pipeline with N decoder threads (0 picks a count).
+  // --ingest loads every file in the directory ADDRESS_BOOK_FILE at once, with
+  // io_uring unless --no-uring is also given.
+  int threads = 0;
+  int pipeline = -1;
+  bool arena = false;
+  bool view = false;
+  bool fast = false;
+  bool columns = false;
+  bool indexed = false;
+  bool intern = false;
+  bool ingest = false;
+  bool use_uring = true;
+  int arg = 1;
+  for (; arg < argc - 1; ++arg) {
+    if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc - 1) {
+      threads = atoi(argv[++arg]);
+    } else if (strcmp(argv[arg], "--arena") == 0) {
+      arena = true;
+    } else if (strcmp(argv[arg], "--view") == 0) {
+      view = true;
+    } else if (strcmp(argv[arg], "--fast") == 0) {
+      fast = true;
+    } else if (strcmp(argv[arg], "--columns") == 0) {
+      columns = true;
+    } else if (strcmp(argv[arg], "--index") == 0) {
+      indexed = true;
+    } else if (strcmp(argv[arg], "--intern") == 0) {
+      intern = true;
+    } else if (strcmp(argv[arg], "--ingest") == 0) {
+      ingest = true;
+    } else if (strcmp(argv[arg], "--no-uring") == 0) {
+      use_uring = false;
+    } else if (strcmp(argv[arg], "--pipeline") == 0 && arg + 1 < argc - 1) {
+      pipeline = atoi(argv[++arg]);
+    } else {
+      break;
+    }
+  }
+
+  int modes = (threads != 0) + (arena || fast) + view + columns + indexed +
+              intern + (pipeline >= 0) + ingest;
+  if (arg != argc - 1 || modes > 1 || (!use_uring && !ingest)) {
+    cerr << "Usage: " << argv[0]
+         << " [--threads N | [--arena] [--fast] | --view | --columns |"
+         << " --index | --intern | --pipeline N | --ingest [--no-uring]]"
+         << " ADDRESS_BOOK_FILE" << endl;
     return -1;
   }
+  const char *path = argv[arg];
+
+  if (columns) {
+    return scan_columns(path);
+  }
+  if (indexed) {
+    return lookup_index(path);
+  }
+  if (intern) {
+    return intern_book(path);
+  }
+  if (pipeline >= 0) {
+    return read_pipeline(path, pipeline);
+  }
+  if (ingest) {
+    return ingest_directory(path, use_uring);
+  }
 
-  tutorial::AddressBook address_book;
+  if (view) {
+    tutorial::Stopwatch watch;
+    tutorial::MappedFile file;
+    if (!file.open(path)) {
+      cerr << "Failed to open address book: " << path << endl;
+      return -1;
+    }
+    file.advise_sequential();
+
+    tutorial::AddressBookView book(file.data(), file.size());
+    tutorial::PersonView person;
+    int people = 0;
+    int64_t id_sum = 0;
+    while (book.next(&person)) {
+      id_sum += person.id();
+      ++people;
+    }
+    if (book.failed()) {
+      cerr << "Malformed address book: " << path << endl;
+      return -1;
+    }
+
+    double seconds = watch.seconds();
+    cout << "scanned " << people << " ids (sum " << id_sum << ") in "
+         << seconds * 1e3 << " ms, " << file.size() / 1e6 / seconds
+         << " MB/s, peak RSS " << tutorial::peak_rss_bytes() / (1 << 20)
+         << " MB" << endl;
+    return 0;
+  }
+
+  unique_ptr<tutorial::AddressBook> heap_book;
+  unique_ptr<tutorial::ArenaAddressBook> arena_book;
+  tutorial::AddressBook *address_book;
+  if (arena) {
+    arena_book.reset(new tutorial::ArenaAddressBook);
+    address_book = arena_book->book();
+  } else {
+    heap_book.reset(new tutorial::AddressBook);
+    address_book = heap_book.get();
+  }
 
   {
-    // Read the existing address book.
-    fstream input(argv[1, ios::in | ios::binary);
+    // Read the existing address book straight out of the page cache.
+    tutorial::LoadStats stats;
+    tutorial::AllocationCounters before = tutorial::thread_allocations();
+    bool loaded;
+    if (threads == 0) {
+      tutorial::Arena *target = arena ? arena_book->arena() : nullptr;
+      tutorial::ArenaScope scope(target);
+      loaded = fast ? load_fast(path, address_book, &stats)
+                    : tutorial::load_address_book(path, address_book, &stats);
+    } else {
+      loaded = tutorial::load_address_book_parallel(path, threads,
+                                                    address_book, &stats);
+    }
+    tutorial::AllocationCounters after = tutorial::thread_allocations();
+
+    if (!loaded) {
+      cerr << "Failed to load address book: " << path << endl;
+      return -1;
+    }
+
+    cout << "loaded " << stats.people << " people (" << stats.bytes
+         << " bytes) in " << stats.seconds * 1e3 << " ms, "
+         << stats.bytes / 1e6 / stats.seconds << " MB/s, peak RSS "
+         << stats.peak_rss / (1 << 20) << " MB" << endl;
+
+    // the counters are per thread, so they miss the parallel loader's workers.
+    if (threads == 0) {
+      double people = max(1, stats.people);
+      cout << "allocations per person: heap "
+           << (after.heap - before.heap) / people << ", arena "
+           << (after.arena - before.arena) / people << endl;
+    }
   }
 
+  tutorial::Stopwatch teardown;
+  heap_book.reset();
+  arena_book.reset();
+  cout << "teardown in " << teardown.seconds() * 1e3 << " ms" << endl;
+
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
 }
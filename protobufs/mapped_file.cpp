@@ -0,0 +1,107 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace tutorial {
+
+namespace {
+
+size_t page_size() {
+  static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+} // namespace
+
+MappedFile::MappedFile(MappedFile &&other) : MappedFile() {
+  *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) {
+  if (this != &other) {
+    close();
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_open, other.m_open);
+  }
+  return *this;
+}
+
+bool MappedFile::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size > 0) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    m_data = static_cast<uint8_t *>(addr);
+  }
+
+  // the mapping holds its own reference to the file.
+  ::close(fd);
+  m_size = size;
+  m_open = true;
+  return true;
+}
+
+void MappedFile::close() {
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+  }
+  m_data = nullptr;
+  m_size = 0;
+  m_open = false;
+}
+
+void MappedFile::advise_sequential() { advise(0, m_size, MADV_SEQUENTIAL); }
+
+void MappedFile::advise_willneed(size_t offset, size_t length) {
+  advise(offset, length, MADV_WILLNEED);
+}
+
+void MappedFile::advise_dontneed(size_t offset, size_t length) {
+  advise(offset, length, MADV_DONTNEED);
+}
+
+void MappedFile::advise(size_t offset, size_t length, int advice) {
+  if (m_data == nullptr || offset >= m_size) {
+    return;
+  }
+
+  // madvise wants a page-aligned start; round the start down and the end up,
+  // except for MADV_DONTNEED, where only whole pages inside the range may go.
+  size_t end = std::min(m_size, offset + length);
+  size_t begin = offset & ~(page_size() - 1);
+  if (advice == MADV_DONTNEED) {
+    begin = (offset + page_size() - 1) & ~(page_size() - 1);
+    end = end == m_size ? end : end & ~(page_size() - 1);
+    if (begin >= end) {
+      return;
+    }
+  }
+
+  // hints are best-effort; a failure only costs performance.
+  madvise(m_data + begin, end - begin, advice);
+}
+
+} // namespace tutorial
@@ -0,0 +1,48 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tutorial {
+
+// read-only mmap of an entire file; bytes are handed to CodedInputStream
+// directly, so nothing is copied on the way from the page cache to the parser.
+class MappedFile {
+public:
+  MappedFile() : m_data(nullptr), m_size(0), m_open(false) {}
+  ~MappedFile() { close(); }
+
+  MappedFile(MappedFile &&other);
+  MappedFile &operator=(MappedFile &&other);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // returns false (and leaves the object closed) if the file cannot be
+  // opened or mapped; an empty file maps successfully with size() == 0.
+  bool open(const std::string &path);
+  void close();
+
+  // madvise hints; ranges are clamped to the mapping and page-aligned.
+  void advise_sequential();
+  void advise_willneed(size_t offset, size_t length);
+  // drops already-consumed pages from our RSS; the page cache keeps them.
+  void advise_dontneed(size_t offset, size_t length);
+
+  const uint8_t *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool is_open() const { return m_open; }
+
+private:
+  void advise(size_t offset, size_t length, int advice);
+
+  uint8_t *m_data;
+  size_t m_size;
+  bool m_open;
+};
+
+} // namespace tutorial
+
+#endif // MAPPED_FILE_H_
@@ -0,0 +1,120 @@
+#include "message_pool.h"
+
+#include <algorithm>
+
+namespace tutorial {
+
+namespace {
+
+const size_t kDefaultCapacity = 4096;
+
+} // namespace
+
+const int PersonPool::kMaxSparePhones;
+
+PersonPool::PersonPool() : m_capacity(kDefaultCapacity), m_spare_phones(0) {}
+
+PersonPool::~PersonPool() { trim(); }
+
+PersonPool &PersonPool::local() {
+  static thread_local PersonPool pool;
+  return pool;
+}
+
+Person *PersonPool::acquire() {
+  Person *person;
+  if (m_people.empty()) {
+    person = new Person;
+  } else {
+    person = m_people.back();
+    m_people.pop_back();
+  }
+
+  google::protobuf::RepeatedPtrField<Person_PhoneNumber> *phones =
+      person->mutable_phone();
+  while (phones->ClearedCount() < m_spare_phones && !m_phones.empty()) {
+    phones->AddCleared(m_phones.back());
+    m_phones.pop_back();
+  }
+  return person;
+}
+
+void PersonPool::release(Person *person) {
+  if (person == nullptr) {
+    return;
+  }
+  if (m_people.size() >= m_capacity) {
+    delete person;
+    return;
+  }
+
+  person->Clear();
+  google::protobuf::RepeatedPtrField<Person_PhoneNumber> *phones =
+      person->mutable_phone();
+  m_spare_phones = std::max(m_spare_phones,
+                            std::min(phones->ClearedCount(), kMaxSparePhones));
+  while (phones->ClearedCount() > m_spare_phones) {
+    Person_PhoneNumber *phone = phones->ReleaseCleared();
+    if (m_phones.size() < m_capacity * kMaxSparePhones) {
+      m_phones.push_back(phone);
+    } else {
+      delete phone;
+    }
+  }
+  m_people.push_back(person);
+}
+
+void PersonPool::acquire(size_t count, std::vector<Person *> *people) {
+  people->reserve(people->size() + count);
+  for (size_t i = 0; i < count; ++i) {
+    people->push_back(acquire());
+  }
+}
+
+void PersonPool::release(Person *const *people, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    release(people[i]);
+  }
+}
+
+void PersonPool::recycle(AddressBook *book) {
+  google::protobuf::RepeatedPtrField<Person> *people = book->mutable_person();
+  while (people->size() > 0) {
+    release(people->ReleaseLast());
+  }
+  while (people->ClearedCount() > 0) {
+    release(people->ReleaseCleared());
+  }
+}
+
+void PersonPool::prime(AddressBook *book, int count) {
+  google::protobuf::RepeatedPtrField<Person> *people = book->mutable_person();
+  for (int i = 0; i < count; ++i) {
+    people->AddCleared(acquire());
+  }
+}
+
+void PersonPool::set_capacity(size_t people) {
+  m_capacity = people;
+  while (m_people.size() > m_capacity) {
+    delete m_people.back();
+    m_people.pop_back();
+  }
+  while (m_phones.size() > m_capacity * kMaxSparePhones) {
+    delete m_phones.back();
+    m_phones.pop_back();
+  }
+}
+
+void PersonPool::trim() {
+  for (Person *person : m_people) {
+    delete person;
+  }
+  for (Person_PhoneNumber *phone : m_phones) {
+    delete phone;
+  }
+  m_people.clear();
+  m_phones.clear();
+}
+
+} // namespace tutorial
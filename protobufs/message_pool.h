@@ -0,0 +1,69 @@
+#ifndef MESSAGE_POOL_H_
+#define MESSAGE_POOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "person.pb.h"
+
+// free lists of cleared Person and PhoneNumber messages, one pool per thread.
+// Clear() keeps a message's string capacity and leaves its phones allocated
+// as cleared elements of the RepeatedPtrField, so a recycled Person parses
+// the next record of similar shape without constructing anything or calling
+// malloc. the phone pool evens out the spare phones between people: each
+// released Person keeps up to the most phones any record has needed (capped
+// at kMaxSparePhones), passes the rest to the pool, and is topped back up
+// from it when handed out.
+//
+// pooled messages are ordinary heap objects. don't release messages
+// allocated inside an ArenaScope (arena.h); they would outlive their arena.
+namespace tutorial {
+
+class PersonPool {
+public:
+  static const int kMaxSparePhones = 16;
+
+  PersonPool();
+  ~PersonPool();
+
+  PersonPool(const PersonPool &) = delete;
+  PersonPool &operator=(const PersonPool &) = delete;
+
+  // the calling thread's pool, deleted with its contents at thread exit.
+  static PersonPool &local();
+
+  // a cleared Person, from the pool if it has one.
+  Person *acquire();
+  // clears `person` and keeps it, or deletes it if the pool is full.
+  void release(Person *person);
+
+  // the same for `count` messages at a time.
+  void acquire(size_t count, std::vector<Person *> *people);
+  void release(Person *const *people, size_t count);
+
+  // moves every Person out of `book`, live or cleared, into the pool.
+  void recycle(AddressBook *book);
+  // hands `count` pooled people to `book` as cleared elements, so that the
+  // next `count` add_person() calls, including the generated parser's,
+  // reuse them instead of allocating.
+  void prime(AddressBook *book, int count);
+
+  size_t people() const { return m_people.size(); }
+  size_t phones() const { return m_phones.size(); }
+
+  // pooled people beyond `people` (and phones beyond kMaxSparePhones times
+  // that) are deleted on release; the default is 4096.
+  void set_capacity(size_t people);
+  // deletes everything pooled.
+  void trim();
+
+private:
+  std::vector<Person *> m_people;
+  std::vector<Person_PhoneNumber *> m_phones;
+  size_t m_capacity;
+  int m_spare_phones;
+};
+
+} // namespace tutorial
+
+#endif // MESSAGE_POOL_H_
@@ -0,0 +1,618 @@
+#include "packed_book.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "file_io.h"
+#include "mapped_file.h"
+#include "string_view.h"
+#include "varint.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const char kMagic[8] = {'X', 'P', 'P', 'A', 'C', 'K', '0', '1'};
+
+// ids per block, as 32 rows of 4 lanes: id 4 * row + lane sits in `lane`.
+const size_t kBlockIds = 128;
+const int kRows = 32;
+const int kLanes = 4;
+
+const uint8_t kUnsetType = 3;
+
+struct IdBlock {
+  int32_t first;
+  // the narrowest gap between consecutive ids, which every gap is stored
+  // relative to.
+  uint32_t min_delta;
+  // bits per stored gap; the block is followed by 4 * width packed words.
+  uint32_t width;
+  uint32_t reserved;
+};
+
+int bit_width(uint32_t value) {
+  return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+// packs 128 values of `width` bits, each lane into its own run of `width`
+// words, interleaved with the other lanes' so that word k of every lane is
+// one 16-byte load.
+void pack_lanes(const uint32_t *values, int width, uint32_t *out) {
+  for (int lane = 0; lane < kLanes; ++lane) {
+    uint32_t *word = out + lane;
+    uint32_t bits = 0;
+    int used = 0;
+    for (int row = 0; row < kRows; ++row) {
+      uint32_t value = values[row * kLanes + lane];
+      bits |= value << used;
+      used += width;
+      if (used >= 32) {
+        *word = bits;
+        word += kLanes;
+        used -= 32;
+        bits = used > 0 ? value >> (width - used) : 0;
+      }
+    }
+  }
+}
+
+// ids are the running sum of min_delta plus each stored gap, starting from
+// first - min_delta so that the first stored gap, always zero, lands on
+// `first`.
+void unpack_block_scalar(const IdBlock &block, const uint32_t *in,
+                         int32_t *out) {
+  int width = block.width;
+  uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+  uint32_t gaps[kBlockIds];
+  for (int lane = 0; lane < kLanes; ++lane) {
+    const uint32_t *word = in + lane;
+    uint32_t bits = width > 0 ? *word : 0;
+    int used = 0;
+    for (int row = 0; row < kRows; ++row) {
+      uint32_t value = bits >> used;
+      used += width;
+      if (used >= 32) {
+        used -= 32;
+        if (row + 1 < kRows || used > 0) {
+          word += kLanes;
+          bits = *word;
+        }
+        if (used > 0) {
+          value |= bits << (width - used);
+        }
+      }
+      gaps[row * kLanes + lane] = value & mask;
+    }
+  }
+  uint32_t id = static_cast<uint32_t>(block.first) - block.min_delta;
+  for (size_t i = 0; i < kBlockIds; ++i) {
+    id += gaps[i] + block.min_delta;
+    out[i] = static_cast<int32_t>(id);
+  }
+}
+
+#if defined(__SSE2__)
+
+// the scalar loop with the four lanes in one register, and the running sum
+// done a row at a time: two shifted adds sum within the row, and the last
+// id of the row before is broadcast and added on top.
+void unpack_block_sse2(const IdBlock &block, const uint32_t *in,
+                       int32_t *out) {
+  int width = block.width;
+  const __m128i mask = _mm_set1_epi32(width == 32 ? ~0u : (1u << width) - 1);
+  const __m128i min_delta = _mm_set1_epi32(block.min_delta);
+  const __m128i *word = reinterpret_cast<const __m128i *>(in);
+  __m128i bits = width > 0 ? _mm_loadu_si128(word) : _mm_setzero_si128();
+  __m128i id = _mm_set1_epi32(static_cast<uint32_t>(block.first) -
+                              block.min_delta);
+  __m128i *dst = reinterpret_cast<__m128i *>(out);
+  int used = 0;
+  for (int row = 0; row < kRows; ++row) {
+    __m128i value = _mm_srl_epi32(bits, _mm_cvtsi32_si128(used));
+    used += width;
+    if (used >= 32) {
+      used -= 32;
+      if (row + 1 < kRows || used > 0) {
+        bits = _mm_loadu_si128(++word);
+      }
+      if (used > 0) {
+        value = _mm_or_si128(
+            value, _mm_sll_epi32(bits, _mm_cvtsi32_si128(width - used)));
+      }
+    }
+    __m128i sum = _mm_add_epi32(_mm_and_si128(value, mask), min_delta);
+    sum = _mm_add_epi32(sum, _mm_slli_si128(sum, 4));
+    sum = _mm_add_epi32(sum, _mm_slli_si128(sum, 8));
+    id = _mm_add_epi32(sum, id);
+    _mm_storeu_si128(dst + row, id);
+    id = _mm_shuffle_epi32(id, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+}
+
+#endif // __SSE2__
+
+// `scalar` picks the portable loop even where SSE2 is available.
+void unpack_block(const IdBlock &block, const uint32_t *in, int32_t *out,
+                  bool scalar) {
+#if defined(__SSE2__)
+  if (!scalar) {
+    unpack_block_sse2(block, in, out);
+    return;
+  }
+#endif
+  unpack_block_scalar(block, in, out);
+}
+
+void pack_ids(const std::vector<int32_t> &ids, std::string *out) {
+  for (size_t begin = 0; begin < ids.size(); begin += kBlockIds) {
+    size_t count = std::min(kBlockIds, ids.size() - begin);
+    const int32_t *block_ids = ids.data() + begin;
+    uint32_t gaps[kBlockIds] = {};
+    uint32_t min_delta = ~0u;
+    for (size_t i = 1; i < count; ++i) {
+      min_delta = std::min(min_delta, static_cast<uint32_t>(block_ids[i]) -
+                                          static_cast<uint32_t>(
+                                              block_ids[i - 1]));
+    }
+    if (count == 1) {
+      min_delta = 0;
+    }
+    uint32_t widest = 0;
+    for (size_t i = 1; i < count; ++i) {
+      gaps[i] = static_cast<uint32_t>(block_ids[i]) -
+                static_cast<uint32_t>(block_ids[i - 1]) - min_delta;
+      widest = std::max(widest, gaps[i]);
+    }
+
+    IdBlock block;
+    block.first = block_ids[0];
+    block.min_delta = min_delta;
+    block.width = bit_width(widest);
+    block.reserved = 0;
+    uint32_t packed[kLanes * 32];
+    pack_lanes(gaps, block.width, packed);
+    out->append(reinterpret_cast<const char *>(&block), sizeof(block));
+    out->append(reinterpret_cast<const char *>(packed),
+                kLanes * block.width * sizeof(uint32_t));
+  }
+}
+
+// decodes `count` ids from the id section [p, end).
+bool unpack_id_section(const uint8_t *p, const uint8_t *end, size_t count,
+                       bool scalar, int32_t *ids) {
+  uint32_t packed[kLanes * 32];
+  int32_t tail[kBlockIds];
+  for (size_t begin = 0; begin < count; begin += kBlockIds) {
+    IdBlock block;
+    if (static_cast<size_t>(end - p) < sizeof(block)) {
+      return false;
+    }
+    memcpy(&block, p, sizeof(block));
+    p += sizeof(block);
+    size_t bytes = kLanes * block.width * sizeof(uint32_t);
+    if (block.width > 32 || static_cast<size_t>(end - p) < bytes) {
+      return false;
+    }
+    // copied out so that the scalar unpacker's word loads are aligned
+    // whatever buffer the caller passed.
+    memcpy(packed, p, bytes);
+    p += bytes;
+    if (count - begin >= kBlockIds) {
+      unpack_block(block, packed, ids + begin, scalar);
+    } else {
+      unpack_block(block, packed, tail, scalar);
+      memcpy(ids + begin, tail, (count - begin) * sizeof(int32_t));
+    }
+  }
+  return p == end;
+}
+
+void pack_type(size_t phone, uint8_t type, std::string *out) {
+  if (phone % 4 == 0) {
+    out->push_back(0);
+  }
+  (*out)[phone / 4] |= type << (2 * (phone % 4));
+}
+
+// expands 2-bit types to one byte each.
+void unpack_types(const uint8_t *packed, size_t count, uint8_t *types) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi8(3);
+  for (; i + 64 <= count; i += 64) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(packed + i / 4));
+    __m128i t0 = _mm_and_si128(bytes, mask);
+    __m128i t1 = _mm_and_si128(_mm_srli_epi16(bytes, 2), mask);
+    __m128i t2 = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i t3 = _mm_and_si128(_mm_srli_epi16(bytes, 6), mask);
+    __m128i low01 = _mm_unpacklo_epi8(t0, t1);
+    __m128i high01 = _mm_unpackhi_epi8(t0, t1);
+    __m128i low23 = _mm_unpacklo_epi8(t2, t3);
+    __m128i high23 = _mm_unpackhi_epi8(t2, t3);
+    __m128i *out = reinterpret_cast<__m128i *>(types + i);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(low01, low23));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low01, low23));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high01, high23));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high01, high23));
+  }
+#endif
+  for (; i < count; ++i) {
+    types[i] = (packed[i / 4] >> (2 * (i % 4))) & 3;
+  }
+}
+
+// a string's length plus one, zero if unset, and its bytes.
+void pack_string(bool has, const std::string &value, std::string *lengths,
+                 std::string *blob) {
+  uint8_t length[10];
+  uint8_t *end = wire::write_varint64(has ? value.size() + 1 : 0, length);
+  lengths->append(reinterpret_cast<const char *>(length), end - length);
+  blob->append(value);
+}
+
+void pack_varint(uint64_t value, std::string *out) {
+  uint8_t bytes[10];
+  uint8_t *end = wire::write_varint64(value, bytes);
+  out->append(reinterpret_cast<const char *>(bytes), end - bytes);
+}
+
+void append_section(const std::string &bytes, std::string *out) {
+  static const char kPadding[8] = {};
+  uint64_t length = bytes.size();
+  out->append(reinterpret_cast<const char *>(&length), sizeof(length));
+  out->append(bytes);
+  out->append(kPadding, (8 - bytes.size() % 8) % 8);
+}
+
+// a person's or phone's unknown fields as wire bytes; copying them into an
+// otherwise empty message is the one way to serialize them that protobuf
+// 2.5 and 3.x both offer.
+std::string unknown_fields_bytes(const Person &person) {
+  if (person.unknown_fields().empty()) {
+    return std::string();
+  }
+  Person unknown;
+  unknown.mutable_unknown_fields()->MergeFrom(person.unknown_fields());
+  return unknown.SerializePartialAsString();
+}
+
+// bounds-checked cursor over the sections of a packed book.
+class SectionReader {
+public:
+  SectionReader(const uint8_t *data, size_t size)
+      : m_ptr(data), m_end(data + size) {}
+
+  bool read(void *out, size_t size) {
+    if (static_cast<size_t>(m_end - m_ptr) < size) {
+      return false;
+    }
+    memcpy(out, m_ptr, size);
+    m_ptr += size;
+    return true;
+  }
+
+  bool section(const uint8_t **begin, const uint8_t **end) {
+    uint64_t length;
+    if (!read(&length, sizeof(length))) {
+      return false;
+    }
+    uint64_t padded = (length + 7) & ~uint64_t(7);
+    if (padded < length || padded > static_cast<uint64_t>(m_end - m_ptr)) {
+      return false;
+    }
+    *begin = m_ptr;
+    *end = m_ptr + length;
+    m_ptr += padded;
+    return true;
+  }
+
+  bool done() const { return m_ptr == m_end; }
+  // varint loads may run this far past a section.
+  const uint8_t *readable_end() const { return m_end; }
+
+private:
+  const uint8_t *m_ptr;
+  const uint8_t *m_end;
+};
+
+// decodes exactly `count` varints, which must fill [p, end).
+bool unpack_varints(const uint8_t *p, const uint8_t *end,
+                    const uint8_t *readable_end, size_t count,
+                    std::vector<uint64_t> *values) {
+  values->resize(count);
+  uint64_t *out = values->data();
+  for (size_t done = 0; done < count;) {
+    int batch = static_cast<int>(std::min<size_t>(16, count - done));
+    if (wire::next_varints(&p, end, readable_end, out + done, batch) !=
+        batch) {
+      return false;
+    }
+    done += batch;
+  }
+  return p == end;
+}
+
+// reads the header and the id section.
+bool open_packed(SectionReader *reader, uint64_t *people, uint64_t *phones,
+                 const uint8_t **ids, const uint8_t **ids_end) {
+  char magic[sizeof(kMagic)];
+  return reader->read(magic, sizeof(magic)) &&
+         memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+         reader->read(people, sizeof(*people)) &&
+         reader->read(phones, sizeof(*phones)) && *people <= INT32_MAX &&
+         *phones <= INT32_MAX && reader->section(ids, ids_end);
+}
+
+// hands out consecutive strings of a blob by their packed lengths.
+class StringCursor {
+public:
+  StringCursor(const uint8_t *blob, const uint8_t *blob_end,
+               const std::vector<uint64_t> &lengths)
+      : m_ptr(reinterpret_cast<const char *>(blob)),
+        m_end(reinterpret_cast<const char *>(blob_end)), m_lengths(lengths),
+        m_next(0), m_failed(false) {}
+
+  // the next string; false if it is unset or overruns the blob.
+  bool next(StringView *value) {
+    uint64_t length = m_lengths[m_next++];
+    if (length == 0) {
+      return false;
+    }
+    if (length - 1 > static_cast<uint64_t>(m_end - m_ptr)) {
+      m_failed = true;
+      return false;
+    }
+    *value = StringView(m_ptr, length - 1);
+    m_ptr += length - 1;
+    return true;
+  }
+
+  // true if every string was in bounds and the blob is used up.
+  bool finished() const { return !m_failed && m_ptr == m_end; }
+
+private:
+  const char *m_ptr;
+  const char *m_end;
+  const std::vector<uint64_t> &m_lengths;
+  size_t m_next;
+  bool m_failed;
+};
+
+// parses wire bytes holding only unknown fields into `message`.
+bool merge_unknown(const uint8_t *data, size_t size,
+                   google::protobuf::MessageLite *message) {
+  google::protobuf::io::CodedInputStream input(data, static_cast<int>(size));
+  return message->MergePartialFromCodedStream(&input) &&
+         input.ConsumedEntireMessage();
+}
+
+// the id column; `scalar` as for unpack_block().
+bool read_ids(const uint8_t *data, size_t size, bool scalar,
+              std::vector<int32_t> *ids) {
+  SectionReader reader(data, size);
+  uint64_t people;
+  uint64_t phones;
+  const uint8_t *begin;
+  const uint8_t *end;
+  if (!open_packed(&reader, &people, &phones, &begin, &end)) {
+    return false;
+  }
+  ids->resize(people);
+  return unpack_id_section(begin, end, people, scalar, ids->data());
+}
+
+} // namespace
+
+bool pack_address_book(const AddressBook &book, std::string *out) {
+  size_t people = book.person_size();
+  std::vector<int32_t> ids(people);
+  std::string name_lengths, names, email_lengths, emails;
+  std::string phone_counts, number_lengths, numbers, types;
+  std::string extra_index, extras;
+  size_t phones = 0;
+  size_t next_extra = 0;
+  for (size_t i = 0; i < people; ++i) {
+    const Person &person = book.person(static_cast<int>(i));
+    if (!person.has_id()) {
+      return false;
+    }
+    ids[i] = person.id();
+    pack_string(person.has_name(), person.name(), &name_lengths, &names);
+    pack_string(person.has_email(), person.email(), &email_lengths, &emails);
+    pack_varint(person.phone_size(), &phone_counts);
+    for (int j = 0; j < person.phone_size(); ++j) {
+      const Person::PhoneNumber &phone = person.phone(j);
+      if (!phone.unknown_fields().empty()) {
+        return false;
+      }
+      pack_string(phone.has_number(), phone.number(), &number_lengths,
+                  &numbers);
+      pack_type(phones++,
+                phone.has_type() ? static_cast<uint8_t>(phone.type())
+                                 : kUnsetType,
+                &types);
+    }
+    if (!person.unknown_fields().empty()) {
+      // few people have unknown fields, so only they are listed: the gap
+      // from the one before and the length of their bytes.
+      std::string unknown = unknown_fields_bytes(person);
+      pack_varint(i - next_extra, &extra_index);
+      pack_varint(unknown.size(), &extra_index);
+      extras += unknown;
+      next_extra = i + 1;
+    }
+  }
+  std::string packed_ids;
+  pack_ids(ids, &packed_ids);
+  std::string book_extras;
+  if (!book.unknown_fields().empty()) {
+    AddressBook unknown;
+    unknown.mutable_unknown_fields()->MergeFrom(book.unknown_fields());
+    book_extras = unknown.SerializePartialAsString();
+  }
+
+  uint64_t counts[2] = {people, phones};
+  out->assign(kMagic, sizeof(kMagic));
+  out->append(reinterpret_cast<const char *>(counts), sizeof(counts));
+  for (const std::string *section :
+       {&packed_ids, &name_lengths, &names, &email_lengths, &emails,
+        &phone_counts, &number_lengths, &numbers, &types, &extra_index,
+        &extras, &book_extras}) {
+    append_section(*section, out);
+  }
+  return true;
+}
+
+bool unpack_address_book(const uint8_t *data, size_t size, AddressBook *book) {
+  book->Clear();
+  SectionReader reader(data, size);
+  uint64_t people;
+  uint64_t phones;
+  const uint8_t *ids_begin;
+  const uint8_t *ids_end;
+  if (!open_packed(&reader, &people, &phones, &ids_begin, &ids_end)) {
+    return false;
+  }
+  std::vector<int32_t> ids(people);
+  if (!unpack_id_section(ids_begin, ids_end, people, false, ids.data())) {
+    return false;
+  }
+
+  // (begin, end) of the remaining sections, in file order.
+  enum {
+    kNameLengths, kNames, kEmailLengths, kEmails, kPhoneCounts,
+    kNumberLengths, kNumbers, kTypes, kExtraIndex, kExtras, kBookExtras,
+    kSections
+  };
+  const uint8_t *begin[kSections];
+  const uint8_t *end[kSections];
+  for (int i = 0; i < kSections; ++i) {
+    if (!reader.section(&begin[i], &end[i])) {
+      return false;
+    }
+  }
+  const uint8_t *readable_end = reader.readable_end();
+  std::vector<uint64_t> name_lengths, email_lengths, phone_counts,
+      number_lengths;
+  if (!reader.done() ||
+      !unpack_varints(begin[kNameLengths], end[kNameLengths], readable_end,
+                      people, &name_lengths) ||
+      !unpack_varints(begin[kEmailLengths], end[kEmailLengths], readable_end,
+                      people, &email_lengths) ||
+      !unpack_varints(begin[kPhoneCounts], end[kPhoneCounts], readable_end,
+                      people, &phone_counts) ||
+      !unpack_varints(begin[kNumberLengths], end[kNumberLengths],
+                      readable_end, phones, &number_lengths) ||
+      static_cast<size_t>(end[kTypes] - begin[kTypes]) != (phones + 3) / 4) {
+    return false;
+  }
+  std::vector<uint8_t> types(phones);
+  unpack_types(begin[kTypes], phones, types.data());
+
+  StringCursor names(begin[kNames], end[kNames], name_lengths);
+  StringCursor emails(begin[kEmails], end[kEmails], email_lengths);
+  StringCursor numbers(begin[kNumbers], end[kNumbers], number_lengths);
+  const uint8_t *extra_index = begin[kExtraIndex];
+  const uint8_t *extras = begin[kExtras];
+  // the next person with unknown fields, and how many bytes they have.
+  uint64_t extra_person = people;
+  uint64_t extra_size = 0;
+  auto next_extra = [&](uint64_t from) {
+    uint64_t gap;
+    if (extra_index == end[kExtraIndex]) {
+      extra_person = people;
+      return true;
+    }
+    if (!wire::read_varint64(&extra_index, end[kExtraIndex], &gap) ||
+        !wire::read_varint64(&extra_index, end[kExtraIndex], &extra_size) ||
+        gap >= people - from) {
+      return false;
+    }
+    extra_person = from + gap;
+    return true;
+  };
+  if (!next_extra(0)) {
+    return false;
+  }
+  size_t phone = 0;
+  book->mutable_person()->Reserve(static_cast<int>(people));
+  for (size_t i = 0; i < people; ++i) {
+    Person *person = book->add_person();
+    StringView str;
+    if (names.next(&str)) {
+      person->mutable_name()->assign(str.data(), str.size());
+    }
+    person->set_id(ids[i]);
+    if (emails.next(&str)) {
+      person->mutable_email()->assign(str.data(), str.size());
+    }
+    if (phone_counts[i] > phones - phone) {
+      return false;
+    }
+    for (uint64_t j = 0; j < phone_counts[i]; ++j, ++phone) {
+      Person::PhoneNumber *number = person->add_phone();
+      if (numbers.next(&str)) {
+        number->mutable_number()->assign(str.data(), str.size());
+      }
+      if (types[phone] != kUnsetType) {
+        number->set_type(static_cast<Person::PhoneType>(types[phone]));
+      }
+    }
+    if (i == extra_person) {
+      if (extra_size > static_cast<uint64_t>(end[kExtras] - extras) ||
+          !merge_unknown(extras, extra_size, person)) {
+        return false;
+      }
+      extras += extra_size;
+      if (!next_extra(i + 1)) {
+        return false;
+      }
+    }
+  }
+  return phone == phones && names.finished() && emails.finished() &&
+         numbers.finished() && extras == end[kExtras] &&
+         (begin[kBookExtras] == end[kBookExtras] ||
+          merge_unknown(begin[kBookExtras],
+                        end[kBookExtras] - begin[kBookExtras], book));
+}
+
+bool unpack_ids(const uint8_t *data, size_t size, std::vector<int32_t> *ids) {
+  return read_ids(data, size, false, ids);
+}
+
+bool unpack_ids_scalar(const uint8_t *data, size_t size,
+                       std::vector<int32_t> *ids) {
+  return read_ids(data, size, true, ids);
+}
+
+bool write_packed(const AddressBook &book, const std::string &path) {
+  std::string packed;
+  if (!pack_address_book(book, &packed)) {
+    return false;
+  }
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write_all(fd, packed.data(), packed.size());
+  return ::close(fd) == 0 && ok;
+}
+
+bool read_packed(const std::string &path, AddressBook *book) {
+  MappedFile file;
+  return file.open(path) && unpack_address_book(file.data(), file.size(), book);
+}
+
+} // namespace tutorial
@@ -0,0 +1,60 @@
+#ifndef PACKED_BOOK_H_
+#define PACKED_BOOK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "person.pb.h"
+
+// a compact storage format for address books sorted by id, where protobuf
+// spends a tag and a varint per id and per phone type. here every field is a
+// section of its own:
+//
+//   ids      blocks of 128: the first id, and the gaps to the ids after it
+//            bit-packed at the width of the widest gap less the narrowest
+//            (frame of reference over deltas). consecutive ids pack to zero
+//            bits; ids in any order still round-trip, only wider.
+//   strings  names, emails and phone numbers each as a section of varint
+//            lengths plus one, zero meaning unset, and a blob of the bytes.
+//   phones   a varint count per person, and the types at 2 bits each, with
+//            3 meaning unset.
+//   extras   unknown fields as wire bytes, for round-tripping: the book's own,
+//            and those of the people who have any, listed by their gap in
+//            position from the previous such person.
+//
+// id blocks are laid out in four interleaved lanes, so the SSE2 unpacker
+// recovers four ids per shift-and-mask step and turns gaps back into ids
+// with an in-register prefix sum; types expand 64 at a time. other builds
+// use the scalar loops, which read the same bytes; unpack_ids_scalar() runs
+// the scalar id loop anywhere, so the two can be checked against each other.
+//
+// unpacking reproduces the book exactly: it serializes to the same bytes as
+// the one packed. people must have an id, and phones cannot carry unknown
+// fields.
+//
+// layout: magic, the person and phone counts, then each section as a byte
+// length and its bytes, padded to 8. integers are in host byte order.
+namespace tutorial {
+
+// false, leaving `out` unspecified, if a person has no id or a phone has
+// unknown fields.
+bool pack_address_book(const AddressBook &book, std::string *out);
+
+// replaces the contents of `book`. false if the bytes are not a packed book
+// or are damaged.
+bool unpack_address_book(const uint8_t *data, size_t size, AddressBook *book);
+
+// just the id column, for scans that need nothing else.
+bool unpack_ids(const uint8_t *data, size_t size, std::vector<int32_t> *ids);
+// the same through the scalar unpacker, whatever the build.
+bool unpack_ids_scalar(const uint8_t *data, size_t size,
+                       std::vector<int32_t> *ids);
+
+bool write_packed(const AddressBook &book, const std::string &path);
+bool read_packed(const std::string &path, AddressBook *book);
+
+} // namespace tutorial
+
+#endif // PACKED_BOOK_H_
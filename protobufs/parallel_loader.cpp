@@ -0,0 +1,200 @@
+#include "parallel_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "mapped_file.h"
+#include "stats.h"
+#include "utf8.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// small enough that every core gets several chunks to balance load, large
+// enough that per-chunk overhead (a CodedInputStream, a shard) vanishes.
+const size_t kMinChunkBytes = 64 << 10;
+const size_t kMaxChunkBytes = 16 << 20;
+
+struct Chunk {
+  Chunk(const uint8_t *b, const uint8_t *e) : begin(b), end(e) {}
+
+  const uint8_t *begin;
+  const uint8_t *end;
+  AddressBook shard;
+};
+
+// the scanner appends chunks while workers claim them in order; a deque never
+// moves its elements on push_back, so claimed chunks stay put.
+class ChunkQueue {
+public:
+  ChunkQueue() : m_next(0), m_closed(false) {}
+
+  void push(const uint8_t *begin, const uint8_t *end) {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_chunks.emplace_back(begin, end);
+    }
+    m_ready.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_closed = true;
+    }
+    m_ready.notify_all();
+  }
+
+  // blocks until a chunk is available; null once the queue is closed and
+  // drained.
+  Chunk *pop() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_ready.wait(lk, [this]() { return m_next < m_chunks.size() || m_closed; });
+    return m_next < m_chunks.size() ? &m_chunks[m_next++] : nullptr;
+  }
+
+  // only safe once every worker has been joined.
+  std::deque<Chunk> &chunks() { return m_chunks; }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_ready;
+  std::deque<Chunk> m_chunks;
+  size_t m_next;
+  bool m_closed;
+};
+
+void parse_chunks(ChunkQueue *queue, MappedFile *file, bool validate_utf8,
+                  std::atomic<bool> *failed) {
+  while (Chunk *chunk = queue->pop()) {
+    if (failed->load(std::memory_order_relaxed)) {
+      continue;
+    }
+
+    int length = static_cast<int>(chunk->end - chunk->begin);
+    google::protobuf::io::CodedInputStream input(chunk->begin, length);
+    wire::set_total_bytes_limit(&input, length);
+    if (!chunk->shard.MergePartialFromCodedStream(&input) ||
+        !input.ConsumedEntireMessage() || !chunk->shard.IsInitialized() ||
+        (validate_utf8 && !utf8_valid(chunk->shard))) {
+      failed->store(true, std::memory_order_relaxed);
+    }
+
+    if (file != nullptr) {
+      file->advise_dontneed(chunk->begin - file->data(), length);
+    }
+  }
+}
+
+// moves every Person out of the shards and into `book` by pointer.
+void splice_shards(std::deque<Chunk> *chunks, AddressBook *book) {
+  int total = 0;
+  for (const Chunk &chunk : *chunks) {
+    total += chunk.shard.person_size();
+  }
+
+  google::protobuf::RepeatedPtrField<Person> *people = book->mutable_person();
+  people->Reserve(people->size() + total);
+
+  std::vector<Person *> released;
+  for (Chunk &chunk : *chunks) {
+    google::protobuf::RepeatedPtrField<Person> *shard =
+        chunk.shard.mutable_person();
+    released.resize(shard->size());
+    shard->ExtractSubrange(0, shard->size(), released.data());
+    for (Person *person : released) {
+      people->AddAllocated(person);
+    }
+
+    if (!chunk.shard.unknown_fields().empty()) {
+      book->mutable_unknown_fields()->MergeFrom(chunk.shard.unknown_fields());
+    }
+  }
+}
+
+bool load_parallel(const uint8_t *data, size_t size, int threads,
+                   MappedFile *file, bool validate_utf8, AddressBook *book) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  size_t chunk_bytes = std::min(
+      kMaxChunkBytes, std::max(kMinChunkBytes, size / (threads * 8)));
+
+  ChunkQueue queue;
+  std::atomic<bool> failed(false);
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(parse_chunks, &queue, file, validate_utf8, &failed);
+  }
+
+  // the scan only hops from length prefix to length prefix, so it stays well
+  // ahead of the workers and overlaps with their parsing.
+  const uint8_t *end = data + size;
+  for (const uint8_t *p = data; p < end && !failed.load();) {
+    const uint8_t *next = wire::skip_fields(p, end, chunk_bytes);
+    if (next == nullptr || next - p > INT_MAX) {
+      failed.store(true);
+      break;
+    }
+    queue.push(p, next);
+    p = next;
+  }
+  queue.close();
+
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (failed.load()) {
+    return false;
+  }
+
+  splice_shards(&queue.chunks(), book);
+  return true;
+}
+
+} // namespace
+
+bool load_address_book_parallel(const uint8_t *data, size_t size, int threads,
+                                AddressBook *book, bool validate_utf8) {
+  return load_parallel(data, size, threads, nullptr, validate_utf8, book);
+}
+
+bool load_address_book_parallel(const std::string &path, int threads,
+                                AddressBook *book, LoadStats *stats,
+                                bool validate_utf8) {
+  Stopwatch watch;
+  int people = book->person_size();
+
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  file.advise_sequential();
+  size_t bytes = file.size();
+
+  if (!load_parallel(file.data(), file.size(), threads, &file, validate_utf8,
+                     book)) {
+    return false;
+  }
+
+  if (stats != nullptr) {
+    stats->bytes = bytes;
+    stats->people = book->person_size() - people;
+    stats->seconds = watch.seconds();
+    stats->peak_rss = peak_rss_bytes();
+  }
+  return true;
+}
+
+} // namespace tutorial
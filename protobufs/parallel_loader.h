@@ -0,0 +1,34 @@
+#ifndef PARALLEL_LOADER_H_
+#define PARALLEL_LOADER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "loader.h"
+#include "person.pb.h"
+
+namespace tutorial {
+
+// parses a serialized AddressBook on `threads` cores. the calling thread scans
+// top-level field boundaries and publishes chunks of whole records as it goes;
+// workers parse chunks into shard AddressBooks concurrently with the scan, and
+// the shards' RepeatedPtrField<Person>s are spliced into `book` in file order
+// by pointer, so no Person is copied. top-level unknown fields are kept.
+//
+// the result is the same as book->MergePartialFromCodedStream over the whole
+// buffer; returns false if the buffer is malformed or a loaded Person is
+// missing required fields, and with `validate_utf8` if a string field is not
+// UTF-8, which each worker checks for its own chunks (see utf8.h). threads
+// <= 0 uses every hardware thread.
+bool load_address_book_parallel(const uint8_t *data, size_t size, int threads,
+                                AddressBook *book, bool validate_utf8 = false);
+
+// mmaps `path` and loads it as above. `stats` may be null.
+bool load_address_book_parallel(const std::string &path, int threads,
+                                AddressBook *book, LoadStats *stats = nullptr,
+                                bool validate_utf8 = false);
+
+} // namespace tutorial
+
+#endif // PARALLEL_LOADER_H_
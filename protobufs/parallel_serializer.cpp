@@ -0,0 +1,127 @@
+#include "parallel_serializer.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// below this many people per thread, spawning threads costs more than it
+// saves.
+const int kMinPeoplePerThread = 4096;
+
+int thread_count(const AddressBook &book, int threads) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return std::max(1,
+                  std::min(threads, book.person_size() / kMinPeoplePerThread));
+}
+
+// runs work(range) for ranges 0..ranges-1, range 0 on the calling thread.
+template <typename Work> void run_ranges(int ranges, Work work) {
+  std::vector<std::thread> workers;
+  for (int i = 1; i < ranges; ++i) {
+    workers.emplace_back(work, i);
+  }
+  work(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+int range_begin(const AddressBook &book, int ranges, int range) {
+  return static_cast<int>(static_cast<int64_t>(book.person_size()) * range /
+                          ranges);
+}
+
+// a person field: tag, length, record.
+size_t record_size(int size) {
+  return 1 + wire::varint_size(static_cast<uint32_t>(size)) + size;
+}
+
+// the book's own unknown fields, which the generated code writes after the
+// last person. copying them into an otherwise empty book is the one way to
+// serialize them that protobuf 2.5 and 3.x both offer.
+std::string unknown_fields_bytes(const AddressBook &book) {
+  if (book.unknown_fields().empty()) {
+    return std::string();
+  }
+  AddressBook unknown;
+  unknown.mutable_unknown_fields()->MergeFrom(book.unknown_fields());
+  return unknown.SerializePartialAsString();
+}
+
+} // namespace
+
+size_t byte_size_parallel(const AddressBook &book, int threads) {
+  int ranges = thread_count(book, threads);
+  std::vector<size_t> totals(ranges);
+  run_ranges(ranges, [&](int range) {
+    size_t total = 0;
+    int end = range_begin(book, ranges, range + 1);
+    for (int i = range_begin(book, ranges, range); i < end; ++i) {
+      total += record_size(book.person(i).ByteSize());
+    }
+    totals[range] = total;
+  });
+
+  size_t total = unknown_fields_bytes(book).size();
+  for (size_t range_total : totals) {
+    total += range_total;
+  }
+  return total;
+}
+
+uint8_t *serialize_with_cached_sizes_parallel(const AddressBook &book,
+                                              int threads, uint8_t *target) {
+  int ranges = thread_count(book, threads);
+
+  // range totals again, from the sizes cached by byte_size_parallel(); this
+  // pass only reads one int per Person.
+  std::vector<size_t> offsets(ranges + 1);
+  run_ranges(ranges, [&](int range) {
+    size_t total = 0;
+    int end = range_begin(book, ranges, range + 1);
+    for (int i = range_begin(book, ranges, range); i < end; ++i) {
+      total += record_size(book.person(i).GetCachedSize());
+    }
+    offsets[range + 1] = total;
+  });
+  for (int range = 0; range < ranges; ++range) {
+    offsets[range + 1] += offsets[range];
+  }
+
+  run_ranges(ranges, [&](int range) {
+    uint8_t *p = target + offsets[range];
+    int end = range_begin(book, ranges, range + 1);
+    for (int i = range_begin(book, ranges, range); i < end; ++i) {
+      const Person &person = book.person(i);
+      *p++ = static_cast<uint8_t>(wire::kPersonTag);
+      p = wire::write_varint64(static_cast<uint32_t>(person.GetCachedSize()),
+                               p);
+      p = person.SerializeWithCachedSizesToArray(p);
+    }
+  });
+
+  std::string unknown = unknown_fields_bytes(book);
+  uint8_t *end = target + offsets[ranges];
+  std::copy(unknown.begin(), unknown.end(), end);
+  return end + unknown.size();
+}
+
+void serialize_address_book_parallel(const AddressBook &book, int threads,
+                                     std::string *output) {
+  output->resize(byte_size_parallel(book, threads));
+  if (output->empty()) {
+    return;
+  }
+  serialize_with_cached_sizes_parallel(
+      book, threads, reinterpret_cast<uint8_t *>(&(*output)[0]));
+}
+
+} // namespace tutorial
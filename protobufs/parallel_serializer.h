@@ -0,0 +1,39 @@
+#ifndef PARALLEL_SERIALIZER_H_
+#define PARALLEL_SERIALIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "person.pb.h"
+
+// serializes an AddressBook on several cores. the people are split into one
+// contiguous range per thread; each thread sizes its range, a prefix sum over
+// the range totals gives every range its offset in the output, and each
+// thread then writes its records into its own slice of one shared buffer.
+// the bytes are identical to the generated serializer's: records in order,
+// then the book's unknown fields.
+//
+// the two steps mirror ByteSize() and SerializeWithCachedSizesToArray(), and
+// the same rule applies: the book must not change in between. threads <= 0
+// uses every hardware thread.
+namespace tutorial {
+
+// sizes (and caches the size of) every Person; returns the serialized size
+// of the whole book.
+size_t byte_size_parallel(const AddressBook &book, int threads);
+
+// writes the book to `target`, which must hold the size byte_size_parallel()
+// just returned; returns the end of the written bytes.
+uint8_t *serialize_with_cached_sizes_parallel(const AddressBook &book,
+                                              int threads, uint8_t *target);
+
+// both steps into `output`, replacing its contents. resizing a std::string
+// zero-fills it on one core first; callers writing very large books can skip
+// that by using the two calls above on a buffer of their own.
+void serialize_address_book_parallel(const AddressBook &book, int threads,
+                                     std::string *output);
+
+} // namespace tutorial
+
+#endif // PARALLEL_SERIALIZER_H_
@@ -0,0 +1,327 @@
+#include "person_store.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "message_pool.h"
+
+namespace tutorial {
+
+namespace {
+
+// slots per table when a shard starts out; tables are rebuilt once three
+// quarters of their slots have held a key.
+const size_t kInitialCapacity = 16;
+// how many more replaced Persons and tables a shard holds before it tries
+// to free them again.
+const size_t kRetireBatch = 64;
+const int kReaderSlots = 256;
+
+// 0 marks an empty slot, so keys carry a bit above the id.
+uint64_t key_of(int32_t id) {
+  return (uint64_t(1) << 32) | static_cast<uint32_t>(id);
+}
+
+// shards take bits from 40 up and slots the bottom ones. a multiply alone
+// leaves the bottom bits depending only on the id's own bottom bits, so ids
+// a power of two apart would share a few home slots and turn each probe
+// into a scan; murmur3's finalizer makes every bit depend on the whole id.
+uint64_t hash_of(int32_t id) {
+  uint64_t h = static_cast<uint32_t>(id);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+// one per reading thread, on a cache line of its own: padding alone would
+// still let a slot straddle two lines, each shared with a neighbour.
+struct alignas(64) ReaderSlot {
+  // the epoch the reader entered in; 0 while it is outside.
+  std::atomic<uint64_t> epoch;
+  std::atomic<bool> taken;
+};
+
+static_assert(sizeof(ReaderSlot) == 64, "a ReaderSlot fills one cache line");
+
+// shared by every store; both start out zeroed as statics.
+std::atomic<uint64_t> g_epoch(1);
+ReaderSlot g_readers[kReaderSlots];
+
+// the calling thread's ReaderSlot, claimed on its first read and given back
+// when the thread exits; null if every slot was taken.
+class ReaderRegistration {
+public:
+  ReaderRegistration() : m_slot(nullptr) {
+    for (ReaderSlot &slot : g_readers) {
+      bool expected = false;
+      if (slot.taken.compare_exchange_strong(expected, true)) {
+        m_slot = &slot;
+        break;
+      }
+    }
+  }
+  ~ReaderRegistration() {
+    if (m_slot) {
+      m_slot->taken.store(false, std::memory_order_release);
+    }
+  }
+
+  ReaderRegistration(const ReaderRegistration &) = delete;
+  ReaderRegistration &operator=(const ReaderRegistration &) = delete;
+
+  ReaderSlot *slot() const { return m_slot; }
+
+private:
+  ReaderSlot *m_slot;
+};
+
+thread_local ReaderRegistration t_reader;
+
+// announces the reader for as long as it lives. the announcement is a
+// sequentially consistent exchange, ordered before every pointer the reader
+// then loads, so a writer that does not see it knows the reader will see
+// the writer's unlinking. (on x86 an xchg, cheaper than a store and mfence.)
+class EpochGuard {
+public:
+  explicit EpochGuard(ReaderSlot *slot) : m_slot(slot) {
+    m_slot->epoch.exchange(g_epoch.load(std::memory_order_relaxed));
+  }
+  ~EpochGuard() { m_slot->epoch.store(0, std::memory_order_release); }
+
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+
+private:
+  ReaderSlot *m_slot;
+};
+
+} // namespace
+
+// linear probing over a power-of-two number of slots. a slot's key is set
+// once; removing a person only clears its pointer, so the slot is reused
+// if the id comes back and dropped when the table is rebuilt.
+struct PersonStore::Table {
+  struct Slot {
+    std::atomic<uint64_t> key;
+    std::atomic<const Person *> person;
+  };
+
+  // slots start out zeroed.
+  explicit Table(size_t capacity)
+      : mask(capacity - 1), slots(new Slot[capacity]()) {}
+
+  size_t capacity() const { return mask + 1; }
+
+  // the slot holding `key`, or the empty one where it would go. a table is
+  // never full, so the probe always ends.
+  Slot *probe(uint64_t hash, uint64_t key, std::memory_order order) const {
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      uint64_t found = slots[i].key.load(order);
+      if (found == key || found == 0) {
+        return &slots[i];
+      }
+    }
+  }
+
+  size_t mask;
+  std::unique_ptr<Slot[]> slots;
+};
+
+struct PersonStore::Shard {
+  struct Retired {
+    uint64_t epoch;
+    const Person *person;
+    Table *table;
+  };
+
+  Shard()
+      : table(new Table(kInitialCapacity)), used(0), live(0),
+        next_reclaim(kRetireBatch) {}
+  ~Shard() {
+    Table *current = table.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < current->capacity(); ++i) {
+      delete current->slots[i].person.load(std::memory_order_relaxed);
+    }
+    delete current;
+    for (const Retired &item : retired) {
+      delete item.person;
+      delete item.table;
+    }
+  }
+
+  // writers only.
+  std::mutex mutex;
+  std::atomic<Table *> table;
+  // slots with a key, including removed people's, and people.
+  size_t used;
+  size_t live;
+  std::vector<Retired> retired;
+  // a reader held up inside its epoch keeps things retired; they wait for
+  // the next batch rather than costing every write a scan of the readers.
+  size_t next_reclaim;
+};
+
+PersonStore::PersonStore(int shards) : m_size(0) {
+  size_t count = 1;
+  while (count < static_cast<size_t>(std::max(shards, 1))) {
+    count *= 2;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    m_shards.emplace_back(new Shard);
+  }
+  m_shard_mask = count - 1;
+}
+
+PersonStore::~PersonStore() {}
+
+PersonStore::Shard &PersonStore::shard(uint64_t hash) const {
+  return *m_shards[(hash >> 40) & m_shard_mask];
+}
+
+bool PersonStore::put(const Person &person) {
+  if (!person.IsInitialized()) {
+    return false;
+  }
+  // built before the lock, and never changed once it is reachable.
+  Person *copy = PersonPool::local().acquire();
+  copy->CopyFrom(person);
+  uint64_t hash = hash_of(person.id());
+  uint64_t key = key_of(person.id());
+  Shard &s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  Table *table = s.table.load(std::memory_order_relaxed);
+  Table::Slot *slot = table->probe(hash, key, std::memory_order_relaxed);
+  if (slot->key.load(std::memory_order_relaxed) == key) {
+    const Person *old = slot->person.load(std::memory_order_relaxed);
+    slot->person.store(copy, std::memory_order_release);
+    if (old) {
+      retire(&s, old, nullptr);
+    } else {
+      ++s.live;
+      m_size.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // a fresh table for the live people, twice the size they need, is filled
+  // in before readers can reach it; the old one goes the way of replaced
+  // Persons.
+  if ((s.used + 1) * 4 > table->capacity() * 3) {
+    size_t capacity = kInitialCapacity;
+    while (capacity < (s.live + 1) * 4) {
+      capacity *= 2;
+    }
+    Table *rebuilt = new Table(capacity);
+    for (size_t i = 0; i < table->capacity(); ++i) {
+      const Person *live =
+          table->slots[i].person.load(std::memory_order_relaxed);
+      if (live) {
+        uint64_t live_hash = hash_of(live->id());
+        uint64_t live_key = table->slots[i].key.load(std::memory_order_relaxed);
+        Table::Slot *to =
+            rebuilt->probe(live_hash, live_key, std::memory_order_relaxed);
+        to->key.store(live_key, std::memory_order_relaxed);
+        to->person.store(live, std::memory_order_relaxed);
+      }
+    }
+    s.table.store(rebuilt, std::memory_order_release);
+    retire(&s, nullptr, table);
+    s.used = s.live;
+    table = rebuilt;
+    slot = table->probe(hash, key, std::memory_order_relaxed);
+  }
+  slot->person.store(copy, std::memory_order_relaxed);
+  slot->key.store(key, std::memory_order_release);
+  ++s.used;
+  ++s.live;
+  m_size.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool PersonStore::remove(int32_t id) {
+  uint64_t hash = hash_of(id);
+  uint64_t key = key_of(id);
+  Shard &s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  Table::Slot *slot = s.table.load(std::memory_order_relaxed)
+                          ->probe(hash, key, std::memory_order_relaxed);
+  const Person *old = slot->person.load(std::memory_order_relaxed);
+  if (slot->key.load(std::memory_order_relaxed) != key || !old) {
+    return false;
+  }
+  slot->person.store(nullptr, std::memory_order_release);
+  retire(&s, old, nullptr);
+  --s.live;
+  m_size.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool PersonStore::get(int32_t id, Person *person) const {
+  uint64_t hash = hash_of(id);
+  uint64_t key = key_of(id);
+  Shard &s = shard(hash);
+  ReaderSlot *reader = t_reader.slot();
+  if (!reader) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const Person *found = s.table.load(std::memory_order_relaxed)
+                              ->probe(hash, key, std::memory_order_relaxed)
+                              ->person.load(std::memory_order_relaxed);
+    if (found) {
+      person->CopyFrom(*found);
+    }
+    return found != nullptr;
+  }
+
+  EpochGuard guard(reader);
+  const Table::Slot *slot = s.table.load(std::memory_order_acquire)
+                                ->probe(hash, key, std::memory_order_acquire);
+  // an empty slot's pointer is null too.
+  const Person *found = slot->person.load(std::memory_order_acquire);
+  if (found) {
+    person->CopyFrom(*found);
+  }
+  return found != nullptr;
+}
+
+// the fence puts the unlinking that made these unreachable ahead of the
+// epoch they are filed under.
+void PersonStore::retire(Shard *shard, const Person *person, Table *table) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Shard::Retired item = {g_epoch.load(), person, table};
+  shard->retired.push_back(item);
+  if (shard->retired.size() >= shard->next_reclaim) {
+    reclaim(shard);
+  }
+}
+
+// moves the epoch on, so readers entering from now are known to be past
+// everything retired so far, and frees what every reader still inside
+// entered after. Persons go back to the writer's PersonPool, where put()
+// finds them with their strings and phones still allocated.
+void PersonStore::reclaim(Shard *shard) {
+  uint64_t oldest = g_epoch.fetch_add(1) + 1;
+  for (const ReaderSlot &reader : g_readers) {
+    uint64_t epoch = reader.epoch.load();
+    if (epoch != 0 && epoch < oldest) {
+      oldest = epoch;
+    }
+  }
+  size_t kept = 0;
+  for (const Shard::Retired &item : shard->retired) {
+    if (item.epoch < oldest) {
+      if (item.person) {
+        PersonPool::local().release(const_cast<Person *>(item.person));
+      }
+      delete item.table;
+    } else {
+      shard->retired[kept++] = item;
+    }
+  }
+  shard->retired.resize(kept);
+  shard->next_reclaim = kept + kRetireBatch;
+}
+
+} // namespace tutorial
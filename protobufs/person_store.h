@@ -0,0 +1,67 @@
+#ifndef PERSON_STORE_H_
+#define PERSON_STORE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "person.pb.h"
+
+// an in-memory Person store keyed by id for many threads at once, where one
+// mutex around an AddressBook would serialize them all.
+//
+// ids are striped across shards by hash. each shard is an open-addressing
+// table whose slots point at immutable Persons; a writer builds the new
+// Person first and locks only its shard to swap the pointer in, and a table
+// that fills up is rebuilt on the side and swapped in whole.
+//
+// readers take no lock and never retry: they follow the pointers as they
+// find them, under epoch-based reclamation. a reader announces the global
+// epoch on the way in and clears it on the way out, writers set aside the
+// Persons and tables they replace along with the epoch they did it in, and
+// those are freed once no reader is left in that epoch. a reader that
+// cannot get one of the announcement slots, if more threads than there are
+// slots read at once, locks the shard instead.
+namespace tutorial {
+
+class PersonStore {
+public:
+  // `shards` is rounded up to a power of two.
+  explicit PersonStore(int shards = 64);
+  ~PersonStore();
+
+  PersonStore(const PersonStore &) = delete;
+  PersonStore &operator=(const PersonStore &) = delete;
+
+  // inserts `person`, or replaces the one with its id; false if it is
+  // missing required fields.
+  bool put(const Person &person);
+  // false if there was no person with that id.
+  bool remove(int32_t id);
+
+  // copies the person with `id` into `person`; false if there is none. a
+  // get that overlaps a put or remove of the same id sees it either
+  // entirely or not at all.
+  bool get(int32_t id, Person *person) const;
+  int64_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+  struct Table;
+  struct Shard;
+
+  Shard &shard(uint64_t hash) const;
+  // Persons and tables that writers have replaced wait in their shard until
+  // no reader can still be looking at them.
+  void retire(Shard *shard, const Person *person, Table *table);
+  void reclaim(Shard *shard);
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  uint64_t m_shard_mask;
+  std::atomic<int64_t> m_size;
+};
+
+} // namespace tutorial
+
+#endif // PERSON_STORE_H_
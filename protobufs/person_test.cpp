@@ -0,0 +1,2076 @@
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include "arena.h"
+#include "block_container.h"
+#include "book_appender.h"
+#include "book_diff.h"
+#include "book_index.h"
+#include "book_store.h"
+#include "columnar.h"
+#include "external_sort.h"
+#include "fast_decoder.h"
+#include "generator.h"
+#include "ingest.h"
+#include "interned_book.h"
+#include "lz.h"
+#include "message_pool.h"
+#include "packed_book.h"
+#include "parallel_loader.h"
+#include "parallel_serializer.h"
+#include "person.pb.h"
+#include "person_store.h"
+#include "person_view.h"
+#include "pipelined_reader.h"
+#include "projection.h"
+#include "record_stream.h"
+#include "static_decoder.h"
+#include "utf8.h"
+
+namespace {
+
+void make_person(int i, tutorial::Person *person) {
+  person->set_name("person " + std::to_string(i));
+  person->set_id(i);
+  if (i % 2 == 0) {
+    person->set_email("p" + std::to_string(i) + "@example.com");
+  }
+  for (int j = 0; j < i % 3; ++j) {
+    tutorial::Person::PhoneNumber *phone = person->add_phone();
+    phone->set_number("555-" + std::to_string(i * 10 + j));
+    if (j % 2 == 1) {
+      phone->set_type(tutorial::Person::Work);
+    }
+  }
+}
+
+void make_book(int people, tutorial::AddressBook *book) {
+  for (int i = 0; i < people; ++i) {
+    make_person(i, book->add_person());
+  }
+}
+
+std::string temp_path(const std::string &name) {
+  return "/tmp/person_test." + std::to_string(getpid()) + "." + name;
+}
+
+} // namespace
+
+namespace record_stream {
+
+TEST(RecordStream, RoundTrip) {
+  std::string path = temp_path("stream");
+
+  tutorial::PersonStreamWriter writer;
+  ASSERT_TRUE(writer.open(path));
+  for (int i = 0; i < 1000; ++i) {
+    tutorial::Person person;
+    make_person(i, &person);
+    ASSERT_TRUE(writer.write(person));
+  }
+  ASSERT_TRUE(writer.close());
+
+  tutorial::PersonStreamReader reader;
+  ASSERT_TRUE(reader.open(path));
+
+  // one Person is reused for every record.
+  tutorial::Person person;
+  int count = 0;
+  while (reader.next(&person)) {
+    tutorial::Person expected;
+    make_person(count, &expected);
+    ASSERT_EQ(expected.SerializeAsString(), person.SerializeAsString());
+    ++count;
+  }
+  EXPECT_FALSE(reader.failed());
+  EXPECT_EQ(1000, count);
+
+  std::remove(path.c_str());
+}
+
+TEST(RecordStream, TruncatedRecordFails) {
+  std::string bytes;
+  {
+    google::protobuf::io::StringOutputStream output(&bytes);
+    tutorial::PersonStreamWriter writer(&output);
+    tutorial::Person person;
+    make_person(7, &person);
+    ASSERT_TRUE(writer.write(person));
+    ASSERT_TRUE(writer.write(person));
+    ASSERT_TRUE(writer.close());
+  }
+  bytes.resize(bytes.size() - 3);
+
+  google::protobuf::io::ArrayInputStream input(bytes.data(), bytes.size());
+  tutorial::PersonStreamReader reader(&input);
+  tutorial::Person person;
+  EXPECT_TRUE(reader.next(&person));
+  EXPECT_FALSE(reader.next(&person));
+  EXPECT_TRUE(reader.failed());
+}
+
+} // namespace record_stream
+
+namespace parallel_loader {
+
+TEST(ParallelLoader, MatchesSerialParse) {
+  tutorial::AddressBook book;
+  make_book(20000, &book);
+  book.mutable_unknown_fields()->AddVarint(15, 42);
+  std::string bytes = book.SerializeAsString();
+
+  for (int threads = 1; threads <= 4; ++threads) {
+    tutorial::AddressBook loaded;
+    ASSERT_TRUE(tutorial::load_address_book_parallel(
+        reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), threads,
+        &loaded));
+    EXPECT_EQ(bytes, loaded.SerializeAsString());
+  }
+}
+
+TEST(ParallelLoader, RejectsMissingRequiredField) {
+  tutorial::AddressBook book;
+  make_book(10, &book);
+  book.mutable_person(3)->clear_name();
+  std::string bytes = book.SerializePartialAsString();
+
+  tutorial::AddressBook loaded;
+  EXPECT_FALSE(tutorial::load_address_book_parallel(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), 2,
+      &loaded));
+}
+
+} // namespace parallel_loader
+
+namespace parallel_serializer {
+
+TEST(ParallelSerializer, MatchesSerialBytes) {
+  tutorial::AddressBook book;
+  make_book(50000, &book);
+  book.mutable_person(7)->set_name(std::string(200, 'x'));
+  book.mutable_unknown_fields()->AddVarint(15, 42);
+  std::string expected = book.SerializeAsString();
+
+  for (int threads : {1, 3, 8}) {
+    std::string bytes;
+    tutorial::serialize_address_book_parallel(book, threads, &bytes);
+    EXPECT_EQ(expected, bytes) << threads << " threads";
+  }
+
+  tutorial::AddressBook empty;
+  std::string bytes = "stale";
+  tutorial::serialize_address_book_parallel(empty, 4, &bytes);
+  EXPECT_TRUE(bytes.empty());
+}
+
+} // namespace parallel_serializer
+
+namespace arena {
+
+TEST(Arena, BookGraphLivesInArena) {
+  tutorial::AddressBook source;
+  make_book(1000, &source);
+  std::string bytes = source.SerializeAsString();
+
+  tutorial::ArenaAddressBook arena_book;
+  tutorial::AllocationCounters before = tutorial::thread_allocations();
+  {
+    tutorial::ArenaScope scope(arena_book.arena());
+    ASSERT_TRUE(arena_book.book()->ParseFromString(bytes));
+  }
+  tutorial::AllocationCounters after = tutorial::thread_allocations();
+
+  EXPECT_EQ(before.heap, after.heap);
+  EXPECT_LT(before.arena, after.arena);
+  EXPECT_EQ(bytes, arena_book.book()->SerializeAsString());
+
+  const tutorial::Person &person = arena_book.book()->person(2);
+  EXPECT_TRUE(tutorial::Arena::owns(&person));
+  EXPECT_TRUE(tutorial::Arena::owns(&person.phone(1)));
+
+  std::string heap_copy = person.name();
+  EXPECT_FALSE(tutorial::Arena::owns(&heap_copy));
+}
+
+TEST(Arena, LargeAllocationsGetTheirOwnBlock) {
+  tutorial::Arena arena;
+  void *small = arena.allocate(64);
+  void *large = arena.allocate(8 << 20);
+  EXPECT_TRUE(tutorial::Arena::owns(small));
+  EXPECT_TRUE(tutorial::Arena::owns(static_cast<char *>(large) + (6 << 20)));
+  EXPECT_EQ(2u, arena.blocks());
+}
+
+// every round maps a larger reservation first, so the next arena's blocks
+// land at addresses no earlier round used. deleted slots would use up the
+// registry's empty ones well within these rounds if it never dropped them;
+// lookups must still end, and still find live blocks. (all of it is
+// address space only.)
+TEST(Arena, RegistrySurvivesChurn) {
+  tutorial::Arena live;
+  void *kept = live.allocate(64);
+  int outside = 0;
+  const size_t kBlock = size_t(2) << 20;
+  const size_t kArenaBlocks = 2048;
+  for (size_t round = 1; round <= 2600; ++round) {
+    size_t spacer_bytes = round * kArenaBlocks * kBlock;
+    void *spacer = mmap(nullptr, spacer_bytes, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ASSERT_NE(MAP_FAILED, spacer);
+    {
+      tutorial::Arena arena;
+      arena.allocate((kArenaBlocks - 1) * kBlock);
+    }
+    munmap(spacer, spacer_bytes);
+    ASSERT_FALSE(tutorial::Arena::owns(&outside));
+  }
+  EXPECT_TRUE(tutorial::Arena::owns(kept));
+}
+
+} // namespace arena
+
+namespace person_view {
+
+TEST(PersonView, MatchesParsedPerson) {
+  tutorial::AddressBook book;
+  make_book(100, &book);
+  std::string bytes = book.SerializeAsString();
+
+  tutorial::AddressBookView view(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+  tutorial::PersonView person;
+  int i = 0;
+  while (view.next(&person)) {
+    const tutorial::Person &expected = book.person(i++);
+    ASSERT_TRUE(person.valid());
+    EXPECT_EQ(expected.id(), person.id());
+    EXPECT_EQ(expected.name(), person.name().to_string());
+    EXPECT_EQ(expected.has_email(), person.has_email());
+    EXPECT_EQ(expected.email(), person.email().to_string());
+    ASSERT_EQ(expected.phone_size(), person.phone_size());
+    for (int j = 0; j < expected.phone_size(); ++j) {
+      EXPECT_EQ(expected.phone(j).number(),
+                person.phone(j).number().to_string());
+      EXPECT_EQ(expected.phone(j).type(), person.phone(j).type());
+    }
+  }
+  EXPECT_FALSE(view.failed());
+  EXPECT_EQ(book.person_size(), i);
+}
+
+TEST(PersonView, LastValueWins) {
+  tutorial::Person first;
+  make_person(1, &first);
+  tutorial::Person second;
+  second.set_name("second");
+  second.set_id(-5);
+  std::string bytes = first.SerializeAsString() + second.SerializeAsString();
+
+  tutorial::PersonView person(reinterpret_cast<const uint8_t *>(bytes.data()),
+                              bytes.size());
+  EXPECT_EQ(-5, person.id());
+  EXPECT_EQ("second", person.name().to_string());
+}
+
+TEST(PersonView, MalformedBookFails) {
+  tutorial::AddressBook book;
+  make_book(3, &book);
+  std::string bytes = book.SerializeAsString();
+  bytes.resize(bytes.size() - 1);
+
+  tutorial::AddressBookView view(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+  tutorial::PersonView person;
+  while (view.next(&person)) {
+  }
+  EXPECT_TRUE(view.failed());
+}
+
+} // namespace person_view
+
+namespace utf8 {
+
+// every path (scalar, SSE, AVX2, padded tail) sees the probe at every offset.
+bool valid_at_all_offsets(const std::string &probe) {
+  bool result = true;
+  for (size_t offset = 0; offset < 70; ++offset) {
+    std::string str = std::string(offset, 'a') + probe + std::string(5, 'b');
+    bool valid = tutorial::utf8_valid(str.data(), str.size());
+    if (offset > 0 && valid != result) {
+      ADD_FAILURE() << "inconsistent result at offset " << offset;
+    }
+    result = valid;
+  }
+  return result;
+}
+
+TEST(Utf8, AcceptsValidSequences) {
+  EXPECT_TRUE(valid_at_all_offsets(""));
+  EXPECT_TRUE(valid_at_all_offsets("\xc3\xa9"));         // U+00E9
+  EXPECT_TRUE(valid_at_all_offsets("\xe2\x82\xac"));     // U+20AC
+  EXPECT_TRUE(valid_at_all_offsets("\xed\x9f\xbf"));     // U+D7FF
+  EXPECT_TRUE(valid_at_all_offsets("\xf0\x9f\x98\x80")); // U+1F600
+  EXPECT_TRUE(valid_at_all_offsets("\xf4\x8f\xbf\xbf")); // U+10FFFF
+}
+
+TEST(Utf8, RejectsInvalidSequences) {
+  EXPECT_FALSE(valid_at_all_offsets("\x80"));             // lone continuation
+  EXPECT_FALSE(valid_at_all_offsets("\xc3"));             // truncated
+  EXPECT_FALSE(valid_at_all_offsets("\xe2\x82"));         // truncated
+  EXPECT_FALSE(valid_at_all_offsets("\xc0\xaf"));         // overlong
+  EXPECT_FALSE(valid_at_all_offsets("\xe0\x80\xaf"));     // overlong
+  EXPECT_FALSE(valid_at_all_offsets("\xf0\x80\x80\xaf")); // overlong
+  EXPECT_FALSE(valid_at_all_offsets("\xed\xa0\x80"));     // surrogate
+  EXPECT_FALSE(valid_at_all_offsets("\xf4\x90\x80\x80")); // > U+10FFFF
+  EXPECT_FALSE(valid_at_all_offsets("\xff"));
+}
+
+TEST(Utf8, TruncatedEndOfInput) {
+  std::string str = std::string(31, 'a') + "\xe2";
+  EXPECT_FALSE(tutorial::utf8_valid(str.data(), str.size()));
+  str = std::string(62, 'a') + "\xf0\x9f";
+  EXPECT_FALSE(tutorial::utf8_valid(str.data(), str.size()));
+}
+
+TEST(Utf8, BatchKeepsStringsApart) {
+  // each half is invalid on its own even though the two concatenate into a
+  // valid sequence.
+  tutorial::Utf8Batch batch;
+  batch.add(tutorial::StringView("abc\xe2", 4));
+  batch.add(tutorial::StringView("\x82\xac", 2));
+  EXPECT_FALSE(batch.valid());
+
+  tutorial::Person person;
+  make_person(4, &person);
+  EXPECT_TRUE(tutorial::utf8_valid(person));
+  person.mutable_phone(0)->set_number("555-\xc3");
+  EXPECT_FALSE(tutorial::utf8_valid(person));
+}
+
+// one bad email deep in the book fails every reader that was asked to
+// validate, and none that was not.
+TEST(Utf8, EveryReaderValidatesOnRequest) {
+  tutorial::AddressBook book;
+  make_book(3000, &book);
+  book.mutable_person(2500)->set_email("p2500@\xc0\xaf" "example.com");
+  std::string path = temp_path("utf8_readers");
+  std::ofstream(path, std::ios::binary) << book.SerializeAsString();
+
+  for (bool validate : {false, true}) {
+    tutorial::AddressBook loaded;
+    EXPECT_EQ(!validate, tutorial::load_address_book(path, &loaded, nullptr,
+                                                     validate));
+    loaded.Clear();
+    EXPECT_EQ(!validate, tutorial::load_address_book_parallel(
+                             path, 2, &loaded, nullptr, validate));
+
+    tutorial::PipelineOptions pipeline;
+    pipeline.batch_size = 100;
+    pipeline.validate_utf8 = validate;
+    EXPECT_EQ(!validate,
+              tutorial::read_pipelined(
+                  path, pipeline,
+                  [](const tutorial::AddressBook &) { return true; }));
+
+    tutorial::IngestOptions ingest;
+    ingest.validate_utf8 = validate;
+    EXPECT_EQ(!validate, tutorial::ingest_address_books(
+                             {path}, ingest,
+                             [](size_t, tutorial::AddressBook *) {}));
+  }
+  unlink(path.c_str());
+}
+
+} // namespace utf8
+
+namespace fast_decoder {
+
+void expect_same_as_generated(const std::string &bytes) {
+  tutorial::Person expected;
+  bool expected_ok = expected.ParsePartialFromString(bytes);
+
+  // with and without room to read past the record.
+  std::string padded = bytes + std::string(32, '\xff');
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(padded.data());
+  tutorial::Person decoded;
+  ASSERT_EQ(expected_ok, tutorial::decode_person(data, bytes.size(), &decoded,
+                                                 data + padded.size()));
+  EXPECT_EQ(expected.SerializePartialAsString(),
+            decoded.SerializePartialAsString());
+  ASSERT_EQ(expected_ok,
+            tutorial::decode_person(data, bytes.size(), &decoded));
+  EXPECT_EQ(expected.SerializePartialAsString(),
+            decoded.SerializePartialAsString());
+}
+
+TEST(FastDecoder, CanonicalRecords) {
+  for (int i = 0; i < 200; ++i) {
+    tutorial::Person person;
+    make_person(i * 7919, &person);
+    expect_same_as_generated(person.SerializeAsString());
+  }
+
+  tutorial::Person person;
+  make_person(5, &person);
+  person.set_id(-1);
+  person.set_name(std::string(300, 'n'));
+  expect_same_as_generated(person.SerializeAsString());
+}
+
+TEST(FastDecoder, FallsBackOnOtherShapes) {
+  tutorial::Person person;
+  make_person(2, &person);
+  std::string bytes = person.SerializeAsString();
+
+  // fields out of order, repeated, unknown, or an out-of-range enum.
+  tutorial::Person id_only;
+  id_only.set_id(9);
+  expect_same_as_generated(id_only.SerializePartialAsString() + bytes);
+  expect_same_as_generated(bytes + bytes);
+  person.mutable_unknown_fields()->AddVarint(99, 1);
+  expect_same_as_generated(person.SerializeAsString());
+  expect_same_as_generated(bytes + std::string("\x22\x05\x0a\x01x\x10\x07", 7));
+
+  // truncated and garbage input fail the same way the generated parser does.
+  expect_same_as_generated(bytes.substr(0, bytes.size() - 2));
+  expect_same_as_generated(std::string("\x0a\xff", 2));
+}
+
+TEST(FastDecoder, AddressBookMatchesGeneratedParser) {
+  tutorial::AddressBook book;
+  make_book(5000, &book);
+  book.mutable_unknown_fields()->AddVarint(15, 42);
+  std::string bytes = book.SerializeAsString();
+
+  tutorial::AddressBook decoded;
+  ASSERT_TRUE(tutorial::decode_address_book(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(),
+      &decoded));
+  EXPECT_EQ(bytes, decoded.SerializeAsString());
+}
+
+} // namespace fast_decoder
+
+namespace columnar {
+
+void expect_matches(const tutorial::AddressBook &book,
+                    const tutorial::ColumnarBook &columns) {
+  ASSERT_EQ(static_cast<size_t>(book.person_size()), columns.people());
+  tutorial::Person person;
+  for (int i = 0; i < book.person_size(); ++i) {
+    const tutorial::Person &expected = book.person(i);
+    EXPECT_EQ(expected.id(), columns.ids()[i]);
+    EXPECT_EQ(expected.name(), columns.name(i).to_string());
+    EXPECT_EQ(expected.has_email(), columns.has_email(i));
+    EXPECT_EQ(expected.email(), columns.email(i).to_string());
+    ASSERT_EQ(static_cast<size_t>(expected.phone_size()),
+              columns.phone_end(i) - columns.phone_begin(i));
+    for (int j = 0; j < expected.phone_size(); ++j) {
+      size_t phone = columns.phone_begin(i) + j;
+      EXPECT_EQ(expected.phone(j).number(),
+                columns.phone_number(phone).to_string());
+      EXPECT_EQ(expected.phone(j).type(), columns.phone_type(phone));
+    }
+    columns.materialize(i, &person);
+    EXPECT_EQ(expected.name(), person.name());
+    EXPECT_EQ(expected.phone_size(), person.phone_size());
+  }
+}
+
+TEST(Columnar, MatchesBookAndBytes) {
+  tutorial::AddressBook book;
+  make_book(1000, &book);
+  tutorial::ColumnarBook from_book;
+  from_book.assign(book);
+  expect_matches(book, from_book);
+
+  // a repeated name on the wire: the last one wins, as when parsing.
+  std::string bytes = book.SerializeAsString();
+  tutorial::Person renamed;
+  make_person(1000, &renamed);
+  bytes += "\x0a" + std::string(1, renamed.ByteSize() + 5) +
+           renamed.SerializeAsString() + std::string("\x0a\x03new", 5);
+  renamed.set_name("new");
+  *book.add_person() = renamed;
+
+  tutorial::ColumnarBook from_bytes;
+  ASSERT_TRUE(from_bytes.assign(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size()));
+  expect_matches(book, from_bytes);
+}
+
+TEST(Columnar, RejectsIncompleteRecords) {
+  tutorial::AddressBook book;
+  book.add_person()->set_name("no id");
+  std::string bytes = book.SerializePartialAsString();
+  tutorial::ColumnarBook columns;
+  EXPECT_FALSE(columns.assign(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size()));
+  EXPECT_EQ(0u, columns.people());
+}
+
+TEST(Columnar, SaveAndLoad) {
+  std::string path = temp_path("columns");
+  tutorial::AddressBook book;
+  make_book(777, &book);
+  tutorial::ColumnarBook columns;
+  columns.assign(book);
+  ASSERT_TRUE(columns.save(path));
+
+  tutorial::ColumnarBook loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_matches(book, loaded);
+
+  // a truncated file is rejected outright.
+  ASSERT_EQ(0, truncate(path.c_str(), 100));
+  EXPECT_FALSE(loaded.load(path));
+  EXPECT_EQ(0u, loaded.people());
+  unlink(path.c_str());
+}
+
+} // namespace columnar
+
+namespace book_index {
+
+TEST(BookIndex, FindsEveryPerson) {
+  std::string path = temp_path("index");
+  tutorial::AddressBook book;
+  make_book(3000, &book);
+  // a second "person 7": lookups return the first one in book order.
+  tutorial::Person *duplicate = book.add_person();
+  duplicate->set_name("person 7");
+  duplicate->set_id(100000);
+  std::string bytes = book.SerializeAsString();
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+
+  ASSERT_TRUE(tutorial::BookIndex::build(data, bytes.size(), path));
+  tutorial::BookIndex index;
+  ASSERT_TRUE(index.open(path, data, bytes.size()));
+  EXPECT_EQ(3001u, index.records());
+
+  std::vector<int32_t> ids;
+  std::vector<tutorial::StringView> names;
+  for (int i = 0; i < book.person_size(); ++i) {
+    ids.push_back(book.person(i).id());
+    names.push_back(book.person(i).name());
+  }
+  ids.push_back(-1);
+  names.push_back(tutorial::StringView("nobody", 6));
+
+  size_t count = ids.size();
+  std::vector<tutorial::PersonView> people(count);
+  std::unique_ptr<bool[]> found(new bool[count]);
+  index.find_ids(ids.data(), count, people.data(), found.get());
+  for (size_t i = 0; i + 1 < count; ++i) {
+    ASSERT_TRUE(found[i]);
+    EXPECT_EQ(ids[i], people[i].id());
+  }
+  EXPECT_FALSE(found[count - 1]);
+
+  index.find_names(names.data(), count, people.data(), found.get());
+  for (size_t i = 0; i + 1 < count; ++i) {
+    ASSERT_TRUE(found[i]);
+    EXPECT_EQ(names[i], people[i].name());
+  }
+  EXPECT_FALSE(found[count - 1]);
+
+  tutorial::PersonView person;
+  ASSERT_TRUE(index.find_name(tutorial::StringView("person 7"), &person));
+  EXPECT_EQ(7, person.id());
+  ASSERT_TRUE(index.find_id(100000, &person));
+  EXPECT_EQ("person 7", person.name().to_string());
+  EXPECT_FALSE(index.find_id(3000, &person));
+  unlink(path.c_str());
+}
+
+TEST(BookIndex, RefusesOtherBook) {
+  std::string path = temp_path("index");
+  tutorial::AddressBook book;
+  make_book(10, &book);
+  std::string bytes = book.SerializeAsString();
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+  ASSERT_TRUE(tutorial::BookIndex::build(data, bytes.size(), path));
+
+  tutorial::BookIndex index;
+  EXPECT_FALSE(index.open(path, data, bytes.size() - 1));
+  EXPECT_FALSE(index.is_open());
+
+  // the same people in another order, as sort_book would leave them: the
+  // same size, but every offset in the index is wrong.
+  std::reverse(book.mutable_person()->begin(), book.mutable_person()->end());
+  std::string reordered = book.SerializeAsString();
+  ASSERT_EQ(bytes.size(), reordered.size());
+  EXPECT_FALSE(index.open(
+      path, reinterpret_cast<const uint8_t *>(reordered.data()),
+      reordered.size()));
+  EXPECT_FALSE(index.is_open());
+  unlink(path.c_str());
+}
+
+} // namespace book_index
+
+namespace book_appender {
+
+std::string read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+TEST(BookAppender, AppendsToExistingBook) {
+  std::string path = temp_path("append");
+  tutorial::AddressBook book;
+  make_book(100, &book);
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << book.SerializeAsString();
+  }
+
+  tutorial::BookAppender appender;
+  ASSERT_TRUE(appender.open(path));
+  for (int i = 100; i < 150; ++i) {
+    make_person(i, book.add_person());
+    ASSERT_TRUE(appender.append(book.person(i)));
+  }
+  tutorial::Person incomplete;
+  incomplete.set_name("no id");
+  EXPECT_FALSE(appender.append(incomplete));
+  ASSERT_TRUE(appender.close());
+
+  tutorial::AddressBook parsed;
+  ASSERT_TRUE(parsed.ParseFromString(read_file(path)));
+  EXPECT_EQ(book.SerializeAsString(), parsed.SerializeAsString());
+  unlink(path.c_str());
+}
+
+TEST(BookAppender, ConcurrentCommitsShareSyncs) {
+  std::string path = temp_path("append");
+  unlink(path.c_str());
+  tutorial::BookAppender appender;
+  ASSERT_TRUE(appender.open(path));
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&appender, t] {
+      for (int i = 0; i < 100; ++i) {
+        tutorial::Person person;
+        make_person(t * 1000 + i, &person);
+        EXPECT_TRUE(appender.append(person));
+        EXPECT_TRUE(appender.commit());
+      }
+    });
+  }
+  for (size_t t = 0; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+  EXPECT_EQ(400, appender.records());
+  EXPECT_LE(appender.commits(), 400);
+  ASSERT_TRUE(appender.close());
+
+  tutorial::AddressBook parsed;
+  ASSERT_TRUE(parsed.ParseFromString(read_file(path)));
+  EXPECT_EQ(400, parsed.person_size());
+  unlink(path.c_str());
+}
+
+TEST(BookAppender, CutsTornRecordOnOpen) {
+  std::string path = temp_path("append");
+  tutorial::AddressBook book;
+  make_book(10, &book);
+  std::string bytes = book.SerializeAsString();
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << bytes << bytes.substr(0, 7);
+  }
+
+  tutorial::BookAppender appender;
+  ASSERT_TRUE(appender.open(path));
+  ASSERT_TRUE(appender.close());
+  EXPECT_EQ(bytes, read_file(path));
+  unlink(path.c_str());
+}
+
+TEST(BookAppender, RefusesDamageBeforeTheEnd) {
+  std::string path = temp_path("append");
+  tutorial::AddressBook book;
+  make_book(10, &book);
+  std::string bytes = book.SerializeAsString();
+  // a person's tag replaced with an invalid wire type, then whole records.
+  std::string damaged = bytes + bytes;
+  damaged[bytes.size()] = '\x0f';
+  std::ofstream(path, std::ios::binary) << damaged;
+
+  tutorial::BookAppender appender;
+  EXPECT_FALSE(appender.open(path));
+  EXPECT_EQ(damaged, read_file(path));
+  unlink(path.c_str());
+}
+
+TEST(BookAppender, CompactKeepsLastRecordPerId) {
+  std::string path = temp_path("append");
+  unlink(path.c_str());
+  tutorial::BookAppender appender;
+  ASSERT_TRUE(appender.open(path));
+  appender.set_autocommit(3);
+  tutorial::AddressBook expected;
+  for (int i = 0; i < 20; ++i) {
+    tutorial::Person person;
+    make_person(i % 5, &person);
+    person.set_name("version " + std::to_string(i));
+    ASSERT_TRUE(appender.append(person));
+    if (i >= 15) {
+      *expected.add_person() = person;
+    }
+  }
+  ASSERT_TRUE(appender.close());
+  EXPECT_GE(appender.commits(), 6);
+
+  ASSERT_TRUE(tutorial::BookAppender::compact(path));
+  tutorial::AddressBook parsed;
+  ASSERT_TRUE(parsed.ParseFromString(read_file(path)));
+  EXPECT_EQ(expected.SerializeAsString(), parsed.SerializeAsString());
+  unlink(path.c_str());
+}
+
+// fields other than people pass through where they were; a person with no
+// id cannot be told apart from another, so the book is left alone.
+TEST(BookAppender, CompactKeepsOtherFieldsAndRefusesMissingIds) {
+  std::string path = temp_path("append");
+  tutorial::Person first;
+  make_person(1, &first);
+  tutorial::Person second = first;
+  second.set_name("second");
+  tutorial::AddressBook book;
+  *book.add_person() = first;
+  std::string bytes = book.SerializeAsString();
+  // field 9 as a varint, which AddressBook does not know.
+  std::string unknown = "\x48\x05";
+  bytes += unknown;
+  book.Clear();
+  *book.add_person() = second;
+  bytes += book.SerializeAsString();
+  std::ofstream(path, std::ios::binary) << bytes;
+
+  ASSERT_TRUE(tutorial::BookAppender::compact(path));
+  EXPECT_EQ(unknown + book.SerializeAsString(), read_file(path));
+
+  tutorial::Person anonymous;
+  anonymous.set_name("no id");
+  book.Clear();
+  *book.add_person() = anonymous;
+  bytes = read_file(path) + book.SerializePartialAsString();
+  std::ofstream(path, std::ios::binary) << bytes;
+  EXPECT_FALSE(tutorial::BookAppender::compact(path));
+  EXPECT_EQ(bytes, read_file(path));
+  unlink(path.c_str());
+}
+
+} // namespace book_appender
+
+namespace block_container {
+
+TEST(Lz, RoundTrip) {
+  std::vector<std::string> inputs = {"", "a", "abcd", std::string(1000, 'z')};
+  std::string text;
+  for (int i = 0; i < 5000; ++i) {
+    text += "p" + std::to_string(i * 7) + "@example.com 555-" +
+            std::to_string(i % 97);
+  }
+  inputs.push_back(text);
+  std::string noise;
+  for (int i = 0; i < 100000; ++i) {
+    noise += static_cast<char>((i * 2654435761u) >> 24);
+  }
+  inputs.push_back(noise);
+
+  for (const std::string &input : inputs) {
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(input.data());
+    std::vector<uint8_t> compressed(tutorial::lz_compress_bound(input.size()));
+    size_t size = tutorial::lz_compress(src, input.size(), compressed.data());
+    ASSERT_LE(size, compressed.size());
+    std::vector<uint8_t> output(input.size() + 1);
+    ASSERT_TRUE(tutorial::lz_decompress(compressed.data(), size, output.data(),
+                                        input.size()));
+    EXPECT_EQ(0, memcmp(src, output.data(), input.size()));
+    // the wrong expected size is an error rather than a short or long read.
+    EXPECT_FALSE(tutorial::lz_decompress(compressed.data(), size,
+                                         output.data(), input.size() + 1));
+  }
+
+  // repeated domains and prefixes compress well even greedily.
+  std::vector<uint8_t> compressed(tutorial::lz_compress_bound(text.size()));
+  EXPECT_LT(tutorial::lz_compress(
+                reinterpret_cast<const uint8_t *>(text.data()), text.size(),
+                compressed.data()),
+            text.size() / 2);
+}
+
+TEST(BlockContainer, RoundTripEveryCodec) {
+  tutorial::AddressBook book;
+  make_book(20000, &book);
+  std::string expected = book.SerializeAsString();
+
+  for (tutorial::BlockCodec codec :
+       {tutorial::kBlockStored, tutorial::kBlockZlib, tutorial::kBlockLz}) {
+    std::string path = temp_path("blocks");
+    tutorial::PersonBlockWriter writer;
+    ASSERT_TRUE(writer.open(path, codec));
+    for (int i = 0; i < book.person_size(); ++i) {
+      ASSERT_TRUE(writer.write(book.person(i)));
+    }
+    ASSERT_TRUE(writer.close());
+
+    tutorial::PersonBlockReader reader;
+    ASSERT_TRUE(reader.open(path));
+    EXPECT_GT(reader.blocks(), 1u);
+    EXPECT_EQ(20000, reader.records());
+    for (size_t i = 0; i < reader.blocks(); ++i) {
+      EXPECT_EQ(codec, static_cast<int>(reader.block(i).codec));
+    }
+
+    tutorial::AddressBook all;
+    ASSERT_TRUE(reader.read_all(4, &all));
+    EXPECT_EQ(expected, all.SerializeAsString());
+
+    tutorial::AddressBook range;
+    ASSERT_TRUE(reader.read_ids(1000, 1009, &range));
+    ASSERT_EQ(10, range.person_size());
+    EXPECT_EQ(1000, range.person(0).id());
+    unlink(path.c_str());
+  }
+}
+
+TEST(BlockContainer, DetectsCorruptBlock) {
+  std::string path = temp_path("blocks");
+  tutorial::PersonBlockWriter writer;
+  ASSERT_TRUE(writer.open(path, tutorial::kBlockStored));
+  tutorial::Person person;
+  make_person(3, &person);
+  ASSERT_TRUE(writer.write(person));
+  ASSERT_TRUE(writer.close());
+
+  // flip a byte of the record's name inside the one stored block.
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(8 + 4);
+    file.put('#');
+  }
+  tutorial::PersonBlockReader reader;
+  ASSERT_TRUE(reader.open(path));
+  tutorial::AddressBook book;
+  EXPECT_FALSE(reader.read_block(0, &book));
+  unlink(path.c_str());
+}
+
+} // namespace block_container
+
+namespace message_pool {
+
+TEST(PersonPool, SteadyStateDoesNotAllocate) {
+  std::vector<std::string> records;
+  for (int i = 0; i < 300; ++i) {
+    tutorial::Person person;
+    make_person(i, &person);
+    records.push_back(person.SerializeAsString());
+  }
+
+  tutorial::PersonPool pool;
+  std::vector<tutorial::Person *> batch;
+  tutorial::AllocationCounters before = tutorial::thread_allocations();
+  for (int round = 0; round < 3; ++round) {
+    if (round == 2) {
+      before = tutorial::thread_allocations();
+    }
+    pool.acquire(records.size(), &batch);
+    for (size_t i = 0; i < records.size(); ++i) {
+      ASSERT_TRUE(batch[i]->ParseFromString(records[i]));
+    }
+    pool.release(batch.data(), batch.size());
+    batch.clear();
+  }
+  EXPECT_EQ(0u, tutorial::thread_allocations().heap - before.heap);
+  EXPECT_EQ(records.size(), pool.people());
+}
+
+TEST(PersonPool, PrimedBookParsesIntoPooledPeople) {
+  tutorial::AddressBook source;
+  make_book(500, &source);
+  std::string bytes = source.SerializeAsString();
+
+  // people come back out of the pool in a different order, so the first
+  // rounds still grow the odd phone list; after that nothing allocates.
+  tutorial::PersonPool &pool = tutorial::PersonPool::local();
+  tutorial::AddressBook book;
+  tutorial::AllocationCounters before = tutorial::thread_allocations();
+  for (int round = 0; round < 3; ++round) {
+    if (round == 2) {
+      before = tutorial::thread_allocations();
+    }
+    ASSERT_TRUE(book.ParseFromString(bytes));
+    EXPECT_EQ(500, book.person_size());
+    pool.recycle(&book);
+    EXPECT_EQ(0, book.person_size());
+    EXPECT_EQ(500u, pool.people());
+    pool.prime(&book, 500);
+    EXPECT_EQ(0u, pool.people());
+  }
+  EXPECT_EQ(0u, tutorial::thread_allocations().heap - before.heap);
+  pool.recycle(&book);
+  pool.trim();
+}
+
+} // namespace message_pool
+
+namespace interned_book {
+
+TEST(InternedBook, RoundTripsToWireFormat) {
+  tutorial::AddressBook book;
+  make_book(2000, &book);
+  tutorial::Person *odd = book.add_person();
+  odd->set_name("odd shapes");
+  odd->set_id(-7);
+  odd->set_email("no-at-sign");
+  odd->add_phone()->set_number("5551234");
+  odd->add_phone()->set_number("(415) 555 0000");
+  odd->mutable_phone(1)->set_type(tutorial::Person::Home);
+  tutorial::Person *empty_email = book.add_person();
+  empty_email->set_name("");
+  empty_email->set_id(0);
+  empty_email->set_email("a@b@c.org");
+
+  tutorial::InternedBook interned;
+  ASSERT_TRUE(interned.assign(book));
+  std::string bytes;
+  interned.serialize(&bytes);
+  EXPECT_EQ(book.SerializeAsString(), bytes);
+
+  // one domain for everyone, and "555-" for every generated phone.
+  EXPECT_EQ(2u, interned.domains().size());
+  EXPECT_EQ(2u, interned.prefixes().size());
+  EXPECT_EQ("c.org", interned.email_domain(2001).to_string());
+  EXPECT_EQ("a@b", interned.email_local(2001).to_string());
+
+  tutorial::Person person;
+  for (int i = 0; i < book.person_size(); ++i) {
+    interned.materialize(i, &person);
+    ASSERT_EQ(book.person(i).SerializeAsString(), person.SerializeAsString());
+  }
+}
+
+// what the generated parser would keep and the common case never has:
+// unknown fields on people and on the book, and missing required fields.
+TEST(InternedBook, KeepsUnknownAndMissingFields) {
+  tutorial::GeneratorOptions options;
+  options.unknown_percent = 30;
+  tutorial::BookGenerator generator(options);
+  std::string bytes;
+  generator.generate(0, 500, tutorial::kGenerateBook, &bytes);
+  tutorial::AddressBook partial;
+  tutorial::Person *person = partial.add_person();
+  person->set_email("no name or id");
+  person->add_phone()->set_type(tutorial::Person::Work);
+  bytes += partial.SerializePartialAsString();
+  // field 9 as a varint, which AddressBook does not know.
+  bytes += "\x48\x05";
+  tutorial::AddressBook book;
+  ASSERT_TRUE(book.ParsePartialFromString(bytes));
+
+  tutorial::InternedBook interned;
+  ASSERT_TRUE(interned.assign(book));
+  std::string serialized;
+  interned.serialize(&serialized);
+  EXPECT_EQ(bytes, serialized);
+  EXPECT_FALSE(interned.has_name(500));
+  EXPECT_FALSE(interned.has_id(500));
+
+  tutorial::Person materialized;
+  for (int i = 0; i < book.person_size(); ++i) {
+    interned.materialize(i, &materialized);
+    ASSERT_EQ(book.person(i).SerializePartialAsString(),
+              materialized.SerializePartialAsString());
+  }
+
+  // a phone type past the enum is one of the phone's unknown fields, which
+  // are not kept; the Person is refused rather than changed.
+  tutorial::Person::PhoneNumber phone;
+  ASSERT_TRUE(phone.ParseFromString(std::string("\x0a\x01" "5" "\x10\x07")));
+  ASSERT_FALSE(phone.has_type());
+  tutorial::Person odd;
+  make_person(7, &odd);
+  *odd.add_phone() = phone;
+  EXPECT_FALSE(interned.append(odd));
+  EXPECT_EQ(501u, interned.people());
+}
+
+TEST(InternedBook, UsesLessMemoryThanMessages) {
+  tutorial::AddressBook book;
+  make_book(20000, &book);
+  tutorial::InternedBook interned;
+  ASSERT_TRUE(interned.assign(book));
+  EXPECT_LT(interned.bytes_used() * 2, tutorial::space_used(book));
+}
+
+} // namespace interned_book
+
+namespace generator {
+
+TEST(Generator, SlicesMatchWholeBook) {
+  tutorial::GeneratorOptions options;
+  options.unknown_percent = 50;
+  tutorial::BookGenerator generator(options);
+  ASSERT_TRUE(generator.valid());
+
+  std::string whole, slices;
+  generator.generate(0, 1000, tutorial::kGenerateBook, &whole);
+  generator.generate(0, 400, tutorial::kGenerateBook, &slices);
+  generator.generate(400, 600, tutorial::kGenerateBook, &slices);
+  EXPECT_EQ(whole, slices);
+
+  // valid wire format, in the generated serializer's field order.
+  tutorial::AddressBook book;
+  ASSERT_TRUE(book.ParseFromString(whole));
+  ASSERT_EQ(1000, book.person_size());
+  int unknown = 0;
+  for (int i = 0; i < book.person_size(); ++i) {
+    EXPECT_EQ(i, book.person(i).id());
+    unknown += !book.person(i).unknown_fields().empty();
+  }
+  EXPECT_GT(unknown, 0);
+  EXPECT_EQ(whole, book.SerializeAsString());
+
+  options.seed = 2;
+  tutorial::BookGenerator other(options);
+  std::string reseeded;
+  other.generate(0, 1000, tutorial::kGenerateBook, &reseeded);
+  EXPECT_NE(whole, reseeded);
+}
+
+TEST(Generator, WriteIsIndependentOfThreads) {
+  tutorial::GeneratorOptions options;
+  options.people = 150000;
+  options.type_weights[0] = 0;
+  tutorial::BookGenerator generator(options);
+  std::string expected;
+  generator.generate(0, options.people, tutorial::kGenerateStream, &expected);
+
+  std::string path = temp_path("generated");
+  for (int threads : {1, 3}) {
+    ASSERT_TRUE(generator.write(path, tutorial::kGenerateStream, threads));
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    EXPECT_EQ(expected, contents.str());
+  }
+
+  tutorial::PersonStreamReader reader;
+  ASSERT_TRUE(reader.open(path));
+  tutorial::Person person;
+  while (reader.next(&person)) {
+    for (int i = 0; i < person.phone_size(); ++i) {
+      EXPECT_NE(tutorial::Person::Mobile, person.phone(i).type());
+    }
+  }
+  EXPECT_FALSE(reader.failed());
+  EXPECT_EQ(options.people, reader.records());
+  unlink(path.c_str());
+}
+
+TEST(Generator, RejectsBadOptions) {
+  tutorial::GeneratorOptions options;
+  options.phones.min = 4;
+  options.phones.max = 2;
+  EXPECT_FALSE(tutorial::BookGenerator(options).valid());
+  options = tutorial::GeneratorOptions();
+  options.type_weights[0] = 0;
+  options.type_weights[1] = 0;
+  options.type_weights[2] = 0;
+  EXPECT_FALSE(tutorial::BookGenerator(options).valid());
+}
+
+} // namespace generator
+
+namespace pipelined_reader {
+
+// small chunks so records straddle them, and one record larger than a chunk.
+tutorial::PipelineOptions small_pipeline() {
+  tutorial::PipelineOptions options;
+  options.decoders = 3;
+  options.batch_size = 7;
+  options.queue_depth = 2;
+  options.chunk_bytes = 100;
+  return options;
+}
+
+TEST(PipelinedReader, MatchesSerialParse) {
+  tutorial::AddressBook book;
+  make_book(1000, &book);
+  book.mutable_person(500)->set_name(std::string(1000, 'x'));
+  std::string path = temp_path("pipelined");
+  std::ofstream(path, std::ios::binary) << book.SerializeAsString();
+
+  tutorial::AddressBook read;
+  tutorial::PipelineStats stats;
+  ASSERT_TRUE(tutorial::read_pipelined(
+      path, small_pipeline(),
+      [&](const tutorial::AddressBook &batch) {
+        EXPECT_LE(batch.person_size(), 7);
+        read.MergeFrom(batch);
+        return true;
+      },
+      &stats));
+  EXPECT_EQ(book.SerializeAsString(), read.SerializeAsString());
+  EXPECT_EQ(1000, stats.people);
+  EXPECT_EQ(static_cast<int64_t>(book.ByteSize()), stats.bytes);
+
+  int batches = 0;
+  EXPECT_TRUE(tutorial::read_pipelined(
+      path, small_pipeline(),
+      [&](const tutorial::AddressBook &) { return ++batches < 3; }));
+  EXPECT_EQ(3, batches);
+  unlink(path.c_str());
+}
+
+TEST(PipelinedReader, TruncatedBookFails) {
+  tutorial::AddressBook book;
+  make_book(100, &book);
+  std::string bytes = book.SerializeAsString();
+  std::string path = temp_path("pipelined_truncated");
+  std::ofstream(path, std::ios::binary) << bytes.substr(0, bytes.size() - 3);
+  EXPECT_FALSE(tutorial::read_pipelined(
+      path, small_pipeline(),
+      [](const tutorial::AddressBook &) { return true; }));
+  unlink(path.c_str());
+
+  tutorial::AddressBook invalid;
+  invalid.add_person()->set_name("no id");
+  std::ofstream(path, std::ios::binary) << invalid.SerializePartialAsString();
+  EXPECT_FALSE(tutorial::read_pipelined(
+      path, small_pipeline(),
+      [](const tutorial::AddressBook &) { return true; }));
+  unlink(path.c_str());
+}
+
+// an invalid wire type near the start stops the read there, rather than
+// being carried with the rest of the file until the end.
+TEST(PipelinedReader, MalformedBookFailsEarly) {
+  tutorial::AddressBook book;
+  make_book(1000, &book);
+  std::string bytes = book.SerializeAsString();
+  bytes[book.person(0).ByteSize() + 2] = '\x0f';
+  std::string path = temp_path("pipelined_malformed");
+  std::ofstream(path, std::ios::binary) << bytes;
+  tutorial::PipelineStats stats;
+  EXPECT_FALSE(tutorial::read_pipelined(
+      path, small_pipeline(),
+      [](const tutorial::AddressBook &) { return true; }, &stats));
+  EXPECT_LT(stats.bytes, static_cast<int64_t>(bytes.size()) / 2);
+  unlink(path.c_str());
+}
+
+} // namespace pipelined_reader
+
+namespace ingest {
+
+// every file arrives once, parsed, through both the ring and the fallback;
+// a missing file and a malformed one are reported as failures.
+TEST(Ingest, LoadsEveryFile) {
+  std::vector<std::string> paths;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 40; ++i) {
+    tutorial::AddressBook book;
+    make_book(i * 3, &book);
+    paths.push_back(temp_path("ingest." + std::to_string(i)));
+    expected.push_back(book.SerializeAsString());
+    std::ofstream(paths.back(), std::ios::binary) << expected.back();
+  }
+  paths.push_back(temp_path("ingest.missing"));
+  paths.push_back(temp_path("ingest.malformed"));
+  std::ofstream(paths.back(), std::ios::binary) << std::string("\x0a\x05" "ab");
+
+  for (bool use_uring : {true, false}) {
+    tutorial::IngestOptions options;
+    options.queue_depth = 4;
+    options.parsers = 2;
+    options.use_uring = use_uring;
+    std::vector<std::string> seen(paths.size(), "unseen");
+    std::mutex mutex;
+    tutorial::IngestStats stats;
+    EXPECT_FALSE(tutorial::ingest_address_books(
+        paths, options,
+        [&](size_t index, tutorial::AddressBook *book) {
+          std::lock_guard<std::mutex> lock(mutex);
+          seen[index] = book ? book->SerializeAsString() : "failed";
+        },
+        &stats));
+    EXPECT_EQ(use_uring && tutorial::uring_available(), stats.used_uring);
+    EXPECT_EQ(42, stats.files);
+    EXPECT_EQ(2, stats.failed);
+    EXPECT_EQ(3 * 39 * 40 / 2, stats.people);
+    EXPECT_LE(stats.p50_latency, stats.p99_latency);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i], seen[i]);
+    }
+    EXPECT_EQ("failed", seen[40]);
+    EXPECT_EQ("failed", seen[41]);
+  }
+  for (const std::string &path : paths) {
+    unlink(path.c_str());
+  }
+}
+
+} // namespace ingest
+
+namespace projection {
+
+TEST(Projection, FillsOnlyRequestedFields) {
+  tutorial::AddressBook book;
+  make_book(30, &book);
+  std::string bytes = book.SerializeAsString();
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+
+  tutorial::AddressBook ids;
+  ASSERT_TRUE(tutorial::parse_address_book_projected(
+      data, bytes.size(), tutorial::kPersonId, &ids));
+  ASSERT_EQ(30, ids.person_size());
+  for (int i = 0; i < 30; ++i) {
+    const tutorial::Person &person = ids.person(i);
+    EXPECT_EQ(i, person.id());
+    EXPECT_FALSE(person.has_name());
+    EXPECT_FALSE(person.has_email());
+    EXPECT_EQ(0, person.phone_size());
+  }
+
+  tutorial::AddressBook types;
+  ASSERT_TRUE(tutorial::parse_address_book_projected(
+      data, bytes.size(), tutorial::kPhoneType, &types));
+  for (int i = 0; i < 30; ++i) {
+    const tutorial::Person &person = types.person(i);
+    EXPECT_FALSE(person.has_id());
+    ASSERT_EQ(book.person(i).phone_size(), person.phone_size());
+    for (int j = 0; j < person.phone_size(); ++j) {
+      EXPECT_FALSE(person.phone(j).has_number());
+      EXPECT_EQ(book.person(i).phone(j).has_type(), person.phone(j).has_type());
+      EXPECT_EQ(book.person(i).phone(j).type(), person.phone(j).type());
+    }
+  }
+
+  tutorial::AddressBook all;
+  ASSERT_TRUE(tutorial::parse_address_book_projected(
+      data, bytes.size(), tutorial::kAllPersonFields, &all));
+  EXPECT_EQ(bytes, all.SerializeAsString());
+}
+
+TEST(Projection, SkipsUnknownAndRejectsMalformed) {
+  tutorial::Person person;
+  make_person(4, &person);
+  // an unknown varint and an unknown group, then a second id that wins.
+  std::string bytes = person.SerializeAsString() + "\x78\x05" +
+                      "\x7b\x08\x01\x7c" + "\x10\x09";
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+  tutorial::Person projected;
+  ASSERT_TRUE(tutorial::parse_person_projected(
+      data, bytes.size(), tutorial::kPersonId | tutorial::kPersonEmail,
+      &projected));
+  EXPECT_EQ(9, projected.id());
+  EXPECT_EQ(person.email(), projected.email());
+  EXPECT_FALSE(projected.has_name());
+  EXPECT_TRUE(projected.unknown_fields().empty());
+
+  // a skipped field's length still has to fit.
+  std::string truncated = person.SerializeAsString();
+  truncated.resize(truncated.size() - 1);
+  EXPECT_FALSE(tutorial::parse_person_projected(
+      reinterpret_cast<const uint8_t *>(truncated.data()), truncated.size(),
+      tutorial::kPersonId, &projected));
+}
+
+} // namespace projection
+
+namespace static_decoder {
+
+TEST(StaticDecoder, MatchesGeneratedParser) {
+  tutorial::AddressBook book;
+  make_book(30, &book);
+  std::string bytes = book.SerializeAsString();
+  tutorial::AddressBook decoded;
+  ASSERT_TRUE(tutorial::static_parse(
+      reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(),
+      &decoded));
+  EXPECT_EQ(bytes, decoded.SerializeAsString());
+
+  // out of order fields, a repeated id, an unknown field and an enum value
+  // outside the enum; the last two go through the generated parser.
+  tutorial::Person person;
+  make_person(4, &person);
+  const std::string inputs[] = {
+      "\x10\x07" + person.SerializeAsString() + "\x10\x09",
+      person.SerializeAsString() + "\x78\x05",
+      person.SerializeAsString() + std::string("\x22\x05\x0a\x01x\x10\x07"),
+      std::string("\x22\x03\x0a\x01"),
+  };
+  for (const std::string &input : inputs) {
+    tutorial::Person expected;
+    bool parsed = expected.ParsePartialFromArray(
+        input.data(), static_cast<int>(input.size()));
+    tutorial::Person actual;
+    actual.set_email("stale");
+    EXPECT_EQ(parsed, tutorial::static_parse(
+                          reinterpret_cast<const uint8_t *>(input.data()),
+                          input.size(), &actual));
+    if (parsed) {
+      EXPECT_EQ(expected.SerializeAsString(), actual.SerializeAsString());
+    }
+  }
+}
+
+} // namespace static_decoder
+
+namespace external_sort {
+
+// the smallest budget, so the book makes well over one merge pass of runs;
+// ids repeat, and people sharing one must keep their input order.
+TEST(ExternalSort, SortsStablyAcrossMergePasses) {
+  const int kPeople = 250000;
+  tutorial::AddressBook book;
+  make_book(kPeople, &book);
+  std::vector<int> order(kPeople);
+  for (int i = 0; i < kPeople; ++i) {
+    book.mutable_person(i)->set_id((i * 7919) % 5000 - 2500);
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return book.person(a).id() < book.person(b).id();
+  });
+  tutorial::AddressBook expected;
+  for (int i : order) {
+    expected.add_person()->CopyFrom(book.person(i));
+  }
+
+  std::string input = temp_path("unsorted");
+  std::string output = temp_path("sorted");
+  std::ofstream(input, std::ios::binary) << book.SerializeAsString();
+  tutorial::SortOptions options;
+  options.memory_bytes = 1 << 20;
+  options.io_bytes = 64 << 10;
+  options.threads = 3;
+  options.temp_dir = "/tmp";
+  tutorial::SortStats stats;
+  ASSERT_TRUE(tutorial::sort_address_book(input, output, options, &stats));
+  EXPECT_EQ(kPeople, stats.people);
+  EXPECT_GT(stats.runs, 15);
+  EXPECT_EQ(2, stats.merge_passes);
+
+  std::ifstream in(output, std::ios::binary);
+  std::string sorted((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+  EXPECT_TRUE(sorted == expected.SerializeAsString());
+  EXPECT_NE(0, access((output + ".run0").c_str(), F_OK));
+  unlink(input.c_str());
+  unlink(output.c_str());
+}
+
+// a book that fits is sorted in memory; a person without an id fails the
+// sort.
+TEST(ExternalSort, SingleRunAndMissingId) {
+  tutorial::AddressBook book;
+  make_book(100, &book);
+  std::reverse(book.mutable_person()->begin(), book.mutable_person()->end());
+  std::string input = temp_path("unsorted");
+  std::string output = temp_path("sorted");
+  std::ofstream(input, std::ios::binary) << book.SerializeAsString();
+  tutorial::SortStats stats;
+  ASSERT_TRUE(tutorial::sort_address_book(input, output,
+                                          tutorial::SortOptions(), &stats));
+  EXPECT_EQ(1, stats.runs);
+  EXPECT_EQ(0, stats.merge_passes);
+  tutorial::AddressBook sorted;
+  std::ifstream in(output, std::ios::binary);
+  ASSERT_TRUE(sorted.ParseFromIstream(&in));
+  ASSERT_EQ(100, sorted.person_size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, sorted.person(i).id());
+  }
+
+  book.mutable_person(7)->clear_id();
+  std::ofstream(input, std::ios::binary) << book.SerializePartialAsString();
+  EXPECT_FALSE(tutorial::sort_address_book(input, output,
+                                           tutorial::SortOptions()));
+  unlink(input.c_str());
+  unlink(output.c_str());
+}
+
+// an invalid wire type early in the book fails the sort in the first run,
+// instead of growing the run buffer until the end of the input.
+TEST(ExternalSort, MalformedInputFailsEarly) {
+  tutorial::AddressBook book;
+  make_book(50000, &book);
+  std::string bytes = book.SerializeAsString();
+  bytes[book.person(0).ByteSize() + 2] = '\x0f';
+  std::string input = temp_path("unsorted");
+  std::string output = temp_path("sorted");
+  std::ofstream(input, std::ios::binary) << bytes;
+  tutorial::SortOptions options;
+  options.memory_bytes = 1 << 20;
+  options.io_bytes = 64 << 10;
+  tutorial::SortStats stats;
+  EXPECT_FALSE(tutorial::sort_address_book(input, output, options, &stats));
+  EXPECT_LT(stats.bytes, static_cast<int64_t>(bytes.size()) / 2);
+  unlink(input.c_str());
+  unlink(output.c_str());
+}
+
+// the parser takes a person tag written in two bytes, 0x8a 0x00, so the
+// sort has to find the id after it rather than one byte in.
+TEST(ExternalSort, OverlongPersonTag) {
+  std::string bytes;
+  for (int id : {3, 1, 2}) {
+    tutorial::Person person;
+    make_person(id, &person);
+    std::string record = person.SerializeAsString();
+    bytes += id == 1 ? std::string("\x8a\x00", 2) : std::string("\x0a");
+    bytes += static_cast<char>(record.size());
+    bytes += record;
+  }
+  tutorial::AddressBook book;
+  ASSERT_TRUE(book.ParseFromString(bytes));
+  ASSERT_EQ(1, book.person(1).id());
+
+  std::string input = temp_path("unsorted");
+  std::string output = temp_path("sorted");
+  std::ofstream(input, std::ios::binary) << bytes;
+  ASSERT_TRUE(tutorial::sort_address_book(input, output,
+                                          tutorial::SortOptions()));
+  tutorial::AddressBook sorted;
+  std::ifstream in(output, std::ios::binary);
+  ASSERT_TRUE(sorted.ParseFromIstream(&in));
+  ASSERT_EQ(3, sorted.person_size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i + 1, sorted.person(i).id());
+  }
+  unlink(input.c_str());
+  unlink(output.c_str());
+}
+
+} // namespace external_sort
+
+namespace book_diff {
+
+// every kind of entry and every change bit, round-tripped through a diff
+// file and applied back to the old book.
+TEST(BookDiff, DiffAndApply) {
+  tutorial::AddressBook before;
+  make_book(100, &before);
+  tutorial::AddressBook after;
+  make_person(5, after.add_person());
+  after.mutable_person(0)->set_id(-5);
+  for (int i = 0; i < 100; ++i) {
+    if (i % 10 == 3) {
+      continue;
+    }
+    tutorial::Person *person = after.add_person();
+    person->CopyFrom(before.person(i));
+    if (i == 20) {
+      person->set_name("renamed");
+    } else if (i == 40) {
+      person->clear_email();
+      person->mutable_phone(0)->set_type(tutorial::Person::Home);
+    } else if (i == 41) {
+      person->add_phone()->set_number("555-0000");
+    }
+  }
+  make_person(200, after.add_person());
+
+  std::string old_path = temp_path("before");
+  std::string new_path = temp_path("after");
+  std::string diff_path = temp_path("diff");
+  std::string applied_path = temp_path("applied");
+  std::ofstream(old_path, std::ios::binary) << before.SerializeAsString();
+  std::ofstream(new_path, std::ios::binary) << after.SerializeAsString();
+
+  std::vector<tutorial::DiffEntry> entries;
+  tutorial::DiffStats stats;
+  ASSERT_TRUE(tutorial::diff_books(
+      old_path, new_path,
+      [&](const tutorial::DiffEntry &entry) {
+        entries.push_back(entry);
+        return true;
+      },
+      &stats));
+  EXPECT_EQ(10, stats.removed);
+  EXPECT_EQ(2, stats.inserted);
+  EXPECT_EQ(3, stats.updated);
+  EXPECT_EQ(87, stats.unchanged);
+  ASSERT_EQ(15u, entries.size());
+  EXPECT_EQ(tutorial::kDiffInsert, entries[0].kind);
+  EXPECT_EQ(-5, entries[0].id);
+  EXPECT_EQ(tutorial::kDiffRemove, entries[1].kind);
+  EXPECT_EQ(3, entries[1].id);
+  EXPECT_EQ(tutorial::kDiffUpdate, entries[3].kind);
+  EXPECT_EQ(20, entries[3].id);
+  EXPECT_EQ(tutorial::kPersonName, entries[3].changed);
+  EXPECT_EQ(40, entries[6].id);
+  EXPECT_EQ(tutorial::kPersonEmail | tutorial::kPhoneType, entries[6].changed);
+  EXPECT_EQ(41, entries[7].id);
+  EXPECT_EQ(tutorial::kPhoneNumber | tutorial::kPhoneType, entries[7].changed);
+  EXPECT_EQ(tutorial::kDiffInsert, entries[14].kind);
+  EXPECT_EQ(200, entries[14].id);
+
+  ASSERT_TRUE(tutorial::write_diff(old_path, new_path, diff_path));
+  ASSERT_TRUE(tutorial::apply_diff(old_path, diff_path, applied_path));
+  std::ifstream in(applied_path, std::ios::binary);
+  std::string applied((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_TRUE(applied == after.SerializeAsString());
+
+  // the diff only fits the book it was made from.
+  EXPECT_FALSE(tutorial::apply_diff(new_path, diff_path, applied_path));
+  // and both books have to be sorted.
+  std::string unsorted = after.SerializeAsString();
+  tutorial::AddressBook first;
+  first.add_person()->CopyFrom(after.person(after.person_size() - 1));
+  std::ofstream(new_path, std::ios::binary)
+      << first.SerializeAsString() << unsorted;
+  EXPECT_FALSE(tutorial::write_diff(old_path, new_path, diff_path));
+  for (const std::string &path : {old_path, new_path, diff_path,
+                                  applied_path}) {
+    unlink(path.c_str());
+  }
+}
+
+// bytes this process has read, from /proc/self/io; -1 where the kernel
+// does not keep the count.
+int64_t bytes_read() {
+  std::ifstream io("/proc/self/io");
+  std::string key;
+  int64_t value;
+  while (io >> key >> value) {
+    if (key == "rchar:") {
+      return value;
+    }
+  }
+  return -1;
+}
+
+// an invalid wire type at the start of a book fails the diff in the first
+// block, instead of growing the reader's buffer until the end of the book.
+TEST(BookDiff, MalformedBookFailsEarly) {
+  tutorial::AddressBook book;
+  make_book(200000, &book);
+  std::string bytes = book.SerializeAsString();
+  bytes[0] = '\x0f';
+  std::string old_path = temp_path("diff_old");
+  std::string new_path = temp_path("diff_new");
+  std::ofstream(old_path, std::ios::binary) << bytes;
+  book.mutable_person()->DeleteSubrange(10, book.person_size() - 10);
+  std::ofstream(new_path, std::ios::binary) << book.SerializeAsString();
+
+  int64_t before = bytes_read();
+  EXPECT_FALSE(tutorial::diff_books(
+      old_path, new_path, [](const tutorial::DiffEntry &) { return true; }));
+  if (before >= 0) {
+    EXPECT_LT(bytes_read() - before, static_cast<int64_t>(bytes.size()) / 2);
+  }
+  unlink(old_path.c_str());
+  unlink(new_path.c_str());
+}
+
+} // namespace book_diff
+
+namespace packed_book {
+
+// ids sorted with gaps, out of order, and negative; unset and empty strings,
+// unset and explicit phone types, and unknown fields on people and the book.
+TEST(PackedBook, RoundTripsExactly) {
+  tutorial::AddressBook book;
+  make_book(1000, &book);
+  for (int i = 0; i < 1000; ++i) {
+    tutorial::Person *person = book.mutable_person(i);
+    person->set_id(i < 900 ? i * 3 + (i % 7 == 0) : 500 - i * 1000);
+    if (i % 5 == 0) {
+      person->mutable_phone()->Clear();
+      for (int j = 0; j < 70; ++j) {
+        person->add_phone()->set_number("");
+        if (j % 4 != 3) {
+          person->mutable_phone(j)->set_type(
+              static_cast<tutorial::Person::PhoneType>(j % 4));
+        }
+      }
+    }
+    if (i % 11 == 0) {
+      person->clear_name();
+      person->mutable_unknown_fields()->AddVarint(15, i);
+    }
+  }
+  book.mutable_unknown_fields()->AddLengthDelimited(9, "book");
+  std::string original = book.SerializePartialAsString();
+
+  std::string packed;
+  ASSERT_TRUE(tutorial::pack_address_book(book, &packed));
+  EXPECT_LT(packed.size(), original.size());
+  tutorial::AddressBook unpacked;
+  ASSERT_TRUE(tutorial::unpack_address_book(
+      reinterpret_cast<const uint8_t *>(packed.data()), packed.size(),
+      &unpacked));
+  EXPECT_TRUE(original == unpacked.SerializePartialAsString());
+
+  std::vector<int32_t> ids;
+  ASSERT_TRUE(tutorial::unpack_ids(
+      reinterpret_cast<const uint8_t *>(packed.data()), packed.size(), &ids));
+  ASSERT_EQ(1000u, ids.size());
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(book.person(i).id(), ids[i]);
+  }
+
+  // truncation anywhere is caught.
+  for (size_t size = 0; size < packed.size(); size += 97) {
+    EXPECT_FALSE(tutorial::unpack_address_book(
+        reinterpret_cast<const uint8_t *>(packed.data()), size, &unpacked));
+  }
+}
+
+// consecutive ids take no bits beyond the block headers.
+// blocks at every gap width, with random gaps on top of a random minimum
+// delta, come out the same from both id unpackers.
+TEST(PackedBook, ScalarAndVectorIdsAgree) {
+  std::mt19937 random(23);
+  for (int width = 0; width <= 32; ++width) {
+    tutorial::AddressBook book;
+    uint32_t id = random();
+    uint32_t min_delta = random() % 1000;
+    // never a whole number of blocks, so the short last one is covered too.
+    int people = 128 * 3 + width + 1;
+    for (int i = 0; i < people; ++i) {
+      uint32_t gap = width == 0 ? 0 : random() >> (32 - width);
+      id += min_delta + gap;
+      book.add_person()->set_id(static_cast<int32_t>(id));
+    }
+    std::string packed;
+    ASSERT_TRUE(tutorial::pack_address_book(book, &packed));
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(packed.data());
+    std::vector<int32_t> ids;
+    std::vector<int32_t> scalar_ids;
+    ASSERT_TRUE(tutorial::unpack_ids(data, packed.size(), &ids));
+    ASSERT_TRUE(tutorial::unpack_ids_scalar(data, packed.size(), &scalar_ids));
+    ASSERT_EQ(static_cast<size_t>(people), ids.size());
+    EXPECT_TRUE(ids == scalar_ids) << "width " << width;
+    for (int i = 0; i < people; ++i) {
+      ASSERT_EQ(book.person(i).id(), ids[i]) << "width " << width;
+    }
+  }
+}
+
+TEST(PackedBook, SequentialIdsPackToHeaders) {
+  tutorial::AddressBook book;
+  for (int i = 0; i < 1280; ++i) {
+    book.add_person()->set_id(i + 100);
+  }
+  std::string packed;
+  ASSERT_TRUE(tutorial::pack_address_book(book, &packed));
+  std::vector<int32_t> ids;
+  ASSERT_TRUE(tutorial::unpack_ids(
+      reinterpret_cast<const uint8_t *>(packed.data()), packed.size(), &ids));
+  ASSERT_EQ(1280u, ids.size());
+  EXPECT_EQ(100, ids[0]);
+  EXPECT_EQ(1379, ids[1279]);
+  // what remains is a one-byte unset name, email and phone count apiece.
+  EXPECT_LT(packed.size(), 1280u * 3 + 512);
+
+  book.mutable_person(3)->clear_id();
+  EXPECT_FALSE(tutorial::pack_address_book(book, &packed));
+}
+
+} // namespace packed_book
+
+namespace book_store {
+
+typedef std::map<int32_t, tutorial::Person> People;
+
+void remove_store(const std::string &dir) {
+  if (DIR *listing = opendir(dir.c_str())) {
+    while (dirent *entry = readdir(listing)) {
+      unlink((dir + "/" + entry->d_name).c_str());
+    }
+    closedir(listing);
+  }
+  rmdir(dir.c_str());
+}
+
+// the store's people in id order, serialized.
+std::string contents(const tutorial::BookStore &store) {
+  tutorial::AddressBook book;
+  store.copy_to(&book);
+  std::sort(book.mutable_person()->begin(), book.mutable_person()->end(),
+            [](const tutorial::Person &a, const tutorial::Person &b) {
+              return a.id() < b.id();
+            });
+  return book.SerializeAsString();
+}
+
+std::string contents(const People &people) {
+  tutorial::AddressBook book;
+  for (const People::value_type &entry : people) {
+    *book.add_person() = entry.second;
+  }
+  return book.SerializeAsString();
+}
+
+// puts, removals, email changes and added phones, mirrored into `expected`.
+void mutate(tutorial::BookStore *store, int first, int count,
+            People *expected) {
+  for (int i = first; i < first + count; ++i) {
+    tutorial::Person person;
+    make_person(i, &person);
+    ASSERT_TRUE(store->put(person));
+    (*expected)[i] = person;
+    if (i % 4 == 0) {
+      ASSERT_TRUE(store->set_email(i, "new" + std::to_string(i)));
+      (*expected)[i].set_email("new" + std::to_string(i));
+    }
+    if (i % 3 == 0) {
+      tutorial::Person::PhoneNumber phone;
+      phone.set_number("added");
+      ASSERT_TRUE(store->add_phone(i, phone));
+      *(*expected)[i].add_phone() = phone;
+    }
+    if (i % 7 == 0) {
+      ASSERT_TRUE(store->remove(i));
+      expected->erase(i);
+    }
+  }
+}
+
+TEST(BookStore, RecoversFromLogAndSnapshot) {
+  std::string dir = temp_path("store");
+  remove_store(dir);
+  tutorial::StoreOptions options;
+  options.checkpoint_bytes = 0;
+  options.threads = 3;
+  People expected;
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    mutate(&store, 0, 200, &expected);
+    tutorial::Person incomplete;
+    incomplete.set_name("no id");
+    EXPECT_FALSE(store.put(incomplete));
+    EXPECT_FALSE(store.remove(7));
+    EXPECT_FALSE(store.set_email(1000, "nobody"));
+    EXPECT_EQ(static_cast<int64_t>(expected.size()), store.size());
+    ASSERT_TRUE(store.close());
+  }
+
+  int64_t logged;
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    logged = store.stats().replayed;
+    EXPECT_GT(logged, 200);
+    EXPECT_EQ(contents(expected), contents(store));
+    tutorial::Person person;
+    ASSERT_TRUE(store.get(8, &person));
+    EXPECT_EQ("new8", person.email());
+    EXPECT_FALSE(store.get(14, &person));
+
+    ASSERT_TRUE(store.checkpoint());
+    mutate(&store, 150, 100, &expected);
+    ASSERT_TRUE(store.close());
+  }
+
+  // the snapshot is a plain book; only the log after it is replayed.
+  tutorial::BookStore store;
+  ASSERT_TRUE(store.open(dir, options));
+  EXPECT_LT(store.stats().replayed, logged);
+  EXPECT_EQ(contents(expected), contents(store));
+  tutorial::AddressBook snapshot;
+  ASSERT_TRUE(snapshot.ParseFromString(
+      book_appender::read_file(dir + "/snapshot." + std::to_string(logged))));
+  EXPECT_EQ(static_cast<int>(200 - 200 / 7 - 1), snapshot.person_size());
+  ASSERT_TRUE(store.close());
+  remove_store(dir);
+}
+
+TEST(BookStore, CutsTornRecordOnOpen) {
+  std::string dir = temp_path("store");
+  remove_store(dir);
+  tutorial::StoreOptions options;
+  People expected;
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    mutate(&store, 0, 10, &expected);
+    ASSERT_TRUE(store.close());
+  }
+  std::string log = book_appender::read_file(dir + "/wal.0");
+  {
+    std::ofstream out(dir + "/wal.0", std::ios::binary | std::ios::app);
+    out << log.substr(0, 7);
+  }
+
+  tutorial::BookStore store;
+  ASSERT_TRUE(store.open(dir, options));
+  EXPECT_EQ(contents(expected), contents(store));
+  EXPECT_EQ(log, book_appender::read_file(dir + "/wal.0"));
+  mutate(&store, 10, 10, &expected);
+  ASSERT_TRUE(store.close());
+  ASSERT_TRUE(store.open(dir, options));
+  EXPECT_EQ(contents(expected), contents(store));
+  ASSERT_TRUE(store.close());
+
+  // damage anywhere but the end is not a torn write.
+  std::string damaged = book_appender::read_file(dir + "/wal.0");
+  damaged[damaged.size() / 2] ^= 1;
+  std::ofstream(dir + "/wal.0", std::ios::binary) << damaged;
+  EXPECT_FALSE(store.open(dir, options));
+  remove_store(dir);
+}
+
+// a bad record with good ones after it in the same segment is not a torn
+// write, and open leaves the segment alone for someone to look at.
+TEST(BookStore, RefusesDamageBeforeTheEnd) {
+  std::string dir = temp_path("store");
+  remove_store(dir);
+  tutorial::StoreOptions options;
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    People expected;
+    mutate(&store, 0, 10, &expected);
+    ASSERT_TRUE(store.close());
+  }
+  std::string damaged = book_appender::read_file(dir + "/wal.0");
+  ASSERT_GT(damaged.size(), 64u);
+  damaged[5] ^= 1;
+  std::ofstream(dir + "/wal.0", std::ios::binary) << damaged;
+
+  tutorial::BookStore store;
+  EXPECT_FALSE(store.open(dir, options));
+  EXPECT_EQ(damaged, book_appender::read_file(dir + "/wal.0"));
+  remove_store(dir);
+}
+
+// a checkpoint that could not write its snapshot leaves its log bytes owed,
+// so the next one writes the snapshot rather than finding nothing to do,
+// and the background thread keeps trying until one succeeds.
+TEST(BookStore, RetriesFailedCheckpoints) {
+  std::string dir = temp_path("store");
+  remove_store(dir);
+  tutorial::StoreOptions options;
+  options.checkpoint_bytes = 0;
+  People expected;
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    mutate(&store, 0, 10, &expected);
+    std::string snapshot =
+        dir + "/snapshot." + std::to_string(store.stats().mutations);
+    // a directory where the snapshot's temporary file goes.
+    ASSERT_EQ(0, mkdir((snapshot + ".tmp").c_str(), 0755));
+    EXPECT_FALSE(store.checkpoint());
+    ASSERT_EQ(0, rmdir((snapshot + ".tmp").c_str()));
+    EXPECT_TRUE(store.checkpoint());
+    EXPECT_EQ(0, access(snapshot.c_str(), F_OK));
+    ASSERT_TRUE(store.close());
+  }
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    EXPECT_EQ(0, store.stats().replayed);
+    EXPECT_EQ(contents(expected), contents(store));
+    ASSERT_TRUE(store.close());
+  }
+  remove_store(dir);
+
+  options.checkpoint_bytes = 1;
+  tutorial::BookStore store;
+  ASSERT_TRUE(store.open(dir, options));
+  std::string blocker = dir + "/snapshot.1.tmp";
+  ASSERT_EQ(0, mkdir(blocker.c_str(), 0755));
+  tutorial::Person person;
+  make_person(1, &person);
+  ASSERT_TRUE(store.put(person));
+  auto wait_for = [&store](int64_t tutorial::StoreStats::*counter) {
+    for (int i = 0; i < 500 && store.stats().*counter == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return store.stats().*counter;
+  };
+  EXPECT_GT(wait_for(&tutorial::StoreStats::failed_checkpoints), 0);
+  ASSERT_EQ(0, rmdir(blocker.c_str()));
+  EXPECT_GT(wait_for(&tutorial::StoreStats::checkpoints), 0);
+  EXPECT_FALSE(store.failed());
+  ASSERT_TRUE(store.close());
+  remove_store(dir);
+}
+
+// writers on several threads, with checkpoints running underneath them
+// both in the background and on demand.
+TEST(BookStore, CheckpointsDoNotBlockOrLoseWrites) {
+  std::string dir = temp_path("store");
+  remove_store(dir);
+  tutorial::StoreOptions options;
+  options.checkpoint_bytes = 8 << 10;
+  std::vector<People> expected(4);
+  {
+    tutorial::BookStore store;
+    ASSERT_TRUE(store.open(dir, options));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&store, &expected, t] {
+        mutate(&store, t * 1000, 300, &expected[t]);
+      });
+    }
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_TRUE(store.checkpoint());
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    EXPECT_GE(store.stats().checkpoints, 1);
+    EXPECT_LT(store.stats().commits, store.stats().mutations);
+    ASSERT_TRUE(store.close());
+  }
+
+  People all;
+  for (const People &people : expected) {
+    all.insert(people.begin(), people.end());
+  }
+  tutorial::BookStore store;
+  ASSERT_TRUE(store.open(dir, options));
+  EXPECT_EQ(contents(all), contents(store));
+  ASSERT_TRUE(store.close());
+  remove_store(dir);
+}
+
+} // namespace book_store
+
+namespace person_store {
+
+TEST(PersonStore, PutGetRemove) {
+  tutorial::PersonStore store(4);
+  for (int i = -2000; i < 3000; ++i) {
+    tutorial::Person person;
+    make_person(i, &person);
+    ASSERT_TRUE(store.put(person));
+  }
+  for (int i = -2000; i < 3000; i += 3) {
+    ASSERT_TRUE(store.remove(i));
+  }
+  EXPECT_FALSE(store.remove(-2000));
+  EXPECT_FALSE(store.remove(5000));
+  tutorial::Person replaced;
+  make_person(2, &replaced);
+  replaced.set_name("replaced");
+  ASSERT_TRUE(store.put(replaced));
+  tutorial::Person returned;
+  make_person(-2000, &returned);
+  ASSERT_TRUE(store.put(returned));
+  tutorial::Person incomplete;
+  incomplete.set_name("no id");
+  EXPECT_FALSE(store.put(incomplete));
+  EXPECT_EQ(5000 - 1667 + 1, store.size());
+
+  for (int i = -2000; i < 3000; ++i) {
+    tutorial::Person found;
+    bool removed = (i + 2000) % 3 == 0 && i != -2000;
+    ASSERT_EQ(!removed, store.get(i, &found)) << i;
+    if (!removed) {
+      tutorial::Person expected;
+      make_person(i, &expected);
+      if (i == 2) {
+        expected.set_name("replaced");
+      }
+      EXPECT_EQ(expected.SerializeAsString(), found.SerializeAsString());
+    }
+  }
+}
+
+// readers racing writers that replace and remove the same few people only
+// ever see one whole version of a person.
+TEST(PersonStore, ReadersSeeWholePeople) {
+  tutorial::PersonStore store(2);
+  std::atomic<bool> done(false);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 2; ++t) {
+    writers.emplace_back([&store, t] {
+      for (int i = 0; i < 20000; ++i) {
+        int id = (i * 7 + t) % 64;
+        if (i % 5 == 4) {
+          store.remove(id);
+          continue;
+        }
+        std::string version = std::to_string(t) + "." + std::to_string(i);
+        tutorial::Person person;
+        person.set_id(id);
+        person.set_name(version);
+        person.set_email(version + "@example.com");
+        for (int j = 0; j < i % 3; ++j) {
+          person.add_phone()->set_number(version);
+        }
+        ASSERT_TRUE(store.put(person));
+      }
+    });
+  }
+  std::vector<std::thread> readers;
+  std::atomic<int64_t> found(0);
+  for (int t = 0; t < 3; ++t) {
+    readers.emplace_back([&store, &done, &found, t] {
+      tutorial::Person person;
+      for (int i = t; !done.load(); ++i) {
+        if (!store.get(i % 64, &person)) {
+          continue;
+        }
+        ++found;
+        ASSERT_EQ(i % 64, person.id());
+        ASSERT_EQ(person.name() + "@example.com", person.email());
+        for (int j = 0; j < person.phone_size(); ++j) {
+          ASSERT_EQ(person.name(), person.phone(j).number());
+        }
+      }
+    });
+  }
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+  done.store(true);
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+  EXPECT_GT(found.load(), 0);
+  int64_t present = 0;
+  tutorial::Person person;
+  for (int id = 0; id < 64; ++id) {
+    present += store.get(id, &person) ? 1 : 0;
+  }
+  EXPECT_EQ(present, store.size());
+}
+
+} // namespace person_store
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  google::protobuf::ShutdownProtobufLibrary();
+  return result;
+}
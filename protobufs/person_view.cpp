@@ -0,0 +1,187 @@
+#include "person_view.h"
+
+namespace tutorial {
+
+namespace {
+
+// the value of the last `tag` field in [data, data + size), if any.
+bool last_field(const uint8_t *data, size_t size, uint32_t tag,
+                const uint8_t **value, const uint8_t **value_end) {
+  bool found = false;
+  wire::for_each_field(data, data + size,
+                       [&](uint32_t field_tag, const uint8_t *begin,
+                           const uint8_t *end) {
+                         if (field_tag == tag) {
+                           *value = begin;
+                           *value_end = end;
+                           found = true;
+                         }
+                         return true;
+                       });
+  return found;
+}
+
+bool last_string(const uint8_t *data, size_t size, int field,
+                 StringView *str) {
+  const uint8_t *value;
+  const uint8_t *value_end;
+  if (!last_field(data, size, wire::make_tag(field, wire::kLengthDelimited),
+                  &value, &value_end)) {
+    return false;
+  }
+  const uint8_t *payload = wire::payload(value, value_end);
+  *str = StringView(reinterpret_cast<const char *>(payload),
+                    value_end - payload);
+  return true;
+}
+
+bool last_varint(const uint8_t *data, size_t size, int field, uint64_t *v) {
+  const uint8_t *value;
+  const uint8_t *value_end;
+  if (!last_field(data, size, wire::make_tag(field, wire::kVarint), &value,
+                  &value_end)) {
+    return false;
+  }
+  return wire::read_varint64(&value, value_end, v);
+}
+
+// unlike the scalars, a phone type out of enum range goes to the generated
+// message's unknown fields, so the last *valid* value is the one that sticks.
+bool last_phone_type(const uint8_t *data, size_t size, int *type) {
+  bool found = false;
+  wire::for_each_field(
+      data, data + size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        uint64_t v;
+        if (tag == wire::make_tag(Person_PhoneNumber::kTypeFieldNumber,
+                                  wire::kVarint) &&
+            wire::read_varint64(&value, value_end, &v) &&
+            Person_PhoneType_IsValid(static_cast<int>(v))) {
+          *type = static_cast<int>(v);
+          found = true;
+        }
+        return true;
+      });
+  return found;
+}
+
+} // namespace
+
+bool PhoneNumberView::has_number() const {
+  StringView number;
+  return last_string(m_data, m_size, Person_PhoneNumber::kNumberFieldNumber,
+                     &number);
+}
+
+StringView PhoneNumberView::number() const {
+  StringView number;
+  last_string(m_data, m_size, Person_PhoneNumber::kNumberFieldNumber,
+              &number);
+  return number;
+}
+
+bool PhoneNumberView::has_type() const {
+  int type;
+  return last_phone_type(m_data, m_size, &type);
+}
+
+Person::PhoneType PhoneNumberView::type() const {
+  int type = Person::Home;
+  last_phone_type(m_data, m_size, &type);
+  return static_cast<Person::PhoneType>(type);
+}
+
+bool PersonView::has_id() const {
+  uint64_t id;
+  return last_varint(m_data, m_size, Person::kIdFieldNumber, &id);
+}
+
+int32_t PersonView::id() const {
+  uint64_t id = 0;
+  last_varint(m_data, m_size, Person::kIdFieldNumber, &id);
+  return static_cast<int32_t>(id);
+}
+
+bool PersonView::has_name() const {
+  StringView name;
+  return last_string(m_data, m_size, Person::kNameFieldNumber, &name);
+}
+
+StringView PersonView::name() const {
+  StringView name;
+  last_string(m_data, m_size, Person::kNameFieldNumber, &name);
+  return name;
+}
+
+bool PersonView::has_email() const {
+  StringView email;
+  return last_string(m_data, m_size, Person::kEmailFieldNumber, &email);
+}
+
+StringView PersonView::email() const {
+  StringView email;
+  last_string(m_data, m_size, Person::kEmailFieldNumber, &email);
+  return email;
+}
+
+int PersonView::phone_size() const {
+  int count = 0;
+  for_each_phone([&](const PhoneNumberView &) { ++count; });
+  return count;
+}
+
+PhoneNumberView PersonView::phone(int index) const {
+  PhoneNumberView result;
+  int i = 0;
+  for_each_phone([&](const PhoneNumberView &phone) {
+    if (i++ == index) {
+      result = phone;
+    }
+  });
+  return result;
+}
+
+bool PersonView::valid() const {
+  bool ok = true;
+  bool framed = wire::for_each_field(
+      m_data, m_data + m_size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == wire::make_tag(Person::kPhoneFieldNumber,
+                                  wire::kLengthDelimited)) {
+          const uint8_t *phone = wire::payload(value, value_end);
+          ok = wire::for_each_field(
+              phone, value_end,
+              [](uint32_t, const uint8_t *, const uint8_t *) { return true; });
+        }
+        return ok;
+      });
+  return framed && ok;
+}
+
+bool PersonView::materialize(Person *person) const {
+  return person->ParseFromArray(m_data, static_cast<int>(m_size));
+}
+
+bool AddressBookView::next(PersonView *person) {
+  while (m_ptr < m_end && !m_failed) {
+    uint32_t tag;
+    if (!wire::read_varint32(&m_ptr, m_end, &tag) || tag == 0) {
+      m_failed = true;
+      return false;
+    }
+    const uint8_t *value = m_ptr;
+    if (!wire::skip_field(tag, &m_ptr, m_end)) {
+      m_failed = true;
+      return false;
+    }
+
+    if (tag == wire::kPersonTag) {
+      const uint8_t *payload = wire::payload(value, m_ptr);
+      *person = PersonView(payload, m_ptr - payload);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace tutorial
@@ -0,0 +1,111 @@
+#ifndef PERSON_VIEW_H_
+#define PERSON_VIEW_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "person.pb.h"
+#include "string_view.h"
+#include "wire.h"
+
+// read-only views over serialized messages. accessors walk the wire format on
+// every call and return strings as views into the original buffer, so reading
+// one field of a Person costs one pass over its bytes and no allocation.
+// the buffer must outlive every view into it.
+//
+// semantics match the generated parser: the last occurrence of a singular
+// field wins, unset fields read as their defaults, and an out-of-range phone
+// type reads as unset. accessors stop at malformed bytes; use valid() to
+// check a record's framing up front.
+namespace tutorial {
+
+class PhoneNumberView {
+public:
+  PhoneNumberView() : m_data(nullptr), m_size(0) {}
+  PhoneNumberView(const uint8_t *data, size_t size)
+      : m_data(data), m_size(size) {}
+
+  bool has_number() const;
+  StringView number() const;
+  bool has_type() const;
+  Person::PhoneType type() const;
+
+  const uint8_t *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const uint8_t *m_data;
+  size_t m_size;
+};
+
+class PersonView {
+public:
+  PersonView() : m_data(nullptr), m_size(0) {}
+  PersonView(const uint8_t *data, size_t size) : m_data(data), m_size(size) {}
+
+  bool has_id() const;
+  int32_t id() const;
+  bool has_name() const;
+  StringView name() const;
+  bool has_email() const;
+  StringView email() const;
+
+  // phone(i) walks the record up to the i-th phone; iterate with
+  // for_each_phone when visiting all of them.
+  int phone_size() const;
+  PhoneNumberView phone(int index) const;
+  template <typename Visitor> void for_each_phone(Visitor visit) const;
+
+  // true if the record's fields and its phones' fields are well formed.
+  bool valid() const;
+  // full decode, for when a scan does need the whole message.
+  bool materialize(Person *person) const;
+
+  const uint8_t *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const uint8_t *m_data;
+  size_t m_size;
+};
+
+// cursor over the Person records of a serialized AddressBook; top-level
+// fields other than `person` are skipped.
+class AddressBookView {
+public:
+  AddressBookView(const uint8_t *data, size_t size)
+      : m_data(data), m_end(data + size), m_ptr(data), m_failed(false) {}
+
+  // returns false at the end of the book or on malformed framing; see
+  // failed().
+  bool next(PersonView *person);
+  bool failed() const { return m_failed; }
+  void rewind() {
+    m_ptr = m_data;
+    m_failed = false;
+  }
+
+private:
+  const uint8_t *m_data;
+  const uint8_t *m_end;
+  const uint8_t *m_ptr;
+  bool m_failed;
+};
+
+template <typename Visitor>
+void PersonView::for_each_phone(Visitor visit) const {
+  wire::for_each_field(
+      m_data, m_data + m_size,
+      [&](uint32_t tag, const uint8_t *value, const uint8_t *value_end) {
+        if (tag == wire::make_tag(Person::kPhoneFieldNumber,
+                                  wire::kLengthDelimited)) {
+          const uint8_t *phone = wire::payload(value, value_end);
+          visit(PhoneNumberView(phone, value_end - phone));
+        }
+        return true;
+      });
+}
+
+} // namespace tutorial
+
+#endif // PERSON_VIEW_H_
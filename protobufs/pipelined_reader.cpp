@@ -0,0 +1,375 @@
+#include "pipelined_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "file_io.h"
+#include "stats.h"
+#include "utf8.h"
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+// a chunk of the file, shared by the slices cut from it. not a std::string,
+// which would zero-fill every chunk before read(2) overwrites it.
+struct Chunk {
+  explicit Chunk(size_t capacity) : data(new uint8_t[capacity]), size(0) {}
+
+  std::unique_ptr<uint8_t[]> data;
+  size_t size;
+};
+
+struct Slice {
+  int64_t sequence;
+  std::shared_ptr<const Chunk> chunk;
+  size_t begin;
+  size_t end;
+};
+
+// decoded batches wait here to be consumed in file order. a decoder may run
+// at most `depth` batches ahead of the consumer, which bounds the window and
+// is the decode stage's backpressure.
+class ReorderWindow {
+public:
+  explicit ReorderWindow(size_t depth)
+      : m_slots(depth, nullptr), m_next(0), m_end(-1), m_stopped(false) {}
+
+  // false if the pipeline stopped first.
+  bool put(int64_t sequence, AddressBook *batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [&] {
+      return m_stopped ||
+             sequence < m_next + static_cast<int64_t>(m_slots.size());
+    });
+    if (m_stopped) {
+      return false;
+    }
+    m_slots[sequence % m_slots.size()] = batch;
+    m_changed.notify_all();
+    return true;
+  }
+
+  // the next batch in order; null after the last one or once stopped.
+  AddressBook *take() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    AddressBook **slot = &m_slots[m_next % m_slots.size()];
+    m_changed.wait(lock,
+                   [&] { return m_stopped || *slot || m_next == m_end; });
+    if (m_stopped || !*slot) {
+      return nullptr;
+    }
+    AddressBook *batch = *slot;
+    *slot = nullptr;
+    ++m_next;
+    m_changed.notify_all();
+    return batch;
+  }
+
+  // no sequence at or past `end` will be put.
+  void finish(int64_t end) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_end = end;
+    m_changed.notify_all();
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopped = true;
+    m_changed.notify_all();
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  std::vector<AddressBook *> m_slots;
+  int64_t m_next;
+  int64_t m_end;
+  bool m_stopped;
+};
+
+// charges the time since the previous charge to one of a stage's counters.
+class StageClock {
+public:
+  void charge(double *counter) {
+    *counter += m_watch.seconds();
+    m_watch.reset();
+  }
+
+private:
+  Stopwatch m_watch;
+};
+
+class Pipeline {
+public:
+  Pipeline(int fd, const PipelineOptions &options)
+      : m_fd(fd), m_options(options), m_slices(options.queue_depth),
+        m_window(options.queue_depth), m_failed(false), m_stopped(false),
+        m_bytes(0) {}
+
+  void read_stage();
+  void decode_stage();
+  bool consume_stage(const BatchConsumer &consume);
+
+  // stops every stage; `failed` if the reason is an error.
+  void stop(bool failed) {
+    if (failed) {
+      m_failed = true;
+    }
+    m_stopped = true;
+    m_slices.close();
+    m_window.stop();
+  }
+
+  bool failed() const { return m_failed; }
+  void collect(PipelineStats *stats);
+
+private:
+  bool emit(int64_t *sequence, const std::shared_ptr<const Chunk> &chunk,
+            size_t begin, size_t end, StageClock *clock);
+  AddressBook *acquire_batch();
+  void release_batch(AddressBook *batch);
+
+  int m_fd;
+  PipelineOptions m_options;
+  BoundedQueue<Slice> m_slices;
+  ReorderWindow m_window;
+  std::atomic<bool> m_failed;
+  std::atomic<bool> m_stopped;
+
+  std::mutex m_batches_mutex;
+  std::vector<std::unique_ptr<AddressBook>> m_batches;
+  std::vector<AddressBook *> m_free_batches;
+
+  // each stage's counters are written only by that stage, except decode's,
+  // which its threads merge under m_stats_mutex.
+  std::mutex m_stats_mutex;
+  int64_t m_bytes;
+  StageStats m_io;
+  StageStats m_decode;
+  StageStats m_consume;
+  PipelineStats m_totals;
+};
+
+bool Pipeline::emit(int64_t *sequence,
+                    const std::shared_ptr<const Chunk> &chunk, size_t begin,
+                    size_t end, StageClock *clock) {
+  Slice slice;
+  slice.sequence = (*sequence)++;
+  slice.chunk = chunk;
+  slice.begin = begin;
+  slice.end = end;
+  clock->charge(&m_io.busy);
+  bool pushed = m_slices.push(std::move(slice));
+  clock->charge(&m_io.blocked);
+  return pushed;
+}
+
+// each chunk starts with whatever incomplete record ended the one before;
+// a record larger than a chunk keeps growing the chunk until it fits.
+void Pipeline::read_stage() {
+  StageClock clock;
+  const size_t chunk_bytes = m_options.chunk_bytes;
+  const int batch_size = m_options.batch_size;
+  int64_t sequence = 0;
+  std::shared_ptr<Chunk> chunk;
+  size_t carried = 0;
+  bool eof = false;
+  bool ok = true;
+
+  while (!eof) {
+    std::shared_ptr<Chunk> next(new Chunk(carried + chunk_bytes));
+    if (carried > 0) {
+      memcpy(next->data.get(), chunk->data.get() + chunk->size - carried,
+             carried);
+    }
+    chunk = next;
+    ssize_t n = read_full(m_fd, chunk->data.get() + carried, chunk_bytes);
+    if (n < 0) {
+      stop(true);
+      return;
+    }
+    m_bytes += n;
+    eof = static_cast<size_t>(n) < chunk_bytes;
+    chunk->size = carried + n;
+
+    const uint8_t *data = chunk->data.get();
+    const uint8_t *end = data + chunk->size;
+    const uint8_t *p = data;
+    const uint8_t *slice_begin = data;
+    int records = 0;
+    while (p < end && ok) {
+      wire::ScanResult result = wire::scan_field(&p, end);
+      // only a record cut off by the end of the chunk is carried into the
+      // next; bad bytes fail the read here, not after the rest of the file
+      // has been carried along behind them.
+      if (result == wire::kScanMalformed) {
+        stop(true);
+        return;
+      }
+      if (result == wire::kScanCutOff) {
+        break;
+      }
+      if (++records == batch_size) {
+        ok = emit(&sequence, chunk, slice_begin - data, p - data, &clock);
+        slice_begin = p;
+        records = 0;
+      }
+    }
+    if (ok && records > 0) {
+      ok = emit(&sequence, chunk, slice_begin - data, p - data, &clock);
+    }
+    // a failed emit means another stage stopped the pipeline.
+    if (!ok) {
+      return;
+    }
+    carried = end - p;
+    // a record still incomplete at the end of the file never will be.
+    if (eof && carried > 0) {
+      stop(true);
+      return;
+    }
+  }
+  clock.charge(&m_io.busy);
+  m_slices.close();
+  m_window.finish(sequence);
+}
+
+void Pipeline::decode_stage() {
+  StageClock clock;
+  StageStats stats;
+  int64_t people = 0;
+  Slice slice;
+  while (m_slices.pop(&slice)) {
+    clock.charge(&stats.starved);
+    if (m_stopped) {
+      continue;
+    }
+    AddressBook *batch = acquire_batch();
+    const uint8_t *begin = slice.chunk->data.get() + slice.begin;
+    bool parsed = batch->ParseFromArray(
+                      begin, static_cast<int>(slice.end - slice.begin)) &&
+                  (!m_options.validate_utf8 || utf8_valid(*batch));
+    slice.chunk.reset();
+    people += batch->person_size();
+    clock.charge(&stats.busy);
+    if (!parsed) {
+      release_batch(batch);
+      stop(true);
+      continue;
+    }
+    if (!m_window.put(slice.sequence, batch)) {
+      release_batch(batch);
+    }
+    clock.charge(&stats.blocked);
+  }
+  clock.charge(&stats.starved);
+
+  std::lock_guard<std::mutex> lock(m_stats_mutex);
+  m_decode.busy += stats.busy;
+  m_decode.starved += stats.starved;
+  m_decode.blocked += stats.blocked;
+  m_totals.people += people;
+}
+
+bool Pipeline::consume_stage(const BatchConsumer &consume) {
+  StageClock clock;
+  while (AddressBook *batch = m_window.take()) {
+    clock.charge(&m_consume.starved);
+    bool more = consume(*batch);
+    ++m_totals.batches;
+    release_batch(batch);
+    clock.charge(&m_consume.busy);
+    if (!more) {
+      stop(false);
+      break;
+    }
+  }
+  clock.charge(&m_consume.starved);
+  return !m_failed;
+}
+
+AddressBook *Pipeline::acquire_batch() {
+  std::lock_guard<std::mutex> lock(m_batches_mutex);
+  if (m_free_batches.empty()) {
+    m_batches.emplace_back(new AddressBook);
+    return m_batches.back().get();
+  }
+  AddressBook *batch = m_free_batches.back();
+  m_free_batches.pop_back();
+  return batch;
+}
+
+void Pipeline::release_batch(AddressBook *batch) {
+  std::lock_guard<std::mutex> lock(m_batches_mutex);
+  m_free_batches.push_back(batch);
+}
+
+void Pipeline::collect(PipelineStats *stats) {
+  std::lock_guard<std::mutex> lock(m_stats_mutex);
+  stats->bytes = m_bytes;
+  stats->people = m_totals.people;
+  stats->batches = m_totals.batches;
+  stats->io = m_io;
+  stats->decode = m_decode;
+  stats->consume = m_consume;
+}
+
+} // namespace
+
+PipelineOptions::PipelineOptions()
+    : decoders(0), batch_size(1024), queue_depth(8), chunk_bytes(4 << 20),
+      validate_utf8(false) {}
+
+bool read_pipelined(const std::string &path, const PipelineOptions &options,
+                    const BatchConsumer &consume, PipelineStats *stats) {
+  Stopwatch watch;
+  PipelineOptions o = options;
+  if (o.decoders <= 0) {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    o.decoders = std::max(1, cores - 1);
+  }
+  if (o.batch_size <= 0 || o.queue_depth <= 0 || o.chunk_bytes == 0) {
+    return false;
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  Pipeline pipeline(fd, o);
+  std::thread reader(&Pipeline::read_stage, &pipeline);
+  std::vector<std::thread> decoders;
+  for (int i = 0; i < o.decoders; ++i) {
+    decoders.emplace_back(&Pipeline::decode_stage, &pipeline);
+  }
+  bool ok = pipeline.consume_stage(consume);
+
+  reader.join();
+  for (std::thread &decoder : decoders) {
+    decoder.join();
+  }
+  ::close(fd);
+  ok = ok && !pipeline.failed();
+
+  if (stats) {
+    pipeline.collect(stats);
+    stats->seconds = watch.seconds();
+  }
+  return ok;
+}
+
+} // namespace tutorial
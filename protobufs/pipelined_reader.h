@@ -0,0 +1,78 @@
+#ifndef PIPELINED_READER_H_
+#define PIPELINED_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "person.pb.h"
+
+// reads a serialized AddressBook in three overlapping stages instead of
+// read-everything, parse-everything, process-everything:
+//
+//   io       one thread read(2)s the file in chunks, finds record
+//            boundaries and cuts each chunk into slices of batch_size
+//            people;
+//   decode   `decoders` threads parse slices into batch AddressBooks;
+//   consume  the calling thread hands the batches, in file order, to a
+//            callback.
+//
+// the stages are joined by bounded queues, so a slow stage stalls the ones
+// before it rather than letting memory grow. batches are recycled once the
+// callback returns, which keeps their Person allocations warm.
+namespace tutorial {
+
+struct PipelineOptions {
+  PipelineOptions();
+
+  // threads <= 0 leaves one hardware thread to the io and consume stages
+  // and gives the rest to decoding.
+  int decoders;
+  int batch_size;
+  // slices waiting for a decoder, and decoded batches waiting for the
+  // consumer.
+  int queue_depth;
+  size_t chunk_bytes;
+  // fails the read on a string field that is not UTF-8, checked by the
+  // decoders batch by batch; see utf8.h. off by default.
+  bool validate_utf8;
+};
+
+// where a stage's time went: doing its own work, waiting for input from the
+// stage before it, and waiting for room in the stage after it. decode adds
+// up its threads.
+struct StageStats {
+  StageStats() : busy(0), starved(0), blocked(0) {}
+
+  double busy;
+  double starved;
+  double blocked;
+};
+
+struct PipelineStats {
+  PipelineStats() : bytes(0), people(0), batches(0), seconds(0) {}
+
+  int64_t bytes;
+  int64_t people;
+  int64_t batches;
+  double seconds;
+  StageStats io;
+  StageStats decode;
+  StageStats consume;
+};
+
+// called once per batch; return false to stop reading early. the batch is
+// reused after the call, so anything kept must be copied or swapped out.
+typedef std::function<bool(const AddressBook &batch)> BatchConsumer;
+
+// false if the file cannot be read, is malformed or truncated, a Person is
+// missing required fields, or validate_utf8 finds invalid UTF-8; an early
+// stop by the consumer is not a failure. `stats` may be null.
+bool read_pipelined(const std::string &path, const PipelineOptions &options,
+                    const BatchConsumer &consume,
+                    PipelineStats *stats = nullptr);
+
+} // namespace tutorial
+
+#endif // PIPELINED_READER_H_
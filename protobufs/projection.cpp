@@ -0,0 +1,138 @@
+#include "projection.h"
+
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+const uint32_t kNameTag = (1 << 3) | wire::kLengthDelimited;
+const uint32_t kIdTag = (2 << 3) | wire::kVarint;
+const uint32_t kEmailTag = (3 << 3) | wire::kLengthDelimited;
+const uint32_t kPhoneTag = (4 << 3) | wire::kLengthDelimited;
+const uint32_t kNumberTag = (1 << 3) | wire::kLengthDelimited;
+const uint32_t kTypeTag = (2 << 3) | wire::kVarint;
+
+// reads a length prefix and checks the payload fits before `end`.
+bool read_length(const uint8_t **p, const uint8_t *end, uint64_t *length) {
+  return wire::read_varint64(p, end, length) &&
+         *length <= static_cast<uint64_t>(end - *p);
+}
+
+bool parse_phone(const uint8_t *p, const uint8_t *end, FieldMask mask,
+                 Person_PhoneNumber *phone) {
+  while (p < end) {
+    uint32_t tag;
+    if (!wire::read_varint32(&p, end, &tag) || tag == 0) {
+      return false;
+    }
+    if (tag == kNumberTag) {
+      uint64_t length;
+      if (!read_length(&p, end, &length)) {
+        return false;
+      }
+      if (mask & kPhoneNumber) {
+        phone->mutable_number()->assign(reinterpret_cast<const char *>(p),
+                                        length);
+      }
+      p += length;
+    } else if (tag == kTypeTag) {
+      uint32_t type;
+      if (!wire::read_varint32(&p, end, &type)) {
+        return false;
+      }
+      if ((mask & kPhoneType) &&
+          Person_PhoneType_IsValid(static_cast<int>(type))) {
+        phone->set_type(static_cast<Person_PhoneType>(type));
+      }
+    } else if (!wire::skip_field(tag, &p, end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parse_person(const uint8_t *p, const uint8_t *end, FieldMask mask,
+                  Person *person) {
+  while (p < end) {
+    uint32_t tag;
+    if (!wire::read_varint32(&p, end, &tag) || tag == 0) {
+      return false;
+    }
+    uint64_t value;
+    switch (tag) {
+    case kNameTag:
+    case kEmailTag:
+      if (!read_length(&p, end, &value)) {
+        return false;
+      }
+      if (tag == kNameTag && (mask & kPersonName)) {
+        person->mutable_name()->assign(reinterpret_cast<const char *>(p),
+                                       value);
+      } else if (tag == kEmailTag && (mask & kPersonEmail)) {
+        person->mutable_email()->assign(reinterpret_cast<const char *>(p),
+                                        value);
+      }
+      p += value;
+      break;
+    case kIdTag:
+      if (!wire::read_varint64(&p, end, &value)) {
+        return false;
+      }
+      if (mask & kPersonId) {
+        person->set_id(static_cast<int32_t>(value));
+      }
+      break;
+    case kPhoneTag:
+      if (!read_length(&p, end, &value)) {
+        return false;
+      }
+      if ((mask & (kPhoneNumber | kPhoneType)) &&
+          !parse_phone(p, p + value, mask, person->add_phone())) {
+        return false;
+      }
+      p += value;
+      break;
+    default:
+      if (!wire::skip_field(tag, &p, end)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool parse_person_projected(const uint8_t *data, size_t size, FieldMask mask,
+                            Person *person) {
+  person->Clear();
+  return parse_person(data, data + size, mask, person);
+}
+
+bool parse_address_book_projected(const uint8_t *data, size_t size,
+                                  FieldMask mask, AddressBook *book) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  while (p < end) {
+    uint32_t tag;
+    if (!wire::read_varint32(&p, end, &tag) || tag == 0) {
+      return false;
+    }
+    if (tag != wire::kPersonTag) {
+      if (!wire::skip_field(tag, &p, end)) {
+        return false;
+      }
+      continue;
+    }
+    uint64_t length;
+    if (!read_length(&p, end, &length) ||
+        !parse_person(p, p + length, mask, book->add_person())) {
+      return false;
+    }
+    p += length;
+  }
+  return true;
+}
+
+} // namespace tutorial
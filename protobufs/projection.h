@@ -0,0 +1,51 @@
+#ifndef PROJECTION_H_
+#define PROJECTION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "person.pb.h"
+
+// parsing restricted to the fields a job asks for. a field outside the mask
+// is stepped over by its tag and length prefix: its bytes are never copied,
+// allocated for or UTF-8 checked, and the field stays unset in the result.
+// phones are only materialized when a phone field is requested, and then
+// carry just the requested parts, so projecting {id, phone.type} yields
+// people with an id and type-only phone entries.
+//
+// requested fields decode as in the generated parser: the last occurrence of
+// a singular field wins, and a phone type outside the enum is dropped (the
+// generated parser would keep it as an unknown field). unknown fields are
+// skipped. since name and id are required, a projection leaving either out
+// produces people IsInitialized() rejects; the results are for reading, not
+// for serializing back.
+namespace tutorial {
+
+enum PersonField {
+  kPersonName = 1 << 0,
+  kPersonId = 1 << 1,
+  kPersonEmail = 1 << 2,
+  kPhoneNumber = 1 << 3,
+  kPhoneType = 1 << 4,
+};
+
+// a set of PersonFields.
+typedef uint32_t FieldMask;
+
+const FieldMask kAllPersonFields =
+    kPersonName | kPersonId | kPersonEmail | kPhoneNumber | kPhoneType;
+
+// parses the masked fields of [data, data + size) into `person`, replacing
+// its contents. false if the record is malformed, including in the fields
+// that are skipped.
+bool parse_person_projected(const uint8_t *data, size_t size, FieldMask mask,
+                            Person *person);
+
+// merges the masked fields of every Person in a serialized AddressBook into
+// `book`. the book's own unknown fields are skipped too.
+bool parse_address_book_projected(const uint8_t *data, size_t size,
+                                  FieldMask mask, AddressBook *book);
+
+} // namespace tutorial
+
+#endif // PROJECTION_H_
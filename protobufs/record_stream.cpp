@@ -0,0 +1,168 @@
+#include "record_stream.h"
+
+#include <fcntl.h>
+
+#include <climits>
+
+#include "wire.h"
+
+namespace tutorial {
+
+namespace {
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+
+// a CodedInputStream counts every byte it has read against its total bytes
+// limit, so the reader swaps in a fresh one once this much has gone through.
+const int kRecycleBytes = 32 << 20;
+
+} // namespace
+
+PersonStreamWriter::PersonStreamWriter() : m_records(0) {}
+
+PersonStreamWriter::PersonStreamWriter(
+    google::protobuf::io::ZeroCopyOutputStream *output)
+    : m_output(new CodedOutputStream(output)), m_records(0) {}
+
+PersonStreamWriter::~PersonStreamWriter() { close(); }
+
+bool PersonStreamWriter::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  m_file.reset(new google::protobuf::io::FileOutputStream(fd));
+  m_output.reset(new CodedOutputStream(m_file.get()));
+  m_records = 0;
+  return true;
+}
+
+bool PersonStreamWriter::write(const Person &person) {
+  if (!m_output) {
+    return false;
+  }
+
+  int size = person.ByteSize();
+  int total = CodedOutputStream::VarintSize32(size) + size;
+
+  // same fast path as Message::SerializeToCodedStream: serialize straight
+  // into the output buffer when the whole record fits in it.
+  uint8_t *buffer = m_output->GetDirectBufferForNBytesAndAdvance(total);
+  if (buffer != nullptr) {
+    buffer = CodedOutputStream::WriteVarint32ToArray(size, buffer);
+    person.SerializeWithCachedSizesToArray(buffer);
+  } else {
+    m_output->WriteVarint32(size);
+    person.SerializeWithCachedSizes(m_output.get());
+  }
+
+  if (m_output->HadError()) {
+    return false;
+  }
+  ++m_records;
+  return true;
+}
+
+bool PersonStreamWriter::close() {
+  bool ok = true;
+  if (m_output) {
+    ok = !m_output->HadError();
+    // the destructor hands unused buffer space back to the underlying stream.
+    m_output.reset();
+  }
+  if (m_file) {
+    ok = m_file->Close() && ok;
+    m_file.reset();
+  }
+  return ok;
+}
+
+PersonStreamReader::PersonStreamReader()
+    : m_input(nullptr), m_records(0), m_validate_utf8(false),
+      m_failed(false) {}
+
+PersonStreamReader::PersonStreamReader(
+    google::protobuf::io::ZeroCopyInputStream *input)
+    : m_input(input), m_records(0), m_validate_utf8(false), m_failed(false) {}
+
+PersonStreamReader::~PersonStreamReader() {
+  // the coded stream must back up into m_file before m_file goes away.
+  m_coded.reset();
+}
+
+bool PersonStreamReader::open(const std::string &path) {
+  m_coded.reset();
+  m_file.reset();
+  m_input = nullptr;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  m_file.reset(new google::protobuf::io::FileInputStream(fd));
+  m_file->SetCloseOnDelete(true);
+  m_input = m_file.get();
+  m_records = 0;
+  m_failed = false;
+  return true;
+}
+
+bool PersonStreamReader::next(Person *person) {
+  if (m_input == nullptr || m_failed) {
+    return false;
+  }
+
+  if (!m_coded || m_coded->CurrentPosition() > kRecycleBytes) {
+    m_coded.reset();
+    m_coded.reset(new CodedInputStream(m_input));
+  }
+
+  // no bytes left at a record boundary is a clean end of stream.
+  const void *data;
+  int available;
+  if (!m_coded->GetDirectBufferPointer(&data, &available)) {
+    return false;
+  }
+
+  uint32_t size;
+  if (!m_coded->ReadVarint32(&size) || size > INT_MAX) {
+    m_failed = true;
+    return false;
+  }
+
+  // a record larger than the recycle window needs the limit raised; the
+  // stream is replaced right after, so the raised limit does not leak.
+  if (size > static_cast<uint32_t>(kRecycleBytes)) {
+    wire::set_total_bytes_limit(m_coded.get(), INT_MAX);
+  }
+
+  CodedInputStream::Limit limit = m_coded->PushLimit(static_cast<int>(size));
+  person->Clear();
+  if (!person->MergePartialFromCodedStream(m_coded.get()) ||
+      !m_coded->ConsumedEntireMessage() ||
+      m_coded->BytesUntilLimit() != 0 || !person->IsInitialized()) {
+    m_failed = true;
+    return false;
+  }
+  m_coded->PopLimit(limit);
+
+  if (m_validate_utf8) {
+    m_utf8.clear();
+    m_utf8.add(*person);
+    if (!m_utf8.valid()) {
+      m_failed = true;
+      return false;
+    }
+  }
+
+  ++m_records;
+  return true;
+}
+
+} // namespace tutorial
@@ -0,0 +1,82 @@
+#ifndef RECORD_STREAM_H_
+#define RECORD_STREAM_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include "person.pb.h"
+#include "utf8.h"
+
+// a person stream is a headerless sequence of varint-length-prefixed Person
+// records, the same framing as Java's writeDelimitedTo/parseDelimitedFrom.
+// unlike one big AddressBook it can be written and read one Person at a time,
+// so neither side ever holds more than a single record.
+namespace tutorial {
+
+class PersonStreamWriter {
+public:
+  PersonStreamWriter();
+  // writes to `output`, which is not owned and must outlive the writer.
+  explicit PersonStreamWriter(google::protobuf::io::ZeroCopyOutputStream *output);
+  ~PersonStreamWriter();
+
+  PersonStreamWriter(const PersonStreamWriter &) = delete;
+  PersonStreamWriter &operator=(const PersonStreamWriter &) = delete;
+
+  // creates or truncates `path`.
+  bool open(const std::string &path);
+  bool write(const Person &person);
+  // flushes buffered records; for files, also closes the descriptor.
+  // returns false if any write failed.
+  bool close();
+
+  int64_t records() const { return m_records; }
+
+private:
+  std::unique_ptr<google::protobuf::io::FileOutputStream> m_file;
+  std::unique_ptr<google::protobuf::io::CodedOutputStream> m_output;
+  int64_t m_records;
+};
+
+class PersonStreamReader {
+public:
+  PersonStreamReader();
+  // reads from `input`, which is not owned and must outlive the reader.
+  explicit PersonStreamReader(google::protobuf::io::ZeroCopyInputStream *input);
+  ~PersonStreamReader();
+
+  PersonStreamReader(const PersonStreamReader &) = delete;
+  PersonStreamReader &operator=(const PersonStreamReader &) = delete;
+
+  bool open(const std::string &path);
+
+  // checks the string fields of every record with the batch validator and
+  // fails the stream on invalid UTF-8; see utf8.h. off by default.
+  void set_validate_utf8(bool validate) { m_validate_utf8 = validate; }
+
+  // clears `person` and parses the next record into it. passing the same
+  // Person on every call keeps its string and phone allocations, so memory
+  // use is bounded by the largest record rather than the stream.
+  // returns false at the end of the stream or on error; see failed().
+  bool next(Person *person);
+  bool failed() const { return m_failed; }
+
+  int64_t records() const { return m_records; }
+
+private:
+  std::unique_ptr<google::protobuf::io::FileInputStream> m_file;
+  google::protobuf::io::ZeroCopyInputStream *m_input;
+  std::unique_ptr<google::protobuf::io::CodedInputStream> m_coded;
+  Utf8Batch m_utf8;
+  int64_t m_records;
+  bool m_validate_utf8;
+  bool m_failed;
+};
+
+} // namespace tutorial
+
+#endif // RECORD_STREAM_H_
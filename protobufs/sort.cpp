@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "external_sort.h"
+
+using namespace std;
+
+namespace {
+
+void print_phase(const char *name, int64_t bytes, double seconds) {
+  cout << "  " << name << ": " << seconds * 1e3 << " ms, "
+       << (seconds > 0 ? bytes / 1e6 / seconds : 0) << " MB/s" << endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  tutorial::SortOptions options;
+  bool ok = true;
+  int arg = 1;
+  for (; arg + 1 < argc - 1 && ok; arg += 2) {
+    const char *value = argv[arg + 1];
+    if (strcmp(argv[arg], "--memory-mb") == 0) {
+      options.memory_bytes = static_cast<size_t>(atoll(value)) << 20;
+    } else if (strcmp(argv[arg], "--io-kb") == 0) {
+      options.io_bytes = static_cast<size_t>(atoll(value)) << 10;
+    } else if (strcmp(argv[arg], "--threads") == 0) {
+      options.threads = atoi(value);
+    } else if (strcmp(argv[arg], "--temp-dir") == 0) {
+      options.temp_dir = value;
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok || arg != argc - 2) {
+    cerr << "Usage: " << argv[0]
+         << " [--memory-mb MB] [--io-kb KB] [--threads N] [--temp-dir DIR]"
+         << " INPUT_FILE OUTPUT_FILE" << endl;
+    return -1;
+  }
+
+  tutorial::SortStats stats;
+  if (!tutorial::sort_address_book(argv[arg], argv[arg + 1], options,
+                                   &stats)) {
+    cerr << "Failed to sort address book: " << argv[arg] << endl;
+    return -1;
+  }
+  cout << "sorted " << stats.people << " people (" << stats.bytes
+       << " bytes) in " << stats.seconds * 1e3 << " ms, "
+       << stats.bytes / 1e6 / stats.seconds << " MB/s; " << stats.runs
+       << " runs, " << stats.merge_passes << " merge passes" << endl;
+  print_phase("read", stats.bytes, stats.read_seconds);
+  print_phase("sort", stats.bytes, stats.sort_seconds);
+  print_phase("write runs", stats.bytes, stats.write_seconds);
+  // every pass reads and writes everything once.
+  print_phase("merge", stats.bytes * stats.merge_passes, stats.merge_seconds);
+  return 0;
+}
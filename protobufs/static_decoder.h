@@ -0,0 +1,192 @@
+#ifndef STATIC_DECODER_H_
+#define STATIC_DECODER_H_
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "person.pb.h"
+#include "wire.h"
+
+// a header-only decoder generated by the compiler from a description of
+// person.proto written as types: each field is its number, wire type and the
+// accessor that stores it, and a message is the list of its fields. the
+// decode loop is instantiated per message, so tags are compile-time
+// constants, the fields are tried in declaration order (the order protoc
+// writes them in) and every accessor call is direct and inlinable, with no
+// virtual Message entry points on the way.
+//
+// anything the description does not cover (unknown fields, a wire type that
+// does not match, an enum value outside the enum) sends that message to its
+// generated parser instead, so results always match ParsePartialFromArray:
+// a nested message falls back on its own, the top-level message as a whole.
+namespace tutorial {
+namespace static_decoder {
+
+template <typename Message, int Number, std::string *(Message::*Mutable)()>
+struct StringField {
+  static constexpr uint32_t kTag = (Number << 3) | wire::kLengthDelimited;
+
+  static bool decode(const uint8_t **p, const uint8_t *end, Message *message) {
+    uint64_t length;
+    if (!wire::read_varint64(p, end, &length) ||
+        length > static_cast<uint64_t>(end - *p)) {
+      return false;
+    }
+    (message->*Mutable)()->assign(reinterpret_cast<const char *>(*p), length);
+    *p += length;
+    return true;
+  }
+};
+
+// int32 and friends; values are truncated to T as the generated code does.
+template <typename Message, int Number, typename T, void (Message::*Set)(T)>
+struct VarintField {
+  static constexpr uint32_t kTag = (Number << 3) | wire::kVarint;
+
+  static bool decode(const uint8_t **p, const uint8_t *end, Message *message) {
+    uint64_t value;
+    if (!wire::read_varint64(p, end, &value)) {
+      return false;
+    }
+    (message->*Set)(static_cast<T>(value));
+    return true;
+  }
+};
+
+template <typename Message, int Number, typename Enum,
+          void (Message::*Set)(Enum), bool (*IsValid)(int)>
+struct EnumField {
+  static constexpr uint32_t kTag = (Number << 3) | wire::kVarint;
+
+  static bool decode(const uint8_t **p, const uint8_t *end, Message *message) {
+    uint32_t value;
+    if (!wire::read_varint32(p, end, &value) ||
+        !IsValid(static_cast<int>(value))) {
+      return false;
+    }
+    (message->*Set)(static_cast<Enum>(value));
+    return true;
+  }
+};
+
+template <typename Message> struct Schema;
+
+template <typename... Fields> struct FieldList;
+
+// the end of the list: no field has this tag.
+template <> struct FieldList<> {
+  template <typename Message>
+  static bool decode(uint32_t, const uint8_t **, const uint8_t *, Message *) {
+    return false;
+  }
+};
+
+template <typename Field, typename... Rest> struct FieldList<Field, Rest...> {
+  template <typename Message>
+  static bool decode(uint32_t tag, const uint8_t **p, const uint8_t *end,
+                     Message *message) {
+    if (tag == Field::kTag) {
+      return Field::decode(p, end, message);
+    }
+    return FieldList<Rest...>::decode(tag, p, end, message);
+  }
+};
+
+// decodes [p, end) into `message` through Schema<Message>; false on anything
+// the schema does not cover, leaving `message` partly filled in.
+template <typename Message>
+bool decode_fields(const uint8_t *p, const uint8_t *end, Message *message) {
+  while (p < end) {
+    uint32_t tag = *p;
+    if (tag < 0x80) {
+      ++p;
+    } else if (!wire::read_varint32(&p, end, &tag)) {
+      return false;
+    }
+    if (!Schema<Message>::Fields::decode(tag, &p, end, message)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Message>
+bool parse_partial(const uint8_t *data, size_t size, Message *message) {
+  message->Clear();
+  if (decode_fields(data, data + size, message)) {
+    return true;
+  }
+  message->Clear();
+  return size <= INT_MAX &&
+         message->ParsePartialFromArray(data, static_cast<int>(size));
+}
+
+// a repeated message field; each occurrence decodes into a new element.
+template <typename Message, int Number, typename Sub, Sub *(Message::*Add)()>
+struct MessageField {
+  static constexpr uint32_t kTag = (Number << 3) | wire::kLengthDelimited;
+
+  static bool decode(const uint8_t **p, const uint8_t *end, Message *message) {
+    uint64_t length;
+    if (!wire::read_varint64(p, end, &length) ||
+        length > static_cast<uint64_t>(end - *p) || length > INT_MAX) {
+      return false;
+    }
+    Sub *sub = (message->*Add)();
+    const uint8_t *sub_end = *p + length;
+    if (!decode_fields(*p, sub_end, sub)) {
+      sub->Clear();
+      if (!sub->ParsePartialFromArray(*p, static_cast<int>(length))) {
+        return false;
+      }
+    }
+    *p = sub_end;
+    return true;
+  }
+};
+
+// person.proto.
+template <> struct Schema<Person_PhoneNumber> {
+  typedef FieldList<
+      StringField<Person_PhoneNumber, 1, &Person_PhoneNumber::mutable_number>,
+      EnumField<Person_PhoneNumber, 2, Person_PhoneType,
+                &Person_PhoneNumber::set_type, &Person_PhoneType_IsValid>>
+      Fields;
+};
+
+template <> struct Schema<Person> {
+  typedef FieldList<
+      StringField<Person, 1, &Person::mutable_name>,
+      VarintField<Person, 2, int32_t, &Person::set_id>,
+      StringField<Person, 3, &Person::mutable_email>,
+      MessageField<Person, 4, Person_PhoneNumber, &Person::add_phone>>
+      Fields;
+};
+
+template <> struct Schema<AddressBook> {
+  typedef FieldList<
+      MessageField<AddressBook, 1, Person, &AddressBook::add_person>>
+      Fields;
+};
+
+} // namespace static_decoder
+
+// drop-in replacements for ParsePartialFromArray.
+inline bool static_parse(const uint8_t *data, size_t size,
+                         Person_PhoneNumber *phone) {
+  return static_decoder::parse_partial(data, size, phone);
+}
+
+inline bool static_parse(const uint8_t *data, size_t size, Person *person) {
+  return static_decoder::parse_partial(data, size, person);
+}
+
+inline bool static_parse(const uint8_t *data, size_t size, AddressBook *book) {
+  return static_decoder::parse_partial(data, size, book);
+}
+
+} // namespace tutorial
+
+#endif // STATIC_DECODER_H_
@@ -0,0 +1,38 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstddef>
+
+namespace tutorial {
+
+class Stopwatch {
+public:
+  Stopwatch() : m_start(std::chrono::steady_clock::now()) {}
+
+  void reset() { m_start = std::chrono::steady_clock::now(); }
+
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         m_start)
+        .count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+// high-water mark of the resident set; ru_maxrss is in kilobytes on linux.
+inline size_t peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+} // namespace tutorial
+
+#endif // STATS_H_
@@ -0,0 +1,52 @@
+#ifndef STRING_VIEW_H_
+#define STRING_VIEW_H_
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace tutorial {
+
+// non-owning reference to bytes in someone else's buffer; std::string_view
+// is C++17 and this tree builds as C++11.
+class StringView {
+public:
+  StringView() : m_data(nullptr), m_size(0) {}
+  StringView(const char *data, size_t size) : m_data(data), m_size(size) {}
+  StringView(const std::string &str) : m_data(str.data()), m_size(str.size()) {}
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  const char *begin() const { return m_data; }
+  const char *end() const { return m_data + m_size; }
+  char operator[](size_t i) const { return m_data[i]; }
+
+  std::string to_string() const { return std::string(m_data, m_size); }
+
+  friend bool operator==(StringView a, StringView b) {
+    return a.m_size == b.m_size &&
+           (a.m_size == 0 || memcmp(a.m_data, b.m_data, a.m_size) == 0);
+  }
+  friend bool operator!=(StringView a, StringView b) { return !(a == b); }
+
+  friend bool operator<(StringView a, StringView b) {
+    size_t n = a.m_size < b.m_size ? a.m_size : b.m_size;
+    int cmp = n == 0 ? 0 : memcmp(a.m_data, b.m_data, n);
+    return cmp != 0 ? cmp < 0 : a.m_size < b.m_size;
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, StringView str) {
+    return os.write(str.m_data, str.m_size);
+  }
+
+private:
+  const char *m_data;
+  size_t m_size;
+};
+
+} // namespace tutorial
+
+#endif // STRING_VIEW_H_
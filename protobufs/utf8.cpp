@@ -0,0 +1,343 @@
+#include "utf8.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+namespace tutorial {
+
+namespace {
+
+// strings at least this long are validated where they are instead of being
+// copied into the batch.
+const size_t kInPlaceBytes = 256;
+const size_t kFlushBytes = 64 << 10;
+
+bool validate_scalar(const uint8_t *p, size_t size) {
+  const uint8_t *end = p + size;
+  while (p < end) {
+    if (end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, 8);
+      if ((word & 0x8080808080808080ull) == 0) {
+        p += 8;
+        continue;
+      }
+    }
+
+    uint8_t lead = *p;
+    if (lead < 0x80) {
+      ++p;
+      continue;
+    }
+
+    int length;
+    uint32_t code_point;
+    uint32_t min_code_point;
+    if ((lead & 0xe0) == 0xc0) {
+      length = 2;
+      code_point = lead & 0x1f;
+      min_code_point = 0x80;
+    } else if ((lead & 0xf0) == 0xe0) {
+      length = 3;
+      code_point = lead & 0x0f;
+      min_code_point = 0x800;
+    } else if ((lead & 0xf8) == 0xf0) {
+      length = 4;
+      code_point = lead & 0x07;
+      min_code_point = 0x10000;
+    } else {
+      return false;
+    }
+
+    if (end - p < length) {
+      return false;
+    }
+    for (int i = 1; i < length; ++i) {
+      if ((p[i] & 0xc0) != 0x80) {
+        return false;
+      }
+      code_point = (code_point << 6) | (p[i] & 0x3f);
+    }
+    if (code_point < min_code_point || code_point > 0x10ffff ||
+        (code_point >= 0xd800 && code_point <= 0xdfff)) {
+      return false;
+    }
+    p += length;
+  }
+  return true;
+}
+
+#ifdef UTF8_X86
+
+// error classes of a (previous byte, current byte) pair; a pair is invalid
+// when the three nibble lookups below agree on at least one class. see
+// "Validating UTF-8 In Less Than One Instruction Per Byte" (Keiser, Lemire).
+const uint8_t kTooShort = 1 << 0;   // 11______ 0_______ / 11______ 11______
+const uint8_t kTooLong = 1 << 1;    // 0_______ 10______
+const uint8_t kOverlong3 = 1 << 2;  // 11100000 100_____
+const uint8_t kTooLarge = 1 << 3;   // 11110100 1001____ and above
+const uint8_t kSurrogate = 1 << 4;  // 11101101 101_____
+const uint8_t kOverlong2 = 1 << 5;  // 1100000_ 10______
+const uint8_t kTooLarge1000 = 1 << 6; // 11110101 1000____ and above
+const uint8_t kOverlong4 = 1 << 6;  // 11110000 1000____
+const uint8_t kTwoConts = 1 << 7;   // 10______ 10______
+const uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// indexed by the high nibble of the previous byte.
+const uint8_t kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong,
+    kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+
+// indexed by the low nibble of the previous byte.
+const uint8_t kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+};
+
+// indexed by the high nibble of the current byte.
+const uint8_t kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+};
+
+// a block ending in these leads needs continuation bytes from the next one.
+const uint8_t kIncompleteMax[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf,
+};
+
+__attribute__((target("sse4.1"))) __m128i
+check_block_sse(__m128i input, __m128i prev_input) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i byte1_high = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte1High)),
+      _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  __m128i byte1_low = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte1Low)),
+      _mm_and_si128(prev1, nibble));
+  __m128i byte2_high = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte2High)),
+      _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+  __m128i special =
+      _mm_and_si128(_mm_and_si128(byte1_high, byte1_low), byte2_high);
+
+  // the second and third continuation bytes of 3- and 4-byte sequences are
+  // the only pairs flagged TWO_CONTS that are actually fine.
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80));
+  __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80));
+  __m128i must23 =
+      _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(0x80));
+  return _mm_xor_si128(must23, special);
+}
+
+__attribute__((target("sse4.1"))) bool validate_sse(const uint8_t *p,
+                                                     size_t size) {
+  const __m128i incomplete_max =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kIncompleteMax + 16));
+  __m128i error = _mm_setzero_si128();
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+
+  uint8_t tail[16];
+  for (size_t i = 0; i < size; i += 16) {
+    __m128i input;
+    if (size - i >= 16) {
+      input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    } else {
+      // zero padding is ASCII, which also flags a sequence cut off by the end.
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, p + i, size - i);
+      input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tail));
+    }
+
+    if (_mm_movemask_epi8(input) == 0) {
+      error = _mm_or_si128(error, prev_incomplete);
+      prev_incomplete = _mm_setzero_si128();
+    } else {
+      error = _mm_or_si128(error, check_block_sse(input, prev_input));
+      prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+    }
+    prev_input = input;
+  }
+  error = _mm_or_si128(error, prev_incomplete);
+  return _mm_testz_si128(error, error) != 0;
+}
+
+__attribute__((target("avx2"))) __m256i
+check_block_avx2(__m256i input, __m256i prev_input) {
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  // lanes are 128 bits wide, so the bytes shifted in come from the upper half
+  // of the previous block for the low lane and the low lane for the high one.
+  __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+  __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+  __m256i byte1_high = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte1High))),
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  __m256i byte1_low = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte1Low))),
+      _mm256_and_si256(prev1, nibble));
+  __m256i byte2_high = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(kByte2High))),
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  __m256i special =
+      _mm256_and_si256(_mm256_and_si256(byte1_high, byte1_low), byte2_high);
+
+  __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+  __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+  __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80));
+  __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                    _mm256_set1_epi8(0x80));
+  return _mm256_xor_si256(must23, special);
+}
+
+__attribute__((target("avx2"))) bool validate_avx2(const uint8_t *p,
+                                                    size_t size) {
+  const __m256i incomplete_max =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kIncompleteMax));
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+
+  uint8_t tail[32];
+  for (size_t i = 0; i < size; i += 32) {
+    __m256i input;
+    if (size - i >= 32) {
+      input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    } else {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, p + i, size - i);
+      input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tail));
+    }
+
+    if (_mm256_movemask_epi8(input) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+    } else {
+      error = _mm256_or_si256(error, check_block_avx2(input, prev_input));
+      prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+    }
+    prev_input = input;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+
+#endif // UTF8_X86
+
+typedef bool (*Validator)(const uint8_t *, size_t);
+
+Validator pick_validator() {
+#ifdef UTF8_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return validate_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return validate_sse;
+  }
+#endif
+  return validate_scalar;
+}
+
+} // namespace
+
+bool utf8_valid(const char *data, size_t size) {
+  static const Validator validate = pick_validator();
+
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  // below one vector the padding copy costs more than it saves.
+  if (size < 16) {
+    return validate_scalar(bytes, size);
+  }
+  return validate(bytes, size);
+}
+
+void Utf8Batch::add(const char *data, size_t size) {
+  if (size >= kInPlaceBytes) {
+    m_valid = utf8_valid(data, size) && m_valid;
+    return;
+  }
+
+  m_packed.append(data, size);
+  m_packed.push_back('\0');
+  if (m_packed.size() >= kFlushBytes) {
+    valid();
+  }
+}
+
+void Utf8Batch::add(const Person &person) {
+  add(person.name());
+  if (person.has_email()) {
+    add(person.email());
+  }
+  for (int i = 0; i < person.phone_size(); ++i) {
+    add(person.phone(i).number());
+  }
+}
+
+bool Utf8Batch::valid() {
+  if (!m_packed.empty()) {
+    m_valid = utf8_valid(m_packed.data(), m_packed.size()) && m_valid;
+    m_packed.clear();
+  }
+  return m_valid;
+}
+
+void Utf8Batch::clear() {
+  m_packed.clear();
+  m_valid = true;
+}
+
+bool utf8_valid(const Person &person) {
+  Utf8Batch batch;
+  batch.add(person);
+  return batch.valid();
+}
+
+bool utf8_valid(const AddressBook &book) {
+  Utf8Batch batch;
+  for (int i = 0; i < book.person_size(); ++i) {
+    batch.add(book.person(i));
+  }
+  return batch.valid();
+}
+
+} // namespace tutorial
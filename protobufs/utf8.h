@@ -0,0 +1,59 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <cstddef>
+#include <string>
+
+#include "person.pb.h"
+#include "string_view.h"
+
+// vectorized UTF-8 validation (Keiser & Lemire's lookup algorithm) with AVX2
+// and SSE4.1 kernels picked at runtime and a scalar fallback. accepts exactly
+// the structurally valid UTF-8 that protobuf accepts: no overlong forms, no
+// surrogates, nothing above U+10FFFF.
+//
+// the generated code only checks string fields (and only logs on failure)
+// when protobuf's GOOGLE_PROTOBUF_UTF8_VALIDATION_ENABLED is on, i.e. in
+// builds without NDEBUG. the Makefile builds person.pb.cc with NDEBUG, so
+// parse and serialize never check. instead every reader can validate once at
+// ingest with the batch checker, and a validated book is trusted from then
+// on: PersonStreamReader::set_validate_utf8(), the `validate_utf8` argument
+// of load_address_book() and load_address_book_parallel(), and
+// PipelineOptions and IngestOptions::validate_utf8.
+namespace tutorial {
+
+bool utf8_valid(const char *data, size_t size);
+inline bool utf8_valid(StringView str) {
+  return utf8_valid(str.data(), str.size());
+}
+
+// collects many short strings and validates them in one vector pass. strings
+// are packed with an ASCII separator between them, which keeps a sequence
+// truncated at the end of one string from being completed by the next.
+// strings long enough to fill vectors on their own are checked in place.
+class Utf8Batch {
+public:
+  Utf8Batch() : m_valid(true) {}
+
+  void add(const char *data, size_t size);
+  void add(StringView str) { add(str.data(), str.size()); }
+  // name, email and every phone number.
+  void add(const Person &person);
+
+  // validates whatever is pending; false if anything added since the last
+  // clear() was invalid.
+  bool valid();
+  void clear();
+
+private:
+  std::string m_packed;
+  bool m_valid;
+};
+
+// every string field of the message, in one batch.
+bool utf8_valid(const Person &person);
+bool utf8_valid(const AddressBook &book);
+
+} // namespace tutorial
+
+#endif // UTF8_H_
@@ -0,0 +1,278 @@
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/stubs/common.h>
+
+// raw wire-format helpers for walking serialized books without going through
+// a CodedInputStream; every reader takes a [p, end) range and advances p.
+namespace tutorial {
+namespace wire {
+
+enum WireType {
+  kVarint = 0,
+  kFixed64 = 1,
+  kLengthDelimited = 2,
+  kStartGroup = 3,
+  kEndGroup = 4,
+  kFixed32 = 5,
+};
+
+// AddressBook.person = 1, length-delimited.
+const uint32_t kPersonTag = (1 << 3) | kLengthDelimited;
+
+inline uint32_t make_tag(int field, WireType type) {
+  return (static_cast<uint32_t>(field) << 3) | type;
+}
+inline int tag_field(uint32_t tag) { return static_cast<int>(tag >> 3); }
+inline WireType tag_type(uint32_t tag) {
+  return static_cast<WireType>(tag & 7);
+}
+
+inline bool read_varint64(const uint8_t **p, const uint8_t *end,
+                          uint64_t *value) {
+  const uint8_t *ptr = *p;
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && ptr < end; shift += 7) {
+    uint8_t byte = *ptr++;
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *p = ptr;
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool read_varint32(const uint8_t **p, const uint8_t *end,
+                          uint32_t *value) {
+  uint64_t v;
+  if (!read_varint64(p, end, &v)) {
+    return false;
+  }
+  // like CodedInputStream, keep the low 32 bits of oversized varints.
+  *value = static_cast<uint32_t>(v);
+  return true;
+}
+
+inline size_t varint_size(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+inline uint8_t *write_varint64(uint64_t value, uint8_t *target) {
+  while (value >= 0x80) {
+    *target++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *target++ = static_cast<uint8_t>(value);
+  return target;
+}
+
+// skips the value of a field whose tag has already been consumed; groups are
+// skipped up to and including their matching end-group tag.
+inline bool skip_field(uint32_t tag, const uint8_t **p, const uint8_t *end) {
+  int depth = 0;
+  for (;;) {
+    uint64_t length;
+    switch (tag_type(tag)) {
+    case kVarint:
+      if (!read_varint64(p, end, &length)) {
+        return false;
+      }
+      break;
+    case kFixed64:
+      if (end - *p < 8) {
+        return false;
+      }
+      *p += 8;
+      break;
+    case kLengthDelimited:
+      if (!read_varint64(p, end, &length) ||
+          length > static_cast<uint64_t>(end - *p)) {
+        return false;
+      }
+      *p += length;
+      break;
+    case kStartGroup:
+      ++depth;
+      break;
+    case kEndGroup:
+      if (--depth < 0) {
+        return false;
+      }
+      break;
+    case kFixed32:
+      if (end - *p < 4) {
+        return false;
+      }
+      *p += 4;
+      break;
+    default:
+      return false;
+    }
+
+    if (depth == 0) {
+      return true;
+    }
+    if (!read_varint32(p, end, &tag) || tag == 0) {
+      return false;
+    }
+  }
+}
+
+// skips whole top-level fields starting at p until at least `min_bytes` have
+// been covered or the input runs out; returns the boundary reached, or null if
+// the input is malformed.
+inline const uint8_t *skip_fields(const uint8_t *p, const uint8_t *end,
+                                  size_t min_bytes) {
+  const uint8_t *begin = p;
+  while (p < end && static_cast<size_t>(p - begin) < min_bytes) {
+    uint32_t tag;
+    if (!read_varint32(&p, end, &tag) || tag == 0 ||
+        !skip_field(tag, &p, end)) {
+      return nullptr;
+    }
+  }
+  return p;
+}
+
+// what scan_field() found: a whole field, one cut off by the end of the
+// input that more bytes could still complete (a torn write, or a buffer
+// that ends mid-record), or bytes no amount of input would make valid.
+enum ScanResult {
+  kScanWhole,
+  kScanCutOff,
+  kScanMalformed,
+};
+
+inline ScanResult scan_varint64(const uint8_t **p, const uint8_t *end,
+                                uint64_t *value) {
+  const uint8_t *ptr = *p;
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (ptr == end) {
+      return kScanCutOff;
+    }
+    uint8_t byte = *ptr++;
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *p = ptr;
+      *value = result;
+      return kScanWhole;
+    }
+  }
+  return kScanMalformed;
+}
+
+// like skip_field() over a whole top-level field, tag included; p only
+// moves past a whole one.
+inline ScanResult scan_field(const uint8_t **p, const uint8_t *end) {
+  const uint8_t *ptr = *p;
+  int depth = 0;
+  do {
+    uint64_t tag;
+    uint64_t length;
+    ScanResult result = scan_varint64(&ptr, end, &tag);
+    if (result != kScanWhole) {
+      return result;
+    }
+    if (static_cast<uint32_t>(tag) == 0) {
+      return kScanMalformed;
+    }
+    switch (tag_type(static_cast<uint32_t>(tag))) {
+    case kVarint:
+      result = scan_varint64(&ptr, end, &length);
+      if (result != kScanWhole) {
+        return result;
+      }
+      break;
+    case kFixed64:
+      if (end - ptr < 8) {
+        return kScanCutOff;
+      }
+      ptr += 8;
+      break;
+    case kLengthDelimited:
+      result = scan_varint64(&ptr, end, &length);
+      if (result != kScanWhole) {
+        return result;
+      }
+      if (length > static_cast<uint64_t>(end - ptr)) {
+        return kScanCutOff;
+      }
+      ptr += length;
+      break;
+    case kStartGroup:
+      ++depth;
+      break;
+    case kEndGroup:
+      if (--depth < 0) {
+        return kScanMalformed;
+      }
+      break;
+    case kFixed32:
+      if (end - ptr < 4) {
+        return kScanCutOff;
+      }
+      ptr += 4;
+      break;
+    default:
+      return kScanMalformed;
+    }
+  } while (depth > 0);
+  *p = ptr;
+  return kScanWhole;
+}
+
+// calls visit(tag, value, value_end) for each field in [p, end), where value
+// points just past the tag; stops early when visit returns false. returns
+// false if the fields are malformed.
+template <typename Visitor>
+inline bool for_each_field(const uint8_t *p, const uint8_t *end,
+                           Visitor visit) {
+  while (p < end) {
+    uint32_t tag;
+    if (!read_varint32(&p, end, &tag) || tag == 0) {
+      return false;
+    }
+    const uint8_t *value = p;
+    if (!skip_field(tag, &p, end)) {
+      return false;
+    }
+    if (!visit(tag, value, p)) {
+      return true;
+    }
+  }
+  return true;
+}
+
+// the payload of a length-delimited value found by for_each_field.
+inline const uint8_t *payload(const uint8_t *value, const uint8_t *value_end) {
+  uint64_t length;
+  read_varint64(&value, value_end, &length);
+  return value;
+}
+
+// protobuf 2.5 takes a separate warning threshold; -1 disables the warning.
+inline void set_total_bytes_limit(google::protobuf::io::CodedInputStream *input,
+                                  int limit) {
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+  input->SetTotalBytesLimit(limit);
+#else
+  input->SetTotalBytesLimit(limit, -1);
+#endif
+}
+
+} // namespace wire
+} // namespace tutorial
+
+#endif // WIRE_H_